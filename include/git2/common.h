@@ -230,7 +230,12 @@ typedef enum {
 	GIT_OPT_SET_SERVER_TIMEOUT,
 	GIT_OPT_GET_SERVER_TIMEOUT,
 	GIT_OPT_SET_USER_AGENT_PRODUCT,
-	GIT_OPT_GET_USER_AGENT_PRODUCT
+	GIT_OPT_GET_USER_AGENT_PRODUCT,
+	GIT_OPT_SET_CACHE_TYPE_MAX_SIZE,
+	GIT_OPT_GET_CACHE_STATISTICS,
+	GIT_OPT_GET_PACK_CACHE_MAX_SIZE,
+	GIT_OPT_SET_PACK_CACHE_MAX_SIZE,
+	GIT_OPT_GET_PACK_CACHE_STATISTICS
 } git_libgit2_opt_t;
 
 /**
@@ -313,7 +318,47 @@ typedef enum {
  *	* opts(GIT_OPT_GET_CACHED_MEMORY, ssize_t *current, ssize_t *allowed)
  *
  *		> Get the current bytes in cache and the maximum that would be
- *		> allowed in the cache.
+ *		> allowed in the cache.  The current size is updated in batches
+ *		> by each cache, so it is approximate.
+ *
+ *	* opts(GIT_OPT_SET_CACHE_TYPE_MAX_SIZE, git_object_t type, ssize_t max_storage_bytes)
+ *
+ *		> Set the maximum total data size that objects of the given type
+ *		> may occupy in the caches of all repositories.  When a type is
+ *		> over its budget, storing another object of that type evicts
+ *		> the least valuable cached objects of the same type first.
+ *		> Setting the value to zero (the default) means that the type
+ *		> is only bounded by `GIT_OPT_SET_CACHE_MAX_SIZE`.
+ *
+ *	* opts(GIT_OPT_GET_CACHE_STATISTICS, size_t *hits, size_t *misses, size_t *evictions)
+ *
+ *		> Get the number of object cache lookups that were satisfied
+ *		> from the cache, the number that were not, and the number of
+ *		> objects evicted from the cache, across all repositories since
+ *		> the library was loaded.  Each cache accumulates these counts
+ *		> locally and publishes them in batches (and when it is cleared
+ *		> or freed), so the values may lag slightly behind.
+ *
+ *	* opts(GIT_OPT_GET_PACK_CACHE_MAX_SIZE, size_t *max_storage_bytes, size_t *max_object_bytes)
+ *
+ *		> Get the memory budget of the delta base cache, and the size
+ *		> of the largest object that will be kept in it.
+ *
+ *	* opts(GIT_OPT_SET_PACK_CACHE_MAX_SIZE, size_t max_storage_bytes, size_t max_object_bytes)
+ *
+ *		> Set the memory budget of the delta base cache, and the size
+ *		> of the largest object that will be kept in it.  The budget
+ *		> is shared by all packfiles opened by the library, so that
+ *		> memory goes to whichever packfiles are in use.  When the
+ *		> cache is full, the least recently used delta bases are
+ *		> evicted.  The defaults are 96MB and 1MB, respectively.
+ *
+ *	* opts(GIT_OPT_GET_PACK_CACHE_STATISTICS, size_t *hits, size_t *inflations, size_t *evictions)
+ *
+ *		> Get the number of delta chains that were resolved using a
+ *		> cached base, the number of times a delta base had to be
+ *		> inflated from the packfile instead, and the number of bases
+ *		> evicted from the delta base cache.
  *
  *	* opts(GIT_OPT_GET_TEMPLATE_PATH, git_buf *out)
  *
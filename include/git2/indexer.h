@@ -83,6 +83,30 @@ typedef struct git_indexer_options {
 
 	/** Do connectivity checks for the received pack */
 	unsigned char verify;
+
+	/**
+	 * Number of threads to use when resolving deltas in
+	 * `git_indexer_commit`.  0 or 1 resolves them on the calling
+	 * thread.  Progress is still reported from the calling thread.
+	 */
+	unsigned int threads;
+
+	/**
+	 * Write and parse the data given to `git_indexer_append` on
+	 * worker threads, so that the caller only has to queue it.
+	 * Progress is then reported from `git_indexer_append` and
+	 * `git_indexer_commit` as it becomes available, rather than
+	 * once per object.  This is ignored when libgit2 is built
+	 * without thread support.
+	 */
+	unsigned char pipeline;
+
+	/**
+	 * Write a reverse index (".rev" file) next to the index, which
+	 * lists the objects in the order in which they are stored in the
+	 * pack.  Support for reading it was added in git 2.31.
+	 */
+	unsigned char write_reverse_index;
 } git_indexer_options;
 
 #define GIT_INDEXER_OPTIONS_VERSION 1
@@ -142,6 +142,56 @@ GIT_EXTERN(void) git_odb_free(git_odb *db);
  */
 GIT_EXTERN(int) git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id);
 
+/**
+ * Options for reading many objects at once with `git_odb_read_many`.
+ *
+ * Initialize with `GIT_ODB_READ_MANY_OPTIONS_INIT`.
+ */
+typedef struct {
+	unsigned int version; /**< version for the struct */
+
+	/**
+	 * The number of threads to unpack the objects with; 0 or 1 reads
+	 * them on the calling thread.  Small batches use fewer threads.
+	 */
+	unsigned int threads;
+} git_odb_read_many_options;
+
+/** Current version for the `git_odb_read_many_options` structure */
+#define GIT_ODB_READ_MANY_OPTIONS_VERSION 1
+
+/** Static constructor for `git_odb_read_many_options` */
+#define GIT_ODB_READ_MANY_OPTIONS_INIT { GIT_ODB_READ_MANY_OPTIONS_VERSION }
+
+/**
+ * Read many objects from the database at once.
+ *
+ * This is the same as calling `git_odb_read` for each of the given
+ * ids, but objects that are stored in packs are read in the order
+ * that they are stored in, and the bases of deltas that are read in
+ * the same batch are kept in the delta base cache, so that reading a
+ * large set of objects (like all the blobs of a tree) is faster.
+ *
+ * Either all the objects are read or none are: if any of them cannot
+ * be read, every element of `out` is set to NULL.
+ *
+ * @param out array of `count` elements to store the read objects in,
+ *        in the order of `ids`; each one must be freed with
+ *        `git_odb_object_free`
+ * @param db database to read the objects from
+ * @param ids the ids of the objects to read
+ * @param count the number of ids
+ * @param opts options for reading the objects, or NULL for defaults
+ * @return 0 if all the objects were read, GIT_ENOTFOUND if any of
+ *         them is not in the database, or an error code
+ */
+GIT_EXTERN(int) git_odb_read_many(
+	git_odb_object **out,
+	git_odb *db,
+	const git_oid *ids,
+	size_t count,
+	const git_odb_read_many_options *opts);
+
 /**
  * Read an object from the database, given a prefix
  * of its identifier.
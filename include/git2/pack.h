@@ -77,6 +77,56 @@ GIT_EXTERN(int) git_packbuilder_new(git_packbuilder **out, git_repository *repo)
  */
 GIT_EXTERN(unsigned int) git_packbuilder_set_threads(git_packbuilder *pb, unsigned int n);
 
+/**
+ * Write a reachability bitmap index along with the packfile
+ *
+ * When enabled, `git_packbuilder_write` also writes a ".bitmap" file
+ * for the new pack, which speeds up later enumerations of its objects,
+ * and a ".rev" reverse index that lists the objects in pack order.
+ * The pack must then contain every object that is reachable from its
+ * commits, as a pack of all the objects of the repository does.
+ *
+ * @param pb The packbuilder
+ * @param enabled Whether to write a bitmap index
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_packbuilder_set_write_bitmap(git_packbuilder *pb, int enabled);
+
+/**
+ * Keep deltas within delta islands
+ *
+ * When enabled, the refs of the repository that match one of the
+ * `pack.island` regular expressions in its configuration put the
+ * objects that they reach on an island, named after the groups that
+ * the expression captured.  Objects are only stored as deltas against
+ * bases that are on all of their islands, whether the deltas are
+ * computed or reused from existing packs.
+ *
+ * A repository that holds many forks can put the refs of each fork on
+ * an island of their own (for example with `pack.island` set to
+ * `refs/virtual/([0-9]+)/`), so that the packs written for one fork
+ * never need the objects of another to resolve their deltas.
+ *
+ * @param pb The packbuilder
+ * @param enabled Whether to use delta islands
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_packbuilder_set_delta_islands(git_packbuilder *pb, int enabled);
+
+/**
+ * Set how far compression may run ahead of writing the packfile
+ *
+ * When several threads are used, objects are compressed by worker
+ * threads while the packfile is being written.  The workers stop
+ * compressing once this many bytes of compressed objects are waiting
+ * to be written.  The default is 32MiB.
+ *
+ * @param pb The packbuilder
+ * @param size The number of bytes that may wait to be written
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_packbuilder_set_write_window(git_packbuilder *pb, size_t size);
+
 /**
  * Insert a single object
  *
@@ -217,6 +267,18 @@ typedef int GIT_CALLBACK(git_packbuilder_foreach_cb)(void *buf, size_t size, voi
  */
 GIT_EXTERN(int) git_packbuilder_foreach(git_packbuilder *pb, git_packbuilder_foreach_cb cb, void *payload);
 
+/**
+ * Create the new pack and write it to a file descriptor
+ *
+ * The pack is written as it is created, in large chunks, without being
+ * held in memory as a whole.
+ *
+ * @param pb the packbuilder
+ * @param fd the file descriptor to write to, such as a file or a pipe
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_packbuilder_write_fd(git_packbuilder *pb, int fd);
+
 /**
  * Get the total number of objects the packbuilder will write out
  *
@@ -104,7 +104,26 @@ typedef enum {
 	 * Do not split commit-graph files. The other split strategy-related option
 	 * fields are ignored.
 	 */
-	GIT_COMMIT_GRAPH_SPLIT_STRATEGY_SINGLE_FILE = 0
+	GIT_COMMIT_GRAPH_SPLIT_STRATEGY_SINGLE_FILE = 0,
+
+	/**
+	 * Write the commits that are not in the commit-graph yet to a new file
+	 * on top of the commit-graph chain, merging the newest files of the
+	 * chain into it as dictated by `size_multiple` and `max_commits`.
+	 */
+	GIT_COMMIT_GRAPH_SPLIT_STRATEGY_MERGE_BY_SIZE,
+
+	/**
+	 * Write the commits that are not in the commit-graph yet to a new file
+	 * on top of the commit-graph chain, never merging existing files.
+	 */
+	GIT_COMMIT_GRAPH_SPLIT_STRATEGY_NO_MERGE,
+
+	/**
+	 * Merge the whole commit-graph chain and the new commits into a chain
+	 * made of a single file.
+	 */
+	GIT_COMMIT_GRAPH_SPLIT_STRATEGY_REPLACE
 } git_commit_graph_split_strategy_t;
 
 /**
@@ -112,28 +131,45 @@ typedef enum {
  * `git_commit_graph_writer_commit`/`git_commit_graph_writer_dump`.
  *
  * Initialize with `GIT_COMMIT_GRAPH_WRITER_OPTIONS_INIT`. Alternatively, you
- * can use `git_commit_graph_writer_options_init`.
+ * can use `git_commit_graph_writer_options_init`.  Both only set the
+ * version; a field left at zero takes its documented default.
  */
 typedef struct {
 	unsigned int version;
 
 	/**
 	 * The strategy to use when adding new commits to a pre-existing commit-graph
-	 * chain.
+	 * chain. Default is `GIT_COMMIT_GRAPH_SPLIT_STRATEGY_SINGLE_FILE`.
 	 */
 	git_commit_graph_split_strategy_t split_strategy;
 
 	/**
 	 * The number of commits in level N is less than X times the number of
-	 * commits in level N + 1. Default is 2.
+	 * commits in level N + 1. Default (or 0) is 2.
 	 */
 	float size_multiple;
 
 	/**
 	 * The number of commits in level N + 1 is more than C commits.
-	 * Default is 64000.
+	 * Default (or 0) is 64000.
 	 */
 	size_t max_commits;
+
+	/**
+	 * Whether to write changed-path Bloom filters, which let path-limited
+	 * history operations skip the commits that do not change a path.
+	 * Computing them requires diffing every commit against its first
+	 * parent. Default (or 0) is disabled.
+	 */
+	int changed_paths;
+
+	/**
+	 * The version of generation numbers to write. Version 2 adds the
+	 * corrected commit dates that git uses since 2.31 to the topological
+	 * levels of version 1; they are a better guide in graph walks when the
+	 * commit times are skewed. Default (or 0) is 2.
+	 */
+	unsigned int generation_version;
 } git_commit_graph_writer_options;
 
 #define GIT_COMMIT_GRAPH_WRITER_OPTIONS_VERSION 1
@@ -158,6 +194,11 @@ GIT_EXTERN(int) git_commit_graph_writer_options_init(
 /**
  * Write a `commit-graph` file to a file.
  *
+ * Unless the split strategy is `GIT_COMMIT_GRAPH_SPLIT_STRATEGY_SINGLE_FILE`,
+ * this adds a file to the `commit-graphs/commit-graph-chain` in the
+ * `objects/info` directory instead, so that only the commits that are not
+ * in the commit-graph yet need to be written.
+ *
  * @param w The writer
  * @param opts Pointer to git_commit_graph_writer_options struct.
  * @return 0 or an error code
@@ -169,6 +210,9 @@ GIT_EXTERN(int) git_commit_graph_writer_commit(
 /**
  * Dump the contents of the `commit-graph` to an in-memory buffer.
  *
+ * This always produces a single file with all of the writer's commits;
+ * the split strategy is ignored.
+ *
  * @param buffer Buffer where to store the contents of the `commit-graph`.
  * @param w The writer.
  * @param opts Pointer to git_commit_graph_writer_options struct.
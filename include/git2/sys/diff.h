@@ -68,10 +68,25 @@ typedef struct {
 	unsigned int version;
 	size_t stat_calls; /**< Number of stat() calls performed */
 	size_t oid_calculations; /**< Number of ID calculations */
+
+	/**
+	 * Number of stat() calls performed ahead of the diff, on several
+	 * threads, for the files of the index (see `core.preloadIndex`);
+	 * these are not included in `stat_calls`.
+	 */
+	size_t preload_stat_calls;
+
+	/**
+	 * Number of stat() calls that were not needed, because the answer
+	 * was already known: from the filesystem monitor, the preloaded
+	 * index, the index's "assume unchanged" and "skip worktree" bits,
+	 * or the type of a directory entry as it was read.
+	 */
+	size_t skipped_stat_calls;
 } git_diff_perfdata;
 
-#define GIT_DIFF_PERFDATA_VERSION 1
-#define GIT_DIFF_PERFDATA_INIT {GIT_DIFF_PERFDATA_VERSION,0,0}
+#define GIT_DIFF_PERFDATA_VERSION 3
+#define GIT_DIFF_PERFDATA_INIT {GIT_DIFF_PERFDATA_VERSION,0,0,0,0}
 
 /**
  * Get performance data for a diff object.
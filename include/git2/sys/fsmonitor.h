@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_sys_git_fsmonitor_h__
+#define INCLUDE_sys_git_fsmonitor_h__
+
+#include "git2/common.h"
+#include "git2/types.h"
+
+/**
+ * @file git2/sys/fsmonitor.h
+ * @brief Filesystem monitors, which tell status and diff what changed
+ * @defgroup git_fsmonitor Filesystem monitors
+ * @ingroup Git
+ *
+ * A filesystem monitor watches a repository's working directory, and
+ * can tell which paths in it changed since a point in time.  When a
+ * repository has one, `git_status_list_new` and
+ * `git_diff_index_to_workdir` do not `lstat` the files that the index
+ * has and that the monitor did not see change; the state of the
+ * monitor is kept in the index, in git's "FSMN" extension, so it
+ * carries over from one status to the next.
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/** A filesystem monitor */
+typedef struct git_fsmonitor git_fsmonitor;
+
+/**
+ * Callback that a filesystem monitor calls for each path that changed.
+ *
+ * @param path the path, relative to the working directory; a path
+ *             ending in a `/` means that anything beneath it may have
+ *             changed
+ * @param payload the payload given to the query
+ * @return 0 to continue, non-zero to stop the query
+ */
+typedef int GIT_CALLBACK(git_fsmonitor_changed_cb)(
+	const char *path,
+	void *payload);
+
+/** An instance of a filesystem monitor */
+struct git_fsmonitor {
+	unsigned int version; /**< The monitor API version */
+
+	/**
+	 * Report the paths that changed since the state described by
+	 * `token`, and describe the current state.
+	 *
+	 * A monitor must provide this function.
+	 *
+	 * @arg out_token The implementation shall point this to a token
+	 *                describing the state of the working directory,
+	 *                taken before the changes to report were looked at.
+	 *                It is given back as the `token` of the next query,
+	 *                and must stay valid until then (or until the
+	 *                monitor is freed).
+	 * @arg token The token returned by an earlier query, or `NULL` if
+	 *            there was none.
+	 * @arg changed_cb Callback to call for each changed path; a path
+	 *                 may be reported more than once.
+	 * @arg payload Payload for the callback.
+	 * @return 0 on success, `GIT_PASSTHROUGH` if the monitor cannot
+	 *         tell what changed since `token` (so that everything has
+	 *         to be checked), or another error code.
+	 */
+	int GIT_CALLBACK(query)(
+		const char **out_token,
+		git_fsmonitor *monitor,
+		const char *token,
+		git_fsmonitor_changed_cb changed_cb,
+		void *payload);
+
+	/**
+	 * Frees any resources held by the monitor.
+	 *
+	 * A monitor must provide this function.
+	 */
+	void GIT_CALLBACK(free)(git_fsmonitor *monitor);
+};
+
+#define GIT_FSMONITOR_VERSION 1
+#define GIT_FSMONITOR_INIT {GIT_FSMONITOR_VERSION}
+
+/**
+ * Initializes a `git_fsmonitor` with default values. Equivalent to
+ * creating an instance with GIT_FSMONITOR_INIT.
+ *
+ * @param monitor the `git_fsmonitor` struct to initialize
+ * @param version Version of struct; pass `GIT_FSMONITOR_VERSION`
+ * @return Zero on success; -1 on failure.
+ */
+GIT_EXTERN(int) git_fsmonitor_init(
+	git_fsmonitor *monitor,
+	unsigned int version);
+
+/**
+ * Create a filesystem monitor that uses inotify to watch the working
+ * directory of a repository.
+ *
+ * The monitor only sees the changes made while it exists, so it is
+ * meant for long-running processes: the first status after it was
+ * created checks every file, and the ones after that only the files
+ * that changed in between.  It is only available on Linux.
+ *
+ * @param out Output pointer to the monitor
+ * @param repo The repository whose working directory to watch
+ * @return 0 on success, <0 error code on failure
+ */
+GIT_EXTERN(int) git_fsmonitor_inotify_new(
+	git_fsmonitor **out,
+	git_repository *repo);
+
+/**
+ * Set the filesystem monitor of a repository.
+ *
+ * The repository will take ownership of the monitor, and free it when
+ * it is freed or given another one.
+ *
+ * @param repo The repository
+ * @param monitor The monitor, or `NULL` to stop using one
+ * @return 0 on success, <0 error code on failure
+ */
+GIT_EXTERN(int) git_repository_set_fsmonitor(
+	git_repository *repo,
+	git_fsmonitor *monitor);
+
+/** @} */
+GIT_END_DECL
+
+#endif
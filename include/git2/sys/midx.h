@@ -53,6 +53,42 @@ GIT_EXTERN(int) git_midx_writer_add(
 		git_midx_writer *w,
 		const char *idx_path);
 
+/**
+ * Set whether the writer should include a reverse index (the `RIDX`
+ * chunk) in the `multi-pack-index`.
+ *
+ * The reverse index lists the objects in the order that they appear in
+ * their packs, which lets readers find an object's neighbour (and thus
+ * its size on disk) without inflating any object headers.  It is off by
+ * default.
+ *
+ * @param w the writer
+ * @param enabled whether to write the reverse index
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_midx_writer_set_write_reverse_index(
+		git_midx_writer *w,
+		int enabled);
+
+/**
+ * Set whether the writer should also write a reachability bitmap index
+ * for the `multi-pack-index`.
+ *
+ * When `repo` is given, `git_midx_writer_commit` also writes a
+ * `multi-pack-index-<checksum>.bitmap` file that covers the objects of
+ * all the packs, and removes the bitmaps of earlier multi-pack-indexes.
+ * The bitmap needs the reverse index, which is then always written.
+ * The packs must contain every object that is reachable from their
+ * commits, and `repo` must stay open until the writer is committed.
+ *
+ * @param w the writer
+ * @param repo the repository of the packs, or NULL not to write a bitmap
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_midx_writer_set_write_bitmap(
+		git_midx_writer *w,
+		git_repository *repo);
+
 /**
  * Write a `multi-pack-index` file to a file.
  *
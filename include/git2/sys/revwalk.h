@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_sys_git_revwalk_h__
+#define INCLUDE_sys_git_revwalk_h__
+
+#include "git2/common.h"
+#include "git2/types.h"
+
+/**
+ * @file git2/sys/revwalk.h
+ * @brief Low-level Git revision walker utilities
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * Performance data from a revision walk
+ */
+typedef struct {
+	unsigned int version;
+
+	/** Number of commits whose parents were read from the commit-graph */
+	size_t parsed_from_graph;
+
+	/** Number of commits that were read from the object database */
+	size_t parsed_from_odb;
+} git_revwalk_perfdata;
+
+#define GIT_REVWALK_PERFDATA_VERSION 1
+#define GIT_REVWALK_PERFDATA_INIT {GIT_REVWALK_PERFDATA_VERSION,0,0}
+
+/**
+ * Get performance data for a revision walk.
+ *
+ * @param out Structure to be filled with revwalk performance data
+ * @param walk Revision walker to read performance data from
+ * @return 0 for success, <0 for error
+ */
+GIT_EXTERN(int) git_revwalk_get_perfdata(
+	git_revwalk_perfdata *out, const git_revwalk *walk);
+
+/** @} */
+GIT_END_DECL
+#endif
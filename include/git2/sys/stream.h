@@ -112,6 +112,19 @@ typedef enum {
 GIT_EXTERN(int) git_stream_register(
 	git_stream_t type, git_stream_registration *registration);
 
+/**
+ * Create the new pack of a packbuilder and write it to a stream
+ *
+ * The pack is written as it is created, in large chunks, without being
+ * held in memory as a whole.  This is suited to sending a pack to a
+ * client over a socket.
+ *
+ * @param pb the packbuilder
+ * @param stream the stream to write to; it must be connected
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_packbuilder_write_stream(git_packbuilder *pb, git_stream *stream);
+
 #ifndef GIT_DEPRECATE_HARD
 
 /** @name Deprecated TLS Stream Registration Functions
@@ -14,8 +14,8 @@
 
 #define BUFFER_SIZE (1024 * 1024)
 
-static int show_help, verbose, read_stdin;
-static char *filename;
+static int show_help, verbose, read_stdin, pipeline;
+static char *filename, *threads;
 static cli_progress progress = CLI_PROGRESS_INIT;
 
 static const cli_opt_spec opts[] = {
@@ -25,6 +25,10 @@ static const cli_opt_spec opts[] = {
 
 	{ CLI_OPT_TYPE_SWITCH,    "verbose", 'v', &verbose,    1,
 	  CLI_OPT_USAGE_DEFAULT,   NULL,    "display progress output" },
+	{ CLI_OPT_TYPE_VALUE,     "threads",  0,   &threads,    0,
+	  CLI_OPT_USAGE_DEFAULT,  "n",      "number of threads to resolve deltas with" },
+	{ CLI_OPT_TYPE_SWITCH,    "pipeline", 0,   &pipeline,   1,
+	  CLI_OPT_USAGE_DEFAULT,   NULL,    "write and parse the pack on worker threads" },
 
 	{ CLI_OPT_TYPE_LITERAL },
 
@@ -49,6 +53,22 @@ static void print_help(void)
 	cli_opt_help_fprint(stdout, opts);
 }
 
+static unsigned int compute_threads(const char *threads)
+{
+	int64_t i;
+	const char *endptr;
+
+	if (!threads)
+		return 0;
+
+	if (git__strntol64(&i, threads, strlen(threads), &endptr, 10) < 0 || i < 0 || i > UINT16_MAX || *endptr) {
+		fprintf(stderr, "fatal: threads '%s' is not valid.\n", threads);
+		exit(128);
+	}
+
+	return (unsigned int)i;
+}
+
 int cmd_index_pack(int argc, char **argv)
 {
 	cli_opt invalid_opt;
@@ -67,6 +87,9 @@ int cmd_index_pack(int argc, char **argv)
 		return 0;
 	}
 
+	idx_opts.threads = compute_threads(threads);
+	idx_opts.pipeline = pipeline;
+
 	if (verbose) {
 		idx_opts.progress_cb = cli_progress_indexer;
 		idx_opts.progress_cb_payload = &progress;
@@ -173,6 +173,9 @@ void git_blame_free(git_blame *blame)
 
 	git_mailmap_free(blame->mailmap);
 
+	git_commit_graph_bloom_key_dispose(&blame->bloom_key);
+	git__free(blame->bloom_path);
+
 	git__free(blame->path);
 	git_blob_free(blame->final_blob);
 	git__free(blame);
@@ -7,6 +7,7 @@
 #include "vector.h"
 #include "diff.h"
 #include "array.h"
+#include "commit_graph.h"
 #include "git2/oid.h"
 
 /*
@@ -79,6 +80,11 @@ struct git_blame {
 	size_t current_diff_line;
 	git_blame_hunk *current_hunk;
 
+	/* The lookup of `bloom_path` in the Bloom filters of `bloom_file` */
+	git_commit_graph_file *bloom_file;
+	char *bloom_path;
+	git_commit_graph_bloom_key bloom_key;
+
 	/* Scoreboard fields */
 	git_commit *final;
 	git_blame__entry *ent;
@@ -10,6 +10,8 @@
 #include "commit.h"
 #include "blob.h"
 #include "diff_xdiff.h"
+#include "odb.h"
+#include "repository.h"
 
 /*
  * Origin is refcounted and usually we keep the blob contents to be
@@ -491,6 +493,55 @@ cleanup:
 	return porigin;
 }
 
+static int prepare_bloom_key(git_blame *blame, git_commit_graph_file *file, const char *path)
+{
+	if (blame->bloom_file == file && blame->bloom_path &&
+	    !strcmp(blame->bloom_path, path))
+		return 0;
+
+	git_commit_graph_bloom_key_dispose(&blame->bloom_key);
+	git__free(blame->bloom_path);
+	blame->bloom_file = NULL;
+
+	if ((blame->bloom_path = git__strdup(path)) == NULL)
+		return -1;
+
+	if (git_commit_graph_bloom_key_init(&blame->bloom_key, file, path) < 0)
+		return -1;
+
+	blame->bloom_file = file;
+	return 0;
+}
+
+/*
+ * Ask the changed-path Bloom filters of the commit-graph whether the path
+ * of origin is the same in the first parent, which saves diffing the
+ * trees of the commits.
+ */
+static bool unchanged_in_first_parent(git_blame *blame, git_blame__origin *origin)
+{
+	git_commit_graph_file *file;
+	git_commit_graph_entry entry;
+	git_odb *odb;
+	bool unchanged = false;
+
+	if (git_repository_odb__weakptr(&odb, blame->repository) < 0 ||
+	    git_odb__get_commit_graph_file(&file, odb) < 0 ||
+	    !file->bloom_filter_index)
+		goto done;
+
+	if (prepare_bloom_key(blame, file, origin->path) < 0 ||
+	    git_commit_graph_entry_find(&entry, file, git_commit_id(origin->commit),
+			git_oid_hexsize(file->oid_type)) < 0)
+		goto done;
+
+	unchanged = (git_commit_graph_bloom_maybe_changed(file, &entry, &blame->bloom_key) == 0);
+
+done:
+	git_error_clear();
+	return unchanged;
+}
+
 /*
  * The blobs of origin and porigin exactly match, so everything origin is
  * suspected for can be blamed on the parent.
@@ -550,7 +601,13 @@ static int pass_blame(git_blame *blame, git_blame__origin *origin, uint32_t opt)
 
 		if ((error = git_commit_parent(&p, origin->commit, i)) < 0)
 			goto finish;
-		porigin = find_origin(blame, p, origin);
+
+		porigin = NULL;
+
+		if (i == 0 && unchanged_in_first_parent(blame, origin))
+			git_blame__get_origin(&porigin, blame, p, origin->path);
+		else
+			porigin = find_origin(blame, p, origin);
 
 		if (!porigin) {
 			/*
@@ -19,6 +19,33 @@ bool git_cache__enabled = true;
 ssize_t git_cache__max_storage = (256 * 1024 * 1024);
 git_atomic_ssize git_cache__current_storage = {0};
 
+git_atomic_ssize git_cache__hits = {0};
+git_atomic_ssize git_cache__misses = {0};
+git_atomic_ssize git_cache__evictions = {0};
+
+/*
+ * The share of a cache's memory that may be held by the protected
+ * segment; the remainder is kept for the probationary segment so that
+ * newly loaded objects have a chance to prove themselves.
+ */
+#define GIT_CACHE_PROTECTED_PERCENT 80
+
+/*
+ * Shards fold their memory accounting into the global counters once
+ * this many bytes have accumulated, and their hit and miss counts once
+ * this many lookups have accumulated.
+ */
+#define GIT_CACHE_ACCOUNTING_BATCH (64 * 1024)
+#define GIT_CACHE_LOOKUP_BATCH     256
+
+struct git_cache_entry {
+	git_cached_obj *obj;
+	git_cache_entry *prev;
+	git_cache_entry *next;
+	git_atomic32 hits;
+	unsigned int segment;
+};
+
 static size_t git_cache__max_object_size[8] = {
 	0,     /* GIT_OBJECT__EXT1 */
 	4096,  /* GIT_OBJECT_COMMIT */
@@ -30,6 +57,10 @@ static size_t git_cache__max_object_size[8] = {
 	0      /* GIT_OBJECT_REF_DELTA */
 };
 
+/* Per-type limits across all caches; 0 means only the global limit applies */
+static ssize_t git_cache__max_type_storage[8];
+static git_atomic_ssize git_cache__current_type_storage[8];
+
 int git_cache_set_max_object_size(git_object_t type, size_t size)
 {
 	if (type < 0 || (size_t)type >= ARRAY_SIZE(git_cache__max_object_size)) {
@@ -41,87 +72,319 @@ int git_cache_set_max_object_size(git_object_t type, size_t size)
 	return 0;
 }
 
+int git_cache_set_max_type_storage(git_object_t type, ssize_t size)
+{
+	if (type < 0 || (size_t)type >= ARRAY_SIZE(git_cache__max_type_storage)) {
+		git_error_set(GIT_ERROR_INVALID, "type out of range");
+		return -1;
+	}
+
+	if (size < 0) {
+		git_error_set(GIT_ERROR_INVALID, "invalid cache size");
+		return -1;
+	}
+
+	git_cache__max_type_storage[type] = size;
+	return 0;
+}
+
+/*
+ * The object ID map hashes on the leading bytes of the ID, so select
+ * the shard with a byte that does not feed into the hash; otherwise the
+ * keys in each shard would all land in the same few hash buckets.
+ */
+GIT_INLINE(git_cache_shard *) cache_shard(git_cache *cache, const git_oid *oid)
+{
+	return &cache->shards[oid->id[sizeof(uint32_t)] % GIT_CACHE_SHARDS];
+}
+
+static void shard_dispose(git_cache_shard *shard)
+{
+	git_oidmap_free(shard->map);
+	git_rwlock_free(&shard->lock);
+}
+
 int git_cache_init(git_cache *cache)
 {
+	size_t i;
+
 	memset(cache, 0, sizeof(*cache));
 
-	if ((git_oidmap_new(&cache->map)) < 0)
-		return -1;
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		git_cache_shard *shard = &cache->shards[i];
 
-	if (git_rwlock_init(&cache->lock)) {
-		git_error_set(GIT_ERROR_OS, "failed to initialize cache rwlock");
-		return -1;
+		if ((git_oidmap_new(&shard->map)) < 0)
+			goto on_error;
+
+		if (git_rwlock_init(&shard->lock)) {
+			git_error_set(GIT_ERROR_OS, "failed to initialize cache rwlock");
+			git_oidmap_free(shard->map);
+			goto on_error;
+		}
 	}
 
 	return 0;
+
+on_error:
+	while (i-- > 0)
+		shard_dispose(&cache->shards[i]);
+
+	git__memzero(cache, sizeof(*cache));
+	return -1;
+}
+
+static void segment_unlink(git_cache_shard *shard, git_cache_entry *entry)
+{
+	git_cache_segment *segment = &shard->segments[entry->segment];
+
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		segment->head = entry->next;
+
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		segment->tail = entry->prev;
+
+	segment->memory -= entry->obj->size;
+	entry->prev = entry->next = NULL;
+}
+
+static void segment_push(git_cache_shard *shard, git_cache_entry *entry, unsigned int idx)
+{
+	git_cache_segment *segment = &shard->segments[idx];
+
+	entry->segment = idx;
+	entry->prev = NULL;
+	entry->next = segment->head;
+
+	if (segment->head)
+		segment->head->prev = entry;
+	else
+		segment->tail = entry;
+
+	segment->head = entry;
+	segment->memory += entry->obj->size;
+}
+
+/* Called with lock */
+static void flush_accounting(git_cache_shard *shard)
+{
+	size_t i;
+
+	git_atomic_ssize_add(&git_cache__current_storage, shard->pending_memory);
+	git_atomic_ssize_add(&git_cache__evictions, shard->pending_evictions);
+
+	for (i = 0; i < ARRAY_SIZE(shard->pending_type_memory); i++) {
+		if (shard->pending_type_memory[i])
+			git_atomic_ssize_add(&git_cache__current_type_storage[i],
+				shard->pending_type_memory[i]);
+	}
+
+	shard->pending_memory = 0;
+	shard->pending_evictions = 0;
+	memset(shard->pending_type_memory, 0, sizeof(shard->pending_type_memory));
+}
+
+/* Called with lock */
+static void account_memory(git_cache_shard *shard, git_cached_obj *obj, ssize_t amount)
+{
+	shard->used_memory += amount;
+	shard->pending_memory += amount;
+
+	if (obj->type >= 0 && (size_t)obj->type < ARRAY_SIZE(shard->pending_type_memory))
+		shard->pending_type_memory[obj->type] += amount;
+
+	/* types with their own budget are accounted eagerly to enforce it */
+	if (shard->pending_memory >= GIT_CACHE_ACCOUNTING_BATCH ||
+	    shard->pending_memory <= -GIT_CACHE_ACCOUNTING_BATCH ||
+	    git_cache__max_type_storage[obj->type] > 0)
+		flush_accounting(shard);
+}
+
+/*
+ * Count a lookup in the shard, and move the pending lookups over to the
+ * global counter once there is at least a batch of them.  The move only
+ * happens if no other thread counted or moved lookups in the meantime,
+ * so none are lost or counted twice; otherwise the next lookup retries.
+ */
+static void account_lookup(git_atomic32 *pending, git_atomic_ssize *global)
+{
+	int count = git_atomic32_inc(pending);
+
+	if (count >= GIT_CACHE_LOOKUP_BATCH &&
+	    git_atomic32_compare_and_swap(pending, count, 0) == count)
+		git_atomic_ssize_add(global, count);
+}
+
+static void flush_lookups(git_atomic32 *pending, git_atomic_ssize *global)
+{
+	int count = git_atomic32_get(pending);
+
+	if (count > 0) {
+		git_atomic32_add(pending, -count);
+		git_atomic_ssize_add(global, count);
+	}
 }
 
 /* called with lock */
-static void clear_cache(git_cache *cache)
+static void clear_shard(git_cache_shard *shard)
 {
-	git_cached_obj *evict = NULL;
+	git_cache_entry *entry, *next;
+	unsigned int i;
 
-	if (git_cache_size(cache) == 0)
-		return;
+	flush_lookups(&shard->pending_hits, &git_cache__hits);
+	flush_lookups(&shard->pending_misses, &git_cache__misses);
 
-	git_oidmap_foreach_value(cache->map, evict, {
-		git_cached_obj_decref(evict);
-	});
+	for (i = 0; i < GIT_CACHE_SEGMENT__COUNT; i++) {
+		for (entry = shard->segments[i].head; entry; entry = next) {
+			next = entry->next;
 
-	git_oidmap_clear(cache->map);
-	git_atomic_ssize_add(&git_cache__current_storage, -cache->used_memory);
-	cache->used_memory = 0;
+			account_memory(shard, entry->obj, -(ssize_t)entry->obj->size);
+			git_cached_obj_decref(entry->obj);
+			git__free(entry);
+		}
+	}
+
+	git_oidmap_clear(shard->map);
+	memset(shard->segments, 0, sizeof(shard->segments));
+	flush_accounting(shard);
 }
 
 void git_cache_clear(git_cache *cache)
 {
-	if (git_rwlock_wrlock(&cache->lock) < 0)
-		return;
+	size_t i;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		git_cache_shard *shard = &cache->shards[i];
+
+		if (git_rwlock_wrlock(&shard->lock) < 0)
+			continue;
 
-	clear_cache(cache);
+		clear_shard(shard);
 
-	git_rwlock_wrunlock(&cache->lock);
+		git_rwlock_wrunlock(&shard->lock);
+	}
 }
 
 void git_cache_dispose(git_cache *cache)
 {
+	size_t i;
+
 	git_cache_clear(cache);
-	git_oidmap_free(cache->map);
-	git_rwlock_free(&cache->lock);
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++)
+		shard_dispose(&cache->shards[i]);
+
 	git__memzero(cache, sizeof(*cache));
 }
 
 /* Called with lock */
-static void cache_evict_entries(git_cache *cache)
+static void cache_remove(git_cache_shard *shard, git_cache_entry *entry)
 {
-	size_t evict_count = git_cache_size(cache) / 2048, i;
-	ssize_t evicted_memory = 0;
+	segment_unlink(shard, entry);
+	git_oidmap_delete(shard->map, &entry->obj->oid);
 
-	if (evict_count < 8)
-		evict_count = 8;
+	account_memory(shard, entry->obj, -(ssize_t)entry->obj->size);
+
+	git_cached_obj_decref(entry->obj);
+	git__free(entry);
+}
 
-	/* do not infinite loop if there's not enough entries to evict  */
-	if (evict_count > git_cache_size(cache)) {
-		clear_cache(cache);
-		return;
+/*
+ * Called with lock.  Demote the least recently promoted entries of the
+ * protected segment until it fits in its share of the cache again; an
+ * entry that has been hit since it was promoted gets another round.
+ */
+static void rebalance_protected(git_cache_shard *shard)
+{
+	git_cache_segment *protected = &shard->segments[GIT_CACHE_SEGMENT_PROTECTED];
+	ssize_t limit = (shard->used_memory / 100) * GIT_CACHE_PROTECTED_PERCENT;
+	size_t budget = git_oidmap_size(shard->map);
+	git_cache_entry *entry;
+
+	while (protected->memory > limit && budget-- > 0) {
+		entry = protected->tail;
+		segment_unlink(shard, entry);
+
+		if (git_atomic32_get(&entry->hits) > 0) {
+			git_atomic32_set(&entry->hits, 0);
+			segment_push(shard, entry, GIT_CACHE_SEGMENT_PROTECTED);
+		} else {
+			segment_push(shard, entry, GIT_CACHE_SEGMENT_PROBATION);
+		}
 	}
+}
 
-	i = 0;
-	while (evict_count > 0) {
-		git_cached_obj *evict;
-		const git_oid *key;
+GIT_INLINE(bool) entry_matches(git_cache_entry *entry, git_object_t type)
+{
+	return (type == GIT_OBJECT_ANY || entry->obj->type == type);
+}
 
-		if (git_oidmap_iterate((void **) &evict, cache->map, &i, &key) == GIT_ITEROVER)
-			break;
+/*
+ * Called with lock.  Find the next entry of the given type to evict,
+ * scanning the probationary segment from its least recently used end
+ * and promoting any entry that was hit since it was admitted.  Only if
+ * nothing in probation qualifies will the protected segment give up an
+ * entry.
+ */
+static git_cache_entry *find_victim(git_cache_shard *shard, git_object_t type)
+{
+	git_cache_segment *probation = &shard->segments[GIT_CACHE_SEGMENT_PROBATION];
+	git_cache_segment *protected = &shard->segments[GIT_CACHE_SEGMENT_PROTECTED];
+	git_cache_entry *entry, *prev;
+	bool promoted = false;
+
+	for (entry = probation->tail; entry; entry = prev) {
+		prev = entry->prev;
+
+		if (!entry_matches(entry, type))
+			continue;
+
+		if (git_atomic32_get(&entry->hits) == 0)
+			return entry;
+
+		git_atomic32_set(&entry->hits, 0);
+		segment_unlink(shard, entry);
+		segment_push(shard, entry, GIT_CACHE_SEGMENT_PROTECTED);
+		promoted = true;
+	}
 
-		evict_count--;
-		evicted_memory += evict->size;
-		git_oidmap_delete(cache->map, key);
-		git_cached_obj_decref(evict);
+	if (promoted) {
+		rebalance_protected(shard);
+
+		for (entry = probation->tail; entry; entry = entry->prev) {
+			if (entry_matches(entry, type))
+				return entry;
+		}
 	}
 
-	cache->used_memory -= evicted_memory;
-	git_atomic_ssize_add(&git_cache__current_storage, -evicted_memory);
+	for (entry = protected->tail; entry; entry = entry->prev) {
+		if (entry_matches(entry, type))
+			return entry;
+	}
+
+	return NULL;
+}
+
+/* Called with lock */
+static void cache_evict_entries(git_cache_shard *shard, git_object_t type)
+{
+	size_t evict_count = git_oidmap_size(shard->map) / 2048;
+	size_t evicted = 0;
+	git_cache_entry *victim;
+
+	if (evict_count < 8)
+		evict_count = 8;
+
+	while (evicted < evict_count &&
+	       (victim = find_victim(shard, type)) != NULL) {
+		cache_remove(shard, victim);
+		evicted++;
+	}
+
+	shard->pending_evictions += (ssize_t)evicted;
 }
 
 static bool cache_should_store(git_object_t object_type, size_t object_size)
@@ -130,33 +393,57 @@ static bool cache_should_store(git_object_t object_type, size_t object_size)
 	return git_cache__enabled && object_size < max_size;
 }
 
+/* Called with lock */
+static bool cache_over_budget(git_cache_shard *shard)
+{
+	return git_atomic_ssize_get(&git_cache__current_storage) +
+		shard->pending_memory > git_cache__max_storage;
+}
+
+/* Called with lock */
+static bool cache_type_over_budget(git_cache_shard *shard, git_object_t object_type)
+{
+	ssize_t max_size = git_cache__max_type_storage[object_type];
+
+	return max_size > 0 &&
+		git_atomic_ssize_get(&git_cache__current_type_storage[object_type]) +
+		shard->pending_type_memory[object_type] > max_size;
+}
+
 static void *cache_get(git_cache *cache, const git_oid *oid, unsigned int flags)
 {
-	git_cached_obj *entry;
+	git_cache_shard *shard = cache_shard(cache, oid);
+	git_cache_entry *entry;
+	git_cached_obj *obj = NULL;
 
-	if (!git_cache__enabled || git_rwlock_rdlock(&cache->lock) < 0)
+	if (!git_cache__enabled || git_rwlock_rdlock(&shard->lock) < 0)
 		return NULL;
 
-	if ((entry = git_oidmap_get(cache->map, oid)) != NULL) {
-		if (flags && entry->flags != flags) {
-			entry = NULL;
-		} else {
-			git_cached_obj_incref(entry);
-		}
+	if ((entry = git_oidmap_get(shard->map, oid)) != NULL &&
+	    (!flags || entry->obj->flags == flags)) {
+		obj = entry->obj;
+		git_cached_obj_incref(obj);
+		git_atomic32_inc(&entry->hits);
 	}
 
-	git_rwlock_rdunlock(&cache->lock);
+	git_rwlock_rdunlock(&shard->lock);
 
-	return entry;
+	if (obj)
+		account_lookup(&shard->pending_hits, &git_cache__hits);
+	else
+		account_lookup(&shard->pending_misses, &git_cache__misses);
+
+	return obj;
 }
 
 static void *cache_store(git_cache *cache, git_cached_obj *entry)
 {
-	git_cached_obj *stored_entry;
+	git_cache_shard *shard = cache_shard(cache, &entry->oid);
+	git_cache_entry *stored;
 
 	git_cached_obj_incref(entry);
 
-	if (!git_cache__enabled && cache->used_memory > 0) {
+	if (!git_cache__enabled && shard->used_memory > 0) {
 		git_cache_clear(cache);
 		return entry;
 	}
@@ -164,43 +451,58 @@ static void *cache_store(git_cache *cache, git_cached_obj *entry)
 	if (!cache_should_store(entry->type, entry->size))
 		return entry;
 
-	if (git_rwlock_wrlock(&cache->lock) < 0)
+	if (git_rwlock_wrlock(&shard->lock) < 0)
 		return entry;
 
 	/* soften the load on the cache */
-	if (git_atomic_ssize_get(&git_cache__current_storage) > git_cache__max_storage)
-		cache_evict_entries(cache);
+	if (cache_over_budget(shard))
+		cache_evict_entries(shard, GIT_OBJECT_ANY);
+
+	if (cache_type_over_budget(shard, entry->type))
+		cache_evict_entries(shard, entry->type);
 
 	/* not found */
-	if ((stored_entry = git_oidmap_get(cache->map, &entry->oid)) == NULL) {
-		if (git_oidmap_set(cache->map, &entry->oid, entry) == 0) {
-			git_cached_obj_incref(entry);
-			cache->used_memory += entry->size;
-			git_atomic_ssize_add(&git_cache__current_storage, (ssize_t)entry->size);
+	if ((stored = git_oidmap_get(shard->map, &entry->oid)) == NULL) {
+		if ((stored = git__calloc(1, sizeof(git_cache_entry))) != NULL) {
+			stored->obj = entry;
+
+			if (git_oidmap_set(shard->map, &entry->oid, stored) == 0) {
+				git_cached_obj_incref(entry);
+				segment_push(shard, stored, GIT_CACHE_SEGMENT_PROBATION);
+				account_memory(shard, entry, (ssize_t)entry->size);
+			} else {
+				git__free(stored);
+			}
 		}
 	}
 	/* found */
 	else {
-		if (stored_entry->flags == entry->flags) {
+		if (stored->obj->flags == entry->flags) {
 			git_cached_obj_decref(entry);
-			git_cached_obj_incref(stored_entry);
-			entry = stored_entry;
-		} else if (stored_entry->flags == GIT_CACHE_STORE_RAW &&
+			git_cached_obj_incref(stored->obj);
+			entry = stored->obj;
+		} else if (stored->obj->flags == GIT_CACHE_STORE_RAW &&
 			   entry->flags == GIT_CACHE_STORE_PARSED) {
-			if (git_oidmap_set(cache->map, &entry->oid, entry) == 0) {
-				git_cached_obj_decref(stored_entry);
+			if (git_oidmap_set(shard->map, &entry->oid, stored) == 0) {
+				ssize_t delta = (ssize_t)entry->size - (ssize_t)stored->obj->size;
+
+				shard->segments[stored->segment].memory += delta;
+				account_memory(shard, entry, delta);
+
+				git_cached_obj_decref(stored->obj);
 				git_cached_obj_incref(entry);
+				stored->obj = entry;
 			} else {
 				git_cached_obj_decref(entry);
-				git_cached_obj_incref(stored_entry);
-				entry = stored_entry;
+				git_cached_obj_incref(stored->obj);
+				entry = stored->obj;
 			}
 		} else {
 			/* NO OP */
 		}
 	}
 
-	git_rwlock_wrunlock(&cache->lock);
+	git_rwlock_wrunlock(&shard->lock);
 	return entry;
 }
 
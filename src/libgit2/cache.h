@@ -30,17 +30,65 @@ typedef struct {
 	git_atomic32 refcount;
 } git_cached_obj;
 
+/*
+ * The cache is a segmented LRU: new entries are admitted into the
+ * probationary segment and only move into the protected segment once
+ * they have been hit while in the cache.  Lookups only bump an atomic
+ * hit counter on the entry (so that they can proceed under the read
+ * lock); the segments are reordered lazily when entries are evicted.
+ * One-shot objects (eg, blobs read once during a diff) thus never push
+ * frequently used commits and trees out of the cache.
+ */
+enum {
+	GIT_CACHE_SEGMENT_PROBATION = 0,
+	GIT_CACHE_SEGMENT_PROTECTED = 1,
+	GIT_CACHE_SEGMENT__COUNT
+};
+
+typedef struct git_cache_entry git_cache_entry;
+
+typedef struct {
+	git_cache_entry *head; /* most recently admitted or promoted */
+	git_cache_entry *tail; /* next eviction candidate */
+	ssize_t memory;
+} git_cache_segment;
+
+/*
+ * The cache is split into independently locked shards, selected by a
+ * byte of the object ID, so that threads sharing a repository rarely
+ * contend for the same lock.  Each shard tracks its memory use and hit
+ * counts locally and folds them into the global counters in batches.
+ */
+#define GIT_CACHE_SHARDS 16
+
 typedef struct {
 	git_oidmap *map;
 	git_rwlock  lock;
 	ssize_t     used_memory;
+	git_cache_segment segments[GIT_CACHE_SEGMENT__COUNT];
+
+	/* accounting not yet folded into the global counters */
+	ssize_t pending_memory;
+	ssize_t pending_type_memory[8];
+	ssize_t pending_evictions;
+	git_atomic32 pending_hits;
+	git_atomic32 pending_misses;
+} git_cache_shard;
+
+typedef struct {
+	git_cache_shard shards[GIT_CACHE_SHARDS];
 } git_cache;
 
 extern bool git_cache__enabled;
 extern ssize_t git_cache__max_storage;
 extern git_atomic_ssize git_cache__current_storage;
 
+extern git_atomic_ssize git_cache__hits;
+extern git_atomic_ssize git_cache__misses;
+extern git_atomic_ssize git_cache__evictions;
+
 int git_cache_set_max_object_size(git_object_t type, size_t size);
+int git_cache_set_max_type_storage(git_object_t type, ssize_t size);
 
 int git_cache_init(git_cache *cache);
 void git_cache_dispose(git_cache *cache);
@@ -55,7 +103,12 @@ void *git_cache_get_any(git_cache *cache, const git_oid *oid);
 
 GIT_INLINE(size_t) git_cache_size(git_cache *cache)
 {
-	return (size_t)git_oidmap_size(cache->map);
+	size_t i, size = 0;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++)
+		size += (size_t)git_oidmap_size(cache->shards[i].map);
+
+	return size;
 }
 
 GIT_INLINE(void) git_cached_obj_incref(void *_obj)
@@ -32,6 +32,7 @@
 #include "pool.h"
 #include "strmap.h"
 #include "path.h"
+#include "sparse-checkout.h"
 
 /* See docs/checkout-internals.md for more information */
 
@@ -43,7 +44,8 @@ enum {
 	CHECKOUT_ACTION__CONFLICT = 8,
 	CHECKOUT_ACTION__REMOVE_CONFLICT = 16,
 	CHECKOUT_ACTION__UPDATE_CONFLICT = 32,
-	CHECKOUT_ACTION__MAX = 32,
+	CHECKOUT_ACTION__SKIP_WORKTREE = 64,
+	CHECKOUT_ACTION__MAX = 64,
 	CHECKOUT_ACTION__REMOVE_AND_UPDATE =
 		(CHECKOUT_ACTION__UPDATE_BLOB | CHECKOUT_ACTION__REMOVE)
 };
@@ -74,6 +76,7 @@ typedef struct {
 	git_checkout_perfdata perfdata;
 	git_strmap *mkdir_map;
 	git_attr_session attr_session;
+	git_sparse_checkout sparse;
 } checkout_data;
 
 typedef struct {
@@ -1297,6 +1300,104 @@ static int checkout_verify_paths(
 	return 0;
 }
 
+/*
+ * Paths outside of the sparse checkout are not written.  Files that are
+ * still there (eg from before the cone was narrowed) are removed, unless
+ * they have changes that are not being forced away, which conflict.
+ */
+static int checkout_action_sparse(
+	int *action,
+	checkout_data *data,
+	const git_diff_delta *delta)
+{
+	git_index_entry wditem;
+	git_str *fullpath;
+	struct stat st;
+
+	*action = CHECKOUT_ACTION__SKIP_WORKTREE;
+
+	/* untracked files are left alone */
+	if (delta->status == GIT_DELTA_ADDED)
+		return 0;
+
+	if (checkout_target_fullpath(&fullpath, data, delta->old_file.path) < 0)
+		return -1;
+
+	/* nothing is checked out, or a directory that we don't touch */
+	if (p_lstat(fullpath->ptr, &st) < 0 || S_ISDIR(st.st_mode))
+		return 0;
+
+	git_index_entry__init_from_stat(&wditem, &st, data->respect_filemode);
+	wditem.path = delta->old_file.path;
+
+	if ((data->strategy & GIT_CHECKOUT_FORCE) == 0 &&
+	    checkout_is_workdir_modified(data, &delta->old_file, &delta->new_file, &wditem)) {
+		*action |= CHECKOUT_ACTION__CONFLICT;
+		return checkout_notify(data, GIT_CHECKOUT_NOTIFY_CONFLICT, delta, &wditem);
+	}
+
+	if ((data->strategy & GIT_CHECKOUT_UPDATE_ONLY) == 0)
+		*action |= CHECKOUT_ACTION_IF(SAFE, REMOVE, NONE);
+
+	return 0;
+}
+
+/*
+ * Paths that are inside of the sparse checkout but still marked "skip
+ * worktree" in the index (eg after the cone was widened) are missing from
+ * the working directory even when they are unmodified.  They are checked
+ * out, unless a file with changes that are not being forced away is in
+ * the way, which conflicts.  Writing the index entry for the checked out
+ * file clears the flag.
+ */
+static int checkout_action_widened(
+	int *action,
+	checkout_data *data,
+	const git_diff_delta *delta)
+{
+	const git_index_entry *ie;
+	git_index_entry wditem;
+	git_str *fullpath;
+	struct stat st;
+
+	if (!data->index ||
+	    (*action & (CHECKOUT_ACTION__UPDATE_BLOB | CHECKOUT_ACTION__CONFLICT)) != 0 ||
+	    delta->status == GIT_DELTA_DELETED ||
+	    S_ISGITLINK(delta->new_file.mode))
+		return 0;
+
+	if ((ie = git_index_get_bypath(data->index, delta->new_file.path, 0)) == NULL ||
+	    (ie->flags_extended & GIT_INDEX_ENTRY_SKIP_WORKTREE) == 0)
+		return 0;
+
+	if (checkout_target_fullpath(&fullpath, data, delta->new_file.path) < 0)
+		return -1;
+
+	if (p_lstat(fullpath->ptr, &st) < 0) {
+		if ((data->strategy & GIT_CHECKOUT_UPDATE_ONLY) != 0)
+			return 0;
+
+		*action |= CHECKOUT_ACTION_IF(SAFE, UPDATE_BLOB, NONE);
+		return checkout_action_common(action, data, delta, NULL);
+	}
+
+	/* a directory in the way is left to the usual checkout */
+	if (S_ISDIR(st.st_mode))
+		return 0;
+
+	git_index_entry__init_from_stat(&wditem, &st, data->respect_filemode);
+	wditem.path = delta->new_file.path;
+
+	if ((data->strategy & GIT_CHECKOUT_FORCE) == 0 &&
+	    checkout_is_workdir_modified(data, &delta->new_file, &delta->new_file, &wditem)) {
+		*action |= CHECKOUT_ACTION__CONFLICT;
+		return checkout_notify(data, GIT_CHECKOUT_NOTIFY_CONFLICT, delta, &wditem);
+	}
+
+	*action |= CHECKOUT_ACTION_IF(SAFE, UPDATE_BLOB, NONE);
+	return checkout_action_common(action, data, delta, &wditem);
+}
+
 static int checkout_get_actions(
 	uint32_t **actions_ptr,
 	size_t **counts_ptr,
@@ -1333,7 +1434,12 @@ static int checkout_get_actions(
 	}
 
 	git_vector_foreach(deltas, i, delta) {
-		if ((error = checkout_action(&act, data, delta, workdir, &wditem, &pathspec)) == 0)
+		/* the workdir iterator does not walk outside of the cone */
+		if (!git_sparse_checkout_includes(&data->sparse, delta->new_file.path))
+			error = checkout_action_sparse(&act, data, delta);
+		else if ((error = checkout_action(&act, data, delta, workdir, &wditem, &pathspec)) == 0 &&
+		         (!data->sparse.enabled ||
+		          (error = checkout_action_widened(&act, data, delta)) == 0))
 			error = checkout_verify_paths(data->repo, act, delta);
 
 		if (error != 0)
@@ -1341,6 +1447,9 @@ static int checkout_get_actions(
 
 		actions[i] = act;
 
+		if (act & CHECKOUT_ACTION__SKIP_WORKTREE)
+			counts[CHECKOUT_ACTION__SKIP_WORKTREE]++;
+
 		if (act & CHECKOUT_ACTION__REMOVE)
 			counts[CHECKOUT_ACTION__REMOVE]++;
 		if (act & CHECKOUT_ACTION__UPDATE_BLOB)
@@ -1890,6 +1999,75 @@ static int checkout_create_the_new(
 	return 0;
 }
 
+/*
+ * Update the index entries of the paths outside of the sparse checkout
+ * to the target, marking them "skip worktree", unless they have changes
+ * staged or in the working directory that are not being forced away.
+ */
+static int checkout_update_sparse_index(
+	unsigned int *actions,
+	checkout_data *data)
+{
+	git_diff_delta *delta;
+	const git_index_entry *existing;
+	git_index_entry entry;
+	git_object_t type;
+	git_odb *odb;
+	size_t i, size;
+	int error;
+
+	if (!data->index || (data->strategy & GIT_CHECKOUT_DONT_UPDATE_INDEX) != 0)
+		return 0;
+
+	if ((error = git_repository_odb__weakptr(&odb, data->repo)) < 0)
+		return error;
+
+	git_vector_foreach(&data->diff->deltas, i, delta) {
+		if ((actions[i] & CHECKOUT_ACTION__SKIP_WORKTREE) == 0 ||
+		    (actions[i] & CHECKOUT_ACTION__CONFLICT) != 0)
+			continue;
+
+		existing = git_index_get_bypath(data->index, delta->old_file.path, 0);
+
+		if (existing && (data->strategy & GIT_CHECKOUT_FORCE) == 0 &&
+		    !git_oid_equal(&existing->id, &delta->old_file.id))
+			continue;
+
+		if (delta->status == GIT_DELTA_DELETED) {
+			if (existing &&
+			    (error = git_index_remove(data->index, delta->old_file.path, 0)) < 0)
+				return error;
+
+			continue;
+		}
+
+		if (existing &&
+		    existing->mode == delta->new_file.mode &&
+		    (existing->flags_extended & GIT_INDEX_ENTRY_SKIP_WORKTREE) != 0 &&
+		    git_oid_equal(&existing->id, &delta->new_file.id))
+			continue;
+
+		memset(&entry, 0, sizeof(entry));
+		entry.path = delta->new_file.path;
+		entry.mode = delta->new_file.mode;
+		entry.flags_extended = GIT_INDEX_ENTRY_SKIP_WORKTREE;
+		git_oid_cpy(&entry.id, &delta->new_file.id);
+
+		/* the diff against a tree does not know the sizes of blobs */
+		if (!S_ISGITLINK(entry.mode)) {
+			if ((error = git_odb_read_header(&size, &type, odb, &entry.id)) < 0)
+				return error;
+
+			entry.file_size = (uint32_t)size;
+		}
+
+		if ((error = git_index_add(data->index, &entry)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
 static int checkout_create_submodules(
 	unsigned int *actions,
 	checkout_data *data)
@@ -2335,6 +2513,8 @@ static void checkout_data_clear(checkout_data *data)
 	data->mkdir_map = NULL;
 
 	git_attr_session__free(&data->attr_session);
+
+	git_sparse_checkout_dispose(&data->sparse);
 }
 
 static int validate_target_directory(checkout_data *data)
@@ -2462,6 +2642,12 @@ static int checkout_data_init(
 			 &data->respect_filemode, repo, GIT_CONFIGMAP_FILEMODE)) < 0)
 		goto cleanup;
 
+	/* only the working directory itself has a sparse checkout */
+	if (git_repository_workdir(repo) &&
+	    strcmp(data->opts.target_directory, git_repository_workdir(repo)) == 0 &&
+	    (error = git_sparse_checkout_load(&data->sparse, repo)) < 0)
+		goto cleanup;
+
 	if (!data->opts.baseline && !data->opts.baseline_index) {
 		data->opts_free_baseline = true;
 		error = 0;
@@ -2580,7 +2766,8 @@ int git_checkout_iterator(
 
 	workdir_opts.flags = git_iterator_ignore_case(target) ?
 		GIT_ITERATOR_IGNORE_CASE : GIT_ITERATOR_DONT_IGNORE_CASE;
-	workdir_opts.flags |= GIT_ITERATOR_DONT_AUTOEXPAND;
+	workdir_opts.flags |= GIT_ITERATOR_DONT_AUTOEXPAND |
+		GIT_ITERATOR_SKIP_SPARSE_DIRS;
 	workdir_opts.start = data.pfx;
 	workdir_opts.end = data.pfx;
 
@@ -2661,6 +2848,10 @@ int git_checkout_iterator(
 		(error = checkout_create_conflicts(&data)) < 0)
 		goto cleanup;
 
+	if (counts[CHECKOUT_ACTION__SKIP_WORKTREE] > 0 &&
+		(error = checkout_update_sparse_index(actions, &data)) < 0)
+		goto cleanup;
+
 	if (data.index != git_iterator_index(target) &&
 		(error = checkout_extensions_update_index(&data)) < 0)
 		goto cleanup;
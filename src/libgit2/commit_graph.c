@@ -39,12 +39,36 @@ struct git_commit_graph_header {
 #define COMMIT_GRAPH_EXTRA_EDGE_LIST_ID 0x45444745    /* "EDGE" */
 #define COMMIT_GRAPH_BLOOM_FILTER_INDEX_ID 0x42494458 /* "BIDX" */
 #define COMMIT_GRAPH_BLOOM_FILTER_DATA_ID 0x42444154  /* "BDAT" */
+#define COMMIT_GRAPH_BASE_GRAPHS_LIST_ID 0x42415345   /* "BASE" */
+#define COMMIT_GRAPH_GENERATION_DATA_ID 0x47444132    /* "GDA2" */
+#define COMMIT_GRAPH_GENERATION_DATA_OVERFLOW_ID 0x47444f32 /* "GDO2" */
+
+/*
+ * The first version of the corrected commit dates, which git wrote
+ * incorrectly and ignores since 2.36.
+ */
+#define COMMIT_GRAPH_GENERATION_DATA_V1_ID 0x47444154 /* "GDAT" */
+#define COMMIT_GRAPH_GENERATION_DATA_OVERFLOW_V1_ID 0x47444f56 /* "GDOV" */
+
+#define COMMIT_GRAPH_GENERATION_DATA_OVERFLOW 0x80000000u
+#define COMMIT_GRAPH_GENERATION_DATA_MAX_OFFSET 0x7fffffffu
 
 struct git_commit_graph_chunk {
 	off64_t offset;
 	size_t length;
 };
 
+/*
+ * Changed-path Bloom filters are computed with the settings that git
+ * uses by default: 7 hashes and 10 bits per changed path, and a commit
+ * changing more than 512 paths gets a filter that matches every path.
+ */
+#define COMMIT_GRAPH_BLOOM_DATA_HEADER_SIZE 12
+#define COMMIT_GRAPH_BLOOM_HASH_VERSION 1
+#define COMMIT_GRAPH_BLOOM_NUM_HASHES 7
+#define COMMIT_GRAPH_BLOOM_BITS_PER_ENTRY 10
+#define COMMIT_GRAPH_BLOOM_MAX_CHANGED_PATHS 512
+
 typedef git_array_t(size_t) parent_index_array_t;
 
 struct packed_commit {
@@ -52,6 +76,7 @@ struct packed_commit {
 	git_oid sha1;
 	git_oid tree_oid;
 	uint32_t generation;
+	uint64_t corrected_commit_date;
 	git_time_t commit_time;
 	git_array_oid_t parents;
 	parent_index_array_t parent_indices;
@@ -196,6 +221,96 @@ static int commit_graph_parse_extra_edge_list(
 	return 0;
 }
 
+static int commit_graph_parse_generation_data(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_generation_data,
+		struct git_commit_graph_chunk *chunk_generation_data_overflow)
+{
+	if (chunk_generation_data->offset == 0) {
+		if (chunk_generation_data_overflow->offset != 0)
+			return commit_graph_error("unexpected Generation Data Overflow chunk");
+		return 0;
+	}
+
+	if (chunk_generation_data->length != file->num_commits * 4)
+		return commit_graph_error("malformed Generation Data chunk");
+	if (chunk_generation_data_overflow->length % 8 != 0)
+		return commit_graph_error("malformed Generation Data Overflow chunk");
+
+	file->generation_data = data + chunk_generation_data->offset;
+	file->read_generation_data = true;
+
+	if (chunk_generation_data_overflow->offset != 0) {
+		file->generation_data_overflow = data + chunk_generation_data_overflow->offset;
+		file->num_generation_data_overflow = chunk_generation_data_overflow->length / 8;
+	}
+
+	return 0;
+}
+
+static int commit_graph_parse_bloom_filters(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_bloom_index,
+		struct git_commit_graph_chunk *chunk_bloom_data)
+{
+	const unsigned char *header;
+	uint32_t hash_version, num_hashes, bits_per_entry;
+
+	/* The filters are optional, and only usable with their index. */
+	if (chunk_bloom_index->offset == 0 || chunk_bloom_data->offset == 0)
+		return 0;
+	if (chunk_bloom_index->length != file->num_commits * 4)
+		return commit_graph_error("Bloom Filter Index chunk has wrong length");
+	if (chunk_bloom_data->length < COMMIT_GRAPH_BLOOM_DATA_HEADER_SIZE)
+		return commit_graph_error("Bloom Filter Data chunk is too short");
+
+	header = data + chunk_bloom_data->offset;
+	hash_version = ntohl(*((uint32_t *)(header + 0)));
+	num_hashes = ntohl(*((uint32_t *)(header + 4)));
+	bits_per_entry = ntohl(*((uint32_t *)(header + 8)));
+
+	/* Ignore filters that were computed in a way we don't know. */
+	if ((hash_version != 1 && hash_version != 2) ||
+	    num_hashes == 0 || bits_per_entry == 0)
+		return 0;
+
+	file->bloom_filter_index = data + chunk_bloom_index->offset;
+	file->bloom_filter_data = header + COMMIT_GRAPH_BLOOM_DATA_HEADER_SIZE;
+	file->bloom_filter_data_len = chunk_bloom_data->length - COMMIT_GRAPH_BLOOM_DATA_HEADER_SIZE;
+	file->bloom_hash_version = hash_version;
+	file->bloom_num_hashes = num_hashes;
+	file->bloom_bits_per_entry = bits_per_entry;
+
+	return 0;
+}
+
+static int commit_graph_parse_base_graphs(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_base_graphs,
+		uint32_t num_base_graphs)
+{
+	size_t oid_size = git_oid_size(file->oid_type);
+
+	if (num_base_graphs == 0) {
+		if (chunk_base_graphs->offset != 0)
+			return commit_graph_error("unexpected base graphs list");
+		return 0;
+	}
+
+	if (chunk_base_graphs->offset == 0)
+		return commit_graph_error("missing base graphs list");
+	if (chunk_base_graphs->length != num_base_graphs * oid_size)
+		return commit_graph_error("base graphs list has wrong length");
+
+	file->base_graphs = data + chunk_base_graphs->offset;
+	file->num_base_graphs = num_base_graphs;
+
+	return 0;
+}
+
 int git_commit_graph_file_parse(
 		git_commit_graph_file *file,
 		const unsigned char *data,
@@ -210,7 +325,9 @@ int git_commit_graph_file_parse(
 	int error;
 	struct git_commit_graph_chunk chunk_oid_fanout = {0}, chunk_oid_lookup = {0},
 				      chunk_commit_data = {0}, chunk_extra_edge_list = {0},
-				      chunk_unsupported = {0};
+				      chunk_bloom_index = {0}, chunk_bloom_data = {0},
+				      chunk_base_graphs = {0}, chunk_generation_data = {0},
+				      chunk_generation_data_overflow = {0}, chunk_ignored = {0};
 
 	GIT_ASSERT_ARG(file);
 
@@ -274,9 +391,33 @@ int git_commit_graph_file_parse(
 			break;
 
 		case COMMIT_GRAPH_BLOOM_FILTER_INDEX_ID:
+			chunk_bloom_index.offset = last_chunk_offset;
+			last_chunk = &chunk_bloom_index;
+			break;
+
 		case COMMIT_GRAPH_BLOOM_FILTER_DATA_ID:
-			chunk_unsupported.offset = last_chunk_offset;
-			last_chunk = &chunk_unsupported;
+			chunk_bloom_data.offset = last_chunk_offset;
+			last_chunk = &chunk_bloom_data;
+			break;
+
+		case COMMIT_GRAPH_BASE_GRAPHS_LIST_ID:
+			chunk_base_graphs.offset = last_chunk_offset;
+			last_chunk = &chunk_base_graphs;
+			break;
+
+		case COMMIT_GRAPH_GENERATION_DATA_ID:
+			chunk_generation_data.offset = last_chunk_offset;
+			last_chunk = &chunk_generation_data;
+			break;
+
+		case COMMIT_GRAPH_GENERATION_DATA_OVERFLOW_ID:
+			chunk_generation_data_overflow.offset = last_chunk_offset;
+			last_chunk = &chunk_generation_data_overflow;
+			break;
+
+		case COMMIT_GRAPH_GENERATION_DATA_V1_ID:
+		case COMMIT_GRAPH_GENERATION_DATA_OVERFLOW_V1_ID:
+			last_chunk = &chunk_ignored;
 			break;
 
 		default:
@@ -297,10 +438,39 @@ int git_commit_graph_file_parse(
 	error = commit_graph_parse_extra_edge_list(file, data, &chunk_extra_edge_list);
 	if (error < 0)
 		return error;
+	error = commit_graph_parse_bloom_filters(file, data, &chunk_bloom_index, &chunk_bloom_data);
+	if (error < 0)
+		return error;
+	error = commit_graph_parse_base_graphs(file, data, &chunk_base_graphs, hdr->base_graph_files);
+	if (error < 0)
+		return error;
+	error = commit_graph_parse_generation_data(file, data,
+			&chunk_generation_data, &chunk_generation_data_overflow);
+	if (error < 0)
+		return error;
 
 	return 0;
 }
 
+static int commit_graph_open_file(git_commit_graph *cgraph)
+{
+	int error;
+
+	error = git_commit_graph_file_open(&cgraph->file,
+			git_str_cstr(&cgraph->filename), cgraph->oid_type);
+	cgraph->chained = false;
+
+	if (error == GIT_ENOTFOUND) {
+		git_error_clear();
+
+		error = git_commit_graph_chain_open(&cgraph->file,
+				git_str_cstr(&cgraph->chain_filename), cgraph->oid_type);
+		cgraph->chained = true;
+	}
+
+	return error;
+}
+
 int git_commit_graph_new(
 	git_commit_graph **cgraph_out,
 	const char *objects_dir,
@@ -323,9 +493,13 @@ int git_commit_graph_new(
 	if (error < 0)
 		goto error;
 
+	error = git_str_joinpath(&cgraph->chain_filename, objects_dir,
+			"info/commit-graphs/commit-graph-chain");
+	if (error < 0)
+		goto error;
+
 	if (open_file) {
-		error = git_commit_graph_file_open(&cgraph->file,
-				git_str_cstr(&cgraph->filename), oid_type);
+		error = commit_graph_open_file(cgraph);
 
 		if (error < 0)
 			goto error;
@@ -341,26 +515,39 @@ error:
 	return error;
 }
 
-int git_commit_graph_validate(git_commit_graph *cgraph) {
+static int commit_graph_file_validate(const git_commit_graph_file *file)
+{
 	unsigned char checksum[GIT_HASH_MAX_SIZE];
 	git_hash_algorithm_t checksum_type;
 	size_t checksum_size, trailer_offset;
 
-	checksum_type = git_oid_algorithm(cgraph->oid_type);
+	checksum_type = git_oid_algorithm(file->oid_type);
 	checksum_size = git_hash_size(checksum_type);
-	trailer_offset = cgraph->file->graph_map.len - checksum_size;
+	trailer_offset = file->graph_map.len - checksum_size;
 
-	if (cgraph->file->graph_map.len < checksum_size)
+	if (file->graph_map.len < checksum_size)
 		return commit_graph_error("map length too small");
 
-	if (git_hash_buf(checksum, cgraph->file->graph_map.data, trailer_offset, checksum_type) < 0)
+	if (git_hash_buf(checksum, file->graph_map.data, trailer_offset, checksum_type) < 0)
 		return commit_graph_error("could not calculate signature");
-	if (memcmp(checksum, cgraph->file->checksum, checksum_size) != 0)
+	if (memcmp(checksum, file->checksum, checksum_size) != 0)
 		return commit_graph_error("index signature mismatch");
 
 	return 0;
 }
 
+int git_commit_graph_validate(git_commit_graph *cgraph) {
+	git_commit_graph_file *file;
+	int error;
+
+	for (file = cgraph->file; file; file = file->base) {
+		if ((error = commit_graph_file_validate(file)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
 int git_commit_graph_open(
 	git_commit_graph **cgraph_out,
 	const char *objects_dir
@@ -433,25 +620,109 @@ int git_commit_graph_file_open(
 	return 0;
 }
 
+/*
+ * Check that a file of a commit-graph chain is the one named in the chain
+ * file, and that it was written on top of the files that precede it.
+ */
+static int commit_graph_chain_link(
+	git_commit_graph_file *file,
+	const char *hex)
+{
+	git_commit_graph_file *base;
+	char checksum[GIT_HASH_MAX_SIZE * 2 + 1];
+	size_t oid_size = git_oid_size(file->oid_type);
+	uint32_t num_base_graphs = 0, i;
+
+	git_hash_fmt(checksum, file->checksum, oid_size);
+
+	if (memcmp(checksum, hex, oid_size * 2) != 0)
+		return commit_graph_error("commit-graph chain names the wrong file");
+
+	for (base = file->base; base; base = base->base)
+		num_base_graphs++;
+
+	if (file->num_base_graphs != num_base_graphs)
+		return commit_graph_error("commit-graph chain has the wrong number of base files");
+
+	for (base = file->base, i = num_base_graphs; base; base = base->base) {
+		if (memcmp(file->base_graphs + --i * oid_size, base->checksum, oid_size) != 0)
+			return commit_graph_error("commit-graph chain has the wrong base files");
+	}
+
+	if (file->base) {
+		file->num_commits_in_base = file->base->num_commits_in_base + file->base->num_commits;
+		file->read_generation_data &= file->base->read_generation_data;
+	}
+
+	return 0;
+}
+
+int git_commit_graph_chain_open(
+	git_commit_graph_file **file_out,
+	const char *chain_path,
+	git_oid_t oid_type)
+{
+	git_commit_graph_file *file = NULL, *layer;
+	git_str chain = GIT_STR_INIT, dir = GIT_STR_INIT, path = GIT_STR_INIT;
+	size_t hexsize = git_oid_hexsize(oid_type);
+	const char *line, *end;
+	int error;
+
+	if ((error = git_futils_readbuffer(&chain, chain_path)) < 0 ||
+	    (error = git_fs_path_dirname_r(&dir, chain_path)) < 0)
+		goto done;
+
+	/* The chain lists the checksums of its files, oldest first. */
+	for (line = chain.ptr, end = chain.ptr + chain.size; line < end; line += hexsize + 1) {
+		if ((size_t)(end - line) < hexsize + 1 || line[hexsize] != '\n') {
+			error = commit_graph_error("malformed commit-graph chain");
+			goto done;
+		}
+
+		git_str_clear(&path);
+
+		if ((error = git_str_printf(&path, "%s/graph-%.*s.graph",
+				dir.ptr, (int)hexsize, line)) < 0 ||
+		    (error = git_commit_graph_file_open(&layer, path.ptr, oid_type)) < 0)
+			goto done;
+
+		layer->base = file;
+		file = layer;
+
+		if ((error = commit_graph_chain_link(file, line)) < 0)
+			goto done;
+	}
+
+	if (!file) {
+		git_error_set(GIT_ERROR_ODB, "commit-graph chain is empty - '%s'", chain_path);
+		error = GIT_ENOTFOUND;
+		goto done;
+	}
+
+	*file_out = file;
+	file = NULL;
+
+done:
+	git_commit_graph_file_free(file);
+	git_str_dispose(&chain);
+	git_str_dispose(&dir);
+	git_str_dispose(&path);
+	return error;
+}
+
 int git_commit_graph_get_file(
 	git_commit_graph_file **file_out,
 	git_commit_graph *cgraph)
 {
 	if (!cgraph->checked) {
 		int error = 0;
-		git_commit_graph_file *result = NULL;
 
 		/* We only check once, no matter the result. */
 		cgraph->checked = 1;
 
 		/* Best effort */
-		error = git_commit_graph_file_open(&result,
-			git_str_cstr(&cgraph->filename), cgraph->oid_type);
-
-		if (error < 0)
+		if (!cgraph->file && (error = commit_graph_open_file(cgraph)) < 0)
 			return error;
-
-		cgraph->file = result;
 	}
 	if (!cgraph->file)
 		return GIT_ENOTFOUND;
@@ -460,39 +731,107 @@ int git_commit_graph_get_file(
 	return 0;
 }
 
+static bool commit_graph_chain_needs_refresh(
+	const git_commit_graph_file *file,
+	const char *chain_path)
+{
+	git_str chain = GIT_STR_INIT;
+	size_t hexsize = git_oid_hexsize(file->oid_type);
+	char checksum[GIT_HASH_MAX_SIZE * 2 + 1];
+	const char *line;
+	bool needs_refresh = true;
+
+	if (git_futils_readbuffer(&chain, chain_path) < 0) {
+		git_error_clear();
+		return true;
+	}
+
+	/* Compare the newest files first, from the end of the chain. */
+	for (line = chain.ptr + chain.size; file; file = file->base) {
+		if ((size_t)(line - chain.ptr) < hexsize + 1)
+			goto done;
+
+		line -= hexsize + 1;
+		git_hash_fmt(checksum, (unsigned char *)file->checksum, hexsize / 2);
+
+		if (memcmp(line, checksum, hexsize) != 0 || line[hexsize] != '\n')
+			goto done;
+	}
+
+	needs_refresh = (line != chain.ptr);
+
+done:
+	git_str_dispose(&chain);
+	return needs_refresh;
+}
+
 void git_commit_graph_refresh(git_commit_graph *cgraph)
 {
+	bool needs_refresh;
+
 	if (!cgraph->checked)
 		return;
 
-	if (cgraph->file
-	    && git_commit_graph_file_needs_refresh(cgraph->file, git_str_cstr(&cgraph->filename))) {
+	if (cgraph->file) {
+		/* A new single commit-graph file takes precedence over the chain. */
+		if (cgraph->chained)
+			needs_refresh = git_fs_path_exists(git_str_cstr(&cgraph->filename)) ||
+				commit_graph_chain_needs_refresh(cgraph->file,
+					git_str_cstr(&cgraph->chain_filename));
+		else
+			needs_refresh = git_commit_graph_file_needs_refresh(cgraph->file,
+					git_str_cstr(&cgraph->filename));
+
 		/* We just free the commit graph. The next time it is requested, it will be
 		 * re-loaded. */
-		git_commit_graph_file_free(cgraph->file);
-		cgraph->file = NULL;
+		if (needs_refresh) {
+			git_commit_graph_file_free(cgraph->file);
+			cgraph->file = NULL;
+		}
 	}
 	/* Force a lazy re-check next time it is needed. */
 	cgraph->checked = 0;
 }
 
+/*
+ * Find the file of a commit-graph chain that holds the commit at the
+ * given position within the chain.
+ */
+static const git_commit_graph_file *commit_graph_file_at(
+		const git_commit_graph_file *file,
+		size_t pos)
+{
+	while (file && pos < file->num_commits_in_base)
+		file = file->base;
+
+	if (file && pos - file->num_commits_in_base >= file->num_commits)
+		return NULL;
+
+	return file;
+}
+
 static int git_commit_graph_entry_get_byindex(
 		git_commit_graph_entry *e,
 		const git_commit_graph_file *file,
 		size_t pos)
 {
 	const unsigned char *commit_data;
-	size_t oid_size = git_oid_size(file->oid_type);
+	size_t oid_size, local_pos;
+	bool read_generation_data;
 
 	GIT_ASSERT_ARG(e);
 	GIT_ASSERT_ARG(file);
 
-	if (pos >= file->num_commits) {
+	oid_size = git_oid_size(file->oid_type);
+	read_generation_data = file->read_generation_data;
+
+	if ((file = commit_graph_file_at(file, pos)) == NULL) {
 		git_error_set(GIT_ERROR_INVALID, "commit index %zu does not exist", pos);
 		return GIT_ENOTFOUND;
 	}
 
-	commit_data = file->commit_data + pos * (oid_size + 4 * sizeof(uint32_t));
+	local_pos = pos - file->num_commits_in_base;
+	commit_data = file->commit_data + local_pos * (oid_size + 4 * sizeof(uint32_t));
 	git_oid__fromraw(&e->tree_oid, commit_data, file->oid_type);
 	e->parent_indices[0] = ntohl(*((uint32_t *)(commit_data + oid_size)));
 	e->parent_indices[1] = ntohl(
@@ -527,7 +866,30 @@ static int git_commit_graph_entry_get_byindex(
 		}
 	}
 
-	git_oid__fromraw(&e->sha1, &file->oid_lookup[pos * oid_size], file->oid_type);
+	e->corrected_commit_date = 0;
+	if (read_generation_data) {
+		uint32_t offset = ntohl(*((uint32_t *)(file->generation_data + local_pos * 4)));
+		uint64_t overflow;
+
+		if (offset & COMMIT_GRAPH_GENERATION_DATA_OVERFLOW) {
+			offset &= ~COMMIT_GRAPH_GENERATION_DATA_OVERFLOW;
+
+			if (offset >= file->num_generation_data_overflow) {
+				git_error_set(GIT_ERROR_INVALID,
+				              "generation data overflow %u does not exist", offset);
+				return GIT_ENOTFOUND;
+			}
+
+			overflow = ((uint64_t)ntohl(*((uint32_t *)(file->generation_data_overflow + offset * 8)))) << 32 |
+				ntohl(*((uint32_t *)(file->generation_data_overflow + offset * 8 + 4)));
+			e->corrected_commit_date = (uint64_t)e->commit_time + overflow;
+		} else {
+			e->corrected_commit_date = (uint64_t)e->commit_time + offset;
+		}
+	}
+
+	git_oid__fromraw(&e->sha1, &file->oid_lookup[local_pos * oid_size], file->oid_type);
+	e->graph_pos = pos;
 	return 0;
 }
 
@@ -563,8 +925,8 @@ bool git_commit_graph_file_needs_refresh(const git_commit_graph_file *file, cons
 	return (memcmp(checksum, file->checksum, checksum_size) != 0);
 }
 
-int git_commit_graph_entry_find(
-		git_commit_graph_entry *e,
+static int commit_graph_file_find(
+		size_t *out,
 		const git_commit_graph_file *file,
 		const git_oid *short_oid,
 		size_t len)
@@ -574,10 +936,6 @@ int git_commit_graph_entry_find(
 	const unsigned char *current = NULL;
 	size_t oid_size, oid_hexsize;
 
-	GIT_ASSERT_ARG(e);
-	GIT_ASSERT_ARG(file);
-	GIT_ASSERT_ARG(short_oid);
-
 	oid_size = git_oid_size(file->oid_type);
 	oid_hexsize = git_oid_hexsize(file->oid_type);
 
@@ -611,14 +969,51 @@ int git_commit_graph_entry_find(
 			found = 2;
 	}
 
+	if (!found)
+		return GIT_ENOTFOUND;
+	if (found > 1)
+		return GIT_EAMBIGUOUS;
+
+	*out = (size_t)pos;
+	return 0;
+}
+
+int git_commit_graph_entry_find(
+		git_commit_graph_entry *e,
+		const git_commit_graph_file *file,
+		const git_oid *short_oid,
+		size_t len)
+{
+	const git_commit_graph_file *layer;
+	size_t pos, found_pos = 0;
+	int error, found = 0;
+
+	GIT_ASSERT_ARG(e);
+	GIT_ASSERT_ARG(file);
+	GIT_ASSERT_ARG(short_oid);
+
+	/* Look through every file of a commit-graph chain, newest first. */
+	for (layer = file; layer; layer = layer->base) {
+		error = commit_graph_file_find(&pos, layer, short_oid, len);
+
+		if (error == GIT_ENOTFOUND)
+			continue;
+
+		if (error == GIT_EAMBIGUOUS || found++)
+			return git_odb__error_ambiguous(
+					"found multiple offsets for commit-graph index entry");
+
+		found_pos = layer->num_commits_in_base + pos;
+
+		if (len == git_oid_hexsize(file->oid_type))
+			break;
+	}
+
 	if (!found)
 		return git_odb__error_notfound(
 				"failed to find offset for commit-graph index entry", short_oid, len);
-	if (found > 1)
-		return git_odb__error_ambiguous(
-				"found multiple offsets for commit-graph index entry");
 
-	return git_commit_graph_entry_get_byindex(e, file, pos);
+	return git_commit_graph_entry_get_byindex(e, file, found_pos);
 }
 
 int git_commit_graph_entry_parent(
@@ -627,6 +1022,8 @@ int git_commit_graph_entry_parent(
 		const git_commit_graph_entry *entry,
 		size_t n)
 {
+	const git_commit_graph_file *layer;
+
 	GIT_ASSERT_ARG(parent);
 	GIT_ASSERT_ARG(file);
 
@@ -638,83 +1035,285 @@ int git_commit_graph_entry_parent(
 	if (n == 0 || (n == 1 && entry->parent_count == 2))
 		return git_commit_graph_entry_get_byindex(parent, file, entry->parent_indices[n]);
 
+	/* The extra edges are in the file that holds the commit itself. */
+	if ((layer = commit_graph_file_at(file, entry->graph_pos)) == NULL) {
+		git_error_set(GIT_ERROR_INVALID, "commit index %zu does not exist", entry->graph_pos);
+		return GIT_ENOTFOUND;
+	}
+
 	return git_commit_graph_entry_get_byindex(
 			parent,
 			file,
 			ntohl(
-					*(uint32_t *)(file->extra_edge_list
+					*(uint32_t *)(layer->extra_edge_list
 						      + (entry->extra_parents_index + n - 1)
 								      * sizeof(uint32_t)))
 					& 0x7fffffff);
 }
 
-int git_commit_graph_file_close(git_commit_graph_file *file)
+/*
+ * The Bloom filter hash: 32-bit murmur3.  Version 1 of the filters was
+ * computed with the bytes of the path taken as signed chars, as git
+ * did at the time, and version 2 with them taken as unsigned.
+ */
+GIT_INLINE(uint32_t) bloom_rotl(uint32_t value, int count)
 {
-	GIT_ASSERT_ARG(file);
-
-	if (file->graph_map.data)
-		git_futils_mmap_free(&file->graph_map);
-
-	return 0;
+	return (value << count) | (value >> (32 - count));
 }
 
-void git_commit_graph_free(git_commit_graph *cgraph)
+static uint32_t bloom_murmur3(
+		uint32_t seed,
+		const char *data,
+		size_t len,
+		uint32_t hash_version)
 {
-	if (!cgraph)
-		return;
+	const uint32_t c1 = 0xcc9e2d51, c2 = 0x1b873593;
+	const unsigned char *bytes = (const unsigned char *)data;
+	uint32_t h = seed, k;
+	size_t i;
 
-	git_str_dispose(&cgraph->filename);
-	git_commit_graph_file_free(cgraph->file);
-	git__free(cgraph);
+#define BLOOM_BYTE(b) (hash_version == 1 ? \
+	(uint32_t)(int32_t)(signed char)(b) : (uint32_t)(b))
+
+	for (i = 0; i + 4 <= len; i += 4) {
+		k = BLOOM_BYTE(bytes[i]) |
+		    (BLOOM_BYTE(bytes[i + 1]) << 8) |
+		    (BLOOM_BYTE(bytes[i + 2]) << 16) |
+		    (BLOOM_BYTE(bytes[i + 3]) << 24);
+
+		k *= c1;
+		k = bloom_rotl(k, 15);
+		k *= c2;
+
+		h ^= k;
+		h = bloom_rotl(h, 13);
+		h = h * 5 + 0xe6546b64;
+	}
+
+	k = 0;
+
+	switch (len & 3) {
+	case 3:
+		k ^= BLOOM_BYTE(bytes[i + 2]) << 16;
+		/* fall through */
+	case 2:
+		k ^= BLOOM_BYTE(bytes[i + 1]) << 8;
+		/* fall through */
+	case 1:
+		k ^= BLOOM_BYTE(bytes[i]);
+		k *= c1;
+		k = bloom_rotl(k, 15);
+		k *= c2;
+		h ^= k;
+	}
+
+#undef BLOOM_BYTE
+
+	h ^= (uint32_t)len;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h;
 }
 
-void git_commit_graph_file_free(git_commit_graph_file *file)
+static void bloom_hashes(
+		uint32_t *out,
+		const char *path,
+		size_t len,
+		uint32_t num_hashes,
+		uint32_t hash_version)
 {
-	if (!file)
-		return;
+	uint32_t h0 = bloom_murmur3(0x293ae76f, path, len, hash_version);
+	uint32_t h1 = bloom_murmur3(0x7e646e2c, path, len, hash_version);
+	uint32_t i;
 
-	git_commit_graph_file_close(file);
-	git__free(file);
+	for (i = 0; i < num_hashes; i++)
+		out[i] = h0 + i * h1;
 }
 
-static int packed_commit__cmp(const void *a_, const void *b_)
+GIT_INLINE(size_t) bloom_bit(uint32_t hash, size_t filter_len)
 {
-	const struct packed_commit *a = a_;
-	const struct packed_commit *b = b_;
-	return git_oid_cmp(&a->sha1, &b->sha1);
+	return (size_t)(hash % (uint64_t)(filter_len * 8));
 }
 
-int git_commit_graph_writer_new(
-	git_commit_graph_writer **out,
-	const char *objects_info_dir
-#ifdef GIT_EXPERIMENTAL_SHA256
-	, git_oid_t oid_type
-#endif
-	)
+int git_commit_graph_bloom_key_init(
+		git_commit_graph_bloom_key *key,
+		const git_commit_graph_file *file,
+		const char *path)
 {
-	git_commit_graph_writer *w;
+	size_t len = strlen(path), paths = 1, alloc_len, i;
+	const char *slash;
 
-#ifndef GIT_EXPERIMENTAL_SHA256
-	git_oid_t oid_type = GIT_OID_SHA1;
-#endif
+	GIT_ASSERT_ARG(key);
+	GIT_ASSERT_ARG(file);
+	GIT_ASSERT_ARG(path);
 
-	GIT_ASSERT_ARG(out && objects_info_dir && oid_type);
+	memset(key, 0, sizeof(*key));
 
-	w = git__calloc(1, sizeof(git_commit_graph_writer));
-	GIT_ERROR_CHECK_ALLOC(w);
+	if (!file->bloom_filter_index)
+		return GIT_ENOTFOUND;
 
-	w->oid_type = oid_type;
+	for (slash = path; (slash = strchr(slash, '/')) != NULL; slash++)
+		paths++;
 
-	if (git_str_sets(&w->objects_info_dir, objects_info_dir) < 0) {
-		git__free(w);
-		return -1;
-	}
+	GIT_ERROR_CHECK_ALLOC_MULTIPLY(&alloc_len, paths, file->bloom_num_hashes);
+	key->hashes = git__calloc(alloc_len, sizeof(uint32_t));
+	GIT_ERROR_CHECK_ALLOC(key->hashes);
 
-	if (git_vector_init(&w->commits, 0, packed_commit__cmp) < 0) {
-		git_str_dispose(&w->objects_info_dir);
-		git__free(w);
-		return -1;
-	}
+	key->paths = paths;
+	key->num_hashes = file->bloom_num_hashes;
+	key->hash_version = file->bloom_hash_version;
+
+	/* The path itself, then each of its leading directories. */
+	for (i = 0; i < paths; i++) {
+		bloom_hashes(&key->hashes[i * key->num_hashes], path, len,
+			key->num_hashes, file->bloom_hash_version);
+
+		while (len > 0 && path[len - 1] != '/')
+			len--;
+		if (len > 0)
+			len--;
+	}
+
+	return 0;
+}
+
+void git_commit_graph_bloom_key_dispose(git_commit_graph_bloom_key *key)
+{
+	if (!key)
+		return;
+
+	git__free(key->hashes);
+	memset(key, 0, sizeof(*key));
+}
+
+int git_commit_graph_bloom_maybe_changed(
+		const git_commit_graph_file *file,
+		const git_commit_graph_entry *entry,
+		const git_commit_graph_bloom_key *key)
+{
+	const unsigned char *filter;
+	size_t start = 0, end, filter_len, bit, pos, i, j;
+	uint32_t *hashes;
+
+	GIT_ASSERT_ARG(file);
+	GIT_ASSERT_ARG(entry);
+	GIT_ASSERT_ARG(key);
+
+	/*
+	 * The files of a commit-graph chain may have been written with
+	 * different settings, or without filters.
+	 */
+	if ((file = commit_graph_file_at(file, entry->graph_pos)) == NULL ||
+	    !file->bloom_filter_index || !key->hashes ||
+	    file->bloom_num_hashes != key->num_hashes ||
+	    file->bloom_hash_version != key->hash_version)
+		return GIT_ENOTFOUND;
+
+	pos = entry->graph_pos - file->num_commits_in_base;
+
+	end = ntohl(*((uint32_t *)(file->bloom_filter_index + pos * 4)));
+	if (pos > 0)
+		start = ntohl(*((uint32_t *)(file->bloom_filter_index + (pos - 1) * 4)));
+
+	/* An empty filter means that no filter was computed. */
+	if (end <= start || end > file->bloom_filter_data_len)
+		return GIT_ENOTFOUND;
+
+	filter = file->bloom_filter_data + start;
+	filter_len = end - start;
+
+	/* The path did not change if any of its prefixes did not. */
+	for (i = 0; i < key->paths; i++) {
+		hashes = &key->hashes[i * key->num_hashes];
+
+		for (j = 0; j < key->num_hashes; j++) {
+			bit = bloom_bit(hashes[j], filter_len);
+
+			if (!(filter[bit / 8] & (1 << (bit % 8))))
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+int git_commit_graph_file_close(git_commit_graph_file *file)
+{
+	GIT_ASSERT_ARG(file);
+
+	if (file->graph_map.data)
+		git_futils_mmap_free(&file->graph_map);
+
+	return 0;
+}
+
+void git_commit_graph_free(git_commit_graph *cgraph)
+{
+	if (!cgraph)
+		return;
+
+	git_str_dispose(&cgraph->filename);
+	git_str_dispose(&cgraph->chain_filename);
+	git_commit_graph_file_free(cgraph->file);
+	git__free(cgraph);
+}
+
+void git_commit_graph_file_free(git_commit_graph_file *file)
+{
+	git_commit_graph_file *base;
+
+	while (file) {
+		base = file->base;
+
+		git_commit_graph_file_close(file);
+		git__free(file);
+
+		file = base;
+	}
+}
+
+static int packed_commit__cmp(const void *a_, const void *b_)
+{
+	const struct packed_commit *a = a_;
+	const struct packed_commit *b = b_;
+	return git_oid_cmp(&a->sha1, &b->sha1);
+}
+
+int git_commit_graph_writer_new(
+	git_commit_graph_writer **out,
+	const char *objects_info_dir
+#ifdef GIT_EXPERIMENTAL_SHA256
+	, git_oid_t oid_type
+#endif
+	)
+{
+	git_commit_graph_writer *w;
+
+#ifndef GIT_EXPERIMENTAL_SHA256
+	git_oid_t oid_type = GIT_OID_SHA1;
+#endif
+
+	GIT_ASSERT_ARG(out && objects_info_dir && oid_type);
+
+	w = git__calloc(1, sizeof(git_commit_graph_writer));
+	GIT_ERROR_CHECK_ALLOC(w);
+
+	w->oid_type = oid_type;
+
+	if (git_str_sets(&w->objects_info_dir, objects_info_dir) < 0) {
+		git__free(w);
+		return -1;
+	}
+
+	if (git_vector_init(&w->commits, 0, packed_commit__cmp) < 0) {
+		git_str_dispose(&w->objects_info_dir);
+		git__free(w);
+		return -1;
+	}
 
 	*out = w;
 	return 0;
@@ -784,6 +1383,7 @@ int git_commit_graph_writer_add_index_file(
 	struct object_entry_cb_state state = {0};
 	state.repo = repo;
 	state.commits = &w->commits;
+	w->repo = repo;
 
 	error = git_repository_odb(&state.db, repo);
 	if (error < 0)
@@ -813,6 +1413,8 @@ int git_commit_graph_writer_add_revwalk(git_commit_graph_writer *w, git_revwalk
 	git_commit *commit;
 	struct packed_commit *packed_commit;
 
+	w->repo = repo;
+
 	while ((git_revwalk_next(&id, walk)) == 0) {
 		error = git_commit_lookup(&commit, repo, &id);
 		if (error < 0)
@@ -839,13 +1441,23 @@ enum generation_number_commit_state {
 	GENERATION_NUMBER_COMMIT_STATE_VISITED = 3
 };
 
-static int compute_generation_numbers(git_vector *commits)
+/*
+ * Compute the generation numbers of the commits, and the positions of their
+ * parents in the commit-graph. When the commits are written on top of a
+ * commit-graph chain, their parents may also be in the chain: the positions
+ * of the commits then start after those of the chain.
+ */
+static int compute_generation_numbers(
+		git_vector *commits,
+		const git_commit_graph_file *base)
 {
 	git_array_t(size_t) index_stack = GIT_ARRAY_INIT;
 	size_t i, j;
 	size_t *parent_idx;
+	size_t base_commits = base ? base->num_commits_in_base + base->num_commits : 0;
 	enum generation_number_commit_state *commit_states = NULL;
 	struct packed_commit *child_packed_commit;
+	git_commit_graph_entry base_entry;
 	git_oidmap *packed_commit_map = NULL;
 	int error = 0;
 
@@ -874,20 +1486,24 @@ static int compute_generation_numbers(git_vector *commits)
 			goto cleanup;
 		}
 		git_array_foreach (child_packed_commit->parents, parent_i, parent_id) {
+			parent_idx_ptr = git_array_alloc(child_packed_commit->parent_indices);
+			if (!parent_idx_ptr) {
+				error = -1;
+				goto cleanup;
+			}
 			parent_packed_commit = git_oidmap_get(packed_commit_map, parent_id);
-			if (!parent_packed_commit) {
+			if (parent_packed_commit) {
+				*parent_idx_ptr = base_commits + parent_packed_commit->index;
+			} else if (base && git_commit_graph_entry_find(&base_entry, base,
+					parent_id, git_oid_hexsize(base->oid_type)) == 0) {
+				*parent_idx_ptr = base_entry.graph_pos;
+			} else {
 				git_error_set(GIT_ERROR_ODB,
 					      "parent commit %s not found in commit graph",
 					      git_oid_tostr_s(parent_id));
 				error = GIT_ENOTFOUND;
 				goto cleanup;
 			}
-			parent_idx_ptr = git_array_alloc(child_packed_commit->parent_indices);
-			if (!parent_idx_ptr) {
-				error = -1;
-				goto cleanup;
-			}
-			*parent_idx_ptr = parent_packed_commit->index;
 		}
 	}
 
@@ -927,10 +1543,30 @@ static int compute_generation_numbers(git_vector *commits)
 		if (commit_states[i] == GENERATION_NUMBER_COMMIT_STATE_EXPANDED) {
 			/* All of the commits parents have been visited. */
 			child_packed_commit->generation = 0;
+			child_packed_commit->corrected_commit_date =
+				(uint64_t)child_packed_commit->commit_time;
 			git_array_foreach (child_packed_commit->parent_indices, j, parent_idx) {
-				struct packed_commit *parent = git_vector_get(commits, *parent_idx);
-				if (child_packed_commit->generation < parent->generation)
-					child_packed_commit->generation = parent->generation;
+				uint32_t generation;
+				uint64_t corrected_commit_date;
+
+				if (*parent_idx < base_commits) {
+					error = git_commit_graph_entry_get_byindex(
+							&base_entry, base, *parent_idx);
+					if (error < 0)
+						goto cleanup;
+					generation = (uint32_t)base_entry.generation;
+					corrected_commit_date = base_entry.corrected_commit_date;
+				} else {
+					struct packed_commit *parent = git_vector_get(
+							commits, *parent_idx - base_commits);
+					generation = parent->generation;
+					corrected_commit_date = parent->corrected_commit_date;
+				}
+
+				if (child_packed_commit->generation < generation)
+					child_packed_commit->generation = generation;
+				if (child_packed_commit->corrected_commit_date <= corrected_commit_date)
+					child_packed_commit->corrected_commit_date = corrected_commit_date + 1;
 			}
 			if (child_packed_commit->generation
 			    < GIT_COMMIT_GRAPH_GENERATION_NUMBER_MAX) {
@@ -953,6 +1589,8 @@ static int compute_generation_numbers(git_vector *commits)
 			 */
 			commit_states[i] = GENERATION_NUMBER_COMMIT_STATE_VISITED;
 			child_packed_commit->generation = 1;
+			child_packed_commit->corrected_commit_date =
+				(uint64_t)child_packed_commit->commit_time;
 			continue;
 		}
 
@@ -962,14 +1600,22 @@ static int compute_generation_numbers(git_vector *commits)
 		 */
 		*(size_t *)git_array_alloc(index_stack) = i;
 		git_array_foreach (child_packed_commit->parent_indices, j, parent_idx) {
-			if (commit_states[*parent_idx]
+			size_t parent_i;
+
+			/* The commits of the base chain are already visited. */
+			if (*parent_idx < base_commits)
+				continue;
+
+			parent_i = *parent_idx - base_commits;
+
+			if (commit_states[parent_i]
 			    != GENERATION_NUMBER_COMMIT_STATE_UNVISITED) {
 				/* This commit has already been considered. */
 				continue;
 			}
 
-			commit_states[*parent_idx] = GENERATION_NUMBER_COMMIT_STATE_ADDED;
-			*(size_t *)git_array_alloc(index_stack) = *parent_idx;
+			commit_states[parent_i] = GENERATION_NUMBER_COMMIT_STATE_ADDED;
+			*(size_t *)git_array_alloc(index_stack) = parent_i;
 		}
 		commit_states[i] = GENERATION_NUMBER_COMMIT_STATE_EXPANDED;
 	}
@@ -1041,8 +1687,279 @@ static void packed_commit_free_dup(void *packed_commit)
 	packed_commit_free(packed_commit);
 }
 
+typedef git_array_t(uint32_t) bloom_hash_array_t;
+
+/* The paths that a commit changes, as they are gathered for its filter. */
+struct bloom_changes {
+	git_repository *repo;
+	git_str path;
+	bloom_hash_array_t hashes;
+	size_t paths;
+};
+
+static int bloom_add_path(struct bloom_changes *c)
+{
+	uint32_t hashes[COMMIT_GRAPH_BLOOM_NUM_HASHES], *out;
+	size_t i;
+
+	if (git_str_oom(&c->path))
+		return -1;
+
+	bloom_hashes(hashes, c->path.ptr, c->path.size,
+		COMMIT_GRAPH_BLOOM_NUM_HASHES, COMMIT_GRAPH_BLOOM_HASH_VERSION);
+
+	for (i = 0; i < COMMIT_GRAPH_BLOOM_NUM_HASHES; i++) {
+		out = git_array_alloc(c->hashes);
+		GIT_ERROR_CHECK_ALLOC(out);
+		*out = hashes[i];
+	}
+
+	c->paths++;
+	return 0;
+}
+
+GIT_INLINE(bool) bloom_too_many_paths(struct bloom_changes *c)
+{
+	return c->paths > COMMIT_GRAPH_BLOOM_MAX_CHANGED_PATHS;
+}
+
+static void bloom_set_path(struct bloom_changes *c, size_t prefix_len, const char *name)
+{
+	git_str_truncate(&c->path, prefix_len);
+
+	if (prefix_len)
+		git_str_putc(&c->path, '/');
+
+	git_str_puts(&c->path, name);
+}
+
+/* Add every path within a tree, which was added or removed as a whole. */
+static int bloom_add_tree(struct bloom_changes *c, const git_oid *tree_id)
+{
+	git_tree *tree;
+	const git_tree_entry *entry;
+	size_t prefix_len = c->path.size, i;
+	int error;
+
+	if ((error = git_tree_lookup(&tree, c->repo, tree_id)) < 0)
+		return error;
+
+	for (i = 0; i < git_tree_entrycount(tree) && !bloom_too_many_paths(c); i++) {
+		entry = git_tree_entry_byindex(tree, i);
+		bloom_set_path(c, prefix_len, git_tree_entry_name(entry));
+
+		if ((error = bloom_add_path(c)) < 0)
+			break;
+
+		if (git_tree_entry_type(entry) == GIT_OBJECT_TREE &&
+		    (error = bloom_add_tree(c, git_tree_entry_id(entry))) < 0)
+			break;
+	}
+
+	git_str_truncate(&c->path, prefix_len);
+	git_tree_free(tree);
+	return error;
+}
+
+/*
+ * Add the paths that differ between two trees, along with their leading
+ * directories, like a recursive diff of the trees does.
+ */
+static int bloom_diff_trees(
+		struct bloom_changes *c,
+		const git_oid *old_id,
+		const git_oid *new_id)
+{
+	git_tree *old_tree = NULL, *new_tree = NULL;
+	const git_tree_entry *old_entry, *new_entry;
+	size_t prefix_len = c->path.size, i;
+	bool old_is_tree, new_is_tree;
+	int error = 0;
+
+	if ((old_id && (error = git_tree_lookup(&old_tree, c->repo, old_id)) < 0) ||
+	    (error = git_tree_lookup(&new_tree, c->repo, new_id)) < 0)
+		goto done;
+
+	for (i = 0; i < git_tree_entrycount(new_tree) && !bloom_too_many_paths(c); i++) {
+		new_entry = git_tree_entry_byindex(new_tree, i);
+		old_entry = old_tree ? git_tree_entry_byname(old_tree, git_tree_entry_name(new_entry)) : NULL;
+
+		if (old_entry &&
+		    git_oid_equal(git_tree_entry_id(old_entry), git_tree_entry_id(new_entry)) &&
+		    git_tree_entry_filemode_raw(old_entry) == git_tree_entry_filemode_raw(new_entry))
+			continue;
+
+		old_is_tree = old_entry && git_tree_entry_type(old_entry) == GIT_OBJECT_TREE;
+		new_is_tree = git_tree_entry_type(new_entry) == GIT_OBJECT_TREE;
+
+		bloom_set_path(c, prefix_len, git_tree_entry_name(new_entry));
+
+		if ((error = bloom_add_path(c)) < 0)
+			goto done;
+
+		if (old_is_tree && new_is_tree)
+			error = bloom_diff_trees(c, git_tree_entry_id(old_entry), git_tree_entry_id(new_entry));
+		else if (old_is_tree)
+			error = bloom_add_tree(c, git_tree_entry_id(old_entry));
+		else if (new_is_tree)
+			error = bloom_add_tree(c, git_tree_entry_id(new_entry));
+
+		if (error < 0)
+			goto done;
+	}
+
+	for (i = 0; old_tree && i < git_tree_entrycount(old_tree) && !bloom_too_many_paths(c); i++) {
+		old_entry = git_tree_entry_byindex(old_tree, i);
+
+		if (git_tree_entry_byname(new_tree, git_tree_entry_name(old_entry)))
+			continue;
+
+		bloom_set_path(c, prefix_len, git_tree_entry_name(old_entry));
+
+		if ((error = bloom_add_path(c)) < 0 ||
+		    (git_tree_entry_type(old_entry) == GIT_OBJECT_TREE &&
+		     (error = bloom_add_tree(c, git_tree_entry_id(old_entry))) < 0))
+			goto done;
+	}
+
+done:
+	git_str_truncate(&c->path, prefix_len);
+	git_tree_free(old_tree);
+	git_tree_free(new_tree);
+	return error;
+}
+
+/* Append the changed-path Bloom filter of a commit to `filters`. */
+static int bloom_filter_write(
+		git_str *filters,
+		git_repository *repo,
+		struct packed_commit *packed_commit)
+{
+	struct bloom_changes c = { 0 };
+	const git_oid *parent_tree = NULL;
+	git_commit *parent = NULL;
+	size_t filter_len, i, bit;
+	unsigned char *filter;
+	int error;
+
+	c.repo = repo;
+
+	if (git_array_size(packed_commit->parents) > 0) {
+		if ((error = git_commit_lookup(&parent, repo,
+				git_array_get(packed_commit->parents, 0))) < 0)
+			goto done;
+
+		parent_tree = git_commit_tree_id(parent);
+	}
+
+	if ((error = bloom_diff_trees(&c, parent_tree, &packed_commit->tree_oid)) < 0)
+		goto done;
+
+	/* Too many changes: the filter matches every path. */
+	if (bloom_too_many_paths(&c)) {
+		error = git_str_putc(filters, (char)0xff);
+		goto done;
+	}
+
+	filter_len = (c.paths * COMMIT_GRAPH_BLOOM_BITS_PER_ENTRY + 7) / 8;
+	if (!filter_len)
+		filter_len = 1;
+
+	if ((error = git_str_putcn(filters, 0, filter_len)) < 0)
+		goto done;
+
+	filter = (unsigned char *)filters->ptr + filters->size - filter_len;
+
+	for (i = 0; i < git_array_size(c.hashes); i++) {
+		bit = bloom_bit(c.hashes.ptr[i], filter_len);
+		filter[bit / 8] |= (unsigned char)(1 << (bit % 8));
+	}
+
+done:
+	git_commit_free(parent);
+	git_array_clear(c.hashes);
+	git_str_dispose(&c.path);
+	return error;
+}
+
+static int write_u32(git_str *out, uint32_t value)
+{
+	uint32_t word = htonl(value);
+	return git_str_put(out, (const char *)&word, sizeof(word));
+}
+
+static int bloom_filters_write(
+		git_str *bloom_index,
+		git_str *bloom_data,
+		git_commit_graph_writer *w)
+{
+	struct packed_commit *packed_commit;
+	size_t i, filters_start;
+	int error;
+
+	if (!w->repo) {
+		git_error_set(GIT_ERROR_INVALID, "changed-path filters need the commits' repository");
+		return -1;
+	}
+
+	if ((error = write_u32(bloom_data, COMMIT_GRAPH_BLOOM_HASH_VERSION)) < 0 ||
+	    (error = write_u32(bloom_data, COMMIT_GRAPH_BLOOM_NUM_HASHES)) < 0 ||
+	    (error = write_u32(bloom_data, COMMIT_GRAPH_BLOOM_BITS_PER_ENTRY)) < 0)
+		return error;
+
+	filters_start = bloom_data->size;
+
+	git_vector_foreach (&w->commits, i, packed_commit) {
+		if ((error = bloom_filter_write(bloom_data, w->repo, packed_commit)) < 0)
+			return error;
+
+		if (bloom_data->size - filters_start > UINT32_MAX) {
+			git_error_set(GIT_ERROR_INVALID, "changed-path filters are too large");
+			return -1;
+		}
+
+		if ((error = write_u32(bloom_index, (uint32_t)(bloom_data->size - filters_start))) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+/* The checksums of the files of a commit-graph chain, oldest first. */
+static int base_graphs_write(git_str *out, const git_commit_graph_file *base)
+{
+	const git_commit_graph_file *file;
+	size_t oid_size, count = 0, len;
+
+	if (!base)
+		return 0;
+
+	oid_size = git_oid_size(base->oid_type);
+
+	for (file = base; file; file = file->base)
+		count++;
+
+	if (count > UINT8_MAX) {
+		git_error_set(GIT_ERROR_ODB, "commit-graph chain is too long");
+		return -1;
+	}
+
+	GIT_ERROR_CHECK_ALLOC_MULTIPLY(&len, count, oid_size);
+
+	if (git_str_grow(out, len) < 0)
+		return -1;
+
+	for (file = base; file; file = file->base)
+		memcpy(out->ptr + --count * oid_size, file->checksum, oid_size);
+
+	out->size = len;
+	return 0;
+}
+
 static int commit_graph_write(
 		git_commit_graph_writer *w,
+		git_commit_graph_writer_options *opts,
+		const git_commit_graph_file *base,
 		commit_graph_write_cb write_cb,
 		void *cb_data)
 {
@@ -1055,7 +1972,9 @@ static int commit_graph_write(
 	uint32_t oid_fanout[256];
 	off64_t offset;
 	git_str oid_lookup = GIT_STR_INIT, commit_data = GIT_STR_INIT,
-		extra_edge_list = GIT_STR_INIT;
+		extra_edge_list = GIT_STR_INIT, bloom_index = GIT_STR_INIT,
+		bloom_data = GIT_STR_INIT, base_graphs = GIT_STR_INIT,
+		generation_data = GIT_STR_INIT, generation_data_overflow = GIT_STR_INIT;
 	unsigned char checksum[GIT_HASH_MAX_SIZE];
 	git_hash_algorithm_t checksum_type;
 	size_t checksum_size, oid_size;
@@ -1084,9 +2003,15 @@ static int commit_graph_write(
 	/* Sort the commits. */
 	git_vector_sort(&w->commits);
 	git_vector_uniq(&w->commits, packed_commit_free_dup);
-	error = compute_generation_numbers(&w->commits);
+	error = compute_generation_numbers(&w->commits, base);
+	if (error < 0)
+		goto cleanup;
+
+	/* Fill the Base Graphs List. */
+	error = base_graphs_write(&base_graphs, base);
 	if (error < 0)
 		goto cleanup;
+	hdr.base_graph_files = (uint8_t)(git_str_len(&base_graphs) / oid_size);
 
 	/* Fill the OID Fanout table. */
 	oid_fanout_count = 0;
@@ -1176,10 +2101,54 @@ static int commit_graph_write(
 			goto cleanup;
 	}
 
+	/*
+	 * Fill the Generation Data and Generation Data Overflow tables. The
+	 * corrected commit dates of a chain are only used when every file
+	 * has them, so they are pointless on top of files without them.
+	 */
+	if ((!opts || opts->generation_version != 1) &&
+	    (!base || base->read_generation_data)) {
+		git_vector_foreach (&w->commits, i, packed_commit) {
+			uint64_t offset = packed_commit->corrected_commit_date -
+				(uint64_t)packed_commit->commit_time;
+			uint32_t word;
+
+			if (offset > COMMIT_GRAPH_GENERATION_DATA_MAX_OFFSET) {
+				word = htonl(COMMIT_GRAPH_GENERATION_DATA_OVERFLOW |
+					(uint32_t)(git_str_len(&generation_data_overflow) / 8));
+				error = write_offset(offset, commit_graph_write_buf,
+					&generation_data_overflow);
+				if (error < 0)
+					goto cleanup;
+			} else {
+				word = htonl((uint32_t)offset);
+			}
+
+			error = git_str_put(&generation_data, (const char *)&word, sizeof(word));
+			if (error < 0)
+				goto cleanup;
+		}
+	}
+
+	/* Compute the changed-path Bloom filters. */
+	if (opts && opts->changed_paths) {
+		error = bloom_filters_write(&bloom_index, &bloom_data, w);
+		if (error < 0)
+			goto cleanup;
+	}
+
 	/* Write the header. */
 	hdr.chunks = 3;
+	if (git_str_len(&generation_data) > 0)
+		hdr.chunks++;
+	if (git_str_len(&generation_data_overflow) > 0)
+		hdr.chunks++;
 	if (git_str_len(&extra_edge_list) > 0)
 		hdr.chunks++;
+	if (git_str_len(&bloom_data) > 0)
+		hdr.chunks += 2;
+	if (git_str_len(&base_graphs) > 0)
+		hdr.chunks++;
 	error = write_cb((const char *)&hdr, sizeof(hdr), cb_data);
 	if (error < 0)
 		goto cleanup;
@@ -1198,6 +2167,20 @@ static int commit_graph_write(
 	if (error < 0)
 		goto cleanup;
 	offset += git_str_len(&commit_data);
+	if (git_str_len(&generation_data) > 0) {
+		error = write_chunk_header(
+				COMMIT_GRAPH_GENERATION_DATA_ID, offset, write_cb, cb_data);
+		if (error < 0)
+			goto cleanup;
+		offset += git_str_len(&generation_data);
+	}
+	if (git_str_len(&generation_data_overflow) > 0) {
+		error = write_chunk_header(
+				COMMIT_GRAPH_GENERATION_DATA_OVERFLOW_ID, offset, write_cb, cb_data);
+		if (error < 0)
+			goto cleanup;
+		offset += git_str_len(&generation_data_overflow);
+	}
 	if (git_str_len(&extra_edge_list) > 0) {
 		error = write_chunk_header(
 				COMMIT_GRAPH_EXTRA_EDGE_LIST_ID, offset, write_cb, cb_data);
@@ -1205,6 +2188,25 @@ static int commit_graph_write(
 			goto cleanup;
 		offset += git_str_len(&extra_edge_list);
 	}
+	if (git_str_len(&bloom_data) > 0) {
+		error = write_chunk_header(
+				COMMIT_GRAPH_BLOOM_FILTER_INDEX_ID, offset, write_cb, cb_data);
+		if (error < 0)
+			goto cleanup;
+		offset += git_str_len(&bloom_index);
+		error = write_chunk_header(
+				COMMIT_GRAPH_BLOOM_FILTER_DATA_ID, offset, write_cb, cb_data);
+		if (error < 0)
+			goto cleanup;
+		offset += git_str_len(&bloom_data);
+	}
+	if (git_str_len(&base_graphs) > 0) {
+		error = write_chunk_header(
+				COMMIT_GRAPH_BASE_GRAPHS_LIST_ID, offset, write_cb, cb_data);
+		if (error < 0)
+			goto cleanup;
+		offset += git_str_len(&base_graphs);
+	}
 	error = write_chunk_header(0, offset, write_cb, cb_data);
 	if (error < 0)
 		goto cleanup;
@@ -1217,9 +2219,25 @@ static int commit_graph_write(
 	if (error < 0)
 		goto cleanup;
 	error = write_cb(git_str_cstr(&commit_data), git_str_len(&commit_data), cb_data);
+	if (error < 0)
+		goto cleanup;
+	error = write_cb(git_str_cstr(&generation_data), git_str_len(&generation_data), cb_data);
+	if (error < 0)
+		goto cleanup;
+	error = write_cb(git_str_cstr(&generation_data_overflow),
+			git_str_len(&generation_data_overflow), cb_data);
 	if (error < 0)
 		goto cleanup;
 	error = write_cb(git_str_cstr(&extra_edge_list), git_str_len(&extra_edge_list), cb_data);
+	if (error < 0)
+		goto cleanup;
+	error = write_cb(git_str_cstr(&bloom_index), git_str_len(&bloom_index), cb_data);
+	if (error < 0)
+		goto cleanup;
+	error = write_cb(git_str_cstr(&bloom_data), git_str_len(&bloom_data), cb_data);
+	if (error < 0)
+		goto cleanup;
+	error = write_cb(git_str_cstr(&base_graphs), git_str_len(&base_graphs), cb_data);
 	if (error < 0)
 		goto cleanup;
 
@@ -1235,6 +2253,11 @@ cleanup:
 	git_str_dispose(&oid_lookup);
 	git_str_dispose(&commit_data);
 	git_str_dispose(&extra_edge_list);
+	git_str_dispose(&bloom_index);
+	git_str_dispose(&bloom_data);
+	git_str_dispose(&base_graphs);
+	git_str_dispose(&generation_data);
+	git_str_dispose(&generation_data_overflow);
 	git_hash_ctx_cleanup(&ctx);
 	return error;
 }
@@ -1257,6 +2280,263 @@ int git_commit_graph_writer_options_init(
 	return 0;
 }
 
+static int commit_graph_write_file(
+		const char *path,
+		const char *data,
+		size_t len)
+{
+	int error, filebuf_flags = GIT_FILEBUF_DO_NOT_BUFFER;
+	git_filebuf output = GIT_FILEBUF_INIT;
+
+	if (git_repository__fsync_gitdir)
+		filebuf_flags |= GIT_FILEBUF_FSYNC;
+
+	if ((error = git_filebuf_open(&output, path, filebuf_flags, 0644)) < 0)
+		return error;
+
+	if ((error = git_filebuf_write(&output, data, len)) < 0) {
+		git_filebuf_cleanup(&output);
+		return error;
+	}
+
+	return git_filebuf_commit(&output);
+}
+
+static int commit_graph_file_path(
+		git_str *out,
+		const char *graphs_dir,
+		const git_commit_graph_file *file)
+{
+	char checksum[GIT_HASH_MAX_SIZE * 2 + 1];
+
+	git_hash_fmt(checksum, (unsigned char *)file->checksum, git_oid_size(file->oid_type));
+
+	git_str_clear(out);
+	return git_str_printf(out, "%s/graph-%s.graph", graphs_dir, checksum);
+}
+
+static int packed_commit_from_graph(
+		struct packed_commit **out,
+		const git_commit_graph_file *file,
+		const git_commit_graph_entry *entry)
+{
+	struct packed_commit *p;
+	git_commit_graph_entry parent;
+	git_oid *parent_id;
+	size_t i;
+
+	p = git__calloc(1, sizeof(struct packed_commit));
+	GIT_ERROR_CHECK_ALLOC(p);
+
+	git_oid_cpy(&p->sha1, &entry->sha1);
+	git_oid_cpy(&p->tree_oid, &entry->tree_oid);
+	p->commit_time = entry->commit_time;
+
+	for (i = 0; i < entry->parent_count; i++) {
+		if (git_commit_graph_entry_parent(&parent, file, entry, i) < 0 ||
+		    (parent_id = git_array_alloc(p->parents)) == NULL) {
+			packed_commit_free(p);
+			return -1;
+		}
+
+		git_oid_cpy(parent_id, &parent.sha1);
+	}
+
+	*out = p;
+	return 0;
+}
+
+static int packed_commit_in_graph(const git_vector *v, size_t idx, void *payload)
+{
+	struct packed_commit *packed_commit = git_vector_get(v, idx);
+	const git_commit_graph_file *file = payload;
+	git_commit_graph_entry entry;
+
+	if (git_commit_graph_entry_find(&entry, file, &packed_commit->sha1,
+			git_oid_hexsize(file->oid_type)) < 0) {
+		git_error_clear();
+		return 0;
+	}
+
+	packed_commit_free(packed_commit);
+	return 1;
+}
+
+/*
+ * Add the commits of the newest file of a commit-graph chain to the writer,
+ * so that the file can be merged into the one being written.
+ */
+static int commit_graph_merge_file(
+		git_commit_graph_writer *w,
+		const git_commit_graph_file *chain,
+		const git_commit_graph_file *file)
+{
+	struct packed_commit *packed_commit;
+	git_commit_graph_entry entry;
+	size_t i;
+	int error;
+
+	for (i = 0; i < file->num_commits; i++) {
+		if ((error = git_commit_graph_entry_get_byindex(&entry, chain,
+				file->num_commits_in_base + i)) < 0 ||
+		    (error = packed_commit_from_graph(&packed_commit, chain, &entry)) < 0)
+			return error;
+
+		if ((error = git_vector_insert(&w->commits, packed_commit)) < 0) {
+			packed_commit_free(packed_commit);
+			return error;
+		}
+	}
+
+	return 0;
+}
+
+static int commit_graph_write_split(
+		git_commit_graph_writer *w,
+		git_commit_graph_writer_options *opts)
+{
+	git_commit_graph_file *chain = NULL, *base;
+	git_str single_path = GIT_STR_INIT, graphs_dir = GIT_STR_INIT,
+		chain_path = GIT_STR_INIT, path = GIT_STR_INIT,
+		contents = GIT_STR_INIT, chain_contents = GIT_STR_INIT;
+	git_vector expired = GIT_VECTOR_INIT;
+	char checksum[GIT_HASH_MAX_SIZE * 2 + 1];
+	float size_multiple = opts->size_multiple > 0 ? opts->size_multiple : 2.0f;
+	size_t max_commits = opts->max_commits ? opts->max_commits : 64000;
+	size_t oid_size = git_oid_size(w->oid_type), num_commits, i;
+	bool single_file = false;
+	char *expired_path;
+	int error;
+
+	if ((error = git_str_joinpath(&single_path, w->objects_info_dir.ptr, "commit-graph")) < 0 ||
+	    (error = git_str_joinpath(&graphs_dir, w->objects_info_dir.ptr, "commit-graphs")) < 0 ||
+	    (error = git_str_joinpath(&chain_path, graphs_dir.ptr, "commit-graph-chain")) < 0)
+		goto done;
+
+	/*
+	 * Build upon the current commit-graph. A single commit-graph file
+	 * becomes the first file of the chain.
+	 */
+	if ((error = git_commit_graph_file_open(&chain, single_path.ptr, w->oid_type)) == 0) {
+		single_file = true;
+	} else if (error == GIT_ENOTFOUND) {
+		git_error_clear();
+		error = git_commit_graph_chain_open(&chain, chain_path.ptr, w->oid_type);
+	}
+
+	if (error == GIT_ENOTFOUND) {
+		git_error_clear();
+		error = 0;
+	} else if (error < 0) {
+		goto done;
+	}
+
+	/* Only the commits that are not in the commit-graph yet are written. */
+	if (chain)
+		git_vector_remove_matching(&w->commits, packed_commit_in_graph, chain);
+
+	num_commits = git_vector_length(&w->commits);
+
+	if (!num_commits && opts->split_strategy != GIT_COMMIT_GRAPH_SPLIT_STRATEGY_REPLACE)
+		goto done;
+
+	/*
+	 * Keep the chain short by merging the newest files into the new one
+	 * while they are not much larger than it.
+	 */
+	for (base = chain; base; base = base->base) {
+		if (opts->split_strategy == GIT_COMMIT_GRAPH_SPLIT_STRATEGY_NO_MERGE ||
+		    (opts->split_strategy == GIT_COMMIT_GRAPH_SPLIT_STRATEGY_MERGE_BY_SIZE &&
+		     base->num_commits > size_multiple * num_commits &&
+		     num_commits <= max_commits))
+			break;
+
+		if ((error = commit_graph_merge_file(w, chain, base)) < 0)
+			goto done;
+
+		if (single_file)
+			expired_path = git__strdup(single_path.ptr);
+		else if ((error = commit_graph_file_path(&path, graphs_dir.ptr, base)) == 0)
+			expired_path = git_str_detach(&path);
+		else
+			goto done;
+
+		if (!expired_path || (error = git_vector_insert(&expired, expired_path)) < 0) {
+			error = -1;
+			git__free(expired_path);
+			goto done;
+		}
+
+		num_commits += base->num_commits;
+	}
+
+	if ((error = commit_graph_write(w, opts, base, commit_graph_write_buf, &contents)) < 0 ||
+	    (error = git_futils_mkdir(graphs_dir.ptr, 0777, GIT_MKDIR_PATH)) < 0)
+		goto done;
+
+	git_hash_fmt(checksum, (unsigned char *)contents.ptr + contents.size - oid_size, oid_size);
+
+	git_str_clear(&path);
+	if ((error = git_str_printf(&path, "%s/graph-%s.graph", graphs_dir.ptr, checksum)) < 0 ||
+	    (error = commit_graph_write_file(path.ptr, contents.ptr, contents.size)) < 0)
+		goto done;
+
+	/* The chain file lists the files of the chain, oldest first. */
+	git_str_clear(&contents);
+	if ((error = base_graphs_write(&contents, base)) < 0)
+		goto done;
+
+	for (i = 0; i < git_str_len(&contents) / oid_size; i++) {
+		char base_checksum[GIT_HASH_MAX_SIZE * 2 + 1];
+
+		git_hash_fmt(base_checksum, (unsigned char *)contents.ptr + i * oid_size, oid_size);
+
+		if ((error = git_str_printf(&chain_contents, "%s\n", base_checksum)) < 0)
+			goto done;
+	}
+
+	if ((error = git_str_printf(&chain_contents, "%s\n", checksum)) < 0)
+		goto done;
+
+	/* Move a single commit-graph file that was kept into the chain. */
+	if (single_file && base) {
+		if ((error = commit_graph_file_path(&path, graphs_dir.ptr, base)) < 0)
+			goto done;
+
+		git_commit_graph_file_free(chain);
+		chain = NULL;
+
+		if ((error = p_rename(single_path.ptr, path.ptr)) < 0) {
+			git_error_set(GIT_ERROR_OS, "failed to move commit-graph file to '%s'", path.ptr);
+			goto done;
+		}
+	}
+
+	if ((error = commit_graph_write_file(chain_path.ptr,
+			chain_contents.ptr, chain_contents.size)) < 0)
+		goto done;
+
+	/* The files that were merged are not needed anymore. */
+	git_commit_graph_file_free(chain);
+	chain = NULL;
+
+	git_vector_foreach (&expired, i, expired_path)
+		p_unlink(expired_path);
+
+done:
+	git_vector_foreach (&expired, i, expired_path)
+		git__free(expired_path);
+	git_vector_free(&expired);
+	git_commit_graph_file_free(chain);
+	git_str_dispose(&single_path);
+	git_str_dispose(&graphs_dir);
+	git_str_dispose(&chain_path);
+	git_str_dispose(&path);
+	git_str_dispose(&contents);
+	git_str_dispose(&chain_contents);
+	return error;
+}
+
 int git_commit_graph_writer_commit(
 		git_commit_graph_writer *w,
 		git_commit_graph_writer_options *opts)
@@ -1266,8 +2546,8 @@ int git_commit_graph_writer_commit(
 	git_str commit_graph_path = GIT_STR_INIT;
 	git_filebuf output = GIT_FILEBUF_INIT;
 
-	/* TODO: support options and fill in defaults. */
-	GIT_UNUSED(opts);
+	if (opts && opts->split_strategy != GIT_COMMIT_GRAPH_SPLIT_STRATEGY_SINGLE_FILE)
+		return commit_graph_write_split(w, opts);
 
 	error = git_str_joinpath(
 			&commit_graph_path, git_str_cstr(&w->objects_info_dir), "commit-graph");
@@ -1277,17 +2557,26 @@ int git_commit_graph_writer_commit(
 	if (git_repository__fsync_gitdir)
 		filebuf_flags |= GIT_FILEBUF_FSYNC;
 	error = git_filebuf_open(&output, git_str_cstr(&commit_graph_path), filebuf_flags, 0644);
-	git_str_dispose(&commit_graph_path);
 	if (error < 0)
-		return error;
+		goto done;
 
-	error = commit_graph_write(w, commit_graph_write_filebuf, &output);
+	error = commit_graph_write(w, opts, NULL, commit_graph_write_filebuf, &output);
 	if (error < 0) {
 		git_filebuf_cleanup(&output);
-		return error;
+		goto done;
 	}
 
-	return git_filebuf_commit(&output);
+	if ((error = git_filebuf_commit(&output)) < 0)
+		goto done;
+
+	/* The single file supersedes any commit-graph chain. */
+	git_str_joinpath(&commit_graph_path, git_str_cstr(&w->objects_info_dir), "commit-graphs");
+	if (git_fs_path_isdir(git_str_cstr(&commit_graph_path)))
+		git_futils_rmdir_r(git_str_cstr(&commit_graph_path), NULL, GIT_RMDIR_REMOVE_FILES);
+
+done:
+	git_str_dispose(&commit_graph_path);
+	return error;
 }
 
 int git_commit_graph_writer_dump(
@@ -1303,7 +2592,5 @@ int git_commit_graph__writer_dump(
 	git_commit_graph_writer *w,
 	git_commit_graph_writer_options *opts)
 {
-	/* TODO: support options. */
-	GIT_UNUSED(opts);
-	return commit_graph_write(w, commit_graph_write_buf, cgraph);
+	return commit_graph_write(w, opts, NULL, commit_graph_write_buf, cgraph);
 }
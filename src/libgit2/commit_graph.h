@@ -59,6 +59,61 @@ typedef struct git_commit_graph_file {
 	/* The number of entries in the Extra Edge List table. Each entry is 4 bytes wide. */
 	size_t num_extra_edge_list;
 
+	/*
+	 * The Generation Data table. Each 4-byte entry is the network byte order
+	 * offset of the corrected commit date of the i-th commit in the
+	 * `commit_data` table from its commit time. When the most significant bit
+	 * is set, the other bits are the index of the offset in the Generation
+	 * Data Overflow table.
+	 */
+	const unsigned char *generation_data;
+
+	/* The Generation Data Overflow table, of 8-byte offsets. */
+	const unsigned char *generation_data_overflow;
+	/* The number of entries in the Generation Data Overflow table. */
+	size_t num_generation_data_overflow;
+
+	/*
+	 * Whether the corrected commit dates can be used: they need to be in
+	 * this file and in all of its base files.
+	 */
+	bool read_generation_data;
+
+	/*
+	 * The Bloom Filter Index table. Each 4-byte entry is the network byte
+	 * order offset, within the Bloom filters, of the end of the filter of
+	 * the i-th commit in the `commit_data` table.
+	 */
+	const unsigned char *bloom_filter_index;
+
+	/* The changed-path Bloom filters, following the Bloom Filter Data header. */
+	const unsigned char *bloom_filter_data;
+	size_t bloom_filter_data_len;
+
+	/* The settings the Bloom filters were computed with. */
+	uint32_t bloom_hash_version;
+	uint32_t bloom_num_hashes;
+	uint32_t bloom_bits_per_entry;
+
+	/*
+	 * The Base Graphs List. The checksums of the commit-graph files of a
+	 * commit-graph chain that this file builds upon, oldest first.
+	 */
+	const unsigned char *base_graphs;
+	/* The number of entries in the Base Graphs List. */
+	uint32_t num_base_graphs;
+
+	/*
+	 * The commit-graph file that this one builds upon when it is part of a
+	 * commit-graph chain, or NULL. This file owns its base.
+	 */
+	struct git_commit_graph_file *base;
+	/*
+	 * The number of commits in all of the base files. The positions of the
+	 * commits of this file within the whole chain start at this number.
+	 */
+	size_t num_commits_in_base;
+
 	/* The trailer of the file. Contains the SHA1-checksum of the whole file. */
 	unsigned char checksum[GIT_HASH_SHA1_SIZE];
 } git_commit_graph_file;
@@ -71,6 +126,13 @@ typedef struct git_commit_graph_entry {
 	/* The generation number of the commit within the graph */
 	size_t generation;
 
+	/*
+	 * The corrected commit date of the commit: its commit time, or one more
+	 * than the corrected commit date of its parents if that is later. Zero
+	 * when the commit-graph has no corrected commit dates.
+	 */
+	uint64_t corrected_commit_date;
+
 	/* Time in seconds from UNIX epoch. */
 	git_time_t commit_time;
 
@@ -92,13 +154,37 @@ typedef struct git_commit_graph_entry {
 
 	/* The object ID hash of the requested commit. */
 	git_oid sha1;
+
+	/*
+	 * The position of the commit within the commit-graph file, or within
+	 * the whole chain of files when the file is part of one.
+	 */
+	size_t graph_pos;
 } git_commit_graph_entry;
 
+/**
+ * A path to look up in changed-path Bloom filters: the Bloom filter
+ * hashes of the path and of each of its leading directories.
+ */
+typedef struct git_commit_graph_bloom_key {
+	uint32_t *hashes;
+	size_t paths;
+	uint32_t num_hashes;
+	uint32_t hash_version;
+} git_commit_graph_bloom_key;
+
 /* A wrapper for git_commit_graph_file to enable lazy loading in the ODB. */
 struct git_commit_graph {
 	/* The path to the commit-graph file. Something like ".git/objects/info/commit-graph". */
 	git_str filename;
 
+	/*
+	 * The path to the commit-graph chain file, used when there is no
+	 * single commit-graph file. Something like
+	 * ".git/objects/info/commit-graphs/commit-graph-chain".
+	 */
+	git_str chain_filename;
+
 	/* The underlying commit-graph file. */
 	git_commit_graph_file *file;
 
@@ -107,6 +193,9 @@ struct git_commit_graph {
 
 	/* Whether the commit-graph file was already checked for validity. */
 	bool checked;
+
+	/* Whether the commit-graph was read from the commit-graph chain. */
+	bool chained;
 };
 
 /** Create a new commit-graph, optionally opening the underlying file. */
@@ -125,6 +214,16 @@ int git_commit_graph_file_open(
 	const char *path,
 	git_oid_t oid_type);
 
+/*
+ * Open all of the commit-graph files listed in a commit-graph chain
+ * file. The returned file is the newest one, and the older ones can be
+ * reached through its `base`. Returns GIT_ENOTFOUND if there is no chain.
+ */
+int git_commit_graph_chain_open(
+	git_commit_graph_file **file_out,
+	const char *chain_path,
+	git_oid_t oid_type);
+
 /*
  * Attempt to get the git_commit_graph's commit-graph file. This object is
  * still owned by the git_commit_graph. If the repository does not contain a commit graph,
@@ -152,6 +251,9 @@ struct git_commit_graph_writer {
 
 	/* The list of packed commits. */
 	git_vector commits;
+
+	/* The repository the commits were read from. */
+	git_repository *repo;
 };
 
 int git_commit_graph__writer_dump(
@@ -176,6 +278,29 @@ int git_commit_graph_entry_parent(
 		const git_commit_graph_file *file,
 		const git_commit_graph_entry *entry,
 		size_t n);
+
+/*
+ * Prepare the lookup of a path in the changed-path Bloom filters of a
+ * commit-graph file.  Returns GIT_ENOTFOUND if the file has no usable
+ * filters.
+ */
+int git_commit_graph_bloom_key_init(
+		git_commit_graph_bloom_key *key,
+		const git_commit_graph_file *file,
+		const char *path);
+void git_commit_graph_bloom_key_dispose(git_commit_graph_bloom_key *key);
+
+/*
+ * Check whether the path of `key` may differ between a commit and its
+ * first parent (or the empty tree for root commits).  Returns 0 if it
+ * definitely does not, 1 if it may, and GIT_ENOTFOUND if there is no
+ * filter for this commit.
+ */
+int git_commit_graph_bloom_maybe_changed(
+		const git_commit_graph_file *file,
+		const git_commit_graph_entry *entry,
+		const git_commit_graph_bloom_key *key);
+
 int git_commit_graph_file_close(git_commit_graph_file *cgraph);
 void git_commit_graph_file_free(git_commit_graph_file *cgraph);
 
@@ -14,8 +14,8 @@
 
 int git_commit_list_generation_cmp(const void *a, const void *b)
 {
-	uint32_t generation_a = ((git_commit_list_node *) a)->generation;
-	uint32_t generation_b = ((git_commit_list_node *) b)->generation;
+	uint64_t generation_a = ((git_commit_list_node *) a)->generation;
+	uint64_t generation_b = ((git_commit_list_node *) b)->generation;
 
 	if (!generation_a || !generation_b) {
 		/* Fall back to comparing by timestamps if at least one commit lacks a generation. */
@@ -167,42 +167,75 @@ static int commit_quick_parse(
 	return 0;
 }
 
+int git_commit_list_graph_entry(
+	git_commit_graph_file **file_out,
+	git_commit_graph_entry *entry_out,
+	git_revwalk *walk,
+	const git_oid *id)
+{
+	git_commit_graph_file *cgraph_file = NULL;
+	int error;
+
+	if ((error = git_odb__get_commit_graph_file(&cgraph_file, walk->odb)) < 0) {
+		git_error_clear();
+		return GIT_ENOTFOUND;
+	}
+
+	if ((error = git_commit_graph_entry_find(entry_out, cgraph_file,
+			id, git_oid_hexsize(walk->repo->oid_type))) < 0)
+		return error;
+
+	*file_out = cgraph_file;
+	return 0;
+}
+
+static int commit_graph_parse(
+	git_revwalk *walk,
+	git_commit_list_node *commit,
+	git_commit_graph_file *cgraph_file,
+	git_commit_graph_entry *e)
+{
+	git_commit_graph_entry parent;
+	size_t i;
+	int error;
+
+	/* Prefer the corrected commit dates when the graph has them. */
+	commit->generation = e->corrected_commit_date ?
+		e->corrected_commit_date : (uint64_t)e->generation;
+	commit->time = e->commit_time;
+	commit->out_degree = (uint16_t)e->parent_count;
+	commit->parents = alloc_parents(walk, commit, commit->out_degree);
+	GIT_ERROR_CHECK_ALLOC(commit->parents);
+
+	for (i = 0; i < commit->out_degree; ++i) {
+		if ((error = git_commit_graph_entry_parent(&parent, cgraph_file, e, i)) < 0)
+			return error;
+
+		commit->parents[i] = git_revwalk__commit_lookup(walk, &parent.sha1);
+		GIT_ERROR_CHECK_ALLOC(commit->parents[i]);
+	}
+
+	commit->parsed = 1;
+	walk->parsed_from_graph++;
+	return 0;
+}
+
 int git_commit_list_parse(git_revwalk *walk, git_commit_list_node *commit)
 {
 	git_odb_object *obj;
-	git_commit_graph_file *cgraph_file = NULL;
+	git_commit_graph_file *cgraph_file;
+	git_commit_graph_entry e;
 	int error;
 
 	if (commit->parsed)
 		return 0;
 
 	/* Let's try to use the commit graph first. */
-	git_odb__get_commit_graph_file(&cgraph_file, walk->odb);
-	if (cgraph_file) {
-		git_commit_graph_entry e;
-
-		error = git_commit_graph_entry_find(&e, cgraph_file,
-			&commit->oid, git_oid_size(walk->repo->oid_type));
-
-		if (error == 0 && git__is_uint16(e.parent_count)) {
-			size_t i;
-			commit->generation = (uint32_t)e.generation;
-			commit->time = e.commit_time;
-			commit->out_degree = (uint16_t)e.parent_count;
-			commit->parents = alloc_parents(walk, commit, commit->out_degree);
-			GIT_ERROR_CHECK_ALLOC(commit->parents);
-
-			for (i = 0; i < commit->out_degree; ++i) {
-				git_commit_graph_entry parent;
-				error = git_commit_graph_entry_parent(&parent, cgraph_file, &e, i);
-				if (error < 0)
-					return error;
-				commit->parents[i] = git_revwalk__commit_lookup(walk, &parent.sha1);
-			}
-			commit->parsed = 1;
-			return 0;
-		}
-	}
+	if (git_commit_list_graph_entry(&cgraph_file, &e, walk, &commit->oid) == 0 &&
+	    git__is_uint16(e.parent_count))
+		return commit_graph_parse(walk, commit, cgraph_file, &e);
+
+	git_error_clear();
 
 	if ((error = git_odb_read(&obj, walk->odb, &commit->oid)) < 0)
 		return error;
@@ -210,10 +243,35 @@ int git_commit_list_parse(git_revwalk *walk, git_commit_list_node *commit)
 	if (obj->cached.type != GIT_OBJECT_COMMIT) {
 		git_error_set(GIT_ERROR_INVALID, "object is no commit object");
 		error = -1;
-	} else
-		error = commit_quick_parse(walk, commit, obj);
+	} else if ((error = commit_quick_parse(walk, commit, obj)) == 0) {
+		walk->parsed_from_odb++;
+	}
 
 	git_odb_object_free(obj);
 	return error;
 }
 
+int git_commit_list_tree_id(
+	git_oid *out,
+	git_revwalk *walk,
+	git_commit_list_node *commit)
+{
+	git_commit_graph_file *cgraph_file;
+	git_commit_graph_entry e;
+	git_commit *c;
+	int error;
+
+	if (git_commit_list_graph_entry(&cgraph_file, &e, walk, &commit->oid) == 0) {
+		git_oid_cpy(out, &e.tree_oid);
+		return 0;
+	}
+
+	git_error_clear();
+
+	if ((error = git_commit_lookup(&c, walk->repo, &commit->oid)) < 0)
+		return error;
+
+	git_oid_cpy(out, git_commit_tree_id(c));
+	git_commit_free(c);
+	return 0;
+}
@@ -11,6 +11,8 @@
 
 #include "git2/oid.h"
 
+#include "commit_graph.h"
+
 #define PARENT1  (1 << 0)
 #define PARENT2  (1 << 1)
 #define RESULT   (1 << 2)
@@ -26,7 +28,7 @@
 typedef struct git_commit_list_node {
 	git_oid oid;
 	int64_t time;
-	uint32_t generation;
+	uint64_t generation;
 	unsigned int seen:1,
 			 uninteresting:1,
 			 topo_delay:1,
@@ -53,6 +55,25 @@ git_commit_list *git_commit_list_create(git_commit_list_node *item, git_commit_l
 git_commit_list *git_commit_list_insert(git_commit_list_node *item, git_commit_list **list_p);
 git_commit_list *git_commit_list_insert_by_date(git_commit_list_node *item, git_commit_list **list_p);
 int git_commit_list_parse(git_revwalk *walk, git_commit_list_node *commit);
+
+/*
+ * Look up the commit in the commit-graph, returning GIT_ENOTFOUND when
+ * there is no commit-graph or the commit isn't in it.
+ */
+int git_commit_list_graph_entry(
+	git_commit_graph_file **file_out,
+	git_commit_graph_entry *entry_out,
+	git_revwalk *walk,
+	const git_oid *id);
+
+/*
+ * Get the id of the commit's tree, from the commit-graph when possible so
+ * that we don't need to read the commit.
+ */
+int git_commit_list_tree_id(
+	git_oid *out,
+	git_revwalk *walk,
+	git_commit_list_node *commit);
 git_commit_list_node *git_commit_list_pop(git_commit_list **stack);
 
 #endif
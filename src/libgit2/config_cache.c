@@ -64,6 +64,18 @@ static git_configmap _configmap_logallrefupdates[] = {
 	{GIT_CONFIGMAP_STRING, "always", GIT_LOGALLREFUPDATES_ALWAYS},
 };
 
+/*
+ *	core.untrackedCache
+ *		Whether to keep a cache of the untracked files of each
+ *	directory in the index.  When set to "keep" (the default), an
+ *	existing cache is used and updated, but none is created.
+ */
+static git_configmap _configmap_untrackedcache[] = {
+	{GIT_CONFIGMAP_FALSE, NULL, GIT_UNTRACKEDCACHE_FALSE},
+	{GIT_CONFIGMAP_TRUE, NULL, GIT_UNTRACKEDCACHE_TRUE},
+	{GIT_CONFIGMAP_STRING, "keep", GIT_UNTRACKEDCACHE_KEEP},
+};
+
 /*
  * Generic map for integer values
  */
@@ -87,6 +99,7 @@ static struct map_data _configmaps[] = {
 	{"core.protectntfs", NULL, 0, GIT_PROTECTNTFS_DEFAULT },
 	{"core.fsyncobjectfiles", NULL, 0, GIT_FSYNCOBJECTFILES_DEFAULT },
 	{"core.longpaths", NULL, 0, GIT_LONGPATHS_DEFAULT },
+	{"core.untrackedcache", _configmap_untrackedcache, ARRAY_SIZE(_configmap_untrackedcache), GIT_UNTRACKEDCACHE_DEFAULT },
 };
 
 int git_config__configmap_lookup(int *out, git_config *config, git_configmap_item item)
@@ -0,0 +1,404 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "delta-islands.h"
+
+#include "commit.h"
+#include "oidmap.h"
+#include "regexp.h"
+#include "repository.h"
+#include "revwalk.h"
+#include "strmap.h"
+#include "trace.h"
+#include "tree.h"
+#include "vector.h"
+
+#include "git2/config.h"
+#include "git2/refs.h"
+
+/* The number of captured groups that name an island */
+#define ISLAND_MAX_GROUPS 8
+
+struct git_delta_islands {
+	git_packbuilder *pb;
+
+	git_vector regexps;
+
+	/* island names, in the order of their bits */
+	git_vector names;
+	git_strmap *name_ix;
+
+	/*
+	 * Objects that are on the same islands share a set, so sets are
+	 * copied rather than changed once they are given to an object.
+	 */
+	git_vector sets;
+
+	/* the sets of all the commits that were walked */
+	git_oidmap *commits;
+
+	git_revwalk *walk;
+};
+
+static git_bitmap *new_set(git_delta_islands *islands, const git_bitmap *from)
+{
+	git_bitmap *set;
+
+	if ((set = git__calloc(1, sizeof(git_bitmap))) == NULL)
+		return NULL;
+
+	if ((from && git_bitmap_or(set, from) < 0) ||
+	    git_vector_insert(&islands->sets, set) < 0) {
+		git_bitmap_dispose(set);
+		git__free(set);
+		return NULL;
+	}
+
+	return set;
+}
+
+/* Add the islands in `add` to `*set`; returns 1 when `*set` changed */
+static int add_islands(
+	git_delta_islands *islands,
+	const git_bitmap **set,
+	const git_bitmap *add)
+{
+	git_bitmap *grown;
+
+	if (*set == add || (*set && git_bitmap_is_subset(add, *set)))
+		return 0;
+
+	if (!*set) {
+		*set = add;
+		return 1;
+	}
+
+	if ((grown = new_set(islands, *set)) == NULL ||
+	    git_bitmap_or(grown, add) < 0)
+		return -1;
+
+	*set = grown;
+	return 1;
+}
+
+static int load_regexp(const git_config_entry *entry, void *payload)
+{
+	git_delta_islands *islands = payload;
+	git_regexp *regexp;
+	int error;
+
+	regexp = git__calloc(1, sizeof(git_regexp));
+	GIT_ERROR_CHECK_ALLOC(regexp);
+
+	if ((error = git_regexp_compile(regexp, entry->value, 0)) < 0) {
+		git__free(regexp);
+		return error;
+	}
+
+	if ((error = git_vector_insert(&islands->regexps, regexp)) < 0) {
+		git_regexp_dispose(regexp);
+		git__free(regexp);
+	}
+
+	return error;
+}
+
+static int load_regexps(git_delta_islands *islands, git_repository *repo)
+{
+	git_config *config;
+	int error;
+
+	if ((error = git_repository_config_snapshot(&config, repo)) < 0)
+		return error;
+
+	error = git_config_get_multivar_foreach(config, "pack.island", NULL,
+		load_regexp, islands);
+
+	if (error == GIT_ENOTFOUND) {
+		git_error_clear();
+		error = 0;
+	}
+
+	git_config_free(config);
+	return error;
+}
+
+/*
+ * The island of a ref is named after the groups captured by the last
+ * expression that matches it, joined by dashes, as git does.
+ */
+static int island_of_ref(
+	size_t *out,
+	git_delta_islands *islands,
+	const char *refname)
+{
+	git_regmatch matches[ISLAND_MAX_GROUPS + 1];
+	git_str name = GIT_STR_INIT;
+	git_regexp *regexp = NULL;
+	size_t i, pos;
+	void *value;
+	char *ptr;
+	int error = GIT_ENOTFOUND;
+
+	for (i = islands->regexps.length; i > 0; i--) {
+		regexp = git_vector_get(&islands->regexps, i - 1);
+
+		if ((error = git_regexp_search(regexp, refname,
+				ARRAY_SIZE(matches), matches)) != GIT_ENOTFOUND)
+			break;
+	}
+
+	if (error < 0)
+		return error;
+
+	for (i = 1; i < ARRAY_SIZE(matches); i++) {
+		if (matches[i].start < 0)
+			continue;
+
+		if (name.size)
+			git_str_putc(&name, '-');
+
+		git_str_put(&name, refname + matches[i].start,
+			matches[i].end - matches[i].start);
+	}
+
+	if (git_str_oom(&name))
+		return -1;
+
+	if ((value = git_strmap_get(islands->name_ix, name.ptr)) != NULL) {
+		*out = (size_t)value - 1;
+		goto done;
+	}
+
+	pos = islands->names.length;
+	ptr = git_str_detach(&name);
+
+	if ((error = git_vector_insert(&islands->names, ptr)) < 0) {
+		git__free(ptr);
+		goto done;
+	}
+
+	if ((error = git_strmap_set(islands->name_ix, ptr, (void *)(pos + 1))) < 0)
+		goto done;
+
+	*out = pos;
+
+done:
+	git_str_dispose(&name);
+	return error;
+}
+
+static int mark_ref(git_reference *ref, void *payload)
+{
+	git_delta_islands *islands = payload;
+	git_object *commit = NULL;
+	git_commit_list_node *node;
+	git_bitmap *set;
+	size_t island;
+	int error;
+
+	if ((error = island_of_ref(&island, islands, git_reference_name(ref))) < 0 ||
+	    (error = git_reference_peel(&commit, ref, GIT_OBJECT_COMMIT)) < 0) {
+		/* refs that do not lead to a commit are on no island */
+		if (error == GIT_ENOTFOUND || error == GIT_EPEEL ||
+		    error == GIT_EINVALIDSPEC) {
+			git_error_clear();
+			error = 0;
+		}
+
+		goto done;
+	}
+
+	if ((node = git_revwalk__commit_lookup(islands->walk, git_object_id(commit))) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	/* sets are only shared once the walk starts */
+	if ((set = git_oidmap_get(islands->commits, &node->oid)) == NULL) {
+		if ((set = new_set(islands, NULL)) == NULL ||
+		    (error = git_oidmap_set(islands->commits, &node->oid, set)) < 0 ||
+		    (error = git_revwalk_push(islands->walk, &node->oid)) < 0)
+			goto done;
+	}
+
+	error = git_bitmap_set(set, island);
+
+done:
+	git_object_free(commit);
+	git_reference_free(ref);
+	return error;
+}
+
+static int mark_tree(
+	git_delta_islands *islands,
+	const git_oid *tree_id,
+	const git_bitmap *set)
+{
+	git_packbuilder *pb = islands->pb;
+	git_pobject *po;
+	git_tree *tree;
+	const git_tree_entry *entry;
+	size_t i;
+	int error;
+
+	/*
+	 * Trees that are not in the pack are not descended into: the
+	 * objects that they hold are not sent either.
+	 */
+	if ((po = git_oidmap_get(pb->object_ix, tree_id)) == NULL)
+		return 0;
+
+	if ((error = add_islands(islands, &po->islands, set)) <= 0)
+		return error;
+
+	if ((error = git_tree_lookup(&tree, pb->repo, tree_id)) < 0)
+		return error;
+
+	for (i = 0; i < git_tree_entrycount(tree); i++) {
+		entry = git_tree_entry_byindex(tree, i);
+
+		if (git_tree_entry_type(entry) == GIT_OBJECT_TREE)
+			error = mark_tree(islands, git_tree_entry_id(entry), set);
+		else if (git_tree_entry_type(entry) == GIT_OBJECT_BLOB &&
+		         (po = git_oidmap_get(pb->object_ix, git_tree_entry_id(entry))) != NULL)
+			error = add_islands(islands, &po->islands, set);
+
+		if (error < 0)
+			break;
+	}
+
+	git_tree_free(tree);
+	return error < 0 ? error : 0;
+}
+
+/*
+ * Walk the history from the marked commits, children before their
+ * parents, so that each commit has all the islands of the commits that
+ * reach it before they are passed on to its parents and its tree.
+ */
+static int mark_history(git_delta_islands *islands)
+{
+	git_packbuilder *pb = islands->pb;
+	git_commit_list_node *node;
+	git_commit *commit;
+	git_pobject *po;
+	const git_bitmap *set, *parent_set;
+	git_oid id;
+	size_t i;
+	int error;
+
+	if ((error = git_revwalk_sorting(islands->walk, GIT_SORT_TOPOLOGICAL)) < 0)
+		return error;
+
+	while ((error = git_revwalk_next(&id, islands->walk)) == 0) {
+		node = git_oidmap_get(islands->walk->commits, &id);
+		set = git_oidmap_get(islands->commits, &node->oid);
+
+		if (!set)
+			continue;
+
+		for (i = 0; i < node->out_degree; i++) {
+			parent_set = git_oidmap_get(islands->commits, &node->parents[i]->oid);
+
+			if ((error = add_islands(islands, &parent_set, set)) < 0 ||
+			    (error = git_oidmap_set(islands->commits,
+					&node->parents[i]->oid, (void *)parent_set)) < 0)
+				return error;
+		}
+
+		if ((po = git_oidmap_get(pb->object_ix, &id)) == NULL)
+			continue;
+
+		po->islands = set;
+
+		if ((error = git_commit_lookup(&commit, pb->repo, &id)) < 0)
+			return error;
+
+		error = mark_tree(islands, git_commit_tree_id(commit), set);
+		git_commit_free(commit);
+
+		if (error < 0)
+			return error;
+	}
+
+	return (error == GIT_ITEROVER) ? 0 : error;
+}
+
+int git_delta_islands_load(git_delta_islands **out, git_packbuilder *pb)
+{
+	git_delta_islands *islands;
+	int error;
+
+	*out = NULL;
+
+	islands = git__calloc(1, sizeof(git_delta_islands));
+	GIT_ERROR_CHECK_ALLOC(islands);
+
+	islands->pb = pb;
+
+	if ((error = git_vector_init(&islands->regexps, 0, NULL)) < 0 ||
+	    (error = git_vector_init(&islands->names, 0, NULL)) < 0 ||
+	    (error = git_vector_init(&islands->sets, 0, NULL)) < 0 ||
+	    (error = git_strmap_new(&islands->name_ix)) < 0 ||
+	    (error = git_oidmap_new(&islands->commits)) < 0 ||
+	    (error = load_regexps(islands, pb->repo)) < 0)
+		goto on_error;
+
+	if (!islands->regexps.length) {
+		git_delta_islands_free(islands);
+		return 0;
+	}
+
+	if ((error = git_revwalk_new(&islands->walk, pb->repo)) < 0 ||
+	    (error = git_reference_foreach(pb->repo, mark_ref, islands)) < 0 ||
+	    (error = mark_history(islands)) < 0)
+		goto on_error;
+
+	git_trace(GIT_TRACE_DEBUG,
+		"pack-objects: %" PRIuZ " delta islands, %" PRIuZ " island sets",
+		islands->names.length, islands->sets.length);
+
+	/* only the sets are needed from here on */
+	git_revwalk_free(islands->walk);
+	islands->walk = NULL;
+
+	*out = islands;
+	return 0;
+
+on_error:
+	git_delta_islands_free(islands);
+	return error;
+}
+
+void git_delta_islands_free(git_delta_islands *islands)
+{
+	git_regexp *regexp;
+	git_bitmap *set;
+	size_t i;
+
+	if (!islands)
+		return;
+
+	git_vector_foreach(&islands->regexps, i, regexp) {
+		git_regexp_dispose(regexp);
+		git__free(regexp);
+	}
+
+	git_vector_foreach(&islands->sets, i, set) {
+		git_bitmap_dispose(set);
+		git__free(set);
+	}
+
+	git_vector_free_deep(&islands->names);
+	git_vector_free(&islands->regexps);
+	git_vector_free(&islands->sets);
+	git_strmap_free(islands->name_ix);
+	git_oidmap_free(islands->commits);
+	git_revwalk_free(islands->walk);
+	git__free(islands);
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#ifndef INCLUDE_delta_islands_h__
+#define INCLUDE_delta_islands_h__
+
+#include "common.h"
+
+#include "ewah.h"
+#include "pack-objects.h"
+
+/**
+ * Delta islands keep objects from being stored as deltas against bases
+ * that the receiver of a pack may not have.  Every ref that matches one
+ * of the `pack.island` regular expressions puts the objects that it
+ * reaches on an island, named after what the expression captured.  An
+ * object is only stored as a delta against a base that is on all of the
+ * object's islands.
+ *
+ * A site that hosts many forks in one repository can put the refs of
+ * each fork on an island of their own, so that the deltas in a pack of
+ * one fork never need the objects of another, and the deltas stored in
+ * the repository can be sent to every fork as they are.
+ */
+typedef struct git_delta_islands git_delta_islands;
+
+/**
+ * Put the objects of the packbuilder on the islands of the refs that
+ * reach them.  `*out` is left NULL when there is no `pack.island`
+ * configuration.
+ */
+extern int git_delta_islands_load(git_delta_islands **out, git_packbuilder *pb);
+
+extern void git_delta_islands_free(git_delta_islands *islands);
+
+/**
+ * Whether `trg` may be stored as a delta against `src`.  An object that
+ * is on no island may use any base, but is no base for objects that are.
+ */
+GIT_INLINE(bool) git_delta_islands_allow(
+	const git_pobject *trg,
+	const git_pobject *src)
+{
+	if (!trg->islands)
+		return true;
+
+	if (!src->islands)
+		return false;
+
+	return git_bitmap_is_subset(trg->islands, src->islands);
+}
+
+#endif
@@ -119,6 +119,13 @@ int git_diff_get_perfdata(git_diff_perfdata *out, const git_diff *diff)
 	GIT_ERROR_CHECK_VERSION(out, GIT_DIFF_PERFDATA_VERSION, "git_diff_perfdata");
 	out->stat_calls = diff->perf.stat_calls;
 	out->oid_calculations = diff->perf.oid_calculations;
+
+	if (out->version > 1)
+		out->preload_stat_calls = diff->perf.preload_stat_calls;
+
+	if (out->version > 2)
+		out->skipped_stat_calls = diff->perf.skipped_stat_calls;
+
 	return 0;
 }
 
@@ -811,7 +811,7 @@ static int maybe_modified(
 	unsigned int omode = oitem->mode;
 	unsigned int nmode = nitem->mode;
 	bool new_is_workdir = (info->new_iter->type == GIT_ITERATOR_WORKDIR);
-	bool modified_uncertain = false;
+	bool modified_uncertain = false, stat_compared = false;
 	const char *matched_pathspec;
 	int error = 0;
 
@@ -836,7 +836,7 @@ static int maybe_modified(
 			git_index_entry_is_conflict(nitem)) {
 		status = GIT_DELTA_CONFLICTED;
 
-	/* support "assume unchanged" (poorly, b/c we still stat everything) */
+	/* support "assume unchanged" */
 	} else if ((oitem->flags & GIT_INDEX_ENTRY_VALID) != 0) {
 		status = GIT_DELTA_UNMODIFIED;
 
@@ -890,6 +890,7 @@ static int maybe_modified(
 			status = GIT_DELTA_MODIFIED;
 			modified_uncertain =
 				(oitem->file_size <= 0 && nitem->file_size > 0);
+			stat_compared = true;
 		}
 		else if (!git_index_time_eq(&oitem->mtime, &nitem->mtime) ||
 			(use_ctime && !git_index_time_eq(&oitem->ctime, &nitem->ctime)) ||
@@ -900,6 +901,10 @@ static int maybe_modified(
 		{
 			status = GIT_DELTA_MODIFIED;
 			modified_uncertain = true;
+			stat_compared = true;
+		}
+		else {
+			stat_compared = true;
 		}
 
 	/* if mode is GITLINK and submodules are ignored, then skip */
@@ -929,6 +934,15 @@ static int maybe_modified(
 			status = GIT_DELTA_UNMODIFIED;
 	}
 
+	/* the filesystem monitor can vouch for a file that matches the index
+	 * until it sees it change
+	 */
+	if (stat_compared && status == GIT_DELTA_UNMODIFIED &&
+	    (info->new_iter->flags & GIT_ITERATOR_USE_FSMONITOR) != 0 &&
+	    (oitem->flags_extended & GIT_INDEX_ENTRY__FSMONITOR_VALID) == 0)
+		git_index__fsmonitor_mark_valid(
+			git_iterator_index(info->new_iter), oitem);
+
 	/* If we want case changes, then break this into a delete of the old
 	 * and an add of the new so that consumers can act accordingly (eg,
 	 * checkout will update the case on disk.)
@@ -1205,6 +1219,13 @@ static int handle_unmatched_old_item(
 	git_delta_t delta_type = GIT_DELTA_DELETED;
 	int error;
 
+	/* "skip worktree" files (eg outside of a sparse checkout) are not
+	 * expected to be in the working directory
+	 */
+	if (info->new_iter->type == GIT_ITERATOR_WORKDIR &&
+	    (info->oitem->flags_extended & GIT_INDEX_ENTRY_SKIP_WORKTREE) != 0)
+		return iterator_advance(&info->oitem, info->old_iter);
+
 	/* update delta_type if this item is conflicted */
 	if (git_index_entry_is_conflict(info->oitem))
 		delta_type = GIT_DELTA_CONFLICTED;
@@ -1321,6 +1342,8 @@ int git_diff__from_iterators(
 
 	diff->base.perf.stat_calls +=
 		old_iter->stat_calls + new_iter->stat_calls;
+	diff->base.perf.skipped_stat_calls +=
+		old_iter->skipped_stat_calls + new_iter->skipped_stat_calls;
 
 cleanup:
 	if (!error)
@@ -1473,6 +1496,9 @@ int git_diff_index_to_workdir(
 	git_iterator *a = NULL, *b = NULL;
 	git_diff *diff = NULL;
 	char *prefix = NULL;
+	size_t preload_stat_calls = 0;
+	int b_flags = GIT_ITERATOR_DONT_AUTOEXPAND |
+		GIT_ITERATOR_SKIP_KNOWN_STAT;
 	int error = 0;
 
 	GIT_ASSERT_ARG(out);
@@ -1483,20 +1509,44 @@ int git_diff_index_to_workdir(
 	if (!index && (error = diff_load_index(&index, repo)) < 0)
 		return error;
 
+	/* find out which files the filesystem monitor saw change */
+	if (repo->fsmonitor) {
+		if ((error = git_index__fsmonitor_refresh(index, repo->fsmonitor)) < 0)
+			return error;
+
+		b_flags |= GIT_ITERATOR_USE_FSMONITOR;
+	}
+
 	if ((error = diff_prepare_iterator_opts(&prefix, &a_opts, GIT_ITERATOR_INCLUDE_CONFLICTS,
-						&b_opts, GIT_ITERATOR_DONT_AUTOEXPAND, opts)) < 0 ||
-	    (error = git_iterator_for_index(&a, repo, index, &a_opts)) < 0 ||
+						&b_opts, b_flags, opts)) < 0)
+		goto out;
+
+	/* stat the files of the index on several threads, ahead of the diff */
+	if ((error = git_index__preload(&preload_stat_calls, index, repo, prefix)) < 0)
+		goto out;
+
+	if (preload_stat_calls)
+		b_opts.flags |= GIT_ITERATOR_USE_PRELOAD;
+
+	if ((error = git_iterator_for_index(&a, repo, index, &a_opts)) < 0 ||
 	    (error = git_iterator_for_workdir(&b, repo, index, NULL, &b_opts)) < 0 ||
 	    (error = git_diff__from_iterators(&diff, repo, a, b, opts)) < 0)
 		goto out;
 
-	if ((diff->opts.flags & GIT_DIFF_UPDATE_INDEX) && ((git_diff_generated *)diff)->index_updated)
+	diff->perf.preload_stat_calls = preload_stat_calls;
+
+	if ((diff->opts.flags & GIT_DIFF_UPDATE_INDEX) &&
+	    (((git_diff_generated *)diff)->index_updated ||
+	     index->untracked_dirty || index->fsmonitor_dirty))
 		if ((error = git_index_write(index)) < 0)
 			goto out;
 
 	*out = diff;
 	diff = NULL;
 out:
+	if (preload_stat_calls)
+		git_index__preload_clear(index);
+
 	git_iterator_free(a);
 	git_iterator_free(b);
 	git_diff_free(diff);
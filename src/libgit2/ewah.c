@@ -0,0 +1,348 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "ewah.h"
+
+#define BITS_IN_WORD 64
+
+/*
+ * A run-length marker word: the lowest bit is the value of the run, the
+ * next 32 bits the number of clean words in the run and the top 31 bits
+ * the number of literal words that follow the marker.
+ */
+#define RLW_RUNNING_BITS 32
+#define RLW_LITERAL_BITS 31
+#define RLW_LARGEST_RUNNING_COUNT ((((uint64_t)1) << RLW_RUNNING_BITS) - 1)
+#define RLW_LARGEST_LITERAL_COUNT ((((uint64_t)1) << RLW_LITERAL_BITS) - 1)
+
+#define rlw_run_bit(w) ((w) & 1)
+#define rlw_running_len(w) (((w) >> 1) & RLW_LARGEST_RUNNING_COUNT)
+#define rlw_literal_words(w) ((w) >> (1 + RLW_RUNNING_BITS))
+
+static int bitmap_grow(git_bitmap *bitmap, size_t words_len)
+{
+	uint64_t *words;
+	size_t new_len;
+
+	if (words_len <= bitmap->words_len)
+		return 0;
+
+	new_len = max(words_len, bitmap->words_len * 2);
+
+	words = git__reallocarray(bitmap->words, new_len, sizeof(uint64_t));
+	GIT_ERROR_CHECK_ALLOC(words);
+
+	memset(words + bitmap->words_len, 0,
+		(new_len - bitmap->words_len) * sizeof(uint64_t));
+
+	bitmap->words = words;
+	bitmap->words_len = new_len;
+	return 0;
+}
+
+int git_bitmap_set(git_bitmap *bitmap, size_t pos)
+{
+	size_t word = pos / BITS_IN_WORD;
+
+	if (word >= bitmap->words_len && bitmap_grow(bitmap, word + 1) < 0)
+		return -1;
+
+	bitmap->words[word] |= ((uint64_t)1) << (pos % BITS_IN_WORD);
+	return 0;
+}
+
+bool git_bitmap_get(const git_bitmap *bitmap, size_t pos)
+{
+	size_t word = pos / BITS_IN_WORD;
+
+	if (word >= bitmap->words_len)
+		return false;
+
+	return (bitmap->words[word] & (((uint64_t)1) << (pos % BITS_IN_WORD))) != 0;
+}
+
+int git_bitmap_or(git_bitmap *dst, const git_bitmap *src)
+{
+	size_t i;
+
+	if (bitmap_grow(dst, src->words_len) < 0)
+		return -1;
+
+	for (i = 0; i < src->words_len; i++)
+		dst->words[i] |= src->words[i];
+
+	return 0;
+}
+
+int git_bitmap_xor(git_bitmap *dst, const git_bitmap *src)
+{
+	size_t i;
+
+	if (bitmap_grow(dst, src->words_len) < 0)
+		return -1;
+
+	for (i = 0; i < src->words_len; i++)
+		dst->words[i] ^= src->words[i];
+
+	return 0;
+}
+
+void git_bitmap_and(git_bitmap *dst, const git_bitmap *src)
+{
+	size_t i;
+
+	for (i = 0; i < dst->words_len; i++)
+		dst->words[i] &= (i < src->words_len) ? src->words[i] : 0;
+}
+
+void git_bitmap_and_not(git_bitmap *dst, const git_bitmap *src)
+{
+	size_t i, len = min(dst->words_len, src->words_len);
+
+	for (i = 0; i < len; i++)
+		dst->words[i] &= ~src->words[i];
+}
+
+static size_t popcount64(uint64_t w)
+{
+	w = w - ((w >> 1) & 0x5555555555555555ull);
+	w = (w & 0x3333333333333333ull) + ((w >> 2) & 0x3333333333333333ull);
+	w = (w + (w >> 4)) & 0x0f0f0f0f0f0f0f0full;
+	return (size_t)((w * 0x0101010101010101ull) >> 56);
+}
+
+size_t git_bitmap_popcount(const git_bitmap *bitmap)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < bitmap->words_len; i++)
+		count += popcount64(bitmap->words[i]);
+
+	return count;
+}
+
+bool git_bitmap_is_subset(const git_bitmap *a, const git_bitmap *b)
+{
+	size_t i;
+
+	for (i = 0; i < a->words_len; i++) {
+		if (a->words[i] & ~(i < b->words_len ? b->words[i] : 0))
+			return false;
+	}
+
+	return true;
+}
+
+size_t git_bitmap_popcount_and(const git_bitmap *a, const git_bitmap *b)
+{
+	size_t i, count = 0, len = min(a->words_len, b->words_len);
+
+	for (i = 0; i < len; i++)
+		count += popcount64(a->words[i] & b->words[i]);
+
+	return count;
+}
+
+bool git_bitmap_next(size_t *pos, const git_bitmap *bitmap)
+{
+	size_t word = *pos / BITS_IN_WORD;
+	uint64_t w;
+
+	if (word >= bitmap->words_len)
+		return false;
+
+	/* ignore the bits before `pos` in its word */
+	w = bitmap->words[word] & (~((uint64_t)0) << (*pos % BITS_IN_WORD));
+
+	while (!w) {
+		if (++word >= bitmap->words_len)
+			return false;
+
+		w = bitmap->words[word];
+	}
+
+	*pos = word * BITS_IN_WORD;
+
+	while (!(w & 1)) {
+		w >>= 1;
+		(*pos)++;
+	}
+
+	return true;
+}
+
+void git_bitmap_clear(git_bitmap *bitmap)
+{
+	if (bitmap->words)
+		memset(bitmap->words, 0, bitmap->words_len * sizeof(uint64_t));
+}
+
+void git_bitmap_dispose(git_bitmap *bitmap)
+{
+	if (!bitmap)
+		return;
+
+	git__free(bitmap->words);
+	bitmap->words = NULL;
+	bitmap->words_len = 0;
+}
+
+GIT_INLINE(uint32_t) read_u32(const unsigned char *data)
+{
+	return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+	       ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+}
+
+GIT_INLINE(uint64_t) read_u64(const unsigned char *data)
+{
+	return ((uint64_t)read_u32(data) << 32) | read_u32(data + 4);
+}
+
+static int ewah_error(const char *message)
+{
+	git_error_set(GIT_ERROR_ODB, "invalid bitmap: %s", message);
+	return -1;
+}
+
+int git_ewah_size(size_t *out, const unsigned char *data, size_t len)
+{
+	size_t words_len, size;
+
+	if (len < 8)
+		return ewah_error("truncated bitmap header");
+
+	words_len = read_u32(data + 4);
+
+	if (GIT_MULTIPLY_SIZET_OVERFLOW(&size, words_len, sizeof(uint64_t)) ||
+	    GIT_ADD_SIZET_OVERFLOW(&size, size, 12) ||
+	    size > len)
+		return ewah_error("truncated bitmap");
+
+	*out = size;
+	return 0;
+}
+
+int git_ewah_xor(git_bitmap *dst, const unsigned char *data, size_t len)
+{
+	const unsigned char *words;
+	size_t size, bits_len, words_len, i = 0, pos = 0;
+	uint64_t rlw, run, literals;
+
+	if (git_ewah_size(&size, data, len) < 0)
+		return -1;
+
+	bits_len = (read_u32(data) + (size_t)BITS_IN_WORD - 1) / BITS_IN_WORD;
+	words_len = read_u32(data + 4);
+	words = data + 8;
+
+	if (bitmap_grow(dst, bits_len) < 0)
+		return -1;
+
+	while (i < words_len) {
+		rlw = read_u64(words + i * 8);
+		run = rlw_running_len(rlw);
+		literals = rlw_literal_words(rlw);
+		i++;
+
+		if (literals > words_len - i || run > bits_len - pos ||
+		    literals > bits_len - pos - run)
+			return ewah_error("corrupt run-length word");
+
+		if (rlw_run_bit(rlw)) {
+			while (run--)
+				dst->words[pos++] ^= ~((uint64_t)0);
+		} else {
+			pos += (size_t)run;
+		}
+
+		while (literals--)
+			dst->words[pos++] ^= read_u64(words + (i++) * 8);
+	}
+
+	return 0;
+}
+
+static int put_u32(git_str *out, uint32_t value)
+{
+	uint32_t be = htonl(value);
+	return git_str_put(out, (const char *)&be, sizeof(be));
+}
+
+static int put_u64(git_str *out, uint64_t value)
+{
+	if (put_u32(out, (uint32_t)(value >> 32)) < 0)
+		return -1;
+
+	return put_u32(out, (uint32_t)(value & 0xffffffff));
+}
+
+GIT_INLINE(bool) word_is_clean(uint64_t word)
+{
+	return word == 0 || word == ~((uint64_t)0);
+}
+
+int git_ewah_write(git_str *out, const git_bitmap *bitmap, size_t bits)
+{
+	git_str words = GIT_STR_INIT;
+	size_t words_len = (bits + BITS_IN_WORD - 1) / BITS_IN_WORD;
+	size_t i = 0, j, count = 0, last_rlw = 0;
+	uint64_t run, literals, value;
+	int error = 0;
+
+	if (bits > UINT32_MAX) {
+		git_error_set(GIT_ERROR_INVALID, "bitmap is too large");
+		return -1;
+	}
+
+#define WORD(n) (((n) < bitmap->words_len) ? bitmap->words[(n)] : 0)
+
+	do {
+		value = WORD(i) & 1;
+		run = 0;
+
+		while (i < words_len && run < RLW_LARGEST_RUNNING_COUNT &&
+		       word_is_clean(WORD(i)) && (WORD(i) & 1) == value) {
+			run++;
+			i++;
+		}
+
+		for (j = i, literals = 0;
+		     j < words_len && literals < RLW_LARGEST_LITERAL_COUNT &&
+		     !word_is_clean(WORD(j));
+		     j++, literals++)
+			;
+
+		/* only all-ones runs need the run bit */
+		if (!run)
+			value = 0;
+
+		last_rlw = count;
+
+		if ((error = put_u64(&words, value | (run << 1) |
+				(literals << (1 + RLW_RUNNING_BITS)))) < 0)
+			goto done;
+
+		count++;
+
+		for (; i < j; i++, count++) {
+			if ((error = put_u64(&words, WORD(i))) < 0)
+				goto done;
+		}
+	} while (i < words_len);
+
+#undef WORD
+
+	if ((error = put_u32(out, (uint32_t)bits)) < 0 ||
+	    (error = put_u32(out, (uint32_t)count)) < 0 ||
+	    (error = git_str_put(out, words.ptr, words.size)) < 0 ||
+	    (error = put_u32(out, (uint32_t)last_rlw)) < 0)
+		goto done;
+
+done:
+	git_str_dispose(&words);
+	return error;
+}
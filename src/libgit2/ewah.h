@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#ifndef INCLUDE_ewah_h__
+#define INCLUDE_ewah_h__
+
+#include "common.h"
+
+#include "str.h"
+
+/**
+ * An uncompressed bitmap.  Bits are stored least significant first in
+ * 64-bit words, which matches the word layout of EWAH bitmaps, and the
+ * bitmap grows as bits are set.
+ */
+typedef struct {
+	uint64_t *words;
+	size_t words_len;
+} git_bitmap;
+
+#define GIT_BITMAP_INIT { NULL, 0 }
+
+extern int git_bitmap_set(git_bitmap *bitmap, size_t pos);
+extern bool git_bitmap_get(const git_bitmap *bitmap, size_t pos);
+
+/* Combine `src` into `dst`, growing `dst` as needed */
+extern int git_bitmap_or(git_bitmap *dst, const git_bitmap *src);
+extern int git_bitmap_xor(git_bitmap *dst, const git_bitmap *src);
+extern void git_bitmap_and(git_bitmap *dst, const git_bitmap *src);
+extern void git_bitmap_and_not(git_bitmap *dst, const git_bitmap *src);
+
+extern size_t git_bitmap_popcount(const git_bitmap *bitmap);
+
+/* Whether every bit that is set in `a` is also set in `b` */
+extern bool git_bitmap_is_subset(const git_bitmap *a, const git_bitmap *b);
+
+/* Count the bits that are set in both bitmaps */
+extern size_t git_bitmap_popcount_and(const git_bitmap *a, const git_bitmap *b);
+
+/**
+ * Find the first set bit at or after `*pos`.  Returns false once there
+ * are no more set bits.
+ */
+extern bool git_bitmap_next(size_t *pos, const git_bitmap *bitmap);
+
+extern void git_bitmap_clear(git_bitmap *bitmap);
+extern void git_bitmap_dispose(git_bitmap *bitmap);
+
+/**
+ * EWAH ("Enhanced Word-Aligned Hybrid") compressed bitmaps, as stored in
+ * git's reachability bitmap indexes.  A serialized bitmap is the number
+ * of bits, the number of 64-bit words, the words themselves and the
+ * position of the last run-length marker word, all in network byte
+ * order.
+ */
+
+/* Validate a serialized bitmap and return its size in bytes */
+extern int git_ewah_size(size_t *out, const unsigned char *data, size_t len);
+
+/* Decompress a serialized bitmap, XOR-ing its bits into `dst` */
+extern int git_ewah_xor(git_bitmap *dst, const unsigned char *data, size_t len);
+
+/* Compress the first `bits` bits of a bitmap and append them to `out` */
+extern int git_ewah_write(git_str *out, const git_bitmap *bitmap, size_t bits);
+
+#endif
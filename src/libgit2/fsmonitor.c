@@ -0,0 +1,434 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+
+#include "git2/sys/fsmonitor.h"
+
+#include "repository.h"
+#include "fs_path.h"
+#include "strmap.h"
+#include "vector.h"
+
+int git_fsmonitor_init(git_fsmonitor *monitor, unsigned int version)
+{
+	GIT_INIT_STRUCTURE_FROM_TEMPLATE(
+		monitor, version, git_fsmonitor, GIT_FSMONITOR_INIT);
+	return 0;
+}
+
+#ifdef GIT_FSMONITOR_INOTIFY
+
+#include <sys/inotify.h>
+
+#define INOTIFY_EVENTS \
+	(IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | \
+	 IN_DELETE_SELF | IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | \
+	 IN_MOVED_TO | IN_DONT_FOLLOW | IN_ONLYDIR)
+
+/* the events that add or remove a directory's contents */
+#define INOTIFY_DIR_EVENTS \
+	(IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+/* A path that changed, and the query that saw it change last */
+typedef struct {
+	uint64_t seq;
+	char path[GIT_FLEX_ARRAY];
+} inotify_change;
+
+/*
+ * The queries are numbered, and each returns its number as the token.
+ * The changes that a query reads from inotify are stamped with its
+ * number, so a query for a token reports the paths stamped later.
+ * Only the changes since the previous query's token are kept, so that
+ * the map stays small; older tokens cannot be answered.
+ */
+typedef struct {
+	git_fsmonitor parent;
+
+	git_mutex lock;
+	int fd;
+
+	git_str workdir;
+	git_str instance; /* the prefix of this monitor's tokens */
+	git_str token;
+
+	uint64_t seq;
+	uint64_t overflow_seq; /* the last query that found events lost */
+	uint64_t oldest_seq; /* the changes up to this query are forgotten */
+
+	git_vector watches; /* directories, by watch descriptor */
+	git_strmap *changes;
+} inotify_monitor;
+
+static git_atomic32 inotify_instances;
+
+static int inotify_record(inotify_monitor *monitor, const char *path)
+{
+	inotify_change *change;
+	size_t path_len, alloc_len;
+
+	if ((change = git_strmap_get(monitor->changes, path)) == NULL) {
+		path_len = strlen(path);
+
+		GIT_ERROR_CHECK_ALLOC_ADD3(&alloc_len, sizeof(inotify_change), path_len, 1);
+		change = git__calloc(1, alloc_len);
+		GIT_ERROR_CHECK_ALLOC(change);
+
+		memcpy(change->path, path, path_len);
+
+		if (git_strmap_set(monitor->changes, change->path, change) < 0) {
+			git__free(change);
+			return -1;
+		}
+	}
+
+	change->seq = monitor->seq;
+	return 0;
+}
+
+/* Watch `dir` (empty, or with a trailing slash) and the directories in it */
+static int inotify_watch(inotify_monitor *monitor, const char *dir)
+{
+	git_fs_path_diriter diriter = GIT_FS_PATH_DIRITER_INIT;
+	git_str path = GIT_STR_INIT, child = GIT_STR_INIT;
+	const char *filename;
+	size_t filename_len;
+	struct stat st;
+	char *name = NULL, *old;
+	int wd, error;
+
+	if ((error = git_str_joinpath(&path, monitor->workdir.ptr, dir)) < 0)
+		goto done;
+
+	if ((wd = inotify_add_watch(monitor->fd, path.ptr, INOTIFY_EVENTS)) < 0) {
+		/* the directory is already gone again */
+		if (errno == ENOENT || errno == ENOTDIR)
+			goto done;
+
+		git_error_set(GIT_ERROR_OS, "failed to watch '%s'", path.ptr);
+		error = -1;
+		goto done;
+	}
+
+	if ((name = git__strdup(dir)) == NULL ||
+	    git_vector_set((void **)&old, &monitor->watches, wd, name) < 0) {
+		git__free(name);
+		error = -1;
+		goto done;
+	}
+
+	git__free(old);
+
+	if ((error = git_fs_path_diriter_init(&diriter, path.ptr, 0)) < 0) {
+		if (error == GIT_ENOTFOUND) {
+			git_error_clear();
+			error = 0;
+		}
+
+		goto done;
+	}
+
+	while ((error = git_fs_path_diriter_next(&diriter)) == 0) {
+		if ((error = git_fs_path_diriter_filename(&filename, &filename_len, &diriter)) < 0)
+			goto done;
+
+		if (!*dir && strcmp(filename, DOT_GIT) == 0)
+			continue;
+
+		if (git_fs_path_diriter_stat(&st, &diriter) < 0) {
+			git_error_clear();
+			continue;
+		}
+
+		if (!S_ISDIR(st.st_mode))
+			continue;
+
+		git_str_clear(&child);
+
+		if ((error = git_str_printf(&child, "%s%s/", dir, filename)) < 0 ||
+		    (error = inotify_watch(monitor, child.ptr)) < 0)
+			goto done;
+	}
+
+	if (error == GIT_ITEROVER)
+		error = 0;
+
+done:
+	git_fs_path_diriter_free(&diriter);
+	git_str_dispose(&child);
+	git_str_dispose(&path);
+	return error;
+}
+
+static int inotify_handle_event(
+	inotify_monitor *monitor,
+	const struct inotify_event *event,
+	git_str *path)
+{
+	const char *dir;
+	char *old;
+
+	if (event->mask & IN_Q_OVERFLOW) {
+		monitor->overflow_seq = monitor->seq;
+		return 0;
+	}
+
+	if ((dir = git_vector_get(&monitor->watches, (size_t)event->wd)) == NULL)
+		return 0;
+
+	/* a watched directory went away, with everything beneath it */
+	if (!event->len) {
+		if (!(event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)))
+			return 0;
+
+		if (!*dir)
+			monitor->overflow_seq = monitor->seq;
+		else if (inotify_record(monitor, dir) < 0)
+			return -1;
+
+		/* a moved directory is watched again at its new name */
+		if (event->mask & IN_MOVE_SELF)
+			inotify_rm_watch(monitor->fd, event->wd);
+
+		if (event->mask & IN_IGNORED) {
+			git_vector_set((void **)&old, &monitor->watches, (size_t)event->wd, NULL);
+			git__free(old);
+		}
+
+		return 0;
+	}
+
+	if (!*dir && strcmp(event->name, DOT_GIT) == 0)
+		return 0;
+
+	if (event->mask & IN_ISDIR) {
+		if (!(event->mask & INOTIFY_DIR_EVENTS))
+			return 0;
+
+		git_str_clear(path);
+
+		if (git_str_printf(path, "%s%s/", dir, event->name) < 0 ||
+		    inotify_record(monitor, path->ptr) < 0)
+			return -1;
+
+		if ((event->mask & (IN_CREATE | IN_MOVED_TO)) &&
+		    inotify_watch(monitor, path->ptr) < 0)
+			return -1;
+
+		git_str_shorten(path, 1);
+	} else {
+		git_str_clear(path);
+
+		if (git_str_printf(path, "%s%s", dir, event->name) < 0)
+			return -1;
+	}
+
+	return inotify_record(monitor, path->ptr);
+}
+
+static int inotify_read_events(inotify_monitor *monitor)
+{
+	union {
+		struct inotify_event event;
+		char data[4096];
+	} buf;
+	const struct inotify_event *event;
+	git_str path = GIT_STR_INIT;
+	const char *ptr;
+	ssize_t len;
+	int error = 0;
+
+	while ((len = read(monitor->fd, buf.data, sizeof(buf.data))) != 0) {
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+
+			if (errno != EAGAIN) {
+				git_error_set(GIT_ERROR_OS, "failed to read filesystem events");
+				error = -1;
+			}
+
+			break;
+		}
+
+		for (ptr = buf.data; ptr < buf.data + len;
+		     ptr += sizeof(struct inotify_event) + event->len) {
+			event = (const struct inotify_event *)ptr;
+
+			if ((error = inotify_handle_event(monitor, event, &path)) < 0)
+				goto done;
+		}
+	}
+
+done:
+	git_str_dispose(&path);
+	return error;
+}
+
+/* Forget the changes that no token we still answer can ask for */
+static void inotify_prune(inotify_monitor *monitor)
+{
+	inotify_change *change;
+
+	if (monitor->seq < 2)
+		return;
+
+	monitor->oldest_seq = monitor->seq - 1;
+
+	git_strmap_foreach_value(monitor->changes, change, {
+		if (change->seq <= monitor->oldest_seq) {
+			git_strmap_delete(monitor->changes, change->path);
+			git__free(change);
+		}
+	});
+}
+
+static int inotify_query(
+	const char **out_token,
+	git_fsmonitor *fsmonitor,
+	const char *token,
+	git_fsmonitor_changed_cb changed_cb,
+	void *payload)
+{
+	inotify_monitor *monitor = (inotify_monitor *)fsmonitor;
+	inotify_change *change;
+	const char *end;
+	int64_t since;
+	int error;
+
+	if (git_mutex_lock(&monitor->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock filesystem monitor");
+		return -1;
+	}
+
+	monitor->seq++;
+
+	git_str_clear(&monitor->token);
+
+	if ((error = inotify_read_events(monitor)) < 0 ||
+	    (error = git_str_printf(&monitor->token, "%s%" PRIu64,
+			monitor->instance.ptr, monitor->seq)) < 0)
+		goto done;
+
+	*out_token = monitor->token.ptr;
+
+	/* we know nothing of the tokens of others, or of lost events */
+	if (!token || git__prefixcmp(token, monitor->instance.ptr) != 0 ||
+	    git__strntol64(&since, token + monitor->instance.size,
+			strlen(token + monitor->instance.size), &end, 10) < 0 ||
+	    *end || since < 0 || (uint64_t)since >= monitor->seq ||
+	    (uint64_t)since < monitor->overflow_seq ||
+	    (uint64_t)since < monitor->oldest_seq) {
+		git_error_clear();
+		error = GIT_PASSTHROUGH;
+		goto done;
+	}
+
+	git_strmap_foreach_value(monitor->changes, change, {
+		if (change->seq > (uint64_t)since &&
+		    (error = changed_cb(change->path, payload)) != 0)
+			goto done;
+	});
+
+done:
+	inotify_prune(monitor);
+	git_mutex_unlock(&monitor->lock);
+	return error;
+}
+
+static void inotify_free(git_fsmonitor *fsmonitor)
+{
+	inotify_monitor *monitor = (inotify_monitor *)fsmonitor;
+	inotify_change *change;
+	char *dir;
+	size_t i;
+
+	if (monitor->fd >= 0)
+		p_close(monitor->fd);
+
+	git_vector_foreach(&monitor->watches, i, dir)
+		git__free(dir);
+
+	git_vector_free(&monitor->watches);
+
+	if (monitor->changes) {
+		git_strmap_foreach_value(monitor->changes, change, {
+			git__free(change);
+		});
+	}
+
+	git_strmap_free(monitor->changes);
+	git_str_dispose(&monitor->workdir);
+	git_str_dispose(&monitor->instance);
+	git_str_dispose(&monitor->token);
+	git_mutex_free(&monitor->lock);
+	git__free(monitor);
+}
+
+int git_fsmonitor_inotify_new(git_fsmonitor **out, git_repository *repo)
+{
+	inotify_monitor *monitor;
+	int error;
+
+	GIT_ASSERT_ARG(out);
+	GIT_ASSERT_ARG(repo);
+
+	if ((error = git_repository__ensure_not_bare(repo, "watch the working directory")) < 0)
+		return error;
+
+	monitor = git__calloc(1, sizeof(inotify_monitor));
+	GIT_ERROR_CHECK_ALLOC(monitor);
+
+	if (git_mutex_init(&monitor->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to initialize lock");
+		git__free(monitor);
+		return -1;
+	}
+
+	monitor->parent.version = GIT_FSMONITOR_VERSION;
+	monitor->parent.query = inotify_query;
+	monitor->parent.free = inotify_free;
+	monitor->fd = -1;
+
+	if ((error = git_strmap_new(&monitor->changes)) < 0 ||
+	    (error = git_vector_init(&monitor->watches, 0, NULL)) < 0 ||
+	    (error = git_str_puts(&monitor->workdir, git_repository_workdir(repo))) < 0 ||
+	    (error = git_str_printf(&monitor->instance, "libgit2-inotify:%d:%" PRIu64 ":%d:",
+			(int)getpid(), git_time_monotonic(),
+			git_atomic32_inc(&inotify_instances))) < 0)
+		goto on_error;
+
+	if ((monitor->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to initialize inotify");
+		error = -1;
+		goto on_error;
+	}
+
+	if ((error = inotify_watch(monitor, "")) < 0)
+		goto on_error;
+
+	*out = &monitor->parent;
+	return 0;
+
+on_error:
+	inotify_free(&monitor->parent);
+	return error;
+}
+
+#else
+
+int git_fsmonitor_inotify_new(git_fsmonitor **out, git_repository *repo)
+{
+	GIT_UNUSED(out);
+	GIT_UNUSED(repo);
+
+	git_error_set(GIT_ERROR_INVALID, "inotify is not supported on this platform");
+	return -1;
+}
+
+#endif
@@ -9,6 +9,8 @@
 
 #include "revwalk.h"
 #include "merge.h"
+#include "odb.h"
+#include "pack-bitmap.h"
 #include "git2/graph.h"
 
 static int interesting(git_pqueue *list, git_commit_list *roots)
@@ -143,11 +145,55 @@ done:
 	return error;
 }
 
+/*
+ * Count the commits using the bitmap index, when both sides are in the
+ * bitmapped pack.  Returns GIT_ENOTFOUND when the graph must be walked.
+ */
+static int ahead_behind_bitmap(size_t *ahead, size_t *behind, git_repository *repo,
+	const git_oid *local, const git_oid *upstream)
+{
+	git_bitmap local_commits = GIT_BITMAP_INIT, upstream_commits = GIT_BITMAP_INIT;
+	git_pack_bitmap *bitmap;
+	git_odb *odb;
+	size_t common;
+	int error;
+
+	if ((error = git_repository_odb__weakptr(&odb, repo)) < 0 ||
+	    (error = git_odb__get_pack_bitmap(&bitmap, odb)) < 0)
+		return error;
+
+	if ((error = git_pack_bitmap_reachable(&local_commits, bitmap, repo,
+			local, 1, GIT_PACK_BITMAP_COMMITS_ONLY)) < 0 ||
+	    (error = git_pack_bitmap_reachable(&upstream_commits, bitmap, repo,
+			upstream, 1, GIT_PACK_BITMAP_COMMITS_ONLY)) < 0)
+		goto done;
+
+	*ahead = git_pack_bitmap_count(bitmap, &local_commits, GIT_OBJECT_COMMIT);
+	*behind = git_pack_bitmap_count(bitmap, &upstream_commits, GIT_OBJECT_COMMIT);
+
+	git_bitmap_and(&local_commits, &upstream_commits);
+	common = git_pack_bitmap_count(bitmap, &local_commits, GIT_OBJECT_COMMIT);
+
+	*ahead -= common;
+	*behind -= common;
+
+done:
+	git_bitmap_dispose(&local_commits);
+	git_bitmap_dispose(&upstream_commits);
+	return error;
+}
+
 int git_graph_ahead_behind(size_t *ahead, size_t *behind, git_repository *repo,
 	const git_oid *local, const git_oid *upstream)
 {
 	git_revwalk *walk;
 	git_commit_list_node *commit_u, *commit_l;
+	int error;
+
+	if ((error = ahead_behind_bitmap(ahead, behind, repo, local, upstream)) != GIT_ENOTFOUND)
+		return error;
+
+	git_error_clear();
 
 	if (git_revwalk_new(&walk, repo) < 0)
 		return -1;
@@ -193,7 +239,7 @@ int git_graph_reachable_from_any(
 	git_commit_list *result = NULL;
 	git_commit_list_node *commit;
 	size_t i;
-	uint32_t minimum_generation = 0xffffffff;
+	uint64_t minimum_generation = UINT64_MAX;
 	int error = 0;
 
 	if (!length)
@@ -217,6 +263,10 @@ int git_graph_reachable_from_any(
 			goto done;
 		}
 
+		/* Parse the commit to learn its generation number. */
+		if ((error = git_commit_list_parse(walk, commit)) < 0)
+			goto done;
+
 		git_vector_insert(&list, commit);
 		if (minimum_generation > commit->generation)
 			minimum_generation = commit->generation;
@@ -228,6 +278,9 @@ int git_graph_reachable_from_any(
 		goto done;
 	}
 
+	if ((error = git_commit_list_parse(walk, commit)) < 0)
+		goto done;
+
 	if (minimum_generation > commit->generation)
 		minimum_generation = commit->generation;
 
@@ -20,13 +20,17 @@
 #include "idxmap.h"
 #include "diff.h"
 #include "varint.h"
+#include "ewah.h"
 #include "path.h"
+#include "config.h"
+#include "date.h"
 
 #include "git2/odb.h"
 #include "git2/oid.h"
 #include "git2/blob.h"
 #include "git2/config.h"
 #include "git2/sys/index.h"
+#include "git2/sys/fsmonitor.h"
 
 static int index_apply_to_wd_diff(git_index *index, int action, const git_strarray *paths,
 				  unsigned int flags,
@@ -44,6 +48,35 @@ static const unsigned int INDEX_HEADER_SIG = 0x44495243;
 static const char INDEX_EXT_TREECACHE_SIG[] = {'T', 'R', 'E', 'E'};
 static const char INDEX_EXT_UNMERGED_SIG[] = {'R', 'E', 'U', 'C'};
 static const char INDEX_EXT_CONFLICT_NAME_SIG[] = {'N', 'A', 'M', 'E'};
+static const char INDEX_EXT_UNTRACKED_SIG[] = {'U', 'N', 'T', 'R'};
+static const char INDEX_EXT_FSMONITOR_SIG[] = {'F', 'S', 'M', 'N'};
+static const char INDEX_EXT_OFFSET_TABLE_SIG[] = {'I', 'E', 'O', 'T'};
+static const char INDEX_EXT_END_OF_ENTRIES_SIG[] = {'E', 'O', 'I', 'E'};
+static const char INDEX_EXT_LINK_SIG[] = {'l', 'i', 'n', 'k'};
+
+#define INDEX_FSMONITOR_VERSION_TIMESTAMP 1
+#define INDEX_FSMONITOR_VERSION_TOKEN 2
+
+#define INDEX_OFFSET_TABLE_VERSION 1
+
+#define INDEX_SHARED_PREFIX "sharedindex."
+#define INDEX_SHARED_MAX_PERCENT_CHANGE 20
+#define INDEX_SHARED_EXPIRE "2.weeks.ago"
+
+/*
+ * The entries are written in blocks of this many, which can be read on
+ * separate threads; an index is only read on more than one thread if
+ * every thread gets at least this many entries to read.
+ */
+#define INDEX_THREAD_COST 10000
+
+/*
+ * A preload thread stats at least this many files, and there are at most
+ * this many threads; as they mostly wait on the filesystem, there can be
+ * more of them than there are CPUs.
+ */
+#define INDEX_PRELOAD_COST 500
+#define INDEX_PRELOAD_MAX_THREADS 20
 
 #define INDEX_OWNER(idx) ((git_repository *)(GIT_REFCOUNT_OWNER(idx)))
 
@@ -102,6 +135,14 @@ typedef entry_long(GIT_OID_SHA256_SIZE) index_entry_long_sha256;
 #undef entry_short
 #undef entry_long
 
+/* A block of entries, as listed in the offset table */
+typedef struct {
+	size_t offset; /* where the block starts in the file */
+	size_t end;
+	size_t first; /* the position of its first entry */
+	size_t entries;
+} index_entry_block;
+
 struct entry_srch_key {
 	const char *path;
 	size_t pathlen;
@@ -111,6 +152,8 @@ struct entry_srch_key {
 struct entry_internal {
 	git_index_entry entry;
 	size_t pathlen;
+	size_t shared_pos; /* one-based position in the shared index, or 0 */
+	bool shared_changed; /* whether it changed since it was shared */
 	char path[GIT_FLEX_ARRAY];
 };
 
@@ -121,6 +164,8 @@ struct reuc_entry_internal {
 };
 
 bool git_index__enforce_unsaved_safety = false;
+size_t git_index__read_threads = 0;
+size_t git_index__preload_threads = 0;
 
 /* local declarations */
 static int read_extension(size_t *read_len, git_index *index, size_t checksum_size, const char *buffer, size_t buffer_size);
@@ -339,6 +384,17 @@ static void index_entry_free(git_index_entry *entry)
 	git__free(entry);
 }
 
+static void index_split_free(git_index_split *split)
+{
+	if (!split)
+		return;
+
+	git_bitmap_dispose(&split->delete_bitmap);
+	git_bitmap_dispose(&split->replace_bitmap);
+	git_bitmap_dispose(&split->fsmonitor_dirty);
+	git__free(split);
+}
+
 unsigned int git_index__create_mode(unsigned int mode)
 {
 	if (S_ISLNK(mode))
@@ -547,6 +603,7 @@ static int index_remove_entry(git_index *index, size_t pos)
 
 	if (entry != NULL) {
 		git_tree_cache_invalidate_path(index->tree, entry->path);
+		git_untracked_cache_invalidate_path(index->untracked, entry->path);
 		index_map_delete(index->entries_map, entry, index->ignore_case);
 	}
 
@@ -575,6 +632,21 @@ int git_index_clear(git_index *index)
 	index->tree = NULL;
 	git_pool_clear(&index->tree_pool);
 
+	if (index->untracked) {
+		git_untracked_cache_free(index->untracked);
+		index->untracked = NULL;
+		index->untracked_dirty = 1;
+	}
+
+	if (index->fsmonitor_token) {
+		git__free(index->fsmonitor_token);
+		index->fsmonitor_token = NULL;
+		index->fsmonitor_dirty = 1;
+	}
+
+	index_split_free(index->split);
+	index->split = NULL;
+
 	git_idxmap_clear(index->entries_map);
 	while (!error && index->entries.length > 0)
 		error = index_remove_entry(index, index->entries.length - 1);
@@ -725,6 +797,8 @@ int git_index_read(git_index *index, int force)
 	if (!error) {
 		git_futils_filestamp_set(&index->stamp, &stamp);
 		index->dirty = 0;
+		index->untracked_dirty = 0;
+		index->fsmonitor_dirty = 0;
 	}
 
 	git_str_dispose(&buffer);
@@ -797,6 +871,7 @@ static int truncate_racily_clean(git_index *index)
 		 */
 		if (entry) {
 			entry->file_size = 0;
+			((struct entry_internal *)entry)->shared_changed = true;
 			index->dirty = 1;
 		}
 	}
@@ -1442,6 +1517,8 @@ static int index_insert(
 
 			if (trust_path)
 				memcpy((char *)existing->path, entry->path, strlen(entry->path));
+
+			((struct entry_internal *)existing)->shared_changed = true;
 		}
 
 		index_entry_free(entry);
@@ -1455,6 +1532,8 @@ static int index_insert(
 		if ((error = git_vector_insert_sorted(&index->entries, entry, index_no_dups)) < 0 ||
 		    (error = index_map_set(index->entries_map, entry, index->ignore_case)) < 0)
 			goto out;
+
+		git_untracked_cache_invalidate_path(index->untracked, entry->path);
 	}
 
 	index->dirty = 1;
@@ -1702,6 +1781,7 @@ int git_index__fill(git_index *index, const git_vector *source_entries)
 		if ((error = index_map_set(index->entries_map, entry, index->ignore_case)) < 0)
 			break;
 
+		git_untracked_cache_invalidate_path(index->untracked, entry->path);
 		index->dirty = 1;
 	}
 
@@ -1803,6 +1883,289 @@ int git_index_find_prefix(size_t *at_pos, git_index *index, const char *prefix)
 	return error;
 }
 
+static int fsmonitor_changed(const char *path, void *payload)
+{
+	git_index *index = payload;
+	git_index_entry *entry;
+	size_t path_len = strlen(path), pos;
+	int (*prefixcmp)(const char *, const char *) =
+		index->ignore_case ? git__prefixcmp_icase : git__prefixcmp;
+
+	index_find(&pos, index, path, path_len, GIT_INDEX_STAGE_ANY);
+
+	/* the path itself, or what is beneath it if it is a directory */
+	for (; (entry = git_vector_get(&index->entries, pos)) != NULL; pos++) {
+		if (prefixcmp(entry->path, path) != 0)
+			break;
+
+		if (!path_len || path[path_len - 1] == '/' ||
+		    entry->path[path_len] == '\0' || entry->path[path_len] == '/')
+			entry->flags_extended &= ~GIT_INDEX_ENTRY__FSMONITOR_VALID;
+	}
+
+	return 0;
+}
+
+int git_index__fsmonitor_refresh(git_index *index, git_fsmonitor *monitor)
+{
+	git_index_entry *entry;
+	const char *token = NULL;
+	size_t i;
+	int error;
+
+	GIT_ASSERT_ARG(index);
+	GIT_ASSERT_ARG(monitor);
+
+	error = monitor->query(&token, monitor, index->fsmonitor_token,
+		fsmonitor_changed, index);
+
+	if (error == GIT_PASSTHROUGH) {
+		git_vector_foreach(&index->entries, i, entry)
+			entry->flags_extended &= ~GIT_INDEX_ENTRY__FSMONITOR_VALID;
+
+		error = 0;
+	}
+
+	if (error < 0)
+		return error;
+
+	if (!token) {
+		git_error_set(GIT_ERROR_INDEX, "filesystem monitor did not return a token");
+		return -1;
+	}
+
+	if (!index->fsmonitor_token || strcmp(index->fsmonitor_token, token) != 0) {
+		git__free(index->fsmonitor_token);
+
+		index->fsmonitor_token = git__strdup(token);
+		GIT_ERROR_CHECK_ALLOC(index->fsmonitor_token);
+
+		index->fsmonitor_dirty = 1;
+	}
+
+	return 0;
+}
+
+void git_index__fsmonitor_mark_valid(git_index *index, const git_index_entry *entry)
+{
+	/* entries are shared with the iterators that are looking at them */
+	((git_index_entry *)entry)->flags_extended |= GIT_INDEX_ENTRY__FSMONITOR_VALID;
+	index->fsmonitor_dirty = 1;
+}
+
+void git_index__preload_clear(git_index *index)
+{
+	git_index_entry *entry;
+	size_t i;
+
+	git_vector_foreach(&index->entries, i, entry)
+		entry->flags_extended &= ~GIT_INDEX_ENTRY__PRELOADED;
+}
+
+#ifdef GIT_THREADS
+
+/* A thread that stats the files of a run of entries */
+struct preload_thread {
+	git_thread thread;
+	git_index_entry **entries;
+	size_t nr_entries;
+	const char *workdir;
+	uint16_t skip_flags;
+	bool trust_ctime;
+	size_t stat_calls;
+	int error;
+	git_error *error_info;
+};
+
+/*
+ * Whether the workdir iterator would find the same stat data in the
+ * entry as in the file, as far as a diff compares them.
+ */
+static bool preload_matches(
+	const git_index_entry *entry,
+	struct stat *st,
+	bool trust_ctime)
+{
+	git_index_entry current;
+
+	memset(&current, 0, sizeof(git_index_entry));
+	git_index_entry__init_from_stat(&current, st, true);
+
+	return (git_futils_canonical_mode(st->st_mode) == entry->mode &&
+		current.file_size == entry->file_size &&
+		git_index_time_eq(&current.mtime, &entry->mtime) &&
+		(!trust_ctime || git_index_time_eq(&current.ctime, &entry->ctime)) &&
+		current.ino == entry->ino &&
+		current.uid == entry->uid &&
+		current.gid == entry->gid);
+}
+
+static void *preload_thread(void *arg)
+{
+	struct preload_thread *t = arg;
+	git_index_entry *entry;
+	git_str path = GIT_STR_INIT;
+	size_t workdir_len = strlen(t->workdir), i;
+	struct stat st;
+
+	if ((t->error = git_str_puts(&path, t->workdir)) < 0)
+		goto done;
+
+	for (i = 0; i < t->nr_entries; i++) {
+		entry = t->entries[i];
+
+		/* the diff does not stat conflicts, submodules or skipped files */
+		if (GIT_INDEX_ENTRY_STAGE(entry) != 0 ||
+		    (!S_ISREG(entry->mode) && !S_ISLNK(entry->mode)) ||
+		    (entry->flags & GIT_INDEX_ENTRY_VALID) != 0 ||
+		    (entry->flags_extended & t->skip_flags) != 0)
+			continue;
+
+		git_str_truncate(&path, workdir_len);
+
+		if ((t->error = git_str_puts(&path, entry->path)) < 0)
+			break;
+
+		t->stat_calls++;
+
+		if (p_lstat(path.ptr, &st) == 0 &&
+		    preload_matches(entry, &st, t->trust_ctime))
+			entry->flags_extended |= GIT_INDEX_ENTRY__PRELOADED;
+	}
+
+done:
+	if (t->error < 0)
+		git_error_save(&t->error_info);
+
+	git_str_dispose(&path);
+	return NULL;
+}
+
+static size_t preload_threads(size_t entry_count)
+{
+	size_t nr_threads = git_index__preload_threads;
+
+	if (!nr_threads) {
+		nr_threads = entry_count / INDEX_PRELOAD_COST;
+
+		if (nr_threads > INDEX_PRELOAD_MAX_THREADS)
+			nr_threads = INDEX_PRELOAD_MAX_THREADS;
+	}
+
+	return min(nr_threads, entry_count);
+}
+
+int git_index__preload(
+	size_t *stat_calls,
+	git_index *index,
+	git_repository *repo,
+	const char *prefix)
+{
+	struct preload_thread *threads = NULL;
+	git_index_entry *entry;
+	git_config *cfg;
+	int (*prefixcmp)(const char *, const char *) =
+		index->ignore_case ? git__prefixcmp_icase : git__prefixcmp;
+	size_t start = 0, end, nr_threads, started, i;
+	int trust_ctime, error;
+
+	GIT_ASSERT_ARG(stat_calls);
+	GIT_ASSERT_ARG(index);
+	GIT_ASSERT_ARG(repo);
+
+	*stat_calls = 0;
+
+	if (!git_repository_workdir(repo))
+		return 0;
+
+	if ((error = git_repository_config__weakptr(&cfg, repo)) < 0 ||
+	    (error = git_repository__configmap_lookup(&trust_ctime, repo,
+			GIT_CONFIGMAP_TRUSTCTIME)) < 0)
+		return error;
+
+	if (!git_config__get_bool_force(cfg, "core.preloadindex", 1))
+		return 0;
+
+	/* the entries beneath the prefix are next to each other */
+	if (prefix && *prefix) {
+		index_find(&start, index, prefix, strlen(prefix), GIT_INDEX_STAGE_ANY);
+
+		for (end = start; (entry = git_vector_get(&index->entries, end)) != NULL; end++) {
+			if (prefixcmp(entry->path, prefix) != 0)
+				break;
+		}
+	} else {
+		git_vector_sort(&index->entries);
+		end = index->entries.length;
+	}
+
+	if ((nr_threads = preload_threads(end - start)) < 2)
+		return 0;
+
+	threads = git__calloc(nr_threads, sizeof(struct preload_thread));
+	GIT_ERROR_CHECK_ALLOC(threads);
+
+	for (started = 0; started < nr_threads; started++) {
+		struct preload_thread *t = &threads[started];
+		size_t first = start + (end - start) * started / nr_threads;
+		size_t last = start + (end - start) * (started + 1) / nr_threads;
+
+		t->entries = (git_index_entry **)index->entries.contents + first;
+		t->nr_entries = last - first;
+		t->workdir = git_repository_workdir(repo);
+		t->trust_ctime = !!trust_ctime;
+
+		/* the filesystem monitor already vouches for some files */
+		t->skip_flags = GIT_INDEX_ENTRY_SKIP_WORKTREE;
+
+		if (repo->fsmonitor)
+			t->skip_flags |= GIT_INDEX_ENTRY__FSMONITOR_VALID;
+
+		if (git_thread_create(&t->thread, preload_thread, t) != 0) {
+			git_error_set(GIT_ERROR_THREAD, "unable to create thread");
+			error = -1;
+			break;
+		}
+	}
+
+	for (i = 0; i < started; i++) {
+		git_thread_join(&threads[i].thread, NULL);
+
+		if (threads[i].error < 0 && !error) {
+			error = threads[i].error;
+			git_error_restore(threads[i].error_info);
+			threads[i].error_info = NULL;
+		}
+
+		git_error_free(threads[i].error_info);
+		*stat_calls += threads[i].stat_calls;
+	}
+
+	if (error < 0)
+		git_index__preload_clear(index);
+
+	git__free(threads);
+	return error;
+}
+
+#else
+
+int git_index__preload(
+	size_t *stat_calls,
+	git_index *index,
+	git_repository *repo,
+	const char *prefix)
+{
+	GIT_UNUSED(index);
+	GIT_UNUSED(repo);
+	GIT_UNUSED(prefix);
+
+	*stat_calls = 0;
+	return 0;
+}
+
+#endif
+
 int git_index__find_pos(
 	size_t *out, git_index *index, const char *path, size_t path_len, int stage)
 {
@@ -2650,6 +3013,16 @@ static int read_entry(
 		uintmax_t strip_len;
 
 		strip_len = git_decode_varint((const unsigned char *)path_ptr, &varint_len);
+
+		/*
+		 * The first entry of a block that is read on its own
+		 * strips all of the path that came before it.
+		 */
+		if (!last) {
+			last = "";
+			strip_len = 0;
+		}
+
 		last_len = strlen(last);
 
 		if (varint_len == 0 || last_len < strip_len)
@@ -2709,97 +3082,790 @@ static int read_header(struct index_header *dest, const void *buffer)
 	return 0;
 }
 
-static int read_extension(size_t *read_len, git_index *index, size_t checksum_size, const char *buffer, size_t buffer_size)
+/*
+ * Mark every entry as valid except for the ones in the bitmap of entries
+ * that may have changed.  The entries are still in their on-disk order.
+ */
+static int apply_fsmonitor_dirty(git_index *index, const git_bitmap *dirty)
 {
-	struct index_extension dest;
-	size_t total_size;
+	git_index_entry *entry;
+	size_t pos;
 
-	/* buffer is not guaranteed to be aligned */
-	memcpy(&dest, buffer, sizeof(struct index_extension));
-	dest.extension_size = ntohl(dest.extension_size);
+	git_vector_foreach(&index->entries, pos, entry)
+		entry->flags_extended |= GIT_INDEX_ENTRY__FSMONITOR_VALID;
 
-	total_size = dest.extension_size + sizeof(struct index_extension);
+	for (pos = 0; git_bitmap_next(&pos, dirty); pos++) {
+		if ((entry = git_vector_get(&index->entries, pos)) == NULL)
+			return index_error_invalid("invalid fsmonitor extension");
 
-	if (dest.extension_size > total_size ||
-		buffer_size < total_size ||
-		buffer_size - total_size < checksum_size) {
-		index_error_invalid("extension is truncated");
-		return -1;
+		entry->flags_extended &= ~GIT_INDEX_ENTRY__FSMONITOR_VALID;
 	}
 
-	/* optional extension */
-	if (dest.signature[0] >= 'A' && dest.signature[0] <= 'Z') {
-		/* tree cache */
-		if (memcmp(dest.signature, INDEX_EXT_TREECACHE_SIG, 4) == 0) {
-			if (git_tree_cache_read(&index->tree, buffer + 8, dest.extension_size, index->oid_type, &index->tree_pool) < 0)
-				return -1;
-		} else if (memcmp(dest.signature, INDEX_EXT_UNMERGED_SIG, 4) == 0) {
-			if (read_reuc(index, buffer + 8, dest.extension_size) < 0)
-				return -1;
-		} else if (memcmp(dest.signature, INDEX_EXT_CONFLICT_NAME_SIG, 4) == 0) {
-			if (read_conflict_names(index, buffer + 8, dest.extension_size) < 0)
-				return -1;
-		}
-		/* else, unsupported extension. We cannot parse this, but we can skip
-		 * it by returning `total_size */
+	return 0;
+}
+
+/* Read the filesystem monitor's token, and the entries it vouches for */
+static int read_fsmonitor(git_index *index, const char *buffer, size_t size)
+{
+	git_bitmap dirty = GIT_BITMAP_INIT;
+	git_str timestamp = GIT_STR_INIT;
+	const char *token_end;
+	uint32_t version, bitmap_size, hi, lo;
+	size_t ewah_size;
+	int error = -1;
+
+	if (size < 4)
+		goto invalid;
+
+	memcpy(&version, buffer, 4);
+	version = ntohl(version);
+	buffer += 4;
+	size -= 4;
+
+	git__free(index->fsmonitor_token);
+	index->fsmonitor_token = NULL;
+
+	if (version == INDEX_FSMONITOR_VERSION_TIMESTAMP) {
+		if (size < 8)
+			goto invalid;
+
+		memcpy(&hi, buffer, 4);
+		memcpy(&lo, buffer + 4, 4);
+		buffer += 8;
+		size -= 8;
+
+		/* a time in nanoseconds, which we keep as a string token */
+		if (git_str_printf(&timestamp, "%" PRIu64,
+				((uint64_t)ntohl(hi) << 32) | ntohl(lo)) < 0)
+			goto done;
+
+		index->fsmonitor_token = git_str_detach(&timestamp);
+	} else if (version == INDEX_FSMONITOR_VERSION_TOKEN) {
+		if ((token_end = memchr(buffer, '\0', size)) == NULL)
+			goto invalid;
+
+		if ((index->fsmonitor_token = git__strndup(buffer, token_end - buffer)) == NULL)
+			goto done;
+
+		size -= (token_end - buffer) + 1;
+		buffer = token_end + 1;
 	} else {
-		/* we cannot handle non-ignorable extensions;
-		 * in fact they aren't even defined in the standard */
-		git_error_set(GIT_ERROR_INDEX, "unsupported mandatory extension: '%.4s'", dest.signature);
-		return -1;
+		goto invalid;
 	}
 
-	*read_len = total_size;
+	if (size < 4)
+		goto invalid;
+
+	memcpy(&bitmap_size, buffer, 4);
+	bitmap_size = ntohl(bitmap_size);
+	buffer += 4;
+	size -= 4;
+
+	if (bitmap_size != size ||
+	    git_ewah_size(&ewah_size, (const unsigned char *)buffer, size) < 0 ||
+	    ewah_size != size ||
+	    git_ewah_xor(&dirty, (const unsigned char *)buffer, size) < 0)
+		goto invalid;
+
+	/* the bitmap is of the entries once merged with the shared ones */
+	if (index->split) {
+		git_bitmap_dispose(&index->split->fsmonitor_dirty);
+		index->split->fsmonitor_dirty = dirty;
+		index->split->fsmonitor_pending = 1;
+		return 0;
+	}
 
-	return 0;
+	error = apply_fsmonitor_dirty(index, &dirty);
+	goto done;
+
+invalid:
+	error = index_error_invalid("invalid fsmonitor extension");
+done:
+	git_str_dispose(&timestamp);
+	git_bitmap_dispose(&dirty);
+	return error;
 }
 
-static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
+/*
+ * Read the link to the shared index, and the bitmaps of the shared
+ * entries that this index deletes and replaces.
+ */
+static int read_link(git_index *index, const char *buffer, size_t size)
 {
-	int error = 0;
-	unsigned int i;
-	struct index_header header = { 0 };
-	unsigned char checksum[GIT_HASH_MAX_SIZE];
+	git_index_split *split;
 	unsigned char zero_checksum[GIT_HASH_MAX_SIZE] = { 0 };
 	size_t checksum_size = git_hash_size(git_oid_algorithm(index->oid_type));
-	const char *last = NULL;
-	const char *empty = "";
+	size_t ewah_size;
 
-#define seek_forward(_increase) { \
-	if (_increase >= buffer_size) { \
-		error = index_error_invalid("ran out of data while parsing"); \
-		goto done; } \
-	buffer += _increase; \
-	buffer_size -= _increase;\
-}
+	if (index->split || size < checksum_size)
+		return index_error_invalid("invalid link extension");
 
-	if (buffer_size < INDEX_HEADER_SIZE + checksum_size)
-		return index_error_invalid("insufficient buffer space");
+	/* an index that links to nothing does not need a shared index */
+	if (memcmp(buffer, zero_checksum, checksum_size) == 0)
+		return 0;
 
-	/*
-	 * Precalculate the hash of the files's contents -- we'll match
-	 * it to the provided checksum in the footer.
-	 */
-	git_hash_buf(checksum, buffer, buffer_size - checksum_size,
-		git_oid_algorithm(index->oid_type));
+	split = git__calloc(1, sizeof(git_index_split));
+	GIT_ERROR_CHECK_ALLOC(split);
 
-	/* Parse header */
-	if ((error = read_header(&header, buffer)) < 0)
-		return error;
+	index->split = split;
 
-	index->version = header.version;
-	if (index->version >= INDEX_VERSION_NUMBER_COMP)
-		last = empty;
+	memcpy(split->base_checksum, buffer, checksum_size);
+	buffer += checksum_size;
+	size -= checksum_size;
 
-	seek_forward(INDEX_HEADER_SIZE);
+	if (!size)
+		return 0;
 
-	GIT_ASSERT(!index->entries.length);
+	if (git_ewah_size(&ewah_size, (const unsigned char *)buffer, size) < 0 ||
+	    git_ewah_xor(&split->delete_bitmap, (const unsigned char *)buffer, ewah_size) < 0)
+		return index_error_invalid("invalid link extension");
 
-	if ((error = index_map_resize(index->entries_map, header.entry_count, index->ignore_case)) < 0)
-		return error;
+	buffer += ewah_size;
+	size -= ewah_size;
+
+	if (git_ewah_size(&ewah_size, (const unsigned char *)buffer, size) < 0 ||
+	    ewah_size != size ||
+	    git_ewah_xor(&split->replace_bitmap, (const unsigned char *)buffer, size) < 0)
+		return index_error_invalid("invalid link extension");
+
+	return 0;
+}
+
+static int shared_index_path(
+	git_str *out,
+	const char *index_path,
+	const unsigned char *checksum,
+	size_t checksum_size)
+{
+	char hex[(GIT_HASH_MAX_SIZE * 2) + 1];
+
+	git_hash_fmt(hex, (unsigned char *)checksum, checksum_size);
+
+	if (git_fs_path_dirname_r(out, index_path) < 0 ||
+	    git_str_putc(out, '/') < 0 ||
+	    git_str_puts(out, INDEX_SHARED_PREFIX) < 0 ||
+	    git_str_puts(out, hex) < 0)
+		return -1;
+
+	return 0;
+}
+
+static void shared_entry_free(void *entry)
+{
+	index_entry_free(entry);
+}
+
+static int entry_is_null(const git_vector *v, size_t idx, void *payload)
+{
+	GIT_UNUSED(payload);
+	return (git_vector_get(v, idx) == NULL);
+}
+
+/*
+ * Merge the entries of the shared index into the ones read from this
+ * index.  The shared entries in the replace bitmap take the contents of
+ * the nameless entries at the start of this index, in order, and the
+ * ones in the delete bitmap are removed; the remaining entries of this
+ * index are added, replacing any shared entry at the same path.
+ */
+static int read_shared_index(git_index *index)
+{
+	git_index_split *split = index->split;
+	git_index *base = NULL;
+	git_index_entry *entry, *shared;
+	git_vector merged = GIT_VECTOR_INIT;
+	git_str path = GIT_STR_INIT, buffer = GIT_STR_INIT;
+	size_t checksum_size = git_hash_size(git_oid_algorithm(index->oid_type));
+	size_t pos, i, next = 0;
+	int error;
+
+	if (!index->index_file_path) {
+		git_error_set(GIT_ERROR_INDEX, "cannot read the shared index of an in-memory index");
+		return -1;
+	}
+
+	if ((error = shared_index_path(&path, index->index_file_path,
+			split->base_checksum, checksum_size)) < 0 ||
+	    (error = git_futils_readbuffer(&buffer, path.ptr)) < 0 ||
+	    (error = git_index__new(&base, index->oid_type)) < 0 ||
+	    (error = parse_index(base, buffer.ptr, buffer.size)) < 0)
+		goto done;
+
+	if (base->split || memcmp(base->checksum, split->base_checksum, checksum_size) != 0) {
+		error = index_error_invalid("shared index does not match the link to it");
+		goto done;
+	}
+
+	/* the entries are indexed once they are merged */
+	git_idxmap_clear(index->entries_map);
+
+	/* take the shared entries over from the shared index */
+	git_idxmap_clear(base->entries_map);
+	git_vector_swap(&merged, &base->entries);
+	git_vector_set_cmp(&merged, git_index_entry_cmp);
+
+	split->base_count = merged.length;
+
+	git_vector_foreach(&merged, i, shared)
+		((struct entry_internal *)shared)->shared_pos = i + 1;
+
+	for (pos = 0; git_bitmap_next(&pos, &split->replace_bitmap); pos++) {
+		if ((shared = git_vector_get(&merged, pos)) == NULL ||
+		    (entry = git_vector_get(&index->entries, next)) == NULL ||
+		    *entry->path) {
+			error = index_error_invalid("invalid replacement in link extension");
+			goto done;
+		}
+
+		index_entry_cpy(shared, entry);
+		index_entry_adjust_namemask(shared, ((struct entry_internal *)shared)->pathlen);
+		((struct entry_internal *)shared)->shared_changed = true;
+
+		index_entry_free(entry);
+		index->entries.contents[next++] = NULL;
+	}
+
+	for (pos = 0; git_bitmap_next(&pos, &split->delete_bitmap); pos++) {
+		if ((shared = git_vector_get(&merged, pos)) == NULL ||
+		    ((struct entry_internal *)shared)->shared_changed) {
+			error = index_error_invalid("invalid deletion in link extension");
+			goto done;
+		}
+
+		index_entry_free(shared);
+		merged.contents[pos] = NULL;
+	}
+
+	git_vector_remove_matching(&merged, entry_is_null, NULL);
+
+	for (i = next; i < index->entries.length; i++) {
+		entry = git_vector_get(&index->entries, i);
+
+		if (!*entry->path) {
+			error = index_error_invalid("invalid entry in split index");
+			goto done;
+		}
+
+		if ((error = git_vector_insert(&merged, entry)) < 0)
+			goto done;
+
+		index->entries.contents[i] = NULL;
+	}
+
+	/* the sort is stable, so the added entries win over shared ones */
+	git_vector_set_sorted(&merged, 0);
+	git_vector_uniq(&merged, shared_entry_free);
+	git_vector_set_cmp(&merged, index->entries._cmp);
+
+	git_vector_remove_matching(&index->entries, entry_is_null, NULL);
+	git_vector_swap(&merged, &index->entries);
+
+	if ((error = index_map_resize(index->entries_map, index->entries.length, index->ignore_case)) < 0)
+		goto done;
+
+	git_vector_foreach(&index->entries, i, entry) {
+		if ((error = index_map_set(index->entries_map, entry, index->ignore_case)) < 0)
+			goto done;
+	}
+
+	if (split->fsmonitor_pending &&
+	    (error = apply_fsmonitor_dirty(index, &split->fsmonitor_dirty)) < 0)
+		goto done;
+
+done:
+	git_vector_foreach(&merged, i, entry)
+		index_entry_free(entry);
+
+	git_bitmap_dispose(&split->delete_bitmap);
+	git_bitmap_dispose(&split->replace_bitmap);
+	git_bitmap_dispose(&split->fsmonitor_dirty);
+	split->fsmonitor_pending = 0;
+
+	git_vector_remove_matching(&index->entries, entry_is_null, NULL);
+	git_vector_free(&merged);
+	git_index_free(base);
+	git_str_dispose(&buffer);
+	git_str_dispose(&path);
+	return error;
+}
+
+static int read_extension(size_t *read_len, git_index *index, size_t checksum_size, const char *buffer, size_t buffer_size)
+{
+	struct index_extension dest;
+	size_t total_size;
+
+	/* buffer is not guaranteed to be aligned */
+	memcpy(&dest, buffer, sizeof(struct index_extension));
+	dest.extension_size = ntohl(dest.extension_size);
+
+	total_size = dest.extension_size + sizeof(struct index_extension);
+
+	if (dest.extension_size > total_size ||
+		buffer_size < total_size ||
+		buffer_size - total_size < checksum_size) {
+		index_error_invalid("extension is truncated");
+		return -1;
+	}
+
+	/* link to the shared index, which is the one mandatory extension */
+	if (memcmp(dest.signature, INDEX_EXT_LINK_SIG, 4) == 0) {
+		if (read_link(index, buffer + 8, dest.extension_size) < 0)
+			return -1;
+	}
+	/* optional extension */
+	else if (dest.signature[0] >= 'A' && dest.signature[0] <= 'Z') {
+		/* tree cache */
+		if (memcmp(dest.signature, INDEX_EXT_TREECACHE_SIG, 4) == 0) {
+			if (git_tree_cache_read(&index->tree, buffer + 8, dest.extension_size, index->oid_type, &index->tree_pool) < 0)
+				return -1;
+		} else if (memcmp(dest.signature, INDEX_EXT_UNMERGED_SIG, 4) == 0) {
+			if (read_reuc(index, buffer + 8, dest.extension_size) < 0)
+				return -1;
+		} else if (memcmp(dest.signature, INDEX_EXT_CONFLICT_NAME_SIG, 4) == 0) {
+			if (read_conflict_names(index, buffer + 8, dest.extension_size) < 0)
+				return -1;
+		} else if (memcmp(dest.signature, INDEX_EXT_UNTRACKED_SIG, 4) == 0) {
+			git_untracked_cache_free(index->untracked);
+
+			/* like git, drop an untracked cache that we cannot read */
+			if (git_untracked_cache_read(&index->untracked, buffer + 8, dest.extension_size, index->oid_type) < 0)
+				git_error_clear();
+		} else if (memcmp(dest.signature, INDEX_EXT_FSMONITOR_SIG, 4) == 0) {
+			if (read_fsmonitor(index, buffer + 8, dest.extension_size) < 0)
+				return -1;
+		}
+		/* else, unsupported extension. We cannot parse this, but we can skip
+		 * it by returning `total_size */
+	} else {
+		/* we cannot handle non-ignorable extensions;
+		 * in fact they aren't even defined in the standard */
+		git_error_set(GIT_ERROR_INDEX, "unsupported mandatory extension: '%.4s'", dest.signature);
+		return -1;
+	}
+
+	*read_len = total_size;
+
+	return 0;
+}
+
+#ifdef GIT_THREADS
+
+/*
+ * Find where the extensions start, from the "end of index entries"
+ * extension that is the last one when it exists.  It carries a hash of
+ * the headers of the extensions before it, so that it is not mistaken
+ * for the end of some other extension.  Sets `out` to 0 when there is
+ * none to trust.
+ */
+static int read_end_of_entries(
+	size_t *out,
+	git_index *index,
+	const char *buffer,
+	size_t buffer_size,
+	size_t checksum_size)
+{
+	git_hash_algorithm_t algorithm = git_oid_algorithm(index->oid_type);
+	unsigned char checksum[GIT_HASH_MAX_SIZE];
+	struct index_extension extension;
+	size_t extension_size = sizeof(struct index_extension) + 4 + checksum_size;
+	size_t end, pos, size;
+	uint32_t offset;
+	git_hash_ctx ctx;
+	int error;
+
+	*out = 0;
+
+	if (buffer_size < INDEX_HEADER_SIZE + extension_size + checksum_size)
+		return 0;
+
+	end = buffer_size - checksum_size - extension_size;
+
+	memcpy(&extension, buffer + end, sizeof(struct index_extension));
+	memcpy(&offset, buffer + end + sizeof(struct index_extension), 4);
+	offset = ntohl(offset);
+
+	if (memcmp(extension.signature, INDEX_EXT_END_OF_ENTRIES_SIG, 4) != 0 ||
+	    ntohl(extension.extension_size) != 4 + checksum_size ||
+	    offset <= INDEX_HEADER_SIZE || offset > end)
+		return 0;
+
+	if ((error = git_hash_ctx_init(&ctx, algorithm)) < 0)
+		return error;
+
+	for (pos = offset; pos < end; pos += sizeof(struct index_extension) + size) {
+		if (end - pos < sizeof(struct index_extension))
+			goto done;
+
+		memcpy(&extension, buffer + pos, sizeof(struct index_extension));
+		size = ntohl(extension.extension_size);
+
+		if (size > end - pos - sizeof(struct index_extension))
+			goto done;
+
+		if ((error = git_hash_update(&ctx, buffer + pos, sizeof(struct index_extension))) < 0)
+			goto done;
+	}
+
+	if ((error = git_hash_final(checksum, &ctx)) < 0)
+		goto done;
+
+	if (memcmp(checksum, buffer + end + sizeof(struct index_extension) + 4, checksum_size) == 0)
+		*out = offset;
+
+done:
+	git_hash_ctx_cleanup(&ctx);
+	return error;
+}
+
+/*
+ * Read the table of entry blocks, which is the first extension when it
+ * exists.  Sets `out` to NULL when there is none, or when the blocks do
+ * not add up to the entries.
+ */
+static int read_offset_table(
+	index_entry_block **out,
+	size_t *out_len,
+	const char *buffer,
+	size_t extensions_offset,
+	size_t extensions_end,
+	size_t entry_count)
+{
+	index_entry_block *blocks;
+	struct index_extension extension;
+	const char *data;
+	uint32_t version, offset, entries;
+	size_t i, nr_blocks, size, first = 0;
+
+	*out = NULL;
+	*out_len = 0;
+
+	if (extensions_end - extensions_offset < sizeof(struct index_extension))
+		return 0;
+
+	memcpy(&extension, buffer + extensions_offset, sizeof(struct index_extension));
+	size = ntohl(extension.extension_size);
+	data = buffer + extensions_offset + sizeof(struct index_extension);
+
+	if (memcmp(extension.signature, INDEX_EXT_OFFSET_TABLE_SIG, 4) != 0 ||
+	    size < 4 || (size - 4) % 8 != 0)
+		return 0;
+
+	memcpy(&version, data, 4);
+
+	if (ntohl(version) != INDEX_OFFSET_TABLE_VERSION || !(nr_blocks = (size - 4) / 8))
+		return 0;
+
+	blocks = git__calloc(nr_blocks, sizeof(index_entry_block));
+	GIT_ERROR_CHECK_ALLOC(blocks);
+
+	for (i = 0; i < nr_blocks; i++) {
+		memcpy(&offset, data + 4 + (i * 8), 4);
+		memcpy(&entries, data + 8 + (i * 8), 4);
+
+		blocks[i].offset = ntohl(offset);
+		blocks[i].entries = ntohl(entries);
+		blocks[i].first = first;
+
+		if (i)
+			blocks[i - 1].end = blocks[i].offset;
+
+		if (blocks[i].offset < (i ? blocks[i - 1].offset + 1 : INDEX_HEADER_SIZE) ||
+		    blocks[i].offset >= extensions_offset ||
+		    blocks[i].entries > entry_count - first)
+			goto invalid;
+
+		first += blocks[i].entries;
+	}
+
+	blocks[nr_blocks - 1].end = extensions_offset;
+
+	if (blocks[0].offset != INDEX_HEADER_SIZE || first != entry_count)
+		goto invalid;
+
+	*out = blocks;
+	*out_len = nr_blocks;
+	return 0;
+
+invalid:
+	git__free(blocks);
+	return 0;
+}
+
+static int read_entry_block(
+	git_index_entry **entries,
+	git_index *index,
+	const char *buffer,
+	const index_entry_block *block)
+{
+	git_index_entry *entry;
+	const char *last = NULL;
+	size_t i, entry_size, pos = block->offset;
+
+	for (i = 0; i < block->entries; i++) {
+		if (read_entry(&entry, &entry_size, index, 0,
+				buffer + pos, block->end - pos, last) < 0)
+			return index_error_invalid("invalid entry");
+
+		entries[block->first + i] = entry;
+		pos += entry_size;
+
+		if (index->version >= INDEX_VERSION_NUMBER_COMP)
+			last = entry->path;
+	}
+
+	if (pos != block->end)
+		return index_error_invalid("entries do not match the offset table");
+
+	return 0;
+}
+
+/* A thread that decodes blocks of entries, or hashes the file */
+struct read_entries_thread {
+	git_thread thread;
+	git_index *index;
+	git_index_entry **entries;
+	const char *buffer;
+	const index_entry_block *blocks;
+	size_t nr_blocks;
+	unsigned char *checksum;
+	size_t hash_len;
+	int error;
+	git_error *error_info;
+};
+
+static void *read_entries_thread(void *arg)
+{
+	struct read_entries_thread *t = arg;
+	size_t i;
+
+	if (t->checksum)
+		t->error = git_hash_buf(t->checksum, t->buffer, t->hash_len,
+			git_oid_algorithm(t->index->oid_type));
+
+	for (i = 0; i < t->nr_blocks && !t->error; i++)
+		t->error = read_entry_block(t->entries, t->index, t->buffer, &t->blocks[i]);
+
+	if (t->error < 0)
+		git_error_save(&t->error_info);
+
+	return NULL;
+}
+
+static size_t read_entries_threads(size_t entry_count)
+{
+	size_t nr_threads = git_index__read_threads;
+
+	if (!nr_threads) {
+		nr_threads = entry_count / INDEX_THREAD_COST;
+
+		if (nr_threads > (size_t)git__online_cpus())
+			nr_threads = (size_t)git__online_cpus();
+	}
+
+	return nr_threads;
+}
+
+/*
+ * Decode the blocks of entries listed in the offset table on separate
+ * threads, each taking a run of neighbouring blocks, while another one
+ * computes the checksum of the file.  Sets `out` to the offset of the
+ * extensions, or to 0 when the index does not lend itself to it, and
+ * the entries have to be read one after another.
+ */
+static int read_entries_threaded(
+	size_t *out,
+	unsigned char *checksum,
+	git_index *index,
+	const char *buffer,
+	size_t buffer_size,
+	size_t checksum_size,
+	size_t entry_count)
+{
+	struct read_entries_thread *threads = NULL;
+	index_entry_block *blocks = NULL;
+	git_index_entry **entries;
+	size_t extensions_offset, nr_blocks, nr_threads, started, start = 0, i;
+	int error;
+
+	*out = 0;
+
+	if (!entry_count || (nr_threads = read_entries_threads(entry_count)) < 2)
+		return 0;
+
+	if ((error = read_end_of_entries(&extensions_offset, index, buffer, buffer_size, checksum_size)) < 0 ||
+	    !extensions_offset ||
+	    (error = read_offset_table(&blocks, &nr_blocks, buffer, extensions_offset,
+			buffer_size - checksum_size, entry_count)) < 0 ||
+	    !blocks)
+		return error;
+
+	if (nr_threads > nr_blocks)
+		nr_threads = nr_blocks;
+
+	if (nr_threads < 2 ||
+	    (error = git_vector_size_hint(&index->entries, entry_count)) < 0)
+		goto done;
+
+	entries = (git_index_entry **)index->entries.contents;
+	memset(entries, 0, entry_count * sizeof(git_index_entry *));
+
+	if ((threads = git__calloc(nr_threads + 1, sizeof(struct read_entries_thread))) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	for (started = 0; started <= nr_threads; started++) {
+		struct read_entries_thread *t = &threads[started];
+
+		t->index = index;
+		t->entries = entries;
+		t->buffer = buffer;
+
+		/* the first thread hashes, the others decode */
+		if (!started) {
+			t->checksum = checksum;
+			t->hash_len = buffer_size - checksum_size;
+		} else {
+			size_t end = nr_blocks * started / nr_threads;
+
+			t->blocks = blocks + start;
+			t->nr_blocks = end - start;
+			start = end;
+		}
+
+		if (git_thread_create(&t->thread, read_entries_thread, t) != 0) {
+			git_error_set(GIT_ERROR_THREAD, "unable to create thread");
+			error = -1;
+			break;
+		}
+	}
+
+	/* the entries are indexed as the checksum is being computed */
+	for (i = 1; i < started; i++) {
+		git_thread_join(&threads[i].thread, NULL);
+
+		if (threads[i].error < 0 && !error) {
+			error = threads[i].error;
+			git_error_restore(threads[i].error_info);
+			threads[i].error_info = NULL;
+		}
+
+		git_error_free(threads[i].error_info);
+	}
+
+	if (!error) {
+		index->entries.length = entry_count;
+
+		for (i = 0; i < entry_count && !error; i++)
+			error = index_map_set(index->entries_map, entries[i], index->ignore_case);
+	} else {
+		for (i = 0; i < entry_count; i++)
+			index_entry_free(entries[i]);
+	}
+
+	if (started) {
+		git_thread_join(&threads[0].thread, NULL);
+
+		if (threads[0].error < 0 && !error) {
+			error = threads[0].error;
+			git_error_restore(threads[0].error_info);
+			threads[0].error_info = NULL;
+		}
+
+		git_error_free(threads[0].error_info);
+	}
+
+	if (!error)
+		*out = extensions_offset;
+
+done:
+	git__free(threads);
+	git__free(blocks);
+	return error;
+}
+
+#else
+
+static int read_entries_threaded(
+	size_t *out,
+	unsigned char *checksum,
+	git_index *index,
+	const char *buffer,
+	size_t buffer_size,
+	size_t checksum_size,
+	size_t entry_count)
+{
+	GIT_UNUSED(checksum);
+	GIT_UNUSED(index);
+	GIT_UNUSED(buffer);
+	GIT_UNUSED(buffer_size);
+	GIT_UNUSED(checksum_size);
+	GIT_UNUSED(entry_count);
+
+	*out = 0;
+	return 0;
+}
+
+#endif
+
+static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
+{
+	int error = 0;
+	unsigned int i = 0;
+	struct index_header header = { 0 };
+	unsigned char checksum[GIT_HASH_MAX_SIZE];
+	unsigned char zero_checksum[GIT_HASH_MAX_SIZE] = { 0 };
+	size_t checksum_size = git_hash_size(git_oid_algorithm(index->oid_type));
+	const char *last = NULL;
+	const char *empty = "";
+	const char *index_buffer = buffer;
+	size_t index_buffer_size = buffer_size, extensions_offset = 0;
+
+#define seek_forward(_increase) { \
+	if (_increase >= buffer_size) { \
+		error = index_error_invalid("ran out of data while parsing"); \
+		goto done; } \
+	buffer += _increase; \
+	buffer_size -= _increase;\
+}
+
+	if (buffer_size < INDEX_HEADER_SIZE + checksum_size)
+		return index_error_invalid("insufficient buffer space");
+
+	/* Parse header */
+	if ((error = read_header(&header, buffer)) < 0)
+		return error;
+
+	index->version = header.version;
+	if (index->version >= INDEX_VERSION_NUMBER_COMP)
+		last = empty;
+
+	seek_forward(INDEX_HEADER_SIZE);
+
+	GIT_ASSERT(!index->entries.length);
+
+	if ((error = index_map_resize(index->entries_map, header.entry_count, index->ignore_case)) < 0)
+		return error;
+
+	if ((error = read_entries_threaded(&extensions_offset, checksum, index,
+			index_buffer, index_buffer_size, checksum_size,
+			header.entry_count)) < 0)
+		goto done;
+
+	if (extensions_offset) {
+		i = header.entry_count;
+		seek_forward(extensions_offset - INDEX_HEADER_SIZE);
+	} else {
+		/*
+		 * Calculate the hash of the files's contents -- we'll match
+		 * it to the provided checksum in the footer.
+		 */
+		git_hash_buf(checksum, index_buffer, index_buffer_size - checksum_size,
+			git_oid_algorithm(index->oid_type));
+	}
 
 	/* Parse all the entries */
-	for (i = 0; i < header.entry_count && buffer_size > checksum_size; ++i) {
+	for (; i < header.entry_count && buffer_size > checksum_size; ++i) {
 		git_index_entry *entry = NULL;
 		size_t entry_size;
 
@@ -2864,6 +3930,9 @@ static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
 
 #undef seek_forward
 
+	if (index->split && (error = read_shared_index(index)) < 0)
+		goto done;
+
 	/* Entries are stored case-sensitively on disk, so re-sort now if
 	 * in-memory index is supposed to be case-insensitive
 	 */
@@ -2894,10 +3963,12 @@ static bool is_index_extended(git_index *index)
 }
 
 static int write_disk_entry(
+	size_t *out_size,
 	git_index *index,
 	git_filebuf *file,
 	git_index_entry *entry,
-	const char *last)
+	const char *last,
+	bool block_start)
 {
 	void *mem = NULL;
 	struct entry_common *ondisk_common;
@@ -2932,7 +4003,8 @@ static int write_disk_entry(
 	if (last) {
 		const char *last_c = last;
 
-		while (*path_start == *last_c) {
+		/* the first entry of a block shares nothing with the last */
+		while (!block_start && *path_start == *last_c) {
 			if (!*path_start || !*last_c)
 				break;
 			++path_start;
@@ -2948,6 +4020,8 @@ static int write_disk_entry(
 	if (!disk_size || git_filebuf_reserve(file, &mem, disk_size) < 0)
 		return -1;
 
+	*out_size = disk_size;
+
 	memset(mem, 0x0, disk_size);
 
 	/**
@@ -3058,42 +4132,65 @@ static int write_disk_entry(
 	return 0;
 }
 
-static int write_entries(git_index *index, git_filebuf *file)
+/*
+ * Write the entries, and fill in the blocks of the offset table (when
+ * one is given) as they are written.  `end` is set to the offset of the
+ * end of the entries.
+ */
+static int write_entries(
+	size_t *end,
+	index_entry_block *blocks,
+	git_index *index,
+	git_filebuf *file,
+	git_vector *entries,
+	size_t nameless)
 {
 	int error = 0;
-	size_t i;
-	git_vector case_sorted = GIT_VECTOR_INIT, *entries = NULL;
+	size_t i, entry_size, offset = INDEX_HEADER_SIZE;
 	git_index_entry *entry;
+	struct entry_internal unnamed;
 	const char *last = NULL;
-
-	/* If index->entries is sorted case-insensitively, then we need
-	 * to re-sort it case-sensitively before writing */
-	if (index->ignore_case) {
-		if ((error = git_vector_dup(&case_sorted, &index->entries, git_index_entry_cmp)) < 0)
-			goto done;
-
-		git_vector_sort(&case_sorted);
-		entries = &case_sorted;
-	} else {
-		entries = &index->entries;
-	}
+	bool block_start;
 
 	if (index->version >= INDEX_VERSION_NUMBER_COMP)
 		last = "";
 
 	git_vector_foreach(entries, i, entry) {
-		if ((error = write_disk_entry(index, file, entry, last)) < 0)
+		if ((block_start = (blocks && i % INDEX_THREAD_COST == 0))) {
+			blocks[i / INDEX_THREAD_COST].offset = offset;
+			blocks[i / INDEX_THREAD_COST].first = i;
+			blocks[i / INDEX_THREAD_COST].entries =
+				min(INDEX_THREAD_COST, entries->length - i);
+		}
+
+		/* the entries that replace shared ones are written without names */
+		if (i < nameless) {
+			memcpy(&unnamed.entry, entry, sizeof(git_index_entry));
+			unnamed.entry.path = "";
+			unnamed.entry.flags &= ~GIT_INDEX_ENTRY_NAMEMASK;
+			unnamed.pathlen = 0;
+
+			entry = &unnamed.entry;
+		}
+
+		if ((error = write_disk_entry(&entry_size, index, file, entry, last, block_start)) < 0)
 			break;
+
+		offset += entry_size;
+
 		if (index->version >= INDEX_VERSION_NUMBER_COMP)
 			last = entry->path;
 	}
 
-done:
-	git_vector_free(&case_sorted);
+	*end = offset;
 	return error;
 }
 
-static int write_extension(git_filebuf *file, struct index_extension *header, git_str *data)
+static int write_extension(
+	git_filebuf *file,
+	git_hash_ctx *eoie,
+	struct index_extension *header,
+	git_str *data)
 {
 	struct index_extension ondisk;
 
@@ -3101,6 +4198,10 @@ static int write_extension(git_filebuf *file, struct index_extension *header, gi
 	memcpy(&ondisk, header, 4);
 	ondisk.extension_size = htonl(header->extension_size);
 
+	/* the end of entries extension covers the headers of the others */
+	if (eoie && git_hash_update(eoie, &ondisk, sizeof(struct index_extension)) < 0)
+		return -1;
+
 	git_filebuf_write(file, &ondisk, sizeof(struct index_extension));
 	return git_filebuf_write(file, data->ptr, data->size);
 }
@@ -3134,7 +4235,7 @@ on_error:
 	return error;
 }
 
-static int write_name_extension(git_index *index, git_filebuf *file)
+static int write_name_extension(git_index *index, git_filebuf *file, git_hash_ctx *eoie)
 {
 	git_str name_buf = GIT_STR_INIT;
 	git_vector *out = &index->names;
@@ -3152,7 +4253,7 @@ static int write_name_extension(git_index *index, git_filebuf *file)
 	memcpy(&extension.signature, INDEX_EXT_CONFLICT_NAME_SIG, 4);
 	extension.extension_size = (uint32_t)name_buf.size;
 
-	error = write_extension(file, &extension, &name_buf);
+	error = write_extension(file, eoie, &extension, &name_buf);
 
 	git_str_dispose(&name_buf);
 
@@ -3166,69 +4267,224 @@ static int create_reuc_extension_data(git_str *reuc_buf, git_index *index, git_i
 	int i;
 	int error = 0;
 
-	if ((error = git_str_put(reuc_buf, reuc->path, strlen(reuc->path) + 1)) < 0)
-		return error;
+	if ((error = git_str_put(reuc_buf, reuc->path, strlen(reuc->path) + 1)) < 0)
+		return error;
+
+	for (i = 0; i < 3; i++) {
+		if ((error = git_str_printf(reuc_buf, "%o", reuc->mode[i])) < 0 ||
+			(error = git_str_put(reuc_buf, "\0", 1)) < 0)
+			return error;
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (reuc->mode[i] && (error = git_str_put(reuc_buf, (char *)&reuc->oid[i].id, oid_size)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+static int write_reuc_extension(git_index *index, git_filebuf *file, git_hash_ctx *eoie)
+{
+	git_str reuc_buf = GIT_STR_INIT;
+	git_vector *out = &index->reuc;
+	git_index_reuc_entry *reuc;
+	struct index_extension extension;
+	size_t i;
+	int error = 0;
+
+	git_vector_foreach(out, i, reuc) {
+		if ((error = create_reuc_extension_data(&reuc_buf, index, reuc)) < 0)
+			goto done;
+	}
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_UNMERGED_SIG, 4);
+	extension.extension_size = (uint32_t)reuc_buf.size;
+
+	error = write_extension(file, eoie, &extension, &reuc_buf);
+
+	git_str_dispose(&reuc_buf);
+
+done:
+	return error;
+}
+
+static int write_tree_extension(git_index *index, git_filebuf *file, git_hash_ctx *eoie)
+{
+	struct index_extension extension;
+	git_str buf = GIT_STR_INIT;
+	int error;
+
+	if (index->tree == NULL)
+		return 0;
+
+	if ((error = git_tree_cache_write(&buf, index->tree)) < 0)
+		return error;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_TREECACHE_SIG, 4);
+	extension.extension_size = (uint32_t)buf.size;
+
+	error = write_extension(file, eoie, &extension, &buf);
+
+	git_str_dispose(&buf);
+
+	return error;
+}
+
+static int write_untracked_extension(git_index *index, git_filebuf *file, git_hash_ctx *eoie)
+{
+	struct index_extension extension;
+	git_str buf = GIT_STR_INIT;
+	int error;
+
+	if ((error = git_untracked_cache_write(&buf, index->untracked)) < 0)
+		return error;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_UNTRACKED_SIG, 4);
+	extension.extension_size = (uint32_t)buf.size;
+
+	error = write_extension(file, eoie, &extension, &buf);
+
+	git_str_dispose(&buf);
+
+	return error;
+}
+
+/*
+ * Write the filesystem monitor's token, and a bitmap of the entries that
+ * it may have seen change, in their on-disk order.
+ */
+static int write_fsmonitor_extension(git_index *index, git_filebuf *file, git_hash_ctx *eoie)
+{
+	struct index_extension extension;
+	git_vector case_sorted = GIT_VECTOR_INIT, *entries;
+	git_bitmap dirty = GIT_BITMAP_INIT;
+	git_str buf = GIT_STR_INIT;
+	git_index_entry *entry;
+	uint32_t version = htonl(INDEX_FSMONITOR_VERSION_TOKEN), bitmap_size;
+	size_t i, bitmap_start;
+	int error;
+
+	if (index->ignore_case) {
+		if ((error = git_vector_dup(&case_sorted, &index->entries, git_index_entry_cmp)) < 0)
+			goto done;
+
+		git_vector_sort(&case_sorted);
+		entries = &case_sorted;
+	} else {
+		entries = &index->entries;
+	}
+
+	git_vector_foreach(entries, i, entry) {
+		if ((entry->flags_extended & GIT_INDEX_ENTRY__FSMONITOR_VALID) == 0 &&
+		    (error = git_bitmap_set(&dirty, i)) < 0)
+			goto done;
+	}
+
+	if ((error = git_str_put(&buf, (const char *)&version, 4)) < 0 ||
+	    (error = git_str_put(&buf, index->fsmonitor_token,
+			strlen(index->fsmonitor_token) + 1)) < 0 ||
+	    (error = git_str_put(&buf, "\0\0\0\0", 4)) < 0)
+		goto done;
+
+	bitmap_start = buf.size;
+
+	if ((error = git_ewah_write(&buf, &dirty, entries->length)) < 0)
+		goto done;
+
+	bitmap_size = htonl((uint32_t)(buf.size - bitmap_start));
+	memcpy(buf.ptr + bitmap_start - 4, &bitmap_size, 4);
 
-	for (i = 0; i < 3; i++) {
-		if ((error = git_str_printf(reuc_buf, "%o", reuc->mode[i])) < 0 ||
-			(error = git_str_put(reuc_buf, "\0", 1)) < 0)
-			return error;
-	}
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_FSMONITOR_SIG, 4);
+	extension.extension_size = (uint32_t)buf.size;
 
-	for (i = 0; i < 3; i++) {
-		if (reuc->mode[i] && (error = git_str_put(reuc_buf, (char *)&reuc->oid[i].id, oid_size)) < 0)
-			return error;
-	}
+	error = write_extension(file, eoie, &extension, &buf);
 
-	return 0;
+done:
+	git_str_dispose(&buf);
+	git_bitmap_dispose(&dirty);
+	git_vector_free(&case_sorted);
+	return error;
 }
 
-static int write_reuc_extension(git_index *index, git_filebuf *file)
+static int write_offset_table_extension(
+	git_filebuf *file,
+	git_hash_ctx *eoie,
+	const index_entry_block *blocks,
+	size_t nr_blocks)
 {
-	git_str reuc_buf = GIT_STR_INIT;
-	git_vector *out = &index->reuc;
-	git_index_reuc_entry *reuc;
 	struct index_extension extension;
+	git_str buf = GIT_STR_INIT;
+	uint32_t value = htonl(INDEX_OFFSET_TABLE_VERSION);
 	size_t i;
-	int error = 0;
+	int error;
 
-	git_vector_foreach(out, i, reuc) {
-		if ((error = create_reuc_extension_data(&reuc_buf, index, reuc)) < 0)
+	if ((error = git_str_put(&buf, (const char *)&value, 4)) < 0)
+		goto done;
+
+	for (i = 0; i < nr_blocks; i++) {
+		value = htonl((uint32_t)blocks[i].offset);
+
+		if ((error = git_str_put(&buf, (const char *)&value, 4)) < 0)
+			goto done;
+
+		value = htonl((uint32_t)blocks[i].entries);
+
+		if ((error = git_str_put(&buf, (const char *)&value, 4)) < 0)
 			goto done;
 	}
 
 	memset(&extension, 0x0, sizeof(struct index_extension));
-	memcpy(&extension.signature, INDEX_EXT_UNMERGED_SIG, 4);
-	extension.extension_size = (uint32_t)reuc_buf.size;
-
-	error = write_extension(file, &extension, &reuc_buf);
+	memcpy(&extension.signature, INDEX_EXT_OFFSET_TABLE_SIG, 4);
+	extension.extension_size = (uint32_t)buf.size;
 
-	git_str_dispose(&reuc_buf);
+	error = write_extension(file, eoie, &extension, &buf);
 
 done:
+	git_str_dispose(&buf);
 	return error;
 }
 
-static int write_tree_extension(git_index *index, git_filebuf *file)
+static int write_link_extension(git_filebuf *file, git_hash_ctx *eoie, git_str *link)
+{
+	struct index_extension extension;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_LINK_SIG, 4);
+	extension.extension_size = (uint32_t)link->size;
+
+	return write_extension(file, eoie, &extension, link);
+}
+
+static int write_end_of_entries_extension(
+	git_filebuf *file,
+	git_hash_ctx *eoie,
+	size_t entries_end,
+	size_t checksum_size)
 {
 	struct index_extension extension;
+	unsigned char checksum[GIT_HASH_MAX_SIZE];
 	git_str buf = GIT_STR_INIT;
+	uint32_t offset = htonl((uint32_t)entries_end);
 	int error;
 
-	if (index->tree == NULL)
-		return 0;
-
-	if ((error = git_tree_cache_write(&buf, index->tree)) < 0)
-		return error;
+	if ((error = git_hash_final(checksum, eoie)) < 0 ||
+	    (error = git_str_put(&buf, (const char *)&offset, 4)) < 0 ||
+	    (error = git_str_put(&buf, (const char *)checksum, checksum_size)) < 0)
+		goto done;
 
 	memset(&extension, 0x0, sizeof(struct index_extension));
-	memcpy(&extension.signature, INDEX_EXT_TREECACHE_SIG, 4);
+	memcpy(&extension.signature, INDEX_EXT_END_OF_ENTRIES_SIG, 4);
 	extension.extension_size = (uint32_t)buf.size;
 
-	error = write_extension(file, &extension, &buf);
+	error = write_extension(file, NULL, &extension, &buf);
 
+done:
 	git_str_dispose(&buf);
-
 	return error;
 }
 
@@ -3241,15 +4497,28 @@ static void clear_uptodate(git_index *index)
 		entry->flags_extended &= ~GIT_INDEX_ENTRY_UPTODATE;
 }
 
-static int write_index(
+/*
+ * Write the given entries of the index, the first `nameless` of them
+ * without their names.  A shared index only has the entries; a split
+ * index also has the `link` to its shared index.
+ */
+static int write_index_file(
 	unsigned char checksum[GIT_HASH_MAX_SIZE],
 	size_t *checksum_size,
 	git_index *index,
-	git_filebuf *file)
+	git_filebuf *file,
+	git_vector *entries,
+	size_t nameless,
+	git_str *link,
+	bool shared)
 {
 	struct index_header header;
+	index_entry_block *blocks = NULL;
+	git_hash_ctx eoie_ctx, *eoie = NULL;
+	size_t nr_blocks = 0, entries_end;
 	bool is_extended;
 	uint32_t index_version_number;
+	int error = -1;
 
 	GIT_ASSERT_ARG(index);
 	GIT_ASSERT_ARG(file);
@@ -3258,6 +4527,16 @@ static int write_index(
 
 	*checksum_size = git_hash_size(git_oid_algorithm(index->oid_type));
 
+	/*
+	 * Large indexes get a table of their blocks of entries, so that
+	 * they can be read on several threads, like git does.
+	 */
+	if (entries->length > INDEX_THREAD_COST) {
+		nr_blocks = (entries->length + INDEX_THREAD_COST - 1) / INDEX_THREAD_COST;
+		blocks = git__calloc(nr_blocks, sizeof(index_entry_block));
+		GIT_ERROR_CHECK_ALLOC(blocks);
+	}
+
 	if (index->version <= INDEX_VERSION_NUMBER_EXT)  {
 		is_extended = is_index_extended(index);
 		index_version_number = is_extended ? INDEX_VERSION_NUMBER_EXT : INDEX_VERSION_NUMBER_LB;
@@ -3267,37 +4546,382 @@ static int write_index(
 
 	header.signature = htonl(INDEX_HEADER_SIG);
 	header.version = htonl(index_version_number);
-	header.entry_count = htonl((uint32_t)index->entries.length);
+	header.entry_count = htonl((uint32_t)entries->length);
 
 	if (git_filebuf_write(file, &header, sizeof(struct index_header)) < 0)
-		return -1;
+		goto done;
 
-	if (write_entries(index, file) < 0)
-		return -1;
+	if (write_entries(&entries_end, blocks, index, file, entries, nameless) < 0)
+		goto done;
+
+	/* the offsets in the table are 32 bits wide */
+	if (entries_end > UINT32_MAX)
+		nr_blocks = 0;
+
+	/* write the offset table extension, which has to come first */
+	if (nr_blocks) {
+		if (git_hash_ctx_init(&eoie_ctx, git_oid_algorithm(index->oid_type)) < 0)
+			goto done;
+
+		eoie = &eoie_ctx;
+
+		if (write_offset_table_extension(file, eoie, blocks, nr_blocks) < 0)
+			goto done;
+	}
+
+	/* write the link to the shared index */
+	if (link && write_link_extension(file, eoie, link) < 0)
+		goto done;
+
+	if (shared)
+		goto end_of_entries;
 
 	/* write the tree cache extension */
-	if (index->tree != NULL && write_tree_extension(index, file) < 0)
-		return -1;
+	if (index->tree != NULL && write_tree_extension(index, file, eoie) < 0)
+		goto done;
 
 	/* write the rename conflict extension */
-	if (index->names.length > 0 && write_name_extension(index, file) < 0)
-		return -1;
+	if (index->names.length > 0 && write_name_extension(index, file, eoie) < 0)
+		goto done;
 
 	/* write the reuc extension */
-	if (index->reuc.length > 0 && write_reuc_extension(index, file) < 0)
-		return -1;
+	if (index->reuc.length > 0 && write_reuc_extension(index, file, eoie) < 0)
+		goto done;
+
+	/* write the untracked cache extension */
+	if (index->untracked != NULL && write_untracked_extension(index, file, eoie) < 0)
+		goto done;
+
+	/* write the filesystem monitor extension */
+	if (index->fsmonitor_token != NULL && write_fsmonitor_extension(index, file, eoie) < 0)
+		goto done;
+
+end_of_entries:
+	/* write the end of entries extension, which has to come last */
+	if (eoie && write_end_of_entries_extension(file, eoie, entries_end, *checksum_size) < 0)
+		goto done;
 
 	/* get out the hash for all the contents we've appended to the file */
 	git_filebuf_hash(checksum, file);
 
 	/* write it at the end of the file */
 	if (git_filebuf_write(file, checksum, *checksum_size) < 0)
-		return -1;
+		goto done;
 
 	/* file entries are no longer up to date */
 	clear_uptodate(index);
 
-	return 0;
+	error = 0;
+
+done:
+	if (eoie)
+		git_hash_ctx_cleanup(eoie);
+
+	git__free(blocks);
+	return error;
+}
+
+static int split_index_enabled(git_index *index)
+{
+	git_repository *repo = INDEX_OWNER(index);
+	git_config *cfg;
+
+	/* an index that is split stays split, unless told otherwise */
+	if (!repo || git_repository_config__weakptr(&cfg, repo) < 0) {
+		git_error_clear();
+		return (index->split != NULL);
+	}
+
+	return git_config__get_bool_force(cfg, "core.splitindex", index->split != NULL);
+}
+
+static int split_index_max_percent_change(git_index *index)
+{
+	git_repository *repo = INDEX_OWNER(index);
+	git_config *cfg;
+	int percent;
+
+	if (!repo || git_repository_config__weakptr(&cfg, repo) < 0) {
+		git_error_clear();
+		return INDEX_SHARED_MAX_PERCENT_CHANGE;
+	}
+
+	percent = git_config__get_int_force(cfg,
+		"splitindex.maxpercentchange", INDEX_SHARED_MAX_PERCENT_CHANGE);
+
+	return (percent < 0 || percent > 100) ?
+		INDEX_SHARED_MAX_PERCENT_CHANGE : percent;
+}
+
+/*
+ * Remove the shared indexes next to the index, other than `keep`, that
+ * were not used since `splitIndex.sharedIndexExpire`; like git, this is
+ * only done when a new shared index is written, and it is best effort.
+ */
+static void expire_shared_indexes(git_index *index, const char *keep)
+{
+	git_repository *repo = INDEX_OWNER(index);
+	git_fs_path_diriter diriter = GIT_FS_PATH_DIRITER_INIT;
+	git_config *cfg;
+	git_str dir = GIT_STR_INIT;
+	git_time_t expire;
+	const char *path, *filename;
+	char *expire_str = NULL;
+	size_t path_len, filename_len;
+	struct stat st;
+
+	if (repo && git_repository_config__weakptr(&cfg, repo) == 0)
+		expire_str = git_config__get_string_force(cfg,
+			"splitindex.sharedindexexpire", INDEX_SHARED_EXPIRE);
+	else
+		expire_str = git__strdup(INDEX_SHARED_EXPIRE);
+
+	if (!expire_str || strcmp(expire_str, "never") == 0 ||
+	    git_date_parse(&expire, expire_str) < 0 ||
+	    git_fs_path_dirname_r(&dir, index->index_file_path) < 0 ||
+	    git_fs_path_diriter_init(&diriter, dir.ptr, 0) < 0)
+		goto done;
+
+	while (git_fs_path_diriter_next(&diriter) == 0) {
+		if (git_fs_path_diriter_filename(&filename, &filename_len, &diriter) < 0 ||
+		    git_fs_path_diriter_fullpath(&path, &path_len, &diriter) < 0)
+			break;
+
+		if (git__prefixcmp(filename, INDEX_SHARED_PREFIX) != 0 ||
+		    strcmp(path, keep) == 0)
+			continue;
+
+		if (p_stat(path, &st) == 0 && (git_time_t)st.st_mtime <= expire)
+			p_unlink(path);
+	}
+
+done:
+	git_error_clear();
+	git_fs_path_diriter_free(&diriter);
+	git_str_dispose(&dir);
+	git__free(expire_str);
+}
+
+/* Write all the entries to a new shared index, and share them from now */
+static int write_shared_index(git_index *index, git_vector *entries)
+{
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_str path = GIT_STR_INIT;
+	git_index_entry *entry;
+	unsigned char checksum[GIT_HASH_MAX_SIZE];
+	size_t checksum_size, i;
+	int filebuf_hash, error;
+
+	filebuf_hash = git_filebuf_hash_flags(git_oid_algorithm(index->oid_type));
+	GIT_ASSERT(filebuf_hash);
+
+	if (!index->split) {
+		index->split = git__calloc(1, sizeof(git_index_split));
+		GIT_ERROR_CHECK_ALLOC(index->split);
+	}
+
+	if ((error = git_fs_path_dirname_r(&path, index->index_file_path)) < 0 ||
+	    (error = git_str_joinpath(&path, path.ptr, "sharedindex")) < 0 ||
+	    (error = git_filebuf_open(&file, path.ptr,
+			GIT_FILEBUF_TEMPORARY | filebuf_hash, GIT_INDEX_FILE_MODE)) < 0 ||
+	    (error = write_index_file(checksum, &checksum_size, index, &file,
+			entries, 0, NULL, true)) < 0 ||
+	    (error = shared_index_path(&path, index->index_file_path,
+			checksum, checksum_size)) < 0 ||
+	    (error = git_filebuf_commit_at(&file, path.ptr)) < 0)
+		goto done;
+
+	memcpy(index->split->base_checksum, checksum, checksum_size);
+	index->split->base_count = entries->length;
+
+	git_vector_foreach(entries, i, entry) {
+		((struct entry_internal *)entry)->shared_pos = i + 1;
+		((struct entry_internal *)entry)->shared_changed = false;
+	}
+
+	expire_shared_indexes(index, path.ptr);
+
+done:
+	git_filebuf_cleanup(&file);
+	git_str_dispose(&path);
+	return error;
+}
+
+/*
+ * Find the entries to write to a split index: the ones that replace
+ * shared entries, in the order of the shared index, and then the ones
+ * that are not shared.
+ */
+static int split_index_entries(
+	git_vector *out,
+	size_t *nameless,
+	git_bitmap *deleted,
+	git_bitmap *replaced,
+	git_index *index,
+	git_vector *entries)
+{
+	git_bitmap present = GIT_BITMAP_INIT;
+	git_index_entry *entry;
+	struct entry_internal *internal;
+	size_t i;
+	int error = 0;
+
+	git_vector_foreach(entries, i, entry) {
+		internal = (struct entry_internal *)entry;
+
+		if (!internal->shared_pos)
+			continue;
+
+		if ((error = git_bitmap_set(&present, internal->shared_pos - 1)) < 0)
+			goto done;
+
+		if (internal->shared_changed &&
+		    ((error = git_bitmap_set(replaced, internal->shared_pos - 1)) < 0 ||
+		     (error = git_vector_insert(out, entry)) < 0))
+			goto done;
+	}
+
+	*nameless = out->length;
+
+	git_vector_foreach(entries, i, entry) {
+		if (!((struct entry_internal *)entry)->shared_pos &&
+		    (error = git_vector_insert(out, entry)) < 0)
+			goto done;
+	}
+
+	for (i = 0; i < index->split->base_count; i++) {
+		if (!git_bitmap_get(&present, i) &&
+		    (error = git_bitmap_set(deleted, i)) < 0)
+			goto done;
+	}
+
+done:
+	git_bitmap_dispose(&present);
+	return error;
+}
+
+static size_t bitmap_bits(const git_bitmap *bitmap)
+{
+	size_t pos, bits = 0;
+
+	for (pos = 0; git_bitmap_next(&pos, bitmap); pos++)
+		bits = pos + 1;
+
+	return bits;
+}
+
+/*
+ * Work out what to write to a split index, and its link to the shared
+ * index.  A new shared index is written when there is none, or when more
+ * than `splitIndex.maxPercentChange` percent of the entries are added,
+ * replaced or deleted since it was written.
+ */
+static int prepare_split_index(
+	git_vector *out,
+	size_t *nameless,
+	git_str *link,
+	git_index *index,
+	git_vector *entries)
+{
+	git_bitmap deleted = GIT_BITMAP_INIT, replaced = GIT_BITMAP_INIT;
+	git_str path = GIT_STR_INIT;
+	size_t checksum_size = git_hash_size(git_oid_algorithm(index->oid_type));
+	size_t changes;
+	int max_percent, error;
+	bool rewrite = true;
+
+	*nameless = 0;
+
+	if (index->split) {
+		if ((error = split_index_entries(out, nameless, &deleted,
+				&replaced, index, entries)) < 0 ||
+		    (error = shared_index_path(&path, index->index_file_path,
+				index->split->base_checksum, checksum_size)) < 0)
+			goto done;
+
+		max_percent = split_index_max_percent_change(index);
+		changes = out->length + git_bitmap_popcount(&deleted);
+
+		if (max_percent == 100)
+			rewrite = false;
+		else if (max_percent > 0)
+			rewrite = (changes * 100 > (size_t)max_percent * entries->length);
+
+		rewrite = rewrite || !git_fs_path_exists(path.ptr);
+	}
+
+	if (rewrite) {
+		git_vector_clear(out);
+		git_bitmap_clear(&deleted);
+		git_bitmap_clear(&replaced);
+		*nameless = 0;
+
+		if ((error = write_shared_index(index, entries)) < 0)
+			goto done;
+	} else if (git_futils_touch(path.ptr, NULL) < 0) {
+		/* the shared index is still in use; keep it from expiring */
+		git_error_clear();
+	}
+
+	if ((error = git_str_put(link, (const char *)index->split->base_checksum, checksum_size)) < 0 ||
+	    (error = git_ewah_write(link, &deleted, bitmap_bits(&deleted))) < 0 ||
+	    (error = git_ewah_write(link, &replaced, bitmap_bits(&replaced))) < 0)
+		goto done;
+
+done:
+	git_bitmap_dispose(&deleted);
+	git_bitmap_dispose(&replaced);
+	git_str_dispose(&path);
+	return error;
+}
+
+static int write_index(
+	unsigned char checksum[GIT_HASH_MAX_SIZE],
+	size_t *checksum_size,
+	git_index *index,
+	git_filebuf *file)
+{
+	git_vector case_sorted = GIT_VECTOR_INIT, split_entries = GIT_VECTOR_INIT;
+	git_vector *entries;
+	git_str link = GIT_STR_INIT;
+	size_t nameless = 0;
+	bool split;
+	int error;
+
+	GIT_ASSERT_ARG(index);
+	GIT_ASSERT_ARG(file);
+
+	/* If index->entries is sorted case-insensitively, then we need
+	 * to re-sort it case-sensitively before writing */
+	if (index->ignore_case) {
+		if ((error = git_vector_dup(&case_sorted, &index->entries, git_index_entry_cmp)) < 0)
+			goto done;
+
+		git_vector_sort(&case_sorted);
+		entries = &case_sorted;
+	} else {
+		entries = &index->entries;
+	}
+
+	if ((split = split_index_enabled(index))) {
+		if ((error = prepare_split_index(&split_entries, &nameless,
+				&link, index, entries)) < 0)
+			goto done;
+
+		entries = &split_entries;
+	} else {
+		index_split_free(index->split);
+		index->split = NULL;
+	}
+
+	error = write_index_file(checksum, checksum_size, index, file,
+		entries, nameless, split ? &link : NULL, false);
+
+done:
+	git_str_dispose(&link);
+	git_vector_free(&split_entries);
+	git_vector_free(&case_sorted);
+	return error;
 }
 
 int git_index_entry_stage(const git_index_entry *entry)
@@ -3508,6 +5132,11 @@ static int git_index_read_iterator(
 		if (dup_entry && !remove_entry && index->tree)
 			git_tree_cache_invalidate_path(index->tree, dup_entry->path);
 
+		/* a path that comes or goes changes its directory's listing */
+		if (diff)
+			git_untracked_cache_invalidate_path(index->untracked,
+				diff < 0 ? old_entry->path : new_entry->path);
+
 		if (add_entry) {
 			if ((error = git_vector_insert(&new_entries, add_entry)) == 0)
 				error = index_map_set(new_entries_map, add_entry,
@@ -3949,6 +5578,8 @@ int git_indexwriter_commit(git_indexwriter *writer)
 	}
 
 	writer->index->dirty = 0;
+	writer->index->untracked_dirty = 0;
+	writer->index->fsmonitor_dirty = 0;
 	writer->index->on_disk = 1;
 	memcpy(writer->index->checksum, checksum, checksum_size);
 
@@ -14,14 +14,51 @@
 #include "vector.h"
 #include "idxmap.h"
 #include "tree-cache.h"
+#include "untracked-cache.h"
+#include "ewah.h"
 #include "git2/odb.h"
 #include "git2/index.h"
+#include "git2/sys/fsmonitor.h"
 
 #define GIT_INDEX_FILE "index"
 #define GIT_INDEX_FILE_MODE 0666
 
+/*
+ * In-memory entry flag: the filesystem monitor has not seen the file
+ * change since it was last found to match the entry.
+ */
+#define GIT_INDEX_ENTRY__FSMONITOR_VALID (1 << 3)
+
+/*
+ * In-memory entry flag: the file was just found to match the entry by
+ * `git_index__preload`, so the diff that asked for it need not stat it.
+ */
+#define GIT_INDEX_ENTRY__PRELOADED (1 << 4)
+
 extern bool git_index__enforce_unsaved_safety;
 
+/* The number of threads to read an index with; 0 picks it by its size */
+extern size_t git_index__read_threads;
+
+/* The number of threads to preload an index with; 0 picks it by its size */
+extern size_t git_index__preload_threads;
+
+/*
+ * An index that is split from a shared index: it only has the entries
+ * that differ from the shared index's, which is kept in
+ * "sharedindex.<checksum>" next to it.
+ */
+typedef struct {
+	unsigned char base_checksum[GIT_HASH_MAX_SIZE];
+	size_t base_count; /* the number of entries in the shared index */
+
+	/* while reading: how the entries differ from the shared ones */
+	git_bitmap delete_bitmap;
+	git_bitmap replace_bitmap;
+	git_bitmap fsmonitor_dirty;
+	unsigned int fsmonitor_pending:1;
+} git_index_split;
+
 struct git_index {
 	git_refcount rc;
 
@@ -42,10 +79,19 @@ struct git_index {
 	unsigned int distrust_filemode:1;
 	unsigned int no_symlinks:1;
 	unsigned int dirty:1;	/* whether we have unsaved changes */
+	unsigned int untracked_dirty:1; /* the untracked cache has unsaved changes */
+	unsigned int fsmonitor_dirty:1; /* the fsmonitor state has unsaved changes */
 
 	git_tree_cache *tree;
 	git_pool tree_pool;
 
+	git_untracked_cache *untracked;
+
+	/* the filesystem monitor's token, when the index was last checked */
+	char *fsmonitor_token;
+
+	git_index_split *split;
+
 	git_vector names;
 	git_vector reuc;
 
@@ -129,6 +175,31 @@ extern int git_index__find_pos(
 
 extern int git_index__fill(git_index *index, const git_vector *source_entries);
 
+/*
+ * Ask the filesystem monitor which paths changed since the index's
+ * token, and stop trusting the entries for them.
+ */
+extern int git_index__fsmonitor_refresh(git_index *index, git_fsmonitor *monitor);
+
+/* Trust an entry, that was just found to match the working directory */
+extern void git_index__fsmonitor_mark_valid(
+	git_index *index, const git_index_entry *entry);
+
+/*
+ * Stat the files of the entries beneath `prefix` on several threads, like
+ * git's `core.preloadIndex`, and mark the ones that match their entry.
+ * `stat_calls` is set to the number of files that were stat'ed, which is
+ * 0 when the index is too small to be worth it.
+ */
+extern int git_index__preload(
+	size_t *stat_calls,
+	git_index *index,
+	git_repository *repo,
+	const char *prefix);
+
+/* Forget the entries that were marked by `git_index__preload` */
+extern void git_index__preload_clear(git_index *index);
+
 extern void git_index__set_ignore_case(git_index *index, bool ignore_case);
 
 extern unsigned int git_index__create_mode(unsigned int mode);
@@ -35,14 +35,56 @@ struct entry {
 	uint64_t offset_long;
 };
 
+#ifdef GIT_THREADS
+
+struct pipeline_chunk {
+	struct pipeline_chunk *next;
+	size_t len;
+	char data[GIT_FLEX_ARRAY];
+};
+
+struct indexer_pipeline {
+	git_mutex lock;
+	git_cond cond;
+	git_thread writer;
+	git_thread parser;
+
+	unsigned int writer_done :1,
+		done :1,
+		have_stats :1;
+
+	/* Set once the threads have been joined */
+	bool finished;
+
+	/* Data received but not yet written to the packfile */
+	struct pipeline_chunk *head;
+	struct pipeline_chunk *tail;
+	size_t queued;
+
+	/* Number of bytes written to the packfile so far */
+	off64_t written;
+
+	/* The parser's own statistics, and the snapshot it last published */
+	git_indexer_progress parser_stats;
+	git_indexer_progress stats;
+
+	int error;
+	git_error *error_info;
+};
+
+#endif
+
 struct git_indexer {
 	unsigned int parsed_header :1,
 		pack_committed :1,
 		have_stream :1,
 		have_delta :1,
 		do_fsync :1,
-		do_verify :1;
+		do_verify :1,
+		do_pipeline :1,
+		do_write_rev :1;
 	git_oid_t oid_type;
+	unsigned int threads;
 	struct git_pack_header hdr;
 	struct git_pack_file *pack;
 	unsigned int mode;
@@ -72,10 +114,16 @@ struct git_indexer {
 	char inbuf[GIT_HASH_MAX_SIZE];
 	size_t inbuf_len;
 	git_hash_ctx trailer;
+
+#ifdef GIT_THREADS
+	/* Worker threads writing and parsing appended data, if pipelined */
+	struct indexer_pipeline *pipeline;
+#endif
 };
 
 struct delta_info {
 	off64_t delta_off;
+	off64_t delta_end;
 };
 
 #ifndef GIT_DEPRECATE_HARD
@@ -186,6 +234,9 @@ static int indexer_new(
 		goto cleanup;
 
 	idx->do_verify = opts.verify;
+	idx->threads = opts.threads;
+	idx->do_pipeline = !!opts.pipeline;
+	idx->do_write_rev = !!opts.write_reverse_index;
 
 	if (git_repository__fsync_gitdir)
 		idx->do_fsync = 1;
@@ -268,6 +319,7 @@ static int store_delta(git_indexer *idx)
 	delta = git__calloc(1, sizeof(struct delta_info));
 	GIT_ERROR_CHECK_ALLOC(delta);
 	delta->delta_off = idx->entry_start;
+	delta->delta_end = idx->off;
 
 	if (git_vector_insert(&idx->deltas, delta) < 0)
 		return -1;
@@ -581,9 +633,11 @@ static int save_entry(git_indexer *idx, struct entry *entry, struct git_pack_ent
 		return -1;
 	}
 
-	/* Add the object to the list */
-	if (git_vector_insert(&idx->objects, entry) < 0)
+	/* Add the object to the list; the caller still owns both on error */
+	if (git_vector_insert(&idx->objects, entry) < 0) {
+		git_oidmap_delete(idx->pack->idx_cache, &pentry->id);
 		return -1;
+	}
 
 	for (i = entry->oid.id[0]; i < 256; ++i) {
 		idx->fanout[i]++;
@@ -618,7 +672,10 @@ static int hash_and_save(git_indexer *idx, git_rawobj *obj, off64_t entry_start)
 	if (crc_object(&entry->crc, &idx->pack->mwf, entry_start, entry_size) < 0)
 		goto on_error;
 
-	return save_entry(idx, entry, pentry, entry_start);
+	if (save_entry(idx, entry, pentry, entry_start) < 0)
+		goto on_error;
+
+	return 0;
 
 on_error:
 	git__free(pentry);
@@ -629,6 +686,12 @@ on_error:
 
 static int do_progress_callback(git_indexer *idx, git_indexer_progress *stats)
 {
+#ifdef GIT_THREADS
+	/* The pipeline reports its progress from the caller's thread */
+	if (idx->pipeline && !idx->pipeline->finished)
+		return 0;
+#endif
+
 	if (idx->progress_cb)
 		return git_error_set_after_callback_function(
 			idx->progress_cb(stats, idx->progress_payload),
@@ -700,9 +763,9 @@ static int write_at(git_indexer *idx, const void *data, off64_t offset, size_t s
 	return 0;
 }
 
-static int append_to_pack(git_indexer *idx, const void *data, size_t size)
+static int append_to_pack_at(git_indexer *idx, off64_t offset, const void *data, size_t size)
 {
-	if (write_at(idx, data, idx->pack->mwf.size, size) < 0) {
+	if (write_at(idx, data, offset, size) < 0) {
 		git_error_set(GIT_ERROR_OS, "cannot extend packfile '%s'", idx->pack->pack_name);
 		return -1;
 	}
@@ -749,13 +812,13 @@ static int write_at(git_indexer *idx, const void *data, off64_t offset, size_t s
 	return 0;
 }
 
-static int append_to_pack(git_indexer *idx, const void *data, size_t size)
+static int append_to_pack_at(git_indexer *idx, off64_t offset, const void *data, size_t size)
 {
 	off64_t new_size;
 	size_t mmap_alignment;
 	size_t page_offset;
 	off64_t page_start;
-	off64_t current_size = idx->pack->mwf.size;
+	off64_t current_size = offset;
 	int error;
 
 	if (!size)
@@ -777,11 +840,16 @@ static int append_to_pack(git_indexer *idx, const void *data, size_t size)
 		return -1;
 	}
 
-	return write_at(idx, data, idx->pack->mwf.size, size);
+	return write_at(idx, data, offset, size);
 }
 
 #endif
 
+static int append_to_pack(git_indexer *idx, const void *data, size_t size)
+{
+	return append_to_pack_at(idx, idx->pack->mwf.size, data, size);
+}
+
 static int read_stream_object(git_indexer *idx, git_indexer_progress *stats)
 {
 	git_packfile_stream *stream = &idx->stream;
@@ -873,24 +941,12 @@ static int read_stream_object(git_indexer *idx, git_indexer_progress *stats)
 	return 0;
 }
 
-int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_indexer_progress *stats)
+static int parse_available(git_indexer *idx, git_indexer_progress *stats)
 {
 	int error = -1;
 	struct git_pack_header *hdr = &idx->hdr;
 	git_mwindow_file *mwf = &idx->pack->mwf;
 
-	GIT_ASSERT_ARG(idx);
-	GIT_ASSERT_ARG(data);
-	GIT_ASSERT_ARG(stats);
-
-	if ((error = append_to_pack(idx, data, size)) < 0)
-		return error;
-
-	hash_partially(idx, data, (int)size);
-
-	/* Make sure we set the new size of the pack */
-	idx->pack->mwf.size += size;
-
 	if (!idx->parsed_header) {
 		unsigned int total_objects;
 
@@ -954,6 +1010,362 @@ on_error:
 	return error;
 }
 
+#ifdef GIT_THREADS
+
+/*
+ * In pipelined mode `git_indexer_append` only queues a copy of the data.
+ * A writer thread appends it to the packfile and feeds the trailer hash,
+ * and a parser thread inflates and hashes the objects as they become
+ * available in the packfile.  Only the queue of received data holds
+ * memory; the caller blocks once this many bytes are waiting for the
+ * writer.
+ */
+#define PIPELINE_QUEUE_LIMIT (16 * 1024 * 1024)
+
+/* Run with the pipeline lock held */
+static void pipeline_fail(struct indexer_pipeline *pipeline, int error)
+{
+	if (!pipeline->error) {
+		pipeline->error = error;
+		git_error_save(&pipeline->error_info);
+	}
+
+	git_cond_broadcast(&pipeline->cond);
+}
+
+/* Run with the pipeline lock held */
+static int pipeline_error(struct indexer_pipeline *pipeline)
+{
+	if (pipeline->error_info && pipeline->error_info->message)
+		git_error_set_str(pipeline->error_info->klass,
+			pipeline->error_info->message);
+
+	return pipeline->error;
+}
+
+static void *pipeline_writer(void *payload)
+{
+	git_indexer *idx = payload;
+	struct indexer_pipeline *pipeline = idx->pipeline;
+	struct pipeline_chunk *chunk;
+	off64_t offset;
+	int error;
+
+	git_mutex_lock(&pipeline->lock);
+	offset = pipeline->written;
+
+	while (!pipeline->error) {
+		if ((chunk = pipeline->head) == NULL) {
+			if (pipeline->done)
+				break;
+
+			git_cond_wait(&pipeline->cond, &pipeline->lock);
+			continue;
+		}
+
+		if ((pipeline->head = chunk->next) == NULL)
+			pipeline->tail = NULL;
+
+		git_mutex_unlock(&pipeline->lock);
+
+		if ((error = append_to_pack_at(idx, offset, chunk->data, chunk->len)) == 0)
+			hash_partially(idx, (const uint8_t *)chunk->data, chunk->len);
+
+		git_mutex_lock(&pipeline->lock);
+
+		pipeline->queued -= chunk->len;
+		offset += chunk->len;
+		git__free(chunk);
+
+		if (error < 0) {
+			pipeline_fail(pipeline, error);
+			break;
+		}
+
+		pipeline->written = offset;
+		git_cond_broadcast(&pipeline->cond);
+	}
+
+	pipeline->writer_done = 1;
+	git_cond_broadcast(&pipeline->cond);
+	git_mutex_unlock(&pipeline->lock);
+
+	return NULL;
+}
+
+static void *pipeline_parser(void *payload)
+{
+	git_indexer *idx = payload;
+	struct indexer_pipeline *pipeline = idx->pipeline;
+	off64_t written;
+	int error;
+
+	git_mutex_lock(&pipeline->lock);
+
+	while (!pipeline->error) {
+		if ((written = pipeline->written) == idx->pack->mwf.size) {
+			if (pipeline->writer_done)
+				break;
+
+			git_cond_wait(&pipeline->cond, &pipeline->lock);
+			continue;
+		}
+
+		git_mutex_unlock(&pipeline->lock);
+
+		idx->pack->mwf.size = written;
+		error = parse_available(idx, &pipeline->parser_stats);
+
+		git_mutex_lock(&pipeline->lock);
+
+		if (error < 0) {
+			pipeline_fail(pipeline, error);
+			break;
+		}
+
+		if (idx->parsed_header) {
+			memcpy(&pipeline->stats, &pipeline->parser_stats, sizeof(git_indexer_progress));
+			pipeline->have_stats = 1;
+		}
+	}
+
+	git_mutex_unlock(&pipeline->lock);
+
+	return NULL;
+}
+
+static void pipeline_stop(struct indexer_pipeline *pipeline, bool abort)
+{
+	git_mutex_lock(&pipeline->lock);
+
+	if (abort && !pipeline->error)
+		pipeline->error = -1;
+
+	pipeline->done = 1;
+	git_cond_broadcast(&pipeline->cond);
+	git_mutex_unlock(&pipeline->lock);
+
+	git_thread_join(&pipeline->writer, NULL);
+	git_thread_join(&pipeline->parser, NULL);
+
+	pipeline->finished = 1;
+}
+
+static void pipeline_free(struct indexer_pipeline *pipeline)
+{
+	struct pipeline_chunk *chunk;
+
+	if (!pipeline)
+		return;
+
+	while ((chunk = pipeline->head) != NULL) {
+		pipeline->head = chunk->next;
+		git__free(chunk);
+	}
+
+	git_error_free(pipeline->error_info);
+	git_cond_free(&pipeline->cond);
+	git_mutex_free(&pipeline->lock);
+	git__free(pipeline);
+}
+
+static int pipeline_start(git_indexer *idx)
+{
+	struct indexer_pipeline *pipeline;
+
+	pipeline = git__calloc(1, sizeof(struct indexer_pipeline));
+	GIT_ERROR_CHECK_ALLOC(pipeline);
+
+	if (git_mutex_init(&pipeline->lock) < 0) {
+		git__free(pipeline);
+		git_error_set(GIT_ERROR_OS, "failed to initialize indexer lock");
+		return -1;
+	}
+
+	if (git_cond_init(&pipeline->cond) < 0) {
+		git_mutex_free(&pipeline->lock);
+		git__free(pipeline);
+		git_error_set(GIT_ERROR_OS, "failed to initialize indexer condition");
+		return -1;
+	}
+
+	pipeline->written = idx->pack->mwf.size;
+	idx->pipeline = pipeline;
+
+	if (git_thread_create(&pipeline->writer, pipeline_writer, idx) < 0) {
+		idx->pipeline = NULL;
+		pipeline_free(pipeline);
+		git_error_set(GIT_ERROR_THREAD, "unable to create indexer thread");
+		return -1;
+	}
+
+	if (git_thread_create(&pipeline->parser, pipeline_parser, idx) < 0) {
+		git_mutex_lock(&pipeline->lock);
+		pipeline_fail(pipeline, -1);
+		git_mutex_unlock(&pipeline->lock);
+		git_thread_join(&pipeline->writer, NULL);
+		idx->pipeline = NULL;
+		pipeline_free(pipeline);
+		git_error_set(GIT_ERROR_THREAD, "unable to create indexer thread");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int pipeline_report(
+	git_indexer *idx,
+	git_indexer_progress *stats,
+	const git_indexer_progress *snapshot)
+{
+	if (!memcmp(stats, snapshot, sizeof(git_indexer_progress)))
+		return 0;
+
+	memcpy(stats, snapshot, sizeof(git_indexer_progress));
+
+	if (idx->progress_cb)
+		return git_error_set_after_callback_function(
+			idx->progress_cb(stats, idx->progress_payload),
+			"indexer progress");
+
+	return 0;
+}
+
+static int pipeline_append(
+	git_indexer *idx,
+	const void *data,
+	size_t size,
+	git_indexer_progress *stats)
+{
+	struct indexer_pipeline *pipeline = idx->pipeline;
+	struct pipeline_chunk *chunk;
+	git_indexer_progress snapshot;
+	size_t alloclen;
+	bool have_stats;
+	int error;
+
+	GIT_ERROR_CHECK_ALLOC_ADD(&alloclen, sizeof(struct pipeline_chunk), size);
+	chunk = git__malloc(alloclen);
+	GIT_ERROR_CHECK_ALLOC(chunk);
+
+	chunk->next = NULL;
+	chunk->len = size;
+	memcpy(chunk->data, data, size);
+
+	if (git_mutex_lock(&pipeline->lock) < 0) {
+		git__free(chunk);
+		git_error_set(GIT_ERROR_OS, "failed to lock indexer");
+		return -1;
+	}
+
+	while (!pipeline->error && pipeline->queued &&
+	       pipeline->queued + size > PIPELINE_QUEUE_LIMIT)
+		git_cond_wait(&pipeline->cond, &pipeline->lock);
+
+	if ((error = pipeline_error(pipeline)) < 0) {
+		git_mutex_unlock(&pipeline->lock);
+		git__free(chunk);
+		return error;
+	}
+
+	if (pipeline->tail)
+		pipeline->tail->next = chunk;
+	else
+		pipeline->head = chunk;
+
+	pipeline->tail = chunk;
+	pipeline->queued += size;
+	git_cond_broadcast(&pipeline->cond);
+
+	have_stats = pipeline->have_stats;
+	memcpy(&snapshot, &pipeline->stats, sizeof(git_indexer_progress));
+
+	git_mutex_unlock(&pipeline->lock);
+
+	return have_stats ? pipeline_report(idx, stats, &snapshot) : 0;
+}
+
+static int pipeline_finish(git_indexer *idx, git_indexer_progress *stats)
+{
+	struct indexer_pipeline *pipeline = idx->pipeline;
+	int error;
+
+	if (!pipeline->finished)
+		pipeline_stop(pipeline, false);
+
+	if ((error = pipeline_error(pipeline)) < 0)
+		return error;
+
+	return pipeline->have_stats ?
+		pipeline_report(idx, stats, &pipeline->stats) : 0;
+}
+
+#endif
+
+int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_indexer_progress *stats)
+{
+	int error = -1;
+
+	GIT_ASSERT_ARG(idx);
+	GIT_ASSERT_ARG(data);
+	GIT_ASSERT_ARG(stats);
+
+#ifdef GIT_THREADS
+	if (!idx->pipeline && idx->do_pipeline && !idx->parsed_header &&
+	    (error = pipeline_start(idx)) < 0)
+		return error;
+
+	if (idx->pipeline)
+		return pipeline_append(idx, data, size, stats);
+#endif
+
+	if ((error = append_to_pack(idx, data, size)) < 0)
+		return error;
+
+	hash_partially(idx, data, (int)size);
+
+	/* Make sure we set the new size of the pack */
+	idx->pack->mwf.size += size;
+
+	return parse_available(idx, stats);
+}
+
+GIT_INLINE(uint64_t) entry_offset(const struct entry *entry)
+{
+	return entry->offset == UINT32_MAX ? entry->offset_long : entry->offset;
+}
+
+static int entry_offset_cmp(const void *a, const void *b, void *payload)
+{
+	const git_vector *objects = payload;
+	uint64_t a_off = entry_offset(git_vector_get(objects, *(const uint32_t *)a));
+	uint64_t b_off = entry_offset(git_vector_get(objects, *(const uint32_t *)b));
+
+	return (a_off > b_off) - (a_off < b_off);
+}
+
+/* Write the reverse index for the (sorted) objects of the pack */
+static int write_revindex(git_indexer *idx, const char *path, const unsigned char *pack_checksum)
+{
+	uint32_t *positions, i;
+	size_t count = git_vector_length(&idx->objects);
+	int error;
+
+	positions = git__calloc(count ? count : 1, sizeof(uint32_t));
+	GIT_ERROR_CHECK_ALLOC(positions);
+
+	for (i = 0; i < count; i++)
+		positions[i] = i;
+
+	git__qsort_r(positions, count, sizeof(uint32_t), entry_offset_cmp, &idx->objects);
+
+	error = git_packfile_revindex_write(path, positions, count,
+		pack_checksum, idx->oid_type, idx->mode, idx->do_fsync);
+
+	git__free(positions);
+	return error;
+}
+
 static int index_path(git_str *path, git_indexer *idx, const char *suffix)
 {
 	const char prefix[] = "pack-";
@@ -1126,6 +1538,244 @@ static int fix_thin_pack(git_indexer *idx, git_indexer_progress *stats)
 	return 0;
 }
 
+#ifdef GIT_THREADS
+
+/*
+ * Deltas are resolved in batches: the worker threads inflate, hash and
+ * checksum a batch of deltas, and the calling thread then records the
+ * results in pack order, so that the idx_cache, the object list and the
+ * progress callbacks are only ever touched from a single thread.
+ */
+#define RESOLVE_BATCH_PER_THREAD 256
+
+/*
+ * Workers claim this many consecutive deltas at a time; neighbouring
+ * deltas tend to share their bases, which keeps the delta base cache warm.
+ */
+#define RESOLVE_CHUNK_SIZE 16
+
+struct resolved_delta {
+	size_t pos;
+	off64_t entry_start;
+	off64_t entry_end;
+	git_rawobj obj;
+	git_oid oid;
+	uint32_t crc;
+	int error;
+	git_error *error_info;
+};
+
+struct resolve_context {
+	git_indexer *idx;
+	struct resolved_delta *deltas;
+	size_t deltas_len;
+	git_atomic32 next;
+};
+
+static void resolve_one_delta(git_indexer *idx, struct resolved_delta *delta)
+{
+	off64_t off = delta->entry_start;
+	int error;
+
+	if ((error = git_packfile_unpack(&delta->obj, idx->pack, &off)) < 0)
+		goto done;
+
+	if ((error = git_odb__hashobj(&delta->oid, &delta->obj, idx->oid_type)) < 0) {
+		git_error_set(GIT_ERROR_INDEXER, "failed to hash object");
+		goto done;
+	}
+
+	if ((error = crc_object(&delta->crc, &idx->pack->mwf,
+			delta->entry_start, delta->entry_end - delta->entry_start)) < 0)
+		goto done;
+
+	/* The object data is only needed for connectivity checks */
+	if (!idx->do_verify) {
+		git__free(delta->obj.data);
+		delta->obj.data = NULL;
+	}
+
+done:
+	if (error < 0) {
+		git__free(delta->obj.data);
+		delta->obj.data = NULL;
+
+		if (error != GIT_PASSTHROUGH)
+			git_error_save(&delta->error_info);
+	}
+
+	delta->error = error;
+}
+
+static void *resolve_deltas_worker(void *payload)
+{
+	struct resolve_context *ctx = payload;
+	size_t start, end;
+
+	while ((start = (size_t)(git_atomic32_add(&ctx->next,
+			RESOLVE_CHUNK_SIZE) - RESOLVE_CHUNK_SIZE)) < ctx->deltas_len) {
+		end = min(start + RESOLVE_CHUNK_SIZE, ctx->deltas_len);
+
+		for (; start < end; start++)
+			resolve_one_delta(ctx->idx, &ctx->deltas[start]);
+	}
+
+	return NULL;
+}
+
+static int save_resolved_delta(
+	git_indexer *idx,
+	git_indexer_progress *stats,
+	struct resolved_delta *resolved,
+	int *progressed)
+{
+	struct delta_info *delta;
+	struct entry *entry;
+	struct git_pack_entry *pentry;
+	int error;
+
+	if (resolved->error == GIT_PASSTHROUGH) {
+		/* We have not seen the base object, we'll try again later. */
+		return 0;
+	} else if (resolved->error < 0) {
+		git_error_restore(resolved->error_info);
+		resolved->error_info = NULL;
+		return -1;
+	}
+
+	if (idx->do_verify && check_object_connectivity(idx, &resolved->obj) < 0)
+		return 0;
+
+	entry = git__calloc(1, sizeof(*entry));
+	GIT_ERROR_CHECK_ALLOC(entry);
+
+	pentry = git__calloc(1, sizeof(struct git_pack_entry));
+	if (!pentry) {
+		git__free(entry);
+		return -1;
+	}
+
+	git_oid_cpy(&pentry->id, &resolved->oid);
+	git_oid_cpy(&entry->oid, &resolved->oid);
+	entry->crc = resolved->crc;
+
+	/* eg a duplicate object; like the sequential path, skip it */
+	if (save_entry(idx, entry, pentry, resolved->entry_start) < 0) {
+		git__free(pentry);
+		git__free(entry);
+		return 0;
+	}
+
+	stats->indexed_objects++;
+	stats->indexed_deltas++;
+	*progressed = 1;
+
+	if ((error = do_progress_callback(idx, stats)) < 0)
+		return error;
+
+	/* remove from the list */
+	delta = git_vector_get(&idx->deltas, resolved->pos);
+	git_vector_set(NULL, &idx->deltas, resolved->pos, NULL);
+	git__free(delta);
+
+	return 0;
+}
+
+static int resolve_deltas_threaded(git_indexer *idx, git_indexer_progress *stats)
+{
+	struct resolve_context ctx = {0};
+	git_thread *threads = NULL;
+	struct delta_info *delta;
+	size_t batch_size, nthreads, started, pos, i;
+	int progressed, non_null, error = 0;
+
+	nthreads = idx->threads - 1;
+	GIT_ERROR_CHECK_ALLOC_MULTIPLY(&batch_size, idx->threads, RESOLVE_BATCH_PER_THREAD);
+
+	threads = git__calloc(nthreads, sizeof(git_thread));
+	GIT_ERROR_CHECK_ALLOC(threads);
+
+	ctx.idx = idx;
+	ctx.deltas = git__calloc(batch_size, sizeof(struct resolved_delta));
+	if (!ctx.deltas) {
+		error = -1;
+		goto done;
+	}
+
+	while (idx->deltas.length > 0) {
+		progressed = 0;
+		non_null = 0;
+		pos = 0;
+
+		while (pos < idx->deltas.length) {
+			ctx.deltas_len = 0;
+
+			for (; pos < idx->deltas.length && ctx.deltas_len < batch_size; pos++) {
+				struct resolved_delta *resolved;
+
+				if ((delta = git_vector_get(&idx->deltas, pos)) == NULL)
+					continue;
+
+				resolved = &ctx.deltas[ctx.deltas_len++];
+				memset(resolved, 0, sizeof(*resolved));
+				resolved->pos = pos;
+				resolved->entry_start = delta->delta_off;
+				resolved->entry_end = delta->delta_end;
+			}
+
+			if (!ctx.deltas_len)
+				break;
+
+			non_null = 1;
+			git_atomic32_set(&ctx.next, 0);
+
+			/*
+			 * The calling thread works on the batch as well, so
+			 * failing to start a thread only costs parallelism.
+			 */
+			for (started = 0; started < nthreads; started++) {
+				if (git_thread_create(&threads[started],
+						resolve_deltas_worker, &ctx) < 0)
+					break;
+			}
+
+			resolve_deltas_worker(&ctx);
+
+			for (i = 0; i < started; i++)
+				git_thread_join(&threads[i], NULL);
+
+			for (i = 0; i < ctx.deltas_len; i++) {
+				struct resolved_delta *resolved = &ctx.deltas[i];
+
+				if (!error)
+					error = save_resolved_delta(idx, stats, resolved, &progressed);
+
+				git__free(resolved->obj.data);
+				git_error_free(resolved->error_info);
+			}
+
+			if (error < 0)
+				goto done;
+		}
+
+		/* if none were actually set, we're done */
+		if (!non_null)
+			break;
+
+		if (!progressed && (fix_thin_pack(idx, stats) < 0)) {
+			error = -1;
+			goto done;
+		}
+	}
+
+done:
+	git__free(ctx.deltas);
+	git__free(threads);
+	return error;
+}
+
+#endif
+
 static int resolve_deltas(git_indexer *idx, git_indexer_progress *stats)
 {
 	unsigned int i;
@@ -1133,6 +1783,11 @@ static int resolve_deltas(git_indexer *idx, git_indexer_progress *stats)
 	struct delta_info *delta;
 	int progressed = 0, non_null = 0, progress_cb_result;
 
+#ifdef GIT_THREADS
+	if (idx->threads > 1)
+		return resolve_deltas_threaded(idx, stats);
+#endif
+
 	while (idx->deltas.length > 0) {
 		progressed = 0;
 		non_null = 0;
@@ -1152,6 +1807,12 @@ static int resolve_deltas(git_indexer *idx, git_indexer_progress *stats)
 				return -1;
 			}
 
+			/*
+			 * The unpacker leaves the offset alone when the delta
+			 * itself was served from the delta base cache.
+			 */
+			idx->off = delta->delta_end;
+
 			if (idx->do_verify && check_object_connectivity(idx, &obj) < 0)
 				/* TODO: error? continue? */
 				continue;
@@ -1241,6 +1902,11 @@ int git_indexer_commit(git_indexer *idx, git_indexer_progress *stats)
 	int filebuf_hash;
 	bool mismatch;
 
+#ifdef GIT_THREADS
+	if (idx->pipeline && (error = pipeline_finish(idx, stats)) < 0)
+		return error;
+#endif
+
 	if (!idx->parsed_header) {
 		git_error_set(GIT_ERROR_INDEXER, "incomplete pack header");
 		return -1;
@@ -1382,6 +2048,12 @@ int git_indexer_commit(git_indexer *idx, git_indexer_progress *stats)
 
 	git_filebuf_write(&index_file, checksum, checksum_size);
 
+	/* The reverse index needs to be in place before the index is */
+	if (idx->do_write_rev &&
+	    (index_path(&filename, idx, ".rev") < 0 ||
+	     write_revindex(idx, filename.ptr, idx->checksum) < 0))
+		goto on_error;
+
 	/* Figure out what the final name should be */
 	if (index_path(&filename, idx, ".idx") < 0)
 		goto on_error;
@@ -1453,6 +2125,15 @@ void git_indexer_free(git_indexer *idx)
 	if (idx == NULL)
 		return;
 
+#ifdef GIT_THREADS
+	if (idx->pipeline) {
+		if (!idx->pipeline->finished)
+			pipeline_stop(idx->pipeline, true);
+
+		pipeline_free(idx->pipeline);
+	}
+#endif
+
 	if (idx->have_stream)
 		git_packfile_stream_dispose(&idx->stream);
 
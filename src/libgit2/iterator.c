@@ -10,6 +10,7 @@
 #include "tree.h"
 #include "index.h"
 #include "path.h"
+#include "sparse-checkout.h"
 
 #define GIT_ITERATOR_FIRST_ACCESS   (1 << 15)
 #define GIT_ITERATOR_HONOR_IGNORES  (1 << 16)
@@ -171,6 +172,7 @@ static void iterator_clear(git_iterator *iter)
 	iter->started = false;
 	iter->ended = false;
 	iter->stat_calls = 0;
+	iter->skipped_stat_calls = 0;
 	iter->pathlist_walk_idx = 0;
 	iter->flags &= ~GIT_ITERATOR_FIRST_ACCESS;
 }
@@ -1042,6 +1044,13 @@ typedef struct {
 	git_index *index;
 	git_vector index_snapshot;
 
+	/* list unchanged directories from the index's untracked cache */
+	bool use_untracked_cache;
+	bool trust_ctime;
+
+	/* don't walk the directories outside of the sparse checkout */
+	git_sparse_checkout sparse;
+
 	git_oid_t oid_type;
 
 	git_array_t(filesystem_iterator_frame) frames;
@@ -1340,6 +1349,307 @@ static int filesystem_iterator_entry_init(
 	return error;
 }
 
+/*
+ * Whether the index assumes that the file is unchanged, so that its
+ * stat data is never compared: either it is marked "assume unchanged"
+ * or it is outside of the sparse checkout.  Only trust it when readdir
+ * says that the file is still of the same type.
+ */
+GIT_INLINE(bool) filesystem_iterator_index_assumes(
+	filesystem_iterator *iter,
+	const git_index_entry *entry,
+	unsigned int type)
+{
+	return (iter->base.flags & GIT_ITERATOR_SKIP_KNOWN_STAT) &&
+		((entry->flags & GIT_INDEX_ENTRY_VALID) ||
+		 (entry->flags_extended & GIT_INDEX_ENTRY_SKIP_WORKTREE)) &&
+		type == GIT_MODE_TYPE(entry->mode);
+}
+
+/*
+ * Take the stat data of a file that is known to match its index entry
+ * from that entry, rather than from the filesystem: when the filesystem
+ * monitor has not seen it change since it matched, when it was just
+ * preloaded, or when the index assumes it unchanged anyway.
+ */
+static bool filesystem_iterator_index_stat(
+	struct stat *st,
+	filesystem_iterator *iter,
+	const char *path,
+	unsigned int type)
+{
+	const git_index_entry *entry;
+	uint16_t valid = 0;
+
+	if (iter->base.flags & GIT_ITERATOR_USE_FSMONITOR)
+		valid |= GIT_INDEX_ENTRY__FSMONITOR_VALID;
+
+	if (iter->base.flags & GIT_ITERATOR_USE_PRELOAD)
+		valid |= GIT_INDEX_ENTRY__PRELOADED;
+
+	if (!(valid || (iter->base.flags & GIT_ITERATOR_SKIP_KNOWN_STAT)) ||
+	    !iter->index ||
+	    (entry = git_index_get_bypath(iter->index, path, 0)) == NULL ||
+	    (!S_ISREG(entry->mode) && !S_ISLNK(entry->mode)) ||
+	    !((entry->flags_extended & valid) ||
+	      filesystem_iterator_index_assumes(iter, entry, type)))
+		return false;
+
+	memset(st, 0, sizeof(struct stat));
+	st->st_mode = entry->mode;
+	st->st_size = entry->file_size;
+	st->st_rdev = entry->dev;
+	st->st_ino = entry->ino;
+	st->st_uid = entry->uid;
+	st->st_gid = entry->gid;
+	st->st_ctime = entry->ctime.seconds;
+	st->st_mtime = entry->mtime.seconds;
+#if defined(GIT_USE_NSEC)
+	st->st_ctime_nsec = entry->ctime.nanoseconds;
+	st->st_mtime_nsec = entry->mtime.nanoseconds;
+#endif
+
+	return true;
+}
+
+/*
+ * Add the entry for `fullpath` to the new frame, unless it is filtered
+ * out.  When the name was read from the directory, `diriter` is used to
+ * stat it.
+ */
+static int filesystem_iterator_frame_add(
+	filesystem_iterator *iter,
+	filesystem_iterator_frame *new_frame,
+	filesystem_iterator_entry *frame_entry,
+	git_fs_path_diriter *diriter,
+	const char *fullpath,
+	size_t fullpath_len)
+{
+	iterator_pathlist_search_t pathlist_match = ITERATOR_PATHLIST_FULL;
+	git_str path_str = GIT_STR_INIT;
+	filesystem_iterator_entry *entry;
+	struct stat statbuf;
+	const char *path;
+	size_t path_len;
+	unsigned int type = 0;
+	bool dir_expected = false;
+	int error;
+
+	path_str.ptr = (char *)fullpath;
+	path_str.size = fullpath_len;
+
+	if ((error = git_path_validate_str_length(iter->base.repo, &path_str)) < 0)
+		return error;
+
+	GIT_ASSERT(fullpath_len > iter->root_len);
+
+	/* remove the prefix if requested */
+	path = fullpath + iter->root_len;
+	path_len = fullpath_len - iter->root_len;
+
+	/* examine start / end and the pathlist to see if this path is in it.
+	 * note that since we haven't yet stat'ed the path, we cannot know
+	 * whether it's a directory yet or not, so this can give us an
+	 * expected type (S_IFDIR or S_IFREG) that we should examine)
+	 */
+	if (!filesystem_iterator_examine_path(&dir_expected, &pathlist_match,
+		iter, frame_entry, path, path_len))
+		return 0;
+
+	if (diriter)
+		type = git_fs_path_diriter_type(diriter);
+
+	/*
+	 * Files that are known to match the index are not stat'ed.  Nor are
+	 * directories, whose stat data is only needed to look them up in the
+	 * untracked cache.
+	 */
+	if (filesystem_iterator_index_stat(&statbuf, iter, path, type)) {
+		iter->base.skipped_stat_calls++;
+	} else if (type == S_IFDIR &&
+	           (iter->base.flags & GIT_ITERATOR_SKIP_KNOWN_STAT) &&
+	           !iter->use_untracked_cache) {
+		memset(&statbuf, 0, sizeof(statbuf));
+		statbuf.st_mode = S_IFDIR;
+
+		iter->base.skipped_stat_calls++;
+	} else {
+		error = diriter ?
+			git_fs_path_diriter_stat(&statbuf, diriter) :
+			git_fs_path_lstat(fullpath, &statbuf);
+
+		if (error < 0) {
+			/* file was removed between readdir and lstat */
+			if (error == GIT_ENOTFOUND)
+				return 0;
+
+			/* treat the file as unreadable */
+			memset(&statbuf, 0, sizeof(statbuf));
+			statbuf.st_mode = GIT_FILEMODE_UNREADABLE;
+
+			error = 0;
+		}
+
+		iter->base.stat_calls++;
+	}
+
+	/* Ignore wacky things in the filesystem */
+	if (!S_ISDIR(statbuf.st_mode) &&
+		!S_ISREG(statbuf.st_mode) &&
+		!S_ISLNK(statbuf.st_mode) &&
+		statbuf.st_mode != GIT_FILEMODE_UNREADABLE)
+		return 0;
+
+	if (filesystem_iterator_is_dot_git(iter, path, path_len))
+		return 0;
+
+	if (S_ISDIR(statbuf.st_mode) &&
+	    git_sparse_checkout_prunes_dir(&iter->sparse, path, path_len))
+		return 0;
+
+	/* convert submodules to GITLINK and remove trailing slashes */
+	if (S_ISDIR(statbuf.st_mode)) {
+		bool submodule = false;
+
+		if ((error = filesystem_iterator_is_submodule(&submodule,
+				iter, path, path_len)) < 0)
+			return error;
+
+		if (submodule)
+			statbuf.st_mode = GIT_FILEMODE_COMMIT;
+	}
+
+	/* Ensure that the pathlist entry lines up with what we expected */
+	else if (dir_expected)
+		return 0;
+
+	if ((error = filesystem_iterator_entry_init(&entry,
+		iter, new_frame, path, path_len, &statbuf, pathlist_match)) < 0)
+		return error;
+
+	return git_vector_insert(&new_frame->entries, entry);
+}
+
+/*
+ * Collect the names in the directory `dir` (relative to the root, with
+ * a trailing slash) that the index has entries for, or entries beneath.
+ */
+static int filesystem_iterator_index_names(
+	git_vector *out,
+	git_pool *pool,
+	filesystem_iterator *iter,
+	const char *dir,
+	size_t dir_len)
+{
+	const git_vector *entries = &iter->index_snapshot;
+	const git_index_entry *entry;
+	const char *name, *end, *last = NULL;
+	size_t lo = 0, hi = entries->length, mid, len, last_len = 0;
+	char *copy;
+
+	/* the entries beneath a directory are next to each other */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		entry = git_vector_get(entries, mid);
+
+		if (strcmp(entry->path, dir) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < entries->length; lo++) {
+		entry = git_vector_get(entries, lo);
+
+		if (strncmp(entry->path, dir, dir_len) != 0)
+			break;
+
+		name = entry->path + dir_len;
+		len = (end = strchr(name, '/')) ? (size_t)(end - name) : strlen(name);
+
+		if (last && last_len == len && memcmp(last, name, len) == 0)
+			continue;
+
+		if ((copy = git_pool_strndup(pool, name, len)) == NULL ||
+		    git_vector_insert(out, copy) < 0)
+			return -1;
+
+		last = name;
+		last_len = len;
+	}
+
+	git_vector_sort(out);
+	git_vector_uniq(out, NULL);
+	return 0;
+}
+
+/*
+ * Fill the new frame from the untracked cache if it has the directory's
+ * names for its current stat data: those are the names of the index
+ * plus the cached ones.  Returns GIT_ENOTFOUND if it does not.
+ */
+static int filesystem_iterator_frame_from_cache(
+	filesystem_iterator *iter,
+	filesystem_iterator_frame *new_frame,
+	filesystem_iterator_entry *frame_entry,
+	git_str *root,
+	const git_vector *index_names,
+	const struct stat *dir_st)
+{
+	git_untracked_cache *untracked = iter->index->untracked;
+	const git_vector *cached;
+	git_vector names = GIT_VECTOR_INIT;
+	const char *dir = frame_entry ? frame_entry->path : "";
+	char *name;
+	size_t root_len = root->size, i, len;
+	int error;
+
+	if (!untracked ||
+	    (cached = git_untracked_cache_lookup(untracked,
+			dir, dir_st, iter->trust_ctime)) == NULL)
+		return GIT_ENOTFOUND;
+
+	if ((error = git_vector_init(&names,
+			index_names->length + cached->length, git__strcmp_cb)) < 0)
+		goto done;
+
+	git_vector_foreach(index_names, i, name) {
+		if ((error = git_vector_insert(&names, name)) < 0)
+			goto done;
+	}
+
+	git_vector_foreach(cached, i, name) {
+		if ((error = git_vector_insert(&names, name)) < 0)
+			goto done;
+	}
+
+	git_vector_sort(&names);
+
+	git_vector_foreach(&names, i, name) {
+		if (i && strcmp(name, git_vector_get(&names, i - 1)) == 0)
+			continue;
+
+		/* git suffixes the untracked directories it caches */
+		if ((len = strlen(name)) && name[len - 1] == '/')
+			len--;
+
+		git_str_truncate(root, root_len);
+		git_str_put(root, name, len);
+
+		if (git_str_oom(root) ||
+		    (error = filesystem_iterator_frame_add(iter, new_frame,
+				frame_entry, NULL, root->ptr, root->size)) < 0)
+			goto done;
+	}
+
+	error = 0;
+
+done:
+	git_str_truncate(root, root_len);
+	git_vector_free(&names);
+	return error;
+}
+
 static int filesystem_iterator_frame_push(
 	filesystem_iterator *iter,
 	filesystem_iterator_entry *frame_entry)
@@ -1347,12 +1657,18 @@ static int filesystem_iterator_frame_push(
 	filesystem_iterator_frame *new_frame = NULL;
 	git_fs_path_diriter diriter = GIT_FS_PATH_DIRITER_INIT;
 	git_str root = GIT_STR_INIT;
+	git_vector index_names = GIT_VECTOR_INIT, untracked = GIT_VECTOR_INIT;
+	git_pool names_pool;
 	const char *path;
-	filesystem_iterator_entry *entry;
-	struct stat statbuf;
+	char *name;
+	struct stat dir_st;
 	size_t path_len;
+	bool use_cache = false;
 	int error;
 
+	if ((error = git_pool_init(&names_pool, 1)) < 0)
+		return error;
+
 	if (iter->frames.size == FILESYSTEM_MAX_DEPTH) {
 		git_error_set(GIT_ERROR_REPOSITORY,
 			"directory nesting too deep (%"PRIuZ")", iter->frames.size);
@@ -1377,11 +1693,15 @@ static int filesystem_iterator_frame_push(
 
 	new_frame->path_len = frame_entry ? frame_entry->path_len : 0;
 
-	/* Any error here is equivalent to the dir not existing, skip over it */
-	if ((error = git_fs_path_diriter_init(
-			&diriter, root.ptr, iter->dirload_flags)) < 0) {
-		error = GIT_ENOTFOUND;
-		goto done;
+	/*
+	 * The untracked cache is keyed by the directory's stat data, which
+	 * must be taken before it is read.
+	 */
+	if (iter->use_untracked_cache) {
+		if (frame_entry)
+			memcpy(&dir_st, &frame_entry->st, sizeof(struct stat));
+
+		use_cache = frame_entry || p_stat(root.ptr, &dir_st) == 0;
 	}
 
 	if ((error = git_vector_init(&new_frame->entries, 64,
@@ -1396,96 +1716,75 @@ static int filesystem_iterator_frame_push(
 	/* check if this directory is ignored */
 	filesystem_iterator_frame_push_ignores(iter, frame_entry, new_frame);
 
-	while ((error = git_fs_path_diriter_next(&diriter)) == 0) {
-		iterator_pathlist_search_t pathlist_match = ITERATOR_PATHLIST_FULL;
-		git_str path_str = GIT_STR_INIT;
-		bool dir_expected = false;
-
-		if ((error = git_fs_path_diriter_fullpath(&path, &path_len, &diriter)) < 0)
-			goto done;
-
-		path_str.ptr = (char *)path;
-		path_str.size = path_len;
-
-		if ((error = git_path_validate_str_length(iter->base.repo, &path_str)) < 0)
+	if (use_cache) {
+		if ((error = git_vector_init(&index_names, 16, git__strcmp_cb)) < 0 ||
+		    (error = git_vector_init(&untracked, 16, NULL)) < 0 ||
+		    (error = filesystem_iterator_index_names(&index_names,
+				&names_pool, iter, frame_entry ? frame_entry->path : "",
+				new_frame->path_len)) < 0)
 			goto done;
 
-		GIT_ASSERT(path_len > iter->root_len);
-
-		/* remove the prefix if requested */
-		path += iter->root_len;
-		path_len -= iter->root_len;
-
-		/* examine start / end and the pathlist to see if this path is in it.
-		 * note that since we haven't yet stat'ed the path, we cannot know
-		 * whether it's a directory yet or not, so this can give us an
-		 * expected type (S_IFDIR or S_IFREG) that we should examine)
-		 */
-		if (!filesystem_iterator_examine_path(&dir_expected, &pathlist_match,
-			iter, frame_entry, path, path_len))
-			continue;
-
-		/* TODO: don't need to stat if assume unchanged for this path and
-		 * we have an index, we can just copy the data out of it.
-		 */
-
-		if ((error = git_fs_path_diriter_stat(&statbuf, &diriter)) < 0) {
-			/* file was removed between readdir and lstat */
-			if (error == GIT_ENOTFOUND)
-				continue;
-
-			/* treat the file as unreadable */
-			memset(&statbuf, 0, sizeof(statbuf));
-			statbuf.st_mode = GIT_FILEMODE_UNREADABLE;
-
-			error = 0;
-		}
-
-		iter->base.stat_calls++;
+		error = filesystem_iterator_frame_from_cache(iter, new_frame,
+			frame_entry, &root, &index_names, &dir_st);
 
-		/* Ignore wacky things in the filesystem */
-		if (!S_ISDIR(statbuf.st_mode) &&
-			!S_ISREG(statbuf.st_mode) &&
-			!S_ISLNK(statbuf.st_mode) &&
-			statbuf.st_mode != GIT_FILEMODE_UNREADABLE)
-			continue;
+		if (error != GIT_ENOTFOUND)
+			goto sort;
+	}
 
-		if (filesystem_iterator_is_dot_git(iter, path, path_len))
-			continue;
+	/* Any error here is equivalent to the dir not existing, skip over it */
+	if ((error = git_fs_path_diriter_init(
+			&diriter, root.ptr, iter->dirload_flags)) < 0) {
+		error = GIT_ENOTFOUND;
+		goto done;
+	}
 
-		/* convert submodules to GITLINK and remove trailing slashes */
-		if (S_ISDIR(statbuf.st_mode)) {
-			bool submodule = false;
+	while ((error = git_fs_path_diriter_next(&diriter)) == 0) {
+		if ((error = git_fs_path_diriter_fullpath(&path, &path_len, &diriter)) < 0)
+			goto done;
 
-			if ((error = filesystem_iterator_is_submodule(&submodule,
-					iter, path, path_len)) < 0)
+		/* remember the names that the index does not know about */
+		if (use_cache &&
+		    git_vector_bsearch(NULL, &index_names, path + root.size) < 0) {
+			if ((name = git_pool_strdup(&names_pool, path + root.size)) == NULL ||
+			    git_vector_insert(&untracked, name) < 0) {
+				error = -1;
 				goto done;
-
-			if (submodule)
-				statbuf.st_mode = GIT_FILEMODE_COMMIT;
+			}
 		}
 
-		/* Ensure that the pathlist entry lines up with what we expected */
-		else if (dir_expected)
-			continue;
-
-		if ((error = filesystem_iterator_entry_init(&entry,
-			iter, new_frame, path, path_len, &statbuf, pathlist_match)) < 0)
+		if ((error = filesystem_iterator_frame_add(iter, new_frame,
+				frame_entry, &diriter, path, path_len)) < 0)
 			goto done;
-
-		git_vector_insert(&new_frame->entries, entry);
 	}
 
 	if (error == GIT_ITEROVER)
 		error = 0;
 
+	if (use_cache && iter->index->untracked) {
+		int updated = git_untracked_cache_update(iter->index->untracked,
+			frame_entry ? frame_entry->path : "", &dir_st, &untracked);
+
+		if (updated < 0) {
+			error = updated;
+			goto done;
+		}
+
+		if (updated)
+			iter->index->untracked_dirty = 1;
+	}
+
+sort:
 	/* sort now that directory suffix is added */
-	git_vector_sort(&new_frame->entries);
+	if (!error)
+		git_vector_sort(&new_frame->entries);
 
 done:
 	if (error < 0)
 		git_array_pop(iter->frames);
 
+	git_vector_free(&index_names);
+	git_vector_free(&untracked);
+	git_pool_clear(&names_pool);
 	git_str_dispose(&root);
 	git_fs_path_diriter_free(&diriter);
 	return error;
@@ -1880,6 +2179,79 @@ static void filesystem_iterator_clear(filesystem_iterator *iter)
 	iterator_clear(&iter->base);
 }
 
+/*
+ * Decide whether the index's untracked cache lists the directories of
+ * this working directory, following `core.untrackedCache`: "true"
+ * creates one, "false" drops it and "keep" only uses one that is there.
+ */
+static int filesystem_iterator_init_untracked_cache(filesystem_iterator *iter)
+{
+	git_index *index = iter->index;
+	const char *workdir;
+	int mode, trust_ctime, error;
+
+	if (iter->base.type != GIT_ITERATOR_WORKDIR || !index ||
+	    index->ignore_case ||
+	    iterator__descend_symlinks(&iter->base) ||
+	    (workdir = git_repository_workdir(iter->base.repo)) == NULL ||
+	    strcmp(workdir, iter->root) != 0)
+		return 0;
+
+	if ((error = git_repository__configmap_lookup(&mode,
+			iter->base.repo, GIT_CONFIGMAP_UNTRACKEDCACHE)) < 0 ||
+	    (error = git_repository__configmap_lookup(&trust_ctime,
+			iter->base.repo, GIT_CONFIGMAP_TRUSTCTIME)) < 0)
+		return error;
+
+	if (index->untracked &&
+	    (mode == GIT_UNTRACKEDCACHE_FALSE ||
+	     (mode == GIT_UNTRACKEDCACHE_TRUE &&
+	      !git_untracked_cache_is_ours(index->untracked, workdir)))) {
+		git_untracked_cache_free(index->untracked);
+		index->untracked = NULL;
+		index->untracked_dirty = 1;
+	}
+
+	if (!index->untracked && mode == GIT_UNTRACKEDCACHE_TRUE) {
+		if ((error = git_untracked_cache_new(&index->untracked,
+				workdir, index->oid_type)) < 0)
+			return error;
+
+		index->untracked_dirty = 1;
+	}
+
+	iter->use_untracked_cache = index->untracked &&
+		git_untracked_cache_is_ours(index->untracked, workdir);
+	iter->trust_ctime = trust_ctime;
+
+	return 0;
+}
+
+/*
+ * Directories are only pruned when the index says that nothing beneath
+ * them is checked out, so without an index the whole workdir is walked,
+ * unless the caller deals with the paths outside of the cone itself.
+ */
+static int filesystem_iterator_init_sparse_checkout(filesystem_iterator *iter)
+{
+	git_vector none = GIT_VECTOR_INIT;
+	bool skip_all = (iter->base.flags & GIT_ITERATOR_SKIP_SPARSE_DIRS) != 0;
+	const char *workdir;
+	int error;
+
+	if (iter->base.type != GIT_ITERATOR_WORKDIR ||
+	    (!iter->index && !skip_all) ||
+	    (workdir = git_repository_workdir(iter->base.repo)) == NULL ||
+	    strcmp(workdir, iter->root) != 0)
+		return 0;
+
+	if ((error = git_sparse_checkout_load(&iter->sparse, iter->base.repo)) < 0)
+		return error;
+
+	return git_sparse_checkout_read_index(&iter->sparse,
+		skip_all ? &none : &iter->index_snapshot);
+}
+
 static int filesystem_iterator_init(filesystem_iterator *iter)
 {
 	int error;
@@ -1913,6 +2285,7 @@ static void filesystem_iterator_free(git_iterator *i)
 	git_tree_free(iter->tree);
 	if (iter->index)
 		git_index_snapshot_release(&iter->index_snapshot, iter->index);
+	git_sparse_checkout_dispose(&iter->sparse);
 	filesystem_iterator_clear(iter);
 }
 
@@ -1985,7 +2358,9 @@ static int iterator_for_filesystem(
 
 	iter->oid_type = options->oid_type;
 
-	if ((error = filesystem_iterator_init(iter)) < 0)
+	if ((error = filesystem_iterator_init_untracked_cache(iter)) < 0 ||
+	    (error = filesystem_iterator_init_sparse_checkout(iter)) < 0 ||
+	    (error = filesystem_iterator_init(iter)) < 0)
 		goto on_error;
 
 	*out = &iter->base;
@@ -42,7 +42,18 @@ typedef enum {
 	/** descend into symlinked directories */
 	GIT_ITERATOR_DESCEND_SYMLINKS = (1u << 7),
 	/** hash files in workdir or filesystem iterators */
-	GIT_ITERATOR_INCLUDE_HASH = (1u << 8)
+	GIT_ITERATOR_INCLUDE_HASH = (1u << 8),
+	/** don't stat the files that the index's fsmonitor state vouches for */
+	GIT_ITERATOR_USE_FSMONITOR = (1u << 9),
+	/** don't stat the files that were just preloaded from the index */
+	GIT_ITERATOR_USE_PRELOAD = (1u << 10),
+	/** don't stat directories, nor files that the index assumes unchanged */
+	GIT_ITERATOR_SKIP_KNOWN_STAT = (1u << 11),
+	/**
+	 * don't walk any directory outside of the sparse checkout, even if
+	 * the index still tracks files there without the skip-worktree bit
+	 */
+	GIT_ITERATOR_SKIP_SPARSE_DIRS = (1u << 12)
 } git_iterator_flag_t;
 
 typedef enum {
@@ -102,6 +113,7 @@ struct git_iterator {
 	int (*prefixcomp)(const char *str, const char *prefix);
 	int (*entry_srch)(const void *key, const void *array_member);
 	size_t stat_calls;
+	size_t skipped_stat_calls;
 	unsigned int flags;
 };
 
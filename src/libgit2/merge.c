@@ -382,7 +382,7 @@ static int paint_down_to_common(
 		git_revwalk *walk,
 		git_commit_list_node *one,
 		git_vector *twos,
-		uint32_t minimum_generation)
+		uint64_t minimum_generation)
 {
 	git_pqueue list;
 	git_commit_list *result = NULL;
@@ -430,12 +430,17 @@ static int paint_down_to_common(
 			git_commit_list_node *p = commit->parents[i];
 			if ((p->flags & flags) == flags)
 				continue;
-			if (p->generation < minimum_generation)
-				continue;
 
 			if ((error = git_commit_list_parse(walk, p)) < 0)
 				return error;
 
+			/*
+			 * A commit without a generation number is not in the
+			 * commit-graph, and may be reachable from any commit.
+			 */
+			if (p->generation && p->generation < minimum_generation)
+				continue;
+
 			p->flags |= flags;
 			if (git_pqueue_insert(&list, p) < 0)
 				return -1;
@@ -447,7 +452,7 @@ static int paint_down_to_common(
 	return 0;
 }
 
-static int remove_redundant(git_revwalk *walk, git_vector *commits, uint32_t minimum_generation)
+static int remove_redundant(git_revwalk *walk, git_vector *commits, uint64_t minimum_generation)
 {
 	git_vector work = GIT_VECTOR_INIT;
 	unsigned char *redundant;
@@ -520,7 +525,7 @@ int git_merge__bases_many(
 		git_revwalk *walk,
 		git_commit_list_node *one,
 		git_vector *twos,
-		uint32_t minimum_generation)
+		uint64_t minimum_generation)
 {
 	int error;
 	unsigned int i;
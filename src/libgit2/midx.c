@@ -14,6 +14,7 @@
 #include "hash.h"
 #include "odb.h"
 #include "pack.h"
+#include "pack-bitmap.h"
 #include "fs_path.h"
 #include "repository.h"
 #include "str.h"
@@ -35,6 +36,7 @@ struct git_midx_header {
 #define MIDX_OID_LOOKUP_ID 0x4f49444c	   /* "OIDL" */
 #define MIDX_OBJECT_OFFSETS_ID 0x4f4f4646	   /* "OOFF" */
 #define MIDX_OBJECT_LARGE_OFFSETS_ID 0x4c4f4646 /* "LOFF" */
+#define MIDX_REVERSE_INDEX_ID 0x52494458	   /* "RIDX" */
 
 struct git_midx_chunk {
 	off64_t offset;
@@ -161,6 +163,28 @@ static int midx_parse_object_large_offsets(
 	return 0;
 }
 
+static int midx_parse_reverse_index(
+		git_midx_file *idx,
+		const unsigned char *data,
+		struct git_midx_chunk *chunk_reverse_index)
+{
+	uint32_t i;
+
+	if (chunk_reverse_index->offset == 0)
+		return 0;
+	if (chunk_reverse_index->length != idx->num_objects * 4)
+		return midx_error("Reverse Index chunk has wrong length");
+
+	for (i = 0; i < idx->num_objects; i++) {
+		if (ntohl(*((uint32_t *)(data + chunk_reverse_index->offset + i * 4))) >= idx->num_objects)
+			return midx_error("Reverse Index chunk has an out of range entry");
+	}
+
+	idx->revindex = data + chunk_reverse_index->offset;
+
+	return 0;
+}
+
 int git_midx_parse(
 		git_midx_file *idx,
 		const unsigned char *data,
@@ -178,6 +202,7 @@ int git_midx_parse(
 					 chunk_oid_lookup = {0},
 					 chunk_object_offsets = {0},
 					 chunk_object_large_offsets = {0},
+					 chunk_reverse_index = {0},
 					 chunk_unknown = {0};
 
 	GIT_ASSERT_ARG(idx);
@@ -256,6 +281,11 @@ int git_midx_parse(
 			last_chunk = &chunk_object_large_offsets;
 			break;
 
+		case MIDX_REVERSE_INDEX_ID:
+			chunk_reverse_index.offset = last_chunk_offset;
+			last_chunk = &chunk_reverse_index;
+			break;
+
 		default:
 			chunk_unknown.offset = last_chunk_offset;
 			last_chunk = &chunk_unknown;
@@ -278,6 +308,9 @@ int git_midx_parse(
 	if (error < 0)
 		return error;
 	error = midx_parse_object_large_offsets(idx, data, &chunk_object_large_offsets);
+	if (error < 0)
+		return error;
+	error = midx_parse_reverse_index(idx, data, &chunk_reverse_index);
 	if (error < 0)
 		return error;
 
@@ -377,6 +410,39 @@ bool git_midx_needs_refresh(
 	return (memcmp(checksum, idx->checksum, checksum_size) != 0);
 }
 
+static int midx_entry_at(
+		git_midx_entry *e,
+		git_midx_file *idx,
+		uint32_t pos)
+{
+	const unsigned char *object_offset;
+	size_t pack_index;
+	off64_t offset;
+
+	object_offset = idx->object_offsets + pos * 8;
+	offset = ntohl(*((uint32_t *)(object_offset + 4)));
+	if (idx->object_large_offsets && offset & 0x80000000) {
+		uint32_t object_large_offsets_pos = (uint32_t) (offset ^ 0x80000000);
+		const unsigned char *object_large_offsets_index = idx->object_large_offsets;
+
+		/* Make sure we're not being sent out of bounds */
+		if (object_large_offsets_pos >= idx->num_object_large_offsets)
+			return midx_error("invalid index into the object large offsets table");
+
+		object_large_offsets_index += 8 * object_large_offsets_pos;
+
+		offset = (((uint64_t)ntohl(*((uint32_t *)(object_large_offsets_index + 0)))) << 32) |
+				ntohl(*((uint32_t *)(object_large_offsets_index + 4)));
+	}
+	pack_index = ntohl(*((uint32_t *)(object_offset + 0)));
+	if (pack_index >= git_vector_length(&idx->packfile_names))
+		return midx_error("invalid index into the packfile names table");
+	e->pack_index = pack_index;
+	e->offset = offset;
+	return git_oid__fromraw(&e->sha1,
+		idx->oid_lookup + pos * git_oid_size(idx->oid_type), idx->oid_type);
+}
+
 int git_midx_entry_find(
 		git_midx_entry *e,
 		git_midx_file *idx,
@@ -384,11 +450,9 @@ int git_midx_entry_find(
 		size_t len)
 {
 	int pos, found = 0;
-	size_t pack_index, oid_size, oid_hexsize;
+	size_t oid_size, oid_hexsize;
 	uint32_t hi, lo;
 	unsigned char *current = NULL;
-	const unsigned char *object_offset;
-	off64_t offset;
 
 	GIT_ASSERT_ARG(idx);
 
@@ -429,28 +493,34 @@ int git_midx_entry_find(
 	if (found > 1)
 		return git_odb__error_ambiguous("found multiple offsets for multi-pack index entry");
 
-	object_offset = idx->object_offsets + pos * 8;
-	offset = ntohl(*((uint32_t *)(object_offset + 4)));
-	if (idx->object_large_offsets && offset & 0x80000000) {
-		uint32_t object_large_offsets_pos = (uint32_t) (offset ^ 0x80000000);
-		const unsigned char *object_large_offsets_index = idx->object_large_offsets;
+	return midx_entry_at(e, idx, (uint32_t)pos);
+}
 
-		/* Make sure we're not being sent out of bounds */
-		if (object_large_offsets_pos >= idx->num_object_large_offsets)
-			return git_odb__error_notfound("invalid index into the object large offsets table", short_oid, len);
+int git_midx_entry_at_pack_pos(
+		git_midx_entry *e,
+		uint32_t *index_pos_out,
+		git_midx_file *idx,
+		uint32_t pack_pos)
+{
+	uint32_t index_pos;
 
-		object_large_offsets_index += 8 * object_large_offsets_pos;
+	GIT_ASSERT_ARG(e);
+	GIT_ASSERT_ARG(idx);
 
-		offset = (((uint64_t)ntohl(*((uint32_t *)(object_large_offsets_index + 0)))) << 32) |
-				ntohl(*((uint32_t *)(object_large_offsets_index + 4)));
+	if (!idx->revindex) {
+		git_error_set(GIT_ERROR_ODB, "multi-pack index has no reverse index");
+		return GIT_ENOTFOUND;
 	}
-	pack_index = ntohl(*((uint32_t *)(object_offset + 0)));
-	if (pack_index >= git_vector_length(&idx->packfile_names))
-		return midx_error("invalid index into the packfile names table");
-	e->pack_index = pack_index;
-	e->offset = offset;
-	git_oid__fromraw(&e->sha1, current, idx->oid_type);
-	return 0;
+
+	if (pack_pos >= idx->num_objects)
+		return midx_error("pack position out of range");
+
+	index_pos = ntohl(*((uint32_t *)(idx->revindex + pack_pos * 4)));
+
+	if (index_pos_out)
+		*index_pos_out = index_pos;
+
+	return midx_entry_at(e, idx, index_pos);
 }
 
 int git_midx_foreach_entry(
@@ -559,6 +629,26 @@ void git_midx_writer_free(git_midx_writer *w)
 	git__free(w);
 }
 
+int git_midx_writer_set_write_reverse_index(
+		git_midx_writer *w,
+		int enabled)
+{
+	GIT_ASSERT_ARG(w);
+
+	w->write_reverse_index = !!enabled;
+	return 0;
+}
+
+int git_midx_writer_set_write_bitmap(
+		git_midx_writer *w,
+		git_repository *repo)
+{
+	GIT_ASSERT_ARG(w);
+
+	w->bitmap_repo = repo;
+	return 0;
+}
+
 int git_midx_writer_add(
 		git_midx_writer *w,
 		const char *idx_path)
@@ -615,6 +705,18 @@ static int object_entry__cmp(const void *a_, const void *b_)
 	return git_oid_cmp(&a->sha1, &b->sha1);
 }
 
+static int object_entry__pack_order_cmp(const void *a_, const void *b_, void *payload)
+{
+	git_vector *object_entries = (git_vector *)payload;
+	const git_midx_entry *a = git_vector_get(object_entries, *(const uint32_t *)a_);
+	const git_midx_entry *b = git_vector_get(object_entries, *(const uint32_t *)b_);
+
+	if (a->pack_index != b->pack_index)
+		return (a->pack_index > b->pack_index) ? 1 : -1;
+
+	return (a->offset > b->offset) - (a->offset < b->offset);
+}
+
 static int write_offset(off64_t offset, midx_write_cb write_cb, void *cb_data)
 {
 	int error;
@@ -683,7 +785,9 @@ static int midx_write(
 	git_str packfile_names = GIT_STR_INIT,
 		oid_lookup = GIT_STR_INIT,
 		object_offsets = GIT_STR_INIT,
-		object_large_offsets = GIT_STR_INIT;
+		object_large_offsets = GIT_STR_INIT,
+		reverse_index = GIT_STR_INIT;
+	uint32_t *pack_order = NULL;
 	unsigned char checksum[GIT_HASH_MAX_SIZE];
 	size_t checksum_size, oid_size;
 	git_midx_entry *entry;
@@ -805,11 +909,40 @@ static int midx_write(
 			goto cleanup;
 	}
 
+	/*
+	 * Fill the Reverse Index table: the objects' positions in the OID
+	 * Lookup table, in the order they appear in their packs.
+	 */
+	if ((w->write_reverse_index || w->bitmap_repo) &&
+	    git_vector_length(&object_entries) > 0) {
+		pack_order = git__calloc(git_vector_length(&object_entries), sizeof(uint32_t));
+		if (!pack_order) {
+			error = -1;
+			goto cleanup;
+		}
+
+		for (i = 0; i < git_vector_length(&object_entries); i++)
+			pack_order[i] = (uint32_t)i;
+
+		git__qsort_r(pack_order, git_vector_length(&object_entries),
+			sizeof(uint32_t), object_entry__pack_order_cmp, &object_entries);
+
+		for (i = 0; i < git_vector_length(&object_entries); i++) {
+			uint32_t word = htonl(pack_order[i]);
+
+			error = git_str_put(&reverse_index, (const char *)&word, sizeof(word));
+			if (error < 0)
+				goto cleanup;
+		}
+	}
+
 	/* Write the header. */
 	hdr.packfiles = htonl((uint32_t)git_vector_length(&w->packs));
 	hdr.chunks = 4;
 	if (git_str_len(&object_large_offsets) > 0)
 		hdr.chunks++;
+	if (git_str_len(&reverse_index) > 0)
+		hdr.chunks++;
 	error = write_cb((const char *)&hdr, sizeof(hdr), cb_data);
 	if (error < 0)
 		goto cleanup;
@@ -838,6 +971,12 @@ static int midx_write(
 			goto cleanup;
 		offset += git_str_len(&object_large_offsets);
 	}
+	if (git_str_len(&reverse_index) > 0) {
+		error = write_chunk_header(MIDX_REVERSE_INDEX_ID, offset, write_cb, cb_data);
+		if (error < 0)
+			goto cleanup;
+		offset += git_str_len(&reverse_index);
+	}
 	error = write_chunk_header(0, offset, write_cb, cb_data);
 	if (error < 0)
 		goto cleanup;
@@ -856,6 +995,9 @@ static int midx_write(
 	if (error < 0)
 		goto cleanup;
 	error = write_cb(git_str_cstr(&object_large_offsets), git_str_len(&object_large_offsets), cb_data);
+	if (error < 0)
+		goto cleanup;
+	error = write_cb(git_str_cstr(&reverse_index), git_str_len(&reverse_index), cb_data);
 	if (error < 0)
 		goto cleanup;
 
@@ -874,6 +1016,8 @@ cleanup:
 	git_str_dispose(&oid_lookup);
 	git_str_dispose(&object_offsets);
 	git_str_dispose(&object_large_offsets);
+	git_str_dispose(&reverse_index);
+	git__free(pack_order);
 	git_hash_ctx_cleanup(&ctx);
 	return error;
 }
@@ -899,17 +1043,24 @@ int git_midx_writer_commit(
 	if (git_repository__fsync_gitdir)
 		filebuf_flags |= GIT_FILEBUF_FSYNC;
 	error = git_filebuf_open(&output, git_str_cstr(&midx_path), filebuf_flags, 0644);
-	git_str_dispose(&midx_path);
-	if (error < 0)
+	if (error < 0) {
+		git_str_dispose(&midx_path);
 		return error;
+	}
 
 	error = midx_write(w, midx_write_filebuf, &output);
 	if (error < 0) {
 		git_filebuf_cleanup(&output);
+		git_str_dispose(&midx_path);
 		return error;
 	}
 
-	return git_filebuf_commit(&output);
+	if ((error = git_filebuf_commit(&output)) == 0 && w->bitmap_repo)
+		error = git_pack_bitmap_write_midx(git_str_cstr(&midx_path),
+			w->bitmap_repo, NULL, NULL);
+
+	git_str_dispose(&midx_path);
+	return error;
 }
 
 int git_midx_writer_dump(
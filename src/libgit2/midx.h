@@ -51,6 +51,13 @@ typedef struct git_midx_file {
 	/* The number of entries in the Object Large Offsets table. Each entry has an 8-byte with an offset */
 	size_t num_object_large_offsets;
 
+	/*
+	 * The optional Reverse Index table. Each entry is the 4-byte position
+	 * of an object in the OID Lookup table, in pseudo-pack order: sorted
+	 * by pack and then by offset within that pack.
+	 */
+	const unsigned char *revindex;
+
 	/*
 	 * The trailer of the file. Contains the checksum of the whole
 	 * file, in the repository's object format hash.
@@ -91,6 +98,12 @@ struct git_midx_writer {
 
 	/* The object ID type of the writer. */
 	git_oid_t oid_type;
+
+	/* Whether to write the Reverse Index chunk. */
+	unsigned int write_reverse_index : 1;
+
+	/* The repository to write a reachability bitmap for, if any. */
+	git_repository *bitmap_repo;
 };
 
 int git_midx_open(
@@ -105,6 +118,15 @@ int git_midx_entry_find(
 		git_midx_file *idx,
 		const git_oid *short_oid,
 		size_t len);
+/*
+ * Look up the object at the given position of the reverse index, along
+ * with its position in the index (if `index_pos_out` is not NULL).
+ */
+int git_midx_entry_at_pack_pos(
+		git_midx_entry *e,
+		uint32_t *index_pos_out,
+		git_midx_file *idx,
+		uint32_t pack_pos);
 int git_midx_foreach_entry(
 		git_midx_file *idx,
 		git_odb_foreach_cb cb,
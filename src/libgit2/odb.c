@@ -17,6 +17,7 @@
 #include "repository.h"
 #include "blob.h"
 #include "oid.h"
+#include "pack.h"
 
 #include "git2/odb_backend.h"
 #include "git2/oid.h"
@@ -753,6 +754,11 @@ int git_odb__add_default_backends(
 		git_mutex_unlock(&db->lock);
 		return -1;
 	}
+	if (!db->bitmaps &&
+	    git_pack_bitmaps_new(&db->bitmaps, objects_dir, db->options.oid_type) < 0) {
+		git_mutex_unlock(&db->lock);
+		return -1;
+	}
 	git_mutex_unlock(&db->lock);
 
 	return load_alternates(db, objects_dir, alternate_depth);
@@ -915,6 +921,7 @@ static void odb_free(git_odb *db)
 		git_mutex_unlock(&db->lock);
 
 	git_commit_graph_free(db->cgraph);
+	git_pack_bitmaps_free(db->bitmaps);
 	git_vector_free(&db->backends);
 	git_cache_dispose(&db->own_cache);
 	git_mutex_free(&db->lock);
@@ -982,6 +989,52 @@ done:
 	return error;
 }
 
+int git_odb__get_pack_bitmap(git_pack_bitmap **out, git_odb *db)
+{
+	int error = 0;
+
+	if ((error = git_mutex_lock(&db->lock)) < 0) {
+		git_error_set(GIT_ERROR_ODB, "failed to acquire the db lock");
+		return error;
+	}
+	if (!db->bitmaps)
+		error = GIT_ENOTFOUND;
+	else
+		error = git_pack_bitmaps_get(out, db->bitmaps);
+
+	git_mutex_unlock(&db->lock);
+	return error;
+}
+
+int git_odb__find_pack_entry(
+	struct git_pack_entry *out,
+	git_odb *db,
+	const git_oid *id)
+{
+	size_t i;
+	int error = GIT_ENOTFOUND;
+
+	if (git_mutex_lock(&db->lock) < 0) {
+		git_error_set(GIT_ERROR_ODB, "failed to acquire the odb lock");
+		return -1;
+	}
+	for (i = 0; i < db->backends.length; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+
+		error = git_odb_backend__pack_entry_find(out, internal->backend, id);
+
+		if (error != GIT_PASSTHROUGH && error != GIT_ENOTFOUND)
+			break;
+	}
+	git_mutex_unlock(&db->lock);
+
+	if (error == GIT_PASSTHROUGH || error == GIT_ENOTFOUND)
+		return git_odb__error_notfound("object is not in a pack",
+			id, git_oid_hexsize(db->options.oid_type));
+
+	return error;
+}
+
 static int odb_freshen_1(
 	git_odb *db,
 	const git_oid *id,
@@ -1426,6 +1479,328 @@ int git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id)
 	return error;
 }
 
+/* Read at least this many objects on each thread */
+#define READ_MANY_MIN_PER_THREAD 64
+
+typedef struct {
+	size_t pos; /* of the object in the caller's arrays */
+	struct git_pack_entry e;
+	bool is_base; /* another object of the batch is a delta against it */
+} read_many_entry;
+
+static int read_many_entry_cmp(const void *a, const void *b, void *payload)
+{
+	const read_many_entry *x = a, *y = b;
+
+	GIT_UNUSED(payload);
+
+	if (x->e.p != y->e.p)
+		return ((uintptr_t)x->e.p < (uintptr_t)y->e.p) ? -1 : 1;
+
+	if (x->e.offset != y->e.offset)
+		return (x->e.offset < y->e.offset) ? -1 : 1;
+
+	return 0;
+}
+
+/*
+ * Take the objects that are already cached, and find the pack entries
+ * of the others, all under one hold of the odb lock.  Objects that are
+ * in no pack are left for `git_odb_read`.
+ */
+static int read_many_locate(
+	read_many_entry *entries,
+	size_t *nr_entries,
+	git_odb_object **out,
+	git_odb *db,
+	const git_oid *ids,
+	size_t count)
+{
+	size_t i, j;
+	int error = 0;
+
+	*nr_entries = 0;
+
+	if (git_mutex_lock(&db->lock) < 0) {
+		git_error_set(GIT_ERROR_ODB, "failed to acquire the odb lock");
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		if ((out[i] = git_cache_get_raw(odb_cache(db), &ids[i])) != NULL)
+			continue;
+
+		error = GIT_ENOTFOUND;
+
+		for (j = 0; j < db->backends.length; j++) {
+			backend_internal *internal = git_vector_get(&db->backends, j);
+
+			error = git_odb_backend__pack_entry_find(&entries[*nr_entries].e,
+				internal->backend, &ids[i]);
+
+			if (error != GIT_PASSTHROUGH && error != GIT_ENOTFOUND)
+				break;
+		}
+
+		if (!error)
+			entries[(*nr_entries)++].pos = i;
+		else if (error == GIT_PASSTHROUGH || error == GIT_ENOTFOUND)
+			error = 0;
+		else
+			break;
+	}
+	git_mutex_unlock(&db->lock);
+
+	if (!error)
+		git_error_clear();
+
+	return error;
+}
+
+/*
+ * With the entries sorted by their place in the packs, mark those that
+ * are the base of a delta that is also in the batch, so that they are
+ * kept in the delta base cache when they are read.
+ */
+static int read_many_mark_bases(read_many_entry *entries, size_t nr_entries)
+{
+	git_packfile_raw_entry raw;
+	read_many_entry key;
+	size_t i, lo, hi, mid;
+	int cmp, error;
+
+	for (i = 0; i < nr_entries; i++) {
+		if ((error = git_packfile_raw_entry_read(&raw,
+				entries[i].e.p, entries[i].e.offset)) < 0)
+			return error;
+
+		if (raw.type != GIT_OBJECT_OFS_DELTA &&
+		    raw.type != GIT_OBJECT_REF_DELTA)
+			continue;
+
+		key.e.p = entries[i].e.p;
+		key.e.offset = raw.base_offset;
+
+		for (lo = 0, hi = nr_entries; lo < hi; ) {
+			mid = lo + (hi - lo) / 2;
+			cmp = read_many_entry_cmp(&key, &entries[mid], NULL);
+
+			if (!cmp) {
+				entries[mid].is_base = true;
+				break;
+			} else if (cmp < 0) {
+				hi = mid;
+			} else {
+				lo = mid + 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int read_many_entries(
+	git_odb_object **out,
+	git_odb *db,
+	const git_oid *ids,
+	read_many_entry *entries,
+	size_t nr_entries)
+{
+	git_odb_object *object;
+	git_rawobj raw;
+	git_oid hashed;
+	off64_t offset;
+	size_t i;
+	int error = 0;
+
+	for (i = 0; i < nr_entries; i++) {
+		read_many_entry *entry = &entries[i];
+		const git_oid *id = &ids[entry->pos];
+
+		offset = entry->e.offset;
+
+		if ((error = git_packfile_unpack(&raw, entry->e.p, &offset)) < 0)
+			return error;
+
+		if (entry->is_base &&
+		    (error = git_packfile_cache_base(entry->e.p, entry->e.offset, &raw)) < 0)
+			goto out;
+
+		if (git_odb__strict_hash_verification) {
+			if ((error = git_odb__hash(&hashed, raw.data, raw.len, raw.type, db->options.oid_type)) < 0)
+				goto out;
+
+			if (!git_oid_equal(id, &hashed)) {
+				error = git_odb__error_mismatch(id, &hashed);
+				goto out;
+			}
+		}
+
+		if ((object = odb_object__alloc(id, &raw)) == NULL) {
+			error = -1;
+			goto out;
+		}
+
+		out[entry->pos] = git_cache_store_raw(odb_cache(db), object);
+	}
+
+out:
+	if (error)
+		git__free(raw.data);
+	return error;
+}
+
+#ifdef GIT_THREADS
+
+struct read_many_thread {
+	git_thread thread;
+	git_odb *db;
+	git_odb_object **out;
+	const git_oid *ids;
+	read_many_entry *entries;
+	size_t nr_entries;
+	int error;
+	git_error *error_info;
+};
+
+static void *read_many_thread(void *arg)
+{
+	struct read_many_thread *t = arg;
+
+	t->error = read_many_entries(t->out, t->db, t->ids,
+		t->entries, t->nr_entries);
+
+	if (t->error < 0)
+		git_error_save(&t->error_info);
+
+	return NULL;
+}
+
+/*
+ * Give each thread a run of neighbouring entries, so that each one
+ * reads its own stretch of the pack and finds its bases cached.
+ */
+static int read_many_threaded(
+	git_odb_object **out,
+	git_odb *db,
+	const git_oid *ids,
+	read_many_entry *entries,
+	size_t nr_entries,
+	size_t nr_threads)
+{
+	struct read_many_thread *threads;
+	size_t i, started, start = 0;
+	int error = 0;
+
+	threads = git__calloc(nr_threads, sizeof(*threads));
+	GIT_ERROR_CHECK_ALLOC(threads);
+
+	for (started = 0; started < nr_threads; started++) {
+		struct read_many_thread *t = &threads[started];
+		size_t end = nr_entries * (started + 1) / nr_threads;
+
+		t->db = db;
+		t->out = out;
+		t->ids = ids;
+		t->entries = entries + start;
+		t->nr_entries = end - start;
+		start = end;
+
+		if (git_thread_create(&t->thread, read_many_thread, t) != 0) {
+			git_error_set(GIT_ERROR_THREAD, "unable to create thread");
+			error = -1;
+			break;
+		}
+	}
+
+	for (i = 0; i < started; i++) {
+		git_thread_join(&threads[i].thread, NULL);
+
+		if (threads[i].error < 0 && !error) {
+			error = threads[i].error;
+			git_error_restore(threads[i].error_info);
+			threads[i].error_info = NULL;
+		}
+
+		git_error_free(threads[i].error_info);
+	}
+
+	git__free(threads);
+	return error;
+}
+
+#endif
+
+int git_odb_read_many(
+	git_odb_object **out,
+	git_odb *db,
+	const git_oid *ids,
+	size_t count,
+	const git_odb_read_many_options *opts)
+{
+	read_many_entry *entries;
+	size_t i, nr_entries, nr_threads = 1;
+	int error;
+
+	GIT_ASSERT_ARG(out);
+	GIT_ASSERT_ARG(db);
+	GIT_ASSERT_ARG(ids || !count);
+	GIT_ERROR_CHECK_VERSION(opts, GIT_ODB_READ_MANY_OPTIONS_VERSION, "git_odb_read_many_options");
+
+	if (!count)
+		return 0;
+
+	entries = git__calloc(count, sizeof(*entries));
+	GIT_ERROR_CHECK_ALLOC(entries);
+
+	memset(out, 0, count * sizeof(*out));
+
+	for (i = 0; i < count; i++) {
+		if (git_oid_is_zero(&ids[i])) {
+			error = error_null_oid(GIT_ENOTFOUND, "cannot read object");
+			goto done;
+		}
+	}
+
+	if ((error = read_many_locate(entries, &nr_entries, out, db, ids, count)) < 0)
+		goto done;
+
+	git__qsort_r(entries, nr_entries, sizeof(*entries), read_many_entry_cmp, NULL);
+
+	if ((error = read_many_mark_bases(entries, nr_entries)) < 0)
+		goto done;
+
+	if (opts && opts->threads > 1)
+		nr_threads = min(opts->threads, nr_entries / READ_MANY_MIN_PER_THREAD);
+
+#ifdef GIT_THREADS
+	if (nr_threads > 1)
+		error = read_many_threaded(out, db, ids, entries, nr_entries, nr_threads);
+	else
+#endif
+		error = read_many_entries(out, db, ids, entries, nr_entries);
+
+	if (error < 0)
+		goto done;
+
+	/* objects in no pack, like loose ones, are read one by one */
+	for (i = 0; i < count; i++) {
+		if (!out[i] && (error = git_odb_read(&out[i], db, &ids[i])) < 0)
+			goto done;
+	}
+
+done:
+	if (error < 0) {
+		for (i = 0; i < count; i++) {
+			git_odb_object_free(out[i]);
+			out[i] = NULL;
+		}
+	}
+
+	git__free(entries);
+	return error;
+}
+
 static int odb_otype_fast(git_object_t *type_p, git_odb *db, const git_oid *id)
 {
 	git_odb_object *object;
@@ -1948,6 +2323,8 @@ int git_odb_refresh(git_odb *db)
 	}
 	if (db->cgraph)
 		git_commit_graph_refresh(db->cgraph);
+	if (db->bitmaps)
+		git_pack_bitmaps_refresh(db->bitmaps);
 	git_mutex_unlock(&db->lock);
 
 	return 0;
@@ -18,6 +18,7 @@
 #include "cache.h"
 #include "commit_graph.h"
 #include "filter.h"
+#include "pack-bitmap.h"
 #include "posix.h"
 #include "vector.h"
 
@@ -30,6 +31,8 @@
 
 extern bool git_odb__strict_hash_verification;
 
+struct git_pack_entry;
+
 /* DO NOT EXPORT */
 typedef struct {
 	void *data;			/**< Raw, decompressed object data. */
@@ -51,6 +54,7 @@ struct git_odb {
 	git_vector backends;
 	git_cache own_cache;
 	git_commit_graph *cgraph;
+	git_pack_bitmaps *bitmaps;
 	unsigned int do_fsync :1;
 };
 
@@ -152,6 +156,29 @@ int git_odb__read_header_or_object(
  */
 int git_odb__get_commit_graph_file(git_commit_graph_file **out, git_odb *odb);
 
+/*
+ * Attempt to get the reachability bitmap of the ODB's packs.  This object
+ * is still owned by the ODB.  If there is no usable bitmap, it will return
+ * GIT_ENOTFOUND.
+ */
+int git_odb__get_pack_bitmap(git_pack_bitmap **out, git_odb *odb);
+
+/*
+ * Find the pack, and the offset in it, where the object is stored.  This
+ * only looks in the packs of the default pack backends; objects that are
+ * only loose (or in other backends) return GIT_ENOTFOUND.
+ */
+int git_odb__find_pack_entry(
+	struct git_pack_entry *out,
+	git_odb *odb,
+	const git_oid *id);
+
+/* The pack backend's part of git_odb__find_pack_entry */
+int git_odb_backend__pack_entry_find(
+	struct git_pack_entry *e,
+	git_odb_backend *backend,
+	const git_oid *oid);
+
 /* freshen an entry in the object database */
 int git_odb__freshen(git_odb *db, const git_oid *id);
 
@@ -604,6 +604,17 @@ static int pack_backend__read(
 	return 0;
 }
 
+int git_odb_backend__pack_entry_find(
+	struct git_pack_entry *e,
+	git_odb_backend *backend,
+	const git_oid *oid)
+{
+	if (backend->read != pack_backend__read)
+		return GIT_PASSTHROUGH;
+
+	return pack_entry_find(e, (struct pack_backend *)backend, oid);
+}
+
 static int pack_backend__read_prefix(
 	git_oid *out_oid,
 	void **buffer_p,
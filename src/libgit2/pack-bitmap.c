@@ -0,0 +1,1167 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "pack-bitmap.h"
+
+#include "array.h"
+#include "commit.h"
+#include "filebuf.h"
+#include "futils.h"
+#include "fs_path.h"
+#include "hash.h"
+#include "midx.h"
+#include "mwindow.h"
+#include "oid.h"
+#include "oidmap.h"
+#include "pack.h"
+#include "repository.h"
+#include "tree.h"
+
+#include "git2/revwalk.h"
+
+#define BITMAP_SIGNATURE "BITM"
+#define BITMAP_VERSION 1
+#define BITMAP_HEADER_LEN 12
+
+#define BITMAP_OPT_FULL_DAG 0x1
+#define BITMAP_OPT_HASH_CACHE 0x4
+
+#define BITMAP_MAX_XOR_OFFSET 160
+
+/* The bitmap of a multi-pack-index is named after its checksum */
+#define BITMAP_MIDX_NAME "multi-pack-index"
+
+/* A commit is selected for a bitmap once in every this many commits */
+#define BITMAP_COMMIT_INTERVAL 100
+
+/* The order of the type bitmaps in the file */
+enum {
+	BITMAP_COMMITS = 0,
+	BITMAP_TREES,
+	BITMAP_BLOBS,
+	BITMAP_TAGS,
+	BITMAP_TYPES
+};
+
+struct bitmap_entry {
+	git_oid commit_id;
+	uint32_t idx_pos;
+	uint8_t xor_offset;
+	uint8_t flags;
+
+	/* The serialized bitmap, when read from a file */
+	const unsigned char *data;
+	size_t size;
+
+	/* The bitmap itself, when computed by the writer */
+	git_bitmap *computed;
+};
+
+struct git_pack_bitmap {
+	char *path;
+	git_map map;
+	git_oid_t oid_type;
+	size_t oid_size;
+
+	/*
+	 * The packs of the objects: the bitmapped pack, or every pack of
+	 * the multi-pack-index for a multi-pack bitmap.
+	 */
+	struct git_pack_file **packs;
+	size_t packs_len;
+	bool midx;
+
+	/* The checksum of the pack, or of the multi-pack-index */
+	unsigned char checksum[GIT_HASH_MAX_SIZE];
+
+	/* The objects, in index (object id) order */
+	size_t num_objects;
+	git_oid *ids;
+	off64_t *offsets;
+	uint32_t *pack_ids; /* the pack of each object, for a multi-pack bitmap */
+
+	/* Map pack (bit) positions to index positions and back */
+	uint32_t *pack_order;
+	uint32_t *index_order;
+
+	git_bitmap types[BITMAP_TYPES];
+
+	struct bitmap_entry *entries;
+	size_t entries_len;
+	git_oidmap *entry_map;
+
+	/* The name hashes of the objects, in index order */
+	const unsigned char *name_hashes;
+};
+
+static int bitmap_error(const char *message)
+{
+	git_error_set(GIT_ERROR_ODB, "invalid bitmap index: %s", message);
+	return -1;
+}
+
+GIT_INLINE(uint32_t) read_u32(const unsigned char *data)
+{
+	return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+	       ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+}
+
+static int collect_object(const git_oid *id, off64_t offset, void *payload)
+{
+	git_pack_bitmap *bitmap = payload;
+	struct git_pack_file *p = bitmap->packs[0];
+
+	/* the index is open (and locked) once we are called */
+	if (!bitmap->ids) {
+		const unsigned char *trailer = (const unsigned char *)p->index_map.data +
+			p->index_map.len - (p->oid_size * 2);
+
+		memcpy(bitmap->checksum, trailer, p->oid_size);
+
+		bitmap->ids = git__calloc(p->num_objects, sizeof(git_oid));
+		GIT_ERROR_CHECK_ALLOC(bitmap->ids);
+		bitmap->offsets = git__calloc(p->num_objects, sizeof(off64_t));
+		GIT_ERROR_CHECK_ALLOC(bitmap->offsets);
+	}
+
+	if (bitmap->num_objects >= p->num_objects)
+		return bitmap_error("pack index changed while reading it");
+
+	git_oid_cpy(&bitmap->ids[bitmap->num_objects], id);
+	bitmap->offsets[bitmap->num_objects] = offset;
+	bitmap->num_objects++;
+
+	return 0;
+}
+
+/* Read the objects of the pack and compute their bit positions. */
+static int load_pack(git_pack_bitmap *bitmap, const char *idx_path)
+{
+	uint32_t i;
+	int error;
+
+	bitmap->packs = git__calloc(1, sizeof(struct git_pack_file *));
+	GIT_ERROR_CHECK_ALLOC(bitmap->packs);
+	bitmap->packs_len = 1;
+
+	if ((error = git_mwindow_get_pack(&bitmap->packs[0], idx_path, bitmap->oid_type)) < 0 ||
+	    (error = git_pack_foreach_entry_offset(bitmap->packs[0], collect_object, bitmap)) < 0)
+		return error;
+
+	if (!bitmap->num_objects)
+		return 0;
+
+	bitmap->pack_order = git__calloc(bitmap->num_objects, sizeof(uint32_t));
+	GIT_ERROR_CHECK_ALLOC(bitmap->pack_order);
+	bitmap->index_order = git__calloc(bitmap->num_objects, sizeof(uint32_t));
+	GIT_ERROR_CHECK_ALLOC(bitmap->index_order);
+
+	/* The pack's reverse index gives us the bit positions */
+	for (i = 0; i < bitmap->num_objects; i++) {
+		if ((error = git_packfile_pack_pos_to_index(&bitmap->pack_order[i],
+				bitmap->packs[0], i)) < 0)
+			return error;
+
+		bitmap->index_order[bitmap->pack_order[i]] = i;
+	}
+
+	return 0;
+}
+
+/*
+ * Read the objects of a multi-pack-index.  Its reverse index gives the
+ * bit positions: the objects of its first pack in pack order, then those
+ * of the second one, and so on.
+ */
+static int load_midx(git_pack_bitmap *bitmap, const char *midx_path)
+{
+	git_midx_file *midx = NULL;
+	git_midx_entry e;
+	git_str pack_dir = GIT_STR_INIT, idx_path = GIT_STR_INIT;
+	const char *name;
+	uint32_t pos, idx_pos;
+	size_t i;
+	int error;
+
+	if ((error = git_midx_open(&midx, midx_path, bitmap->oid_type)) < 0)
+		return error;
+
+	bitmap->midx = true;
+	memcpy(bitmap->checksum, midx->checksum, bitmap->oid_size);
+
+	if (!midx->revindex) {
+		error = bitmap_error("multi-pack-index has no reverse index");
+		goto done;
+	}
+
+	bitmap->packs_len = git_vector_length(&midx->packfile_names);
+
+	if ((bitmap->packs = git__calloc(bitmap->packs_len ? bitmap->packs_len : 1,
+			sizeof(struct git_pack_file *))) == NULL ||
+	    (error = git_fs_path_dirname_r(&pack_dir, midx_path)) < 0) {
+		error = -1;
+		goto done;
+	}
+
+	git_vector_foreach(&midx->packfile_names, i, name) {
+		if ((error = git_str_joinpath(&idx_path, pack_dir.ptr, name)) < 0 ||
+		    (error = git_mwindow_get_pack(&bitmap->packs[i],
+				idx_path.ptr, bitmap->oid_type)) < 0)
+			goto done;
+	}
+
+	if (!midx->num_objects)
+		goto done;
+
+	bitmap->num_objects = midx->num_objects;
+
+	if ((bitmap->ids = git__calloc(bitmap->num_objects, sizeof(git_oid))) == NULL ||
+	    (bitmap->offsets = git__calloc(bitmap->num_objects, sizeof(off64_t))) == NULL ||
+	    (bitmap->pack_ids = git__calloc(bitmap->num_objects, sizeof(uint32_t))) == NULL ||
+	    (bitmap->pack_order = git__calloc(bitmap->num_objects, sizeof(uint32_t))) == NULL ||
+	    (bitmap->index_order = git__calloc(bitmap->num_objects, sizeof(uint32_t))) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	for (pos = 0; pos < midx->num_objects; pos++) {
+		if ((error = git_midx_entry_at_pack_pos(&e, &idx_pos, midx, pos)) < 0)
+			goto done;
+
+		git_oid_cpy(&bitmap->ids[idx_pos], &e.sha1);
+		bitmap->offsets[idx_pos] = e.offset;
+		bitmap->pack_ids[idx_pos] = (uint32_t)e.pack_index;
+		bitmap->pack_order[pos] = idx_pos;
+		bitmap->index_order[idx_pos] = pos;
+	}
+
+done:
+	git_midx_free(midx);
+	git_str_dispose(&pack_dir);
+	git_str_dispose(&idx_path);
+	return error;
+}
+
+/* Find the bit position of an object, or GIT_ENOTFOUND. */
+static int object_pos(size_t *out, const git_pack_bitmap *bitmap, const git_oid *id)
+{
+	size_t lo = 0, hi = bitmap->num_objects, mid;
+	int cmp;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = git_oid_cmp(id, &bitmap->ids[mid]);
+
+		if (!cmp) {
+			*out = bitmap->index_order[mid];
+			return 0;
+		} else if (cmp < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	return GIT_ENOTFOUND;
+}
+
+static int swap_suffix(git_str *out, const char *path, const char *from, const char *to)
+{
+	size_t path_len = strlen(path), from_len = strlen(from);
+
+	if (path_len < from_len || strcmp(path + path_len - from_len, from) != 0) {
+		git_error_set(GIT_ERROR_ODB, "unexpected file name '%s'", path);
+		return -1;
+	}
+
+	git_str_clear(out);
+	git_str_put(out, path, path_len - from_len);
+	git_str_puts(out, to);
+
+	return git_str_oom(out) ? -1 : 0;
+}
+
+static int bitmap_parse(git_pack_bitmap *bitmap)
+{
+	const unsigned char *data = bitmap->map.data;
+	size_t len = bitmap->map.len, pos, size, entries_len, i;
+	uint16_t version, flags;
+	int error;
+
+	if (len < BITMAP_HEADER_LEN + bitmap->oid_size * 2)
+		return bitmap_error("file is too short");
+
+	if (memcmp(data, BITMAP_SIGNATURE, 4) != 0)
+		return bitmap_error("incorrect signature");
+
+	version = (data[4] << 8) | data[5];
+	flags = (data[6] << 8) | data[7];
+	entries_len = read_u32(data + 8);
+
+	if (version != BITMAP_VERSION)
+		return bitmap_error("unsupported version");
+
+	if (!(flags & BITMAP_OPT_FULL_DAG))
+		return bitmap_error("bitmaps without full closure are not supported");
+
+	if (memcmp(data + BITMAP_HEADER_LEN, bitmap->checksum, bitmap->oid_size) != 0)
+		return bitmap_error(bitmap->midx ?
+			"checksum does not match the multi-pack-index" :
+			"checksum does not match the packfile");
+
+	/* leave the trailing checksum out of what is parsed */
+	len -= bitmap->oid_size;
+	pos = BITMAP_HEADER_LEN + bitmap->oid_size;
+
+	for (i = 0; i < BITMAP_TYPES; i++) {
+		if ((error = git_ewah_xor(&bitmap->types[i], data + pos, len - pos)) < 0 ||
+		    (error = git_ewah_size(&size, data + pos, len - pos)) < 0)
+			return error;
+
+		pos += size;
+	}
+
+	if (entries_len > bitmap->num_objects)
+		return bitmap_error("too many entries");
+
+	if (entries_len) {
+		bitmap->entries = git__calloc(entries_len, sizeof(struct bitmap_entry));
+		GIT_ERROR_CHECK_ALLOC(bitmap->entries);
+	}
+
+	for (i = 0; i < entries_len; i++) {
+		struct bitmap_entry *entry = &bitmap->entries[i];
+
+		if (len - pos < 6)
+			return bitmap_error("truncated entry");
+
+		entry->idx_pos = read_u32(data + pos);
+		entry->xor_offset = data[pos + 4];
+		entry->flags = data[pos + 5];
+		pos += 6;
+
+		if (entry->idx_pos >= bitmap->num_objects)
+			return bitmap_error("entry refers to an unknown object");
+
+		if (entry->xor_offset > BITMAP_MAX_XOR_OFFSET ||
+		    entry->xor_offset > i)
+			return bitmap_error("invalid xor offset");
+
+		if ((error = git_ewah_size(&entry->size, data + pos, len - pos)) < 0)
+			return error;
+
+		entry->data = data + pos;
+		pos += entry->size;
+
+		git_oid_cpy(&entry->commit_id, &bitmap->ids[entry->idx_pos]);
+
+		if ((error = git_oidmap_set(bitmap->entry_map, &entry->commit_id, entry)) < 0)
+			return error;
+
+		bitmap->entries_len++;
+	}
+
+	if (flags & BITMAP_OPT_HASH_CACHE) {
+		if ((len - pos) / 4 < bitmap->num_objects)
+			return bitmap_error("truncated name hash cache");
+
+		bitmap->name_hashes = data + pos;
+	}
+
+	return 0;
+}
+
+static git_pack_bitmap *bitmap_alloc(const char *path, git_oid_t oid_type)
+{
+	git_pack_bitmap *bitmap = git__calloc(1, sizeof(git_pack_bitmap));
+
+	if (!bitmap)
+		return NULL;
+
+	bitmap->oid_type = oid_type;
+	bitmap->oid_size = git_oid_size(oid_type);
+
+	if ((bitmap->path = git__strdup(path)) == NULL ||
+	    git_oidmap_new(&bitmap->entry_map) < 0) {
+		git_pack_bitmap_free(bitmap);
+		return NULL;
+	}
+
+	return bitmap;
+}
+
+/* Whether `path` is the bitmap of a multi-pack-index, rather than of a pack */
+static bool is_midx_bitmap(const char *path)
+{
+	const char *name = strrchr(path, '/');
+
+	return git__prefixcmp(name ? name + 1 : path, BITMAP_MIDX_NAME "-") == 0;
+}
+
+/* Find the file that a bitmap at `path` is for: its pack, or multi-pack-index */
+static int bitmap_source_path(git_str *out, const char *path, bool midx)
+{
+	if (!midx)
+		return swap_suffix(out, path, ".bitmap", ".idx");
+
+	if (git_fs_path_dirname_r(out, path) < 0 ||
+	    git_str_joinpath(out, out->ptr, BITMAP_MIDX_NAME) < 0)
+		return -1;
+
+	return 0;
+}
+
+int git_pack_bitmap_open(
+	git_pack_bitmap **out,
+	const char *path,
+	git_oid_t oid_type)
+{
+	git_pack_bitmap *bitmap;
+	git_str source_path = GIT_STR_INIT;
+	bool midx = is_midx_bitmap(path);
+	git_file fd = -1;
+	struct stat st;
+	int error;
+
+	GIT_ASSERT_ARG(out);
+	GIT_ASSERT_ARG(path);
+
+	if ((fd = git_futils_open_ro(path)) < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+	    !git__is_sizet(st.st_size)) {
+		p_close(fd);
+		git_error_set(GIT_ERROR_ODB, "invalid bitmap index '%s'", path);
+		return GIT_ENOTFOUND;
+	}
+
+	bitmap = bitmap_alloc(path, oid_type);
+	GIT_ERROR_CHECK_ALLOC(bitmap);
+
+	error = git_futils_mmap_ro(&bitmap->map, fd, 0, (size_t)st.st_size);
+	p_close(fd);
+
+	if (error < 0 ||
+	    (error = bitmap_source_path(&source_path, path, midx)) < 0 ||
+	    (error = midx ? load_midx(bitmap, source_path.ptr) :
+			load_pack(bitmap, source_path.ptr)) < 0 ||
+	    (error = bitmap_parse(bitmap)) < 0) {
+		git_pack_bitmap_free(bitmap);
+		goto done;
+	}
+
+	*out = bitmap;
+
+done:
+	git_str_dispose(&source_path);
+	return error;
+}
+
+bool git_pack_bitmap_needs_refresh(const git_pack_bitmap *bitmap)
+{
+	git_file fd = -1;
+	struct stat st;
+	ssize_t bytes_read;
+	unsigned char checksum[GIT_HASH_MAX_SIZE];
+	size_t checksum_size = bitmap->oid_size;
+
+	if ((fd = git_futils_open_ro(bitmap->path)) < 0)
+		return true;
+
+	if (p_fstat(fd, &st) < 0) {
+		p_close(fd);
+		return true;
+	}
+
+	if (!S_ISREG(st.st_mode) || !git__is_sizet(st.st_size) ||
+	    (size_t)st.st_size != bitmap->map.len) {
+		p_close(fd);
+		return true;
+	}
+
+	bytes_read = p_pread(fd, checksum, checksum_size, st.st_size - checksum_size);
+	p_close(fd);
+
+	if (bytes_read != (ssize_t)checksum_size)
+		return true;
+
+	return memcmp(checksum, (const unsigned char *)bitmap->map.data +
+		bitmap->map.len - checksum_size, checksum_size) != 0;
+}
+
+void git_pack_bitmap_free(git_pack_bitmap *bitmap)
+{
+	size_t i;
+
+	if (!bitmap)
+		return;
+
+	for (i = 0; i < bitmap->entries_len; i++) {
+		git_bitmap_dispose(bitmap->entries[i].computed);
+		git__free(bitmap->entries[i].computed);
+	}
+
+	for (i = 0; i < BITMAP_TYPES; i++)
+		git_bitmap_dispose(&bitmap->types[i]);
+
+	git_oidmap_free(bitmap->entry_map);
+	git__free(bitmap->entries);
+	git__free(bitmap->ids);
+	git__free(bitmap->offsets);
+	git__free(bitmap->pack_ids);
+	git__free(bitmap->pack_order);
+	git__free(bitmap->index_order);
+
+	if (bitmap->map.data)
+		git_futils_mmap_free(&bitmap->map);
+
+	for (i = 0; i < bitmap->packs_len; i++) {
+		if (bitmap->packs[i])
+			git_mwindow_put_pack(bitmap->packs[i]);
+	}
+
+	git__free(bitmap->packs);
+
+	git__free(bitmap->path);
+	git__free(bitmap);
+}
+
+size_t git_pack_bitmap_object_count(const git_pack_bitmap *bitmap)
+{
+	return bitmap->num_objects;
+}
+
+int git_pack_bitmap_object(
+	git_oid *id_out,
+	uint32_t *name_hash_out,
+	const git_pack_bitmap *bitmap,
+	size_t pos)
+{
+	uint32_t idx_pos;
+
+	if (pos >= bitmap->num_objects) {
+		git_error_set(GIT_ERROR_ODB, "bitmap position %" PRIuZ " is out of range", pos);
+		return -1;
+	}
+
+	idx_pos = bitmap->pack_order[pos];
+
+	git_oid_cpy(id_out, &bitmap->ids[idx_pos]);
+	*name_hash_out = bitmap->name_hashes ?
+		read_u32(bitmap->name_hashes + idx_pos * 4) : 0;
+
+	return 0;
+}
+
+int git_pack_bitmap_object_location(
+	struct git_pack_file **pack_out,
+	off64_t *offset_out,
+	off64_t *disk_size_out,
+	const git_pack_bitmap *bitmap,
+	size_t pos)
+{
+	struct git_pack_file *pack;
+	uint32_t idx_pos;
+	off64_t offset, next;
+	int error;
+
+	if (pos >= bitmap->num_objects) {
+		git_error_set(GIT_ERROR_ODB, "bitmap position %" PRIuZ " is out of range", pos);
+		return -1;
+	}
+
+	idx_pos = bitmap->pack_order[pos];
+	pack = bitmap->packs[bitmap->midx ? bitmap->pack_ids[idx_pos] : 0];
+	offset = bitmap->offsets[idx_pos];
+
+	/*
+	 * A pack's bit positions are its pack positions, so the next object
+	 * is our end; a multi-pack-index may leave some objects of its packs
+	 * out, so there the pack's own reverse index is searched.
+	 */
+	if (bitmap->midx) {
+		if ((error = git_packfile_object_disk_size(disk_size_out, pack, offset)) < 0)
+			return error;
+	} else {
+		if ((error = git_packfile_pack_pos_to_offset(&next, pack, (uint32_t)pos + 1)) < 0)
+			return error;
+
+		*disk_size_out = next - offset;
+	}
+
+	*pack_out = pack;
+	*offset_out = offset;
+	return 0;
+}
+
+git_object_t git_pack_bitmap_object_type(
+	const git_pack_bitmap *bitmap,
+	size_t pos)
+{
+	int type;
+
+	for (type = GIT_OBJECT_COMMIT; type <= GIT_OBJECT_TAG; type++) {
+		if (git_bitmap_get(&bitmap->types[type - 1], pos))
+			return (git_object_t)type;
+	}
+
+	return GIT_OBJECT_INVALID;
+}
+
+size_t git_pack_bitmap_count(
+	const git_pack_bitmap *bitmap,
+	const git_bitmap *objects,
+	git_object_t type)
+{
+	if (type < GIT_OBJECT_COMMIT || type > GIT_OBJECT_TAG)
+		return 0;
+
+	return git_bitmap_popcount_and(objects, &bitmap->types[type - 1]);
+}
+
+/* Decode the bitmap of an entry, following its chain of XOR bases. */
+static int entry_bitmap(
+	git_bitmap *out,
+	const git_pack_bitmap *bitmap,
+	const struct bitmap_entry *entry)
+{
+	size_t i = entry - bitmap->entries;
+
+	git_bitmap_clear(out);
+
+	if (entry->computed)
+		return git_bitmap_or(out, entry->computed);
+
+	while (true) {
+		if (git_ewah_xor(out, entry->data, entry->size) < 0)
+			return -1;
+
+		if (!entry->xor_offset)
+			break;
+
+		i -= entry->xor_offset;
+		entry = &bitmap->entries[i];
+	}
+
+	return 0;
+}
+
+struct reachable_state {
+	git_pack_bitmap *bitmap;
+	git_repository *repo;
+	git_bitmap *out;
+};
+
+static int reachable_tree(struct reachable_state *state, const git_oid *tree_id)
+{
+	const git_tree_entry *entry;
+	git_tree *tree;
+	size_t pos, i;
+	int error;
+
+	if ((error = object_pos(&pos, state->bitmap, tree_id)) < 0)
+		return error;
+
+	if (git_bitmap_get(state->out, pos))
+		return 0;
+
+	if ((error = git_bitmap_set(state->out, pos)) < 0 ||
+	    (error = git_tree_lookup(&tree, state->repo, tree_id)) < 0)
+		return error;
+
+	for (i = 0; i < git_tree_entrycount(tree); i++) {
+		entry = git_tree_entry_byindex(tree, i);
+
+		switch (git_tree_entry_type(entry)) {
+		case GIT_OBJECT_TREE:
+			error = reachable_tree(state, git_tree_entry_id(entry));
+			break;
+		case GIT_OBJECT_BLOB:
+			if ((error = object_pos(&pos, state->bitmap, git_tree_entry_id(entry))) == 0)
+				error = git_bitmap_set(state->out, pos);
+			break;
+		default:
+			/* submodules are not part of the pack */
+			break;
+		}
+
+		if (error < 0)
+			break;
+	}
+
+	git_tree_free(tree);
+	return error;
+}
+
+int git_pack_bitmap_reachable(
+	git_bitmap *out,
+	git_pack_bitmap *bitmap,
+	git_repository *repo,
+	const git_oid *commits,
+	size_t commits_len,
+	unsigned int flags)
+{
+	struct reachable_state state = { bitmap, repo, out };
+	git_array_t(git_oid) stack = GIT_ARRAY_INIT;
+	git_bitmap stored = GIT_BITMAP_INIT;
+	struct bitmap_entry *entry;
+	git_commit *commit;
+	git_oid *id, commit_id;
+	size_t pos, i;
+	int error = 0;
+
+	/* the stored bitmaps know nothing about grafts */
+	if (git_repository_is_shallow(repo) == 1)
+		return GIT_ENOTFOUND;
+
+	for (i = 0; i < commits_len; i++) {
+		id = git_array_alloc(stack);
+		GIT_ERROR_CHECK_ALLOC(id);
+		git_oid_cpy(id, &commits[i]);
+	}
+
+	while ((id = git_array_pop(stack)) != NULL) {
+		git_oid_cpy(&commit_id, id);
+
+		if ((error = object_pos(&pos, bitmap, &commit_id)) < 0)
+			goto done;
+
+		if (git_bitmap_get(out, pos))
+			continue;
+
+		if ((entry = git_oidmap_get(bitmap->entry_map, &commit_id)) != NULL) {
+			if ((error = entry_bitmap(&stored, bitmap, entry)) < 0 ||
+			    (error = git_bitmap_or(out, &stored)) < 0)
+				goto done;
+
+			continue;
+		}
+
+		if ((error = git_bitmap_set(out, pos)) < 0 ||
+		    (error = git_commit_lookup(&commit, repo, &commit_id)) < 0)
+			goto done;
+
+		if (!(flags & GIT_PACK_BITMAP_COMMITS_ONLY))
+			error = reachable_tree(&state, git_commit_tree_id(commit));
+
+		for (i = 0; !error && i < git_commit_parentcount(commit); i++) {
+			if ((id = git_array_alloc(stack)) == NULL)
+				error = -1;
+			else
+				git_oid_cpy(id, git_commit_parent_id(commit, i));
+		}
+
+		git_commit_free(commit);
+
+		if (error < 0)
+			goto done;
+	}
+
+done:
+	git_bitmap_dispose(&stored);
+	git_array_clear(stack);
+	return error;
+}
+
+static int find_bitmap(void *payload, git_str *path)
+{
+	git_pack_bitmaps *bitmaps = payload;
+	git_pack_bitmap *bitmap;
+
+	if (git__suffixcmp(path->ptr, ".bitmap") != 0)
+		return 0;
+
+	/* A multi-pack-index's bitmap covers more objects than a pack's */
+	if (bitmaps->bitmap &&
+	    (bitmaps->bitmap->midx || !is_midx_bitmap(path->ptr)))
+		return 0;
+
+	/* Best effort: a bitmap that cannot be used is ignored */
+	if (git_pack_bitmap_open(&bitmap, path->ptr, bitmaps->oid_type) < 0) {
+		git_error_clear();
+		return 0;
+	}
+
+	git_pack_bitmap_free(bitmaps->bitmap);
+	bitmaps->bitmap = bitmap;
+	return 0;
+}
+
+int git_pack_bitmaps_new(
+	git_pack_bitmaps **out,
+	const char *objects_dir,
+	git_oid_t oid_type)
+{
+	git_pack_bitmaps *bitmaps;
+
+	GIT_ASSERT_ARG(out);
+	GIT_ASSERT_ARG(objects_dir);
+
+	bitmaps = git__calloc(1, sizeof(git_pack_bitmaps));
+	GIT_ERROR_CHECK_ALLOC(bitmaps);
+
+	bitmaps->oid_type = oid_type;
+
+	if (git_str_joinpath(&bitmaps->pack_dir, objects_dir, "pack") < 0) {
+		git_pack_bitmaps_free(bitmaps);
+		return -1;
+	}
+
+	*out = bitmaps;
+	return 0;
+}
+
+int git_pack_bitmaps_get(git_pack_bitmap **out, git_pack_bitmaps *bitmaps)
+{
+	git_str path = GIT_STR_INIT;
+	int error;
+
+	if (!bitmaps->checked) {
+		/* We only check once, no matter the result. */
+		bitmaps->checked = 1;
+
+		if (!bitmaps->bitmap && git_fs_path_isdir(bitmaps->pack_dir.ptr)) {
+			if ((error = git_str_puts(&path, bitmaps->pack_dir.ptr)) < 0 ||
+			    (error = git_fs_path_direach(&path, 0, find_bitmap, bitmaps)) < 0) {
+				git_str_dispose(&path);
+				return error;
+			}
+
+			git_str_dispose(&path);
+		}
+	}
+
+	if (!bitmaps->bitmap)
+		return GIT_ENOTFOUND;
+
+	*out = bitmaps->bitmap;
+	return 0;
+}
+
+void git_pack_bitmaps_refresh(git_pack_bitmaps *bitmaps)
+{
+	if (!bitmaps->checked)
+		return;
+
+	if (bitmaps->bitmap && git_pack_bitmap_needs_refresh(bitmaps->bitmap)) {
+		git_pack_bitmap_free(bitmaps->bitmap);
+		bitmaps->bitmap = NULL;
+	}
+
+	/* Force a lazy re-check next time it is needed. */
+	bitmaps->checked = 0;
+}
+
+void git_pack_bitmaps_free(git_pack_bitmaps *bitmaps)
+{
+	if (!bitmaps)
+		return;
+
+	git_str_dispose(&bitmaps->pack_dir);
+	git_pack_bitmap_free(bitmaps->bitmap);
+	git__free(bitmaps);
+}
+
+/*
+ * Writing bitmaps: every commit of the pack that is not the parent of
+ * another one gets a bitmap, as does one in every hundred of the others,
+ * so that a walk from any commit reaches a bitmap quickly.
+ */
+
+typedef git_array_t(git_oid) bitmap_commits;
+
+static int put_u32(git_str *out, uint32_t value)
+{
+	uint32_t be = htonl(value);
+	return git_str_put(out, (const char *)&be, sizeof(be));
+}
+
+static int writer_select(
+	git_pack_bitmap *bitmap,
+	git_repository *repo,
+	bitmap_commits *commits)
+{
+	git_bitmap has_child = GIT_BITMAP_INIT;
+	git_revwalk *walk = NULL;
+	git_commit *commit;
+	struct bitmap_entry *entry;
+	git_oid id;
+	size_t i, j, pos, count = 0;
+	int error;
+
+	if (!commits->size)
+		return 0;
+
+	bitmap->entries = git__calloc(commits->size, sizeof(struct bitmap_entry));
+	GIT_ERROR_CHECK_ALLOC(bitmap->entries);
+
+	if ((error = git_revwalk_new(&walk, repo)) < 0 ||
+	    (error = git_revwalk_sorting(walk, GIT_SORT_TOPOLOGICAL | GIT_SORT_REVERSE)) < 0)
+		goto done;
+
+	for (i = 0; i < commits->size; i++) {
+		if ((error = git_commit_lookup(&commit, repo, &commits->ptr[i])) < 0)
+			goto done;
+
+		for (j = 0; !error && j < git_commit_parentcount(commit); j++) {
+			if (object_pos(&pos, bitmap, git_commit_parent_id(commit, j)) == 0)
+				error = git_bitmap_set(&has_child, pos);
+		}
+
+		git_commit_free(commit);
+
+		if (error < 0 ||
+		    (error = git_revwalk_push(walk, &commits->ptr[i])) < 0)
+			goto done;
+	}
+
+	/* parents come first, so that their bitmaps can be reused */
+	while ((error = git_revwalk_next(&id, walk)) == 0) {
+		if (object_pos(&pos, bitmap, &id) < 0) {
+			git_error_set(GIT_ERROR_ODB, "cannot write bitmap: pack is missing the commit %s",
+				git_oid_tostr_s(&id));
+			error = -1;
+			goto done;
+		}
+
+		if (git_bitmap_get(&has_child, pos) &&
+		    (count++ % BITMAP_COMMIT_INTERVAL) != 0)
+			continue;
+
+		entry = &bitmap->entries[bitmap->entries_len];
+		git_oid_cpy(&entry->commit_id, &id);
+		entry->idx_pos = bitmap->pack_order[pos];
+
+		entry->computed = git__calloc(1, sizeof(git_bitmap));
+		GIT_ERROR_CHECK_ALLOC(entry->computed);
+
+		/* only add the entry once its bitmap is complete */
+		if ((error = git_pack_bitmap_reachable(entry->computed,
+				bitmap, repo, &id, 1, 0)) < 0) {
+			git_bitmap_dispose(entry->computed);
+			git__free(entry->computed);
+			entry->computed = NULL;
+			break;
+		}
+
+		bitmap->entries_len++;
+
+		if ((error = git_oidmap_set(bitmap->entry_map, &entry->commit_id, entry)) < 0)
+			goto done;
+	}
+
+	if (error == GIT_ITEROVER)
+		error = 0;
+	else if (error == GIT_ENOTFOUND)
+		git_error_set(GIT_ERROR_ODB, "cannot write bitmap: pack is not closed under reachability");
+
+done:
+	git_revwalk_free(walk);
+	git_bitmap_dispose(&has_child);
+	return error;
+}
+
+static int writer_serialize(
+	git_str *out,
+	git_pack_bitmap *bitmap,
+	git_pack_bitmap_name_hash_cb name_hash,
+	void *payload)
+{
+	unsigned char checksum[GIT_HASH_MAX_SIZE];
+	size_t i;
+	int error;
+
+	if ((error = git_str_put(out, BITMAP_SIGNATURE, 4)) < 0 ||
+	    (error = git_str_putc(out, 0)) < 0 ||
+	    (error = git_str_putc(out, BITMAP_VERSION)) < 0 ||
+	    (error = git_str_putc(out, 0)) < 0 ||
+	    (error = git_str_putc(out, BITMAP_OPT_FULL_DAG |
+			(name_hash ? BITMAP_OPT_HASH_CACHE : 0))) < 0 ||
+	    (error = put_u32(out, (uint32_t)bitmap->entries_len)) < 0 ||
+	    (error = git_str_put(out, (const char *)bitmap->checksum, bitmap->oid_size)) < 0)
+		return error;
+
+	for (i = 0; i < BITMAP_TYPES; i++) {
+		if ((error = git_ewah_write(out, &bitmap->types[i], bitmap->num_objects)) < 0)
+			return error;
+	}
+
+	for (i = 0; i < bitmap->entries_len; i++) {
+		struct bitmap_entry *entry = &bitmap->entries[i];
+
+		if ((error = put_u32(out, entry->idx_pos)) < 0 ||
+		    (error = git_str_putc(out, 0)) < 0 ||
+		    (error = git_str_putc(out, 0)) < 0 ||
+		    (error = git_ewah_write(out, entry->computed, bitmap->num_objects)) < 0)
+			return error;
+	}
+
+	/* without names, there is no hash cache */
+	for (i = 0; name_hash && i < bitmap->num_objects; i++) {
+		if ((error = put_u32(out, name_hash(&bitmap->ids[i], payload))) < 0)
+			return error;
+	}
+
+	if ((error = git_hash_buf(checksum, out->ptr, out->size,
+			git_oid_algorithm(bitmap->oid_type))) < 0)
+		return error;
+
+	return git_str_put(out, (const char *)checksum, bitmap->oid_size);
+}
+
+/* Write the bitmap of the objects loaded into `bitmap` to its path */
+static int writer_write(
+	git_pack_bitmap *bitmap,
+	git_repository *repo,
+	git_pack_bitmap_name_hash_cb name_hash,
+	void *payload)
+{
+	bitmap_commits commits = GIT_ARRAY_INIT;
+	git_str contents = GIT_STR_INIT;
+	git_filebuf file = GIT_FILEBUF_INIT;
+	struct git_pack_file *pack;
+	git_object_t type;
+	git_oid *id;
+	size_t pos;
+	int error = 0;
+
+	for (pos = 0; pos < bitmap->num_objects; pos++) {
+		uint32_t idx_pos = bitmap->pack_order[pos];
+
+		pack = bitmap->packs[bitmap->midx ? bitmap->pack_ids[idx_pos] : 0];
+
+		if ((error = git_packfile_resolve_type(&type,
+				pack, bitmap->offsets[idx_pos])) < 0)
+			goto done;
+
+		if (type < GIT_OBJECT_COMMIT || type > GIT_OBJECT_TAG) {
+			error = bitmap_error("unexpected object type in pack");
+			goto done;
+		}
+
+		if ((error = git_bitmap_set(&bitmap->types[type - 1], pos)) < 0)
+			goto done;
+
+		if (type == GIT_OBJECT_COMMIT) {
+			if ((id = git_array_alloc(commits)) == NULL) {
+				error = -1;
+				goto done;
+			}
+
+			git_oid_cpy(id, &bitmap->ids[idx_pos]);
+		}
+	}
+
+	if ((error = writer_select(bitmap, repo, &commits)) < 0 ||
+	    (error = writer_serialize(&contents, bitmap, name_hash, payload)) < 0)
+		goto done;
+
+	if ((error = git_filebuf_open(&file, bitmap->path,
+			GIT_FILEBUF_DO_NOT_BUFFER, GIT_PACK_FILE_MODE)) < 0 ||
+	    (error = git_filebuf_write(&file, contents.ptr, contents.size)) < 0 ||
+	    (error = git_filebuf_commit(&file)) < 0)
+		goto done;
+
+done:
+	git_filebuf_cleanup(&file);
+	git_array_clear(commits);
+	git_str_dispose(&contents);
+	return error;
+}
+
+int git_pack_bitmap_write(
+	const char *pack_path,
+	git_repository *repo,
+	git_pack_bitmap_name_hash_cb name_hash,
+	void *payload)
+{
+	git_pack_bitmap *bitmap = NULL;
+	git_str path = GIT_STR_INIT;
+	int error;
+
+	GIT_ASSERT_ARG(pack_path);
+	GIT_ASSERT_ARG(repo);
+
+	if ((error = swap_suffix(&path, pack_path, ".pack", ".bitmap")) < 0)
+		goto done;
+
+	if ((bitmap = bitmap_alloc(path.ptr, repo->oid_type)) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	if ((error = swap_suffix(&path, pack_path, ".pack", ".idx")) < 0 ||
+	    (error = load_pack(bitmap, path.ptr)) < 0)
+		goto done;
+
+	error = writer_write(bitmap, repo, name_hash, payload);
+
+done:
+	git_str_dispose(&path);
+	git_pack_bitmap_free(bitmap);
+	return error;
+}
+
+/* Remove the bitmaps of the multi-pack-index other than the current one */
+static int remove_stale_midx_bitmap(void *payload, git_str *path)
+{
+	const char *current = payload;
+
+	if (!is_midx_bitmap(path->ptr) ||
+	    git__suffixcmp(path->ptr, ".bitmap") != 0 ||
+	    strcmp(path->ptr, current) == 0)
+		return 0;
+
+	if (p_unlink(path->ptr) < 0 && errno != ENOENT) {
+		git_error_set(GIT_ERROR_OS, "failed to remove stale bitmap '%s'", path->ptr);
+		return -1;
+	}
+
+	return 0;
+}
+
+int git_pack_bitmap_write_midx(
+	const char *midx_path,
+	git_repository *repo,
+	git_pack_bitmap_name_hash_cb name_hash,
+	void *payload)
+{
+	git_pack_bitmap *bitmap = NULL;
+	git_str path = GIT_STR_INIT;
+	int error;
+
+	GIT_ASSERT_ARG(midx_path);
+	GIT_ASSERT_ARG(repo);
+
+	if ((bitmap = bitmap_alloc(midx_path, repo->oid_type)) == NULL)
+		return -1;
+
+	if ((error = load_midx(bitmap, midx_path)) < 0)
+		goto done;
+
+	/* the bitmap is named after the multi-pack-index that it is for */
+	if ((error = git_str_printf(&path, "%s-", midx_path)) < 0 ||
+	    (error = git_str_encode_hexstr(&path,
+			(const char *)bitmap->checksum, bitmap->oid_size)) < 0 ||
+	    (error = git_str_puts(&path, ".bitmap")) < 0)
+		goto done;
+
+	git__free(bitmap->path);
+	bitmap->path = git_str_detach(&path);
+
+	if ((error = writer_write(bitmap, repo, name_hash, payload)) < 0 ||
+	    (error = git_fs_path_dirname_r(&path, midx_path)) < 0)
+		goto done;
+
+	error = git_fs_path_direach(&path, 0, remove_stale_midx_bitmap, bitmap->path);
+
+done:
+	git_str_dispose(&path);
+	git_pack_bitmap_free(bitmap);
+	return error;
+}
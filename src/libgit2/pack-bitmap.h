@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#ifndef INCLUDE_pack_bitmap_h__
+#define INCLUDE_pack_bitmap_h__
+
+#include "common.h"
+
+#include "git2/types.h"
+
+#include "ewah.h"
+#include "map.h"
+#include "str.h"
+
+struct git_pack_file;
+
+/**
+ * A reachability bitmap index (".bitmap" file) for a single packfile.
+ *
+ * Every object in the pack is given a bit, in the order in which the
+ * objects are stored in the pack, and a selection of the pack's commits
+ * have a bitmap of every object reachable from them.  The reachable set
+ * of any other commit is found by walking it until commits with a bitmap
+ * are reached.
+ *
+ * The bitmap of a multi-pack-index ("multi-pack-index-<checksum>.bitmap")
+ * covers the objects of all of its packs instead, in the order of its
+ * reverse index, and is preferred over the bitmap of a single pack.
+ *
+ * Support for this feature was added in git 2.0, and for multi-pack
+ * bitmaps in git 2.34.
+ */
+typedef struct git_pack_bitmap git_pack_bitmap;
+
+/* A wrapper for git_pack_bitmap to enable lazy loading in the ODB. */
+typedef struct git_pack_bitmaps {
+	/* The pack directory, like ".git/objects/pack". */
+	git_str pack_dir;
+
+	/* The bitmap found in the pack directory, if any. */
+	git_pack_bitmap *bitmap;
+
+	git_oid_t oid_type;
+
+	/* Whether the pack directory was already searched for a bitmap. */
+	bool checked;
+} git_pack_bitmaps;
+
+int git_pack_bitmaps_new(
+	git_pack_bitmaps **out,
+	const char *objects_dir,
+	git_oid_t oid_type);
+
+/*
+ * Get the bitmap of the pack directory, opening it if needed.  Returns
+ * GIT_ENOTFOUND if there is none.
+ */
+int git_pack_bitmaps_get(git_pack_bitmap **out, git_pack_bitmaps *bitmaps);
+void git_pack_bitmaps_refresh(git_pack_bitmaps *bitmaps);
+void git_pack_bitmaps_free(git_pack_bitmaps *bitmaps);
+
+/* Open the ".bitmap" file at `path` along with its pack or packs. */
+int git_pack_bitmap_open(
+	git_pack_bitmap **out,
+	const char *path,
+	git_oid_t oid_type);
+bool git_pack_bitmap_needs_refresh(const git_pack_bitmap *bitmap);
+void git_pack_bitmap_free(git_pack_bitmap *bitmap);
+
+size_t git_pack_bitmap_object_count(const git_pack_bitmap *bitmap);
+
+/*
+ * Look up the object at the given bit position, along with the name
+ * hash that was recorded for it (or zero).
+ */
+int git_pack_bitmap_object(
+	git_oid *id_out,
+	uint32_t *name_hash_out,
+	const git_pack_bitmap *bitmap,
+	size_t pos);
+
+/*
+ * Find where the object at the given bit position lives: its pack, its
+ * offset and the number of bytes it takes up there.  This uses the
+ * pack's reverse index and does not read the object.
+ */
+int git_pack_bitmap_object_location(
+	struct git_pack_file **pack_out,
+	off64_t *offset_out,
+	off64_t *disk_size_out,
+	const git_pack_bitmap *bitmap,
+	size_t pos);
+
+/*
+ * The type of the object at the given bit position, as recorded in the
+ * bitmap, or `GIT_OBJECT_INVALID` if it has none.
+ */
+git_object_t git_pack_bitmap_object_type(
+	const git_pack_bitmap *bitmap,
+	size_t pos);
+
+/* Count the objects of the given type in a bitmap of this pack */
+size_t git_pack_bitmap_count(
+	const git_pack_bitmap *bitmap,
+	const git_bitmap *objects,
+	git_object_t type);
+
+typedef enum {
+	/* Only the commits of the result are needed */
+	GIT_PACK_BITMAP_COMMITS_ONLY = (1u << 0)
+} git_pack_bitmap_reachable_t;
+
+/*
+ * Compute the set of objects reachable from the given commits.  Returns
+ * GIT_ENOTFOUND when some of these objects are not in the bitmapped pack,
+ * in which case callers should fall back to walking the graph.
+ */
+int git_pack_bitmap_reachable(
+	git_bitmap *out,
+	git_pack_bitmap *bitmap,
+	git_repository *repo,
+	const git_oid *commits,
+	size_t commits_len,
+	unsigned int flags);
+
+/* Provides the name hash of an object, for the bitmap's hash cache */
+typedef uint32_t (*git_pack_bitmap_name_hash_cb)(const git_oid *id, void *payload);
+
+/*
+ * Write a bitmap index for the packfile at `pack_path`, whose objects
+ * must all be in `repo`.  The pack must be closed under reachability.
+ */
+int git_pack_bitmap_write(
+	const char *pack_path,
+	git_repository *repo,
+	git_pack_bitmap_name_hash_cb name_hash,
+	void *payload);
+
+/*
+ * Write a bitmap index for the multi-pack-index at `midx_path`, which
+ * must have a reverse index, and remove the bitmaps of its previous
+ * versions.  The objects of its packs must be closed under reachability.
+ */
+int git_pack_bitmap_write_midx(
+	const char *midx_path,
+	git_repository *repo,
+	git_pack_bitmap_name_hash_cb name_hash,
+	void *payload);
+
+#endif
@@ -10,12 +10,17 @@
 #include "buf.h"
 #include "zstream.h"
 #include "delta.h"
+#include "delta-islands.h"
 #include "iterator.h"
+#include "odb.h"
 #include "pack.h"
+#include "pack-bitmap.h"
 #include "thread.h"
+#include "trace.h"
 #include "tree.h"
 #include "util.h"
 #include "revwalk.h"
+#include "stream.h"
 #include "commit_list.h"
 
 #include "git2/pack.h"
@@ -89,6 +94,7 @@ static int packbuilder_config(git_packbuilder *pb)
 	git_config *config;
 	int ret = 0;
 	int64_t val;
+	int use_bitmaps;
 
 	if ((ret = git_repository_config_snapshot(&config, pb->repo)) < 0)
 		return ret;
@@ -115,9 +121,23 @@ static int packbuilder_config(git_packbuilder *pb)
 	config_get("pack.deltaCacheSize", pb->big_file_threshold,
 		   GIT_PACK_BIG_FILE_THRESHOLD);
 	config_get("pack.windowMemory", pb->window_memory_limit, 0);
+	config_get("pack.window", pb->window, GIT_PACK_WINDOW);
+	config_get("pack.depth", pb->depth, GIT_PACK_DEPTH);
 
 #undef config_get
 
+	if ((ret = git_config_get_bool(&use_bitmaps, config, "pack.useBitmaps")) == GIT_ENOTFOUND) {
+		use_bitmaps = 1;
+		ret = 0;
+	} else if (ret < 0) {
+		goto out;
+	}
+
+	pb->use_bitmaps = !!use_bitmaps;
+
+	if (pb->depth > GIT_PACK_MAX_DEPTH)
+		pb->depth = GIT_PACK_MAX_DEPTH;
+
 out:
 	git_config_free(config);
 
@@ -146,6 +166,8 @@ int git_packbuilder_new(git_packbuilder **out, git_repository *repo)
 
 	pb->repo = repo;
 	pb->nr_threads = 1; /* do not spawn any thread by default */
+	pb->reuse_objects = true;
+	pb->write_window = GIT_PACK_WRITE_WINDOW;
 
 	if (git_hash_ctx_init(&pb->ctx, hash_algorithm) < 0 ||
 		git_zstream_init(&pb->zstream, GIT_ZSTREAM_DEFLATE) < 0 ||
@@ -156,8 +178,7 @@ int git_packbuilder_new(git_packbuilder **out, git_repository *repo)
 #ifdef GIT_THREADS
 
 	if (git_mutex_init(&pb->cache_mutex) ||
-		git_mutex_init(&pb->progress_mutex) ||
-		git_cond_init(&pb->progress_cond))
+		git_mutex_init(&pb->progress_mutex))
 	{
 		git_error_set(GIT_ERROR_OS, "failed to initialize packbuilder mutex");
 		goto on_error;
@@ -202,16 +223,49 @@ static int rehash(git_packbuilder *pb)
 	return 0;
 }
 
-int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
-			   const char *name)
+int git_packbuilder_set_write_bitmap(git_packbuilder *pb, int enabled)
+{
+	GIT_ASSERT_ARG(pb);
+
+	pb->write_bitmap = !!enabled;
+	return 0;
+}
+
+int git_packbuilder_set_delta_islands(git_packbuilder *pb, int enabled)
+{
+	GIT_ASSERT_ARG(pb);
+
+	pb->use_delta_islands = !!enabled;
+	return 0;
+}
+
+int git_packbuilder_set_write_window(git_packbuilder *pb, size_t size)
+{
+	GIT_ASSERT_ARG(pb);
+
+	pb->write_window = size;
+	return 0;
+}
+
+/*
+ * Add an object to the pack.  When the caller already knows where the
+ * object lives (`in_pack` is not NULL) and what its type is, nothing is
+ * read: its size is only looked up once we know whether the stored
+ * entry is reused, see `resolve_object_sizes`.
+ */
+static int packbuilder_insert(
+	git_packbuilder *pb,
+	const git_oid *oid,
+	uint32_t hash,
+	git_object_t type,
+	struct git_pack_file *in_pack,
+	off64_t in_pack_offset,
+	off64_t in_pack_size)
 {
 	git_pobject *po;
 	size_t newsize;
 	int ret;
 
-	GIT_ASSERT_ARG(pb);
-	GIT_ASSERT_ARG(oid);
-
 	/* If the object already exists in the hash table, then we don't
 	 * have any work to do */
 	if (git_oidmap_exists(pb->object_ix, oid))
@@ -239,12 +293,20 @@ int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
 	po = pb->object_list + pb->nr_objects;
 	memset(po, 0x0, sizeof(*po));
 
-	if ((ret = git_odb_read_header(&po->size, &po->type, pb->odb, oid)) < 0)
+	if (in_pack) {
+		po->type = type;
+		po->in_pack = in_pack;
+		po->in_pack_offset = in_pack_offset;
+		po->in_pack_size = in_pack_size;
+	} else if ((ret = git_odb_read_header(&po->size, &po->type, pb->odb, oid)) < 0) {
 		return ret;
+	} else {
+		po->size_valid = 1;
+	}
 
 	pb->nr_objects++;
 	git_oid_cpy(&po->id, oid);
-	po->hash = name_hash(name);
+	po->hash = hash;
 
 	if (git_oidmap_set(pb->object_ix, &po->id, po) < 0) {
 		git_error_set_oom();
@@ -272,6 +334,16 @@ int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
 	return 0;
 }
 
+int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
+			   const char *name)
+{
+	GIT_ASSERT_ARG(pb);
+	GIT_ASSERT_ARG(oid);
+
+	return packbuilder_insert(pb, oid, name_hash(name),
+		GIT_OBJECT_INVALID, NULL, 0, 0);
+}
+
 static int get_delta(void **out, git_odb *odb, git_pobject *po)
 {
 	git_odb_object *src = NULL, *trg = NULL;
@@ -310,20 +382,159 @@ on_error:
 	return -1;
 }
 
-static int write_object(
+/* Size of the chunks that are handed to the write callback */
+#define WRITE_CHUNK_SIZE (128 * 1024)
+
+/*
+ * Gathers the pack into chunks of WRITE_CHUNK_SIZE bytes, so that the
+ * write callback sees few large writes at aligned offsets.  Data that
+ * spans whole chunks is passed through without being copied.
+ */
+struct pack_writer {
+	git_packbuilder *pb;
+	int (*write_cb)(void *buf, size_t size, void *cb_data);
+	void *cb_data;
+
+	unsigned char *chunk; /* room for a chunk and the trailer */
+	size_t chunk_len;
+};
+
+static int pack_writer_emit(struct pack_writer *w, const void *buf, size_t len)
+{
+	int error;
+
+	if ((error = w->write_cb((void *)buf, len, w->cb_data)) < 0)
+		return error;
+
+	return git_hash_update(&w->pb->ctx, buf, len);
+}
+
+static int pack_writer_put(struct pack_writer *w, const void *data, size_t len)
+{
+	const unsigned char *buf = data;
+	size_t n;
+	int error;
+
+	while (len) {
+		if (!w->chunk_len && len >= WRITE_CHUNK_SIZE) {
+			n = len - (len % WRITE_CHUNK_SIZE);
+
+			if ((error = pack_writer_emit(w, buf, n)) < 0)
+				return error;
+		} else {
+			n = min(WRITE_CHUNK_SIZE - w->chunk_len, len);
+			memcpy(w->chunk + w->chunk_len, buf, n);
+			w->chunk_len += n;
+
+			if (w->chunk_len == WRITE_CHUNK_SIZE) {
+				w->chunk_len = 0;
+
+				if ((error = pack_writer_emit(w, w->chunk, WRITE_CHUNK_SIZE)) < 0)
+					return error;
+			}
+		}
+
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* Write what is left along with the trailer, which is not hashed itself */
+static int pack_writer_finish(struct pack_writer *w)
+{
+	int error;
+
+	if ((error = git_hash_update(&w->pb->ctx, w->chunk, w->chunk_len)) < 0 ||
+	    (error = git_hash_final(w->chunk + w->chunk_len, &w->pb->ctx)) < 0)
+		return error;
+
+	w->chunk_len += git_oid_size(w->pb->oid_type);
+
+	if ((error = w->write_cb(w->chunk, w->chunk_len, w->cb_data)) < 0)
+		return error;
+
+	w->chunk_len = 0;
+	return 0;
+}
+
+static int reuse_write_cb(const void *buf, size_t len, void *payload)
+{
+	return pack_writer_put(payload, buf, len);
+}
+
+GIT_INLINE(bool) type_is_delta(git_object_t type)
+{
+	return type == GIT_OBJECT_OFS_DELTA || type == GIT_OBJECT_REF_DELTA;
+}
+
+/*
+ * Objects that are stored the way we want to write them are copied
+ * from their pack; a stored delta is only usable when we kept its base.
+ * Only entries that `find_reusable_objects` read and checked qualify.
+ */
+GIT_INLINE(bool) is_reused(git_pobject *po)
+{
+	return po->in_pack && po->in_pack_type && (po->reuse_delta ?
+		po->delta != NULL :
+		!po->delta && !type_is_delta(po->in_pack_type));
+}
+
+/*
+ * An object's entry in the new pack, compressed ahead of the writer.
+ * Entries of reused objects only hold the new header of a delta; their
+ * data is copied from the existing pack as it is written.
+ */
+struct pack_write_entry {
+	git_pobject *po;
+	git_str buf;
+
+	int error;
+	git_error *error_info;
+	unsigned int ready:1;
+};
+
+static int prepare_reused_entry(
 	git_packbuilder *pb,
-	git_pobject *po,
-	int (*write_cb)(void *buf, size_t size, void *cb_data),
-	void *cb_data)
+	struct pack_write_entry *entry)
 {
+	git_pobject *po = entry->po;
+	unsigned char hdr[10];
+	size_t hdr_len;
+	int error;
+
+	/*
+	 * Deltas get a new header that names their base by id, since the
+	 * base may not be at the same place in the new pack.
+	 */
+	if (!po->delta)
+		return 0;
+
+	if ((error = git_packfile__object_header(&hdr_len, hdr,
+			po->delta_size, GIT_OBJECT_REF_DELTA)) < 0 ||
+	    (error = git_str_put(&entry->buf, (char *)hdr, hdr_len)) < 0)
+		return error;
+
+	return git_str_put(&entry->buf, (char *)po->delta->id.id,
+		git_oid_size(pb->oid_type));
+}
+
+static int prepare_entry(
+	git_packbuilder *pb,
+	git_zstream *zstream,
+	struct pack_write_entry *entry)
+{
+	git_pobject *po = entry->po;
 	git_odb_object *obj = NULL;
 	git_object_t type;
-	unsigned char hdr[10], *zbuf = NULL;
+	unsigned char hdr[10];
 	void *data = NULL;
-	size_t hdr_len, zbuf_len = COMPRESS_BUFLEN, data_len, oid_size;
+	size_t hdr_len, data_len, out_len;
 	int error;
 
-	oid_size = git_oid_size(pb->oid_type);
+	if (is_reused(po))
+		return prepare_reused_entry(pb, entry);
 
 	/*
 	 * If we have a delta base, let's use the delta to save space.
@@ -347,44 +558,39 @@ static int write_object(
 		type = git_odb_object_type(obj);
 	}
 
-	/* Write header */
 	if ((error = git_packfile__object_header(&hdr_len, hdr, data_len, type)) < 0 ||
-	    (error = write_cb(hdr, hdr_len, cb_data)) < 0 ||
-	    (error = git_hash_update(&pb->ctx, hdr, hdr_len)) < 0)
+	    (error = git_str_put(&entry->buf, (char *)hdr, hdr_len)) < 0)
 		goto done;
 
-	if (type == GIT_OBJECT_REF_DELTA) {
-		if ((error = write_cb(po->delta->id.id, oid_size, cb_data)) < 0 ||
-		    (error = git_hash_update(&pb->ctx, po->delta->id.id, oid_size)) < 0)
-			goto done;
-	}
+	if (type == GIT_OBJECT_REF_DELTA &&
+	    (error = git_str_put(&entry->buf, (char *)po->delta->id.id,
+			git_oid_size(pb->oid_type))) < 0)
+		goto done;
 
-	/* Write data */
 	if (po->z_delta_size) {
-		data_len = po->z_delta_size;
+		error = git_str_put(&entry->buf, data, po->z_delta_size);
+		goto done;
+	}
 
-		if ((error = write_cb(data, data_len, cb_data)) < 0 ||
-			(error = git_hash_update(&pb->ctx, data, data_len)) < 0)
-			goto done;
-	} else {
-		zbuf = git__malloc(zbuf_len);
-		GIT_ERROR_CHECK_ALLOC(zbuf);
+	git_zstream_reset(zstream);
 
-		git_zstream_reset(&pb->zstream);
+	if ((error = git_zstream_set_input(zstream, data, data_len)) < 0)
+		goto done;
 
-		if ((error = git_zstream_set_input(&pb->zstream, data, data_len)) < 0)
+	while (!git_zstream_done(zstream)) {
+		if ((error = git_str_grow_by(&entry->buf, COMPRESS_BUFLEN)) < 0)
 			goto done;
 
-		while (!git_zstream_done(&pb->zstream)) {
-			if ((error = git_zstream_get_output(zbuf, &zbuf_len, &pb->zstream)) < 0 ||
-				(error = write_cb(zbuf, zbuf_len, cb_data)) < 0 ||
-				(error = git_hash_update(&pb->ctx, zbuf, zbuf_len)) < 0)
-				goto done;
+		out_len = entry->buf.asize - entry->buf.size - 1;
 
-			zbuf_len = COMPRESS_BUFLEN; /* reuse buffer */
-		}
+		if ((error = git_zstream_get_output(entry->buf.ptr + entry->buf.size,
+				&out_len, zstream)) < 0)
+			goto done;
+
+		entry->buf.size += out_len;
 	}
 
+done:
 	/*
 	 * If po->delta is true, data is a delta and it is our
 	 * responsibility to free it (otherwise it's a git_object's
@@ -397,54 +603,65 @@ static int write_object(
 		po->delta_data = NULL;
 	}
 
-	pb->nr_written++;
-
-done:
-	git__free(zbuf);
 	git_odb_object_free(obj);
 	return error;
 }
 
-enum write_one_status {
-	WRITE_ONE_SKIP = -1, /* already written */
-	WRITE_ONE_BREAK = 0, /* writing this will bust the limit; not written */
-	WRITE_ONE_WRITTEN = 1, /* normal */
-	WRITE_ONE_RECURSIVE = 2 /* already scheduled to be written */
-};
-
-static int write_one(
-	enum write_one_status *status,
-	git_packbuilder *pb,
-	git_pobject *po,
-	int (*write_cb)(void *buf, size_t size, void *cb_data),
-	void *cb_data)
+static int write_entry(struct pack_writer *w, struct pack_write_entry *entry)
 {
+	git_pobject *po = entry->po;
+	off64_t start;
 	int error;
 
-	if (po->recursing) {
-		*status = WRITE_ONE_RECURSIVE;
-		return 0;
-	} else if (po->written) {
-		*status = WRITE_ONE_SKIP;
-		return 0;
+	if ((error = pack_writer_put(w, entry->buf.ptr, entry->buf.size)) < 0)
+		return error;
+
+	if (is_reused(po)) {
+		start = po->delta ? po->in_pack_data_offset : po->in_pack_offset;
+
+		if ((error = git_packfile_raw_copy(po->in_pack, start,
+				po->in_pack_offset + po->in_pack_size - start,
+				reuse_write_cb, w)) < 0)
+			return error;
 	}
 
+	git_str_dispose(&entry->buf);
+	w->pb->nr_written++;
+	return 0;
+}
+
+/*
+ * Lay out the entries in the order that they are written, with every
+ * delta after its base.  Returns false when `po` is already on the way
+ * to being laid out, that is when its delta chain loops back to it.
+ */
+static bool plan_one(
+	struct pack_write_entry *entries,
+	size_t *nr_entries,
+	git_pobject *po)
+{
+	if (po->recursing)
+		return false;
+	else if (po->written)
+		return true;
+
 	if (po->delta) {
 		po->recursing = 1;
 
-		if ((error = write_one(status, pb, po->delta, write_cb, cb_data)) < 0)
-			return error;
-
 		/* we cannot depend on this one */
-		if (*status == WRITE_ONE_RECURSIVE)
+		if (!plan_one(entries, nr_entries, po->delta)) {
+			git__free(po->delta_data);
+			po->delta_data = NULL;
+			po->z_delta_size = 0;
 			po->delta = NULL;
+		}
 	}
 
-	*status = WRITE_ONE_WRITTEN;
 	po->written = 1;
 	po->recursing = 0;
 
-	return write_object(pb, po, write_cb, cb_data);
+	entries[(*nr_entries)++].po = po;
+	return true;
 }
 
 GIT_INLINE(void) add_to_write_order(git_pobject **wo, size_t *endp,
@@ -629,16 +846,181 @@ static int compute_write_order(git_pobject ***out, git_packbuilder *pb)
 	return 0;
 }
 
+#ifdef GIT_THREADS
+
+/*
+ * Worker threads compress the entries in the order that they are
+ * written, while the calling thread writes them out.  The workers stop
+ * taking entries once `pb->write_window` bytes are compressed but not
+ * yet written, so that memory use does not grow with the pack.
+ */
+struct write_threads {
+	git_packbuilder *pb;
+
+	struct pack_write_entry *entries;
+	size_t nr_entries;
+
+	git_mutex mutex;
+	git_cond cond;
+
+	size_t next; /* the next entry to prepare */
+	size_t written; /* the number of entries written */
+	size_t in_flight; /* bytes prepared but not yet written */
+	bool stop;
+};
+
+static void *write_thread(void *arg)
+{
+	struct write_threads *wt = arg;
+	struct pack_write_entry *entry;
+	git_zstream zstream = GIT_ZSTREAM_INIT;
+	int init_error, error;
+
+	init_error = git_zstream_init(&zstream, GIT_ZSTREAM_DEFLATE);
+
+	git_mutex_lock(&wt->mutex);
+
+	while (!wt->stop && wt->next < wt->nr_entries) {
+		/* always leave the writer something to do */
+		if (wt->in_flight >= wt->pb->write_window &&
+		    wt->next > wt->written) {
+			git_cond_wait(&wt->cond, &wt->mutex);
+			continue;
+		}
+
+		entry = &wt->entries[wt->next++];
+		git_mutex_unlock(&wt->mutex);
+
+		if ((error = init_error) < 0 ||
+		    (error = prepare_entry(wt->pb, &zstream, entry)) < 0) {
+			entry->error = error;
+			git_error_save(&entry->error_info);
+		}
+
+		git_mutex_lock(&wt->mutex);
+		entry->ready = 1;
+		wt->in_flight += entry->buf.size;
+		git_cond_broadcast(&wt->cond);
+	}
+
+	git_mutex_unlock(&wt->mutex);
+	git_zstream_free(&zstream);
+	return NULL;
+}
+
+static int write_entries_threaded(
+	git_packbuilder *pb,
+	struct pack_writer *w,
+	struct pack_write_entry *entries,
+	size_t nr_entries,
+	size_t nr_threads)
+{
+	struct write_threads wt = { 0 };
+	struct pack_write_entry *entry;
+	git_thread *threads;
+	size_t i, size, started = 0;
+	int error = 0;
+
+	wt.pb = pb;
+	wt.entries = entries;
+	wt.nr_entries = nr_entries;
+
+	threads = git__mallocarray(nr_threads, sizeof(*threads));
+	GIT_ERROR_CHECK_ALLOC(threads);
+
+	if (git_mutex_init(&wt.mutex) || git_cond_init(&wt.cond)) {
+		git_error_set(GIT_ERROR_OS, "failed to initialize packbuilder mutex");
+		git__free(threads);
+		return -1;
+	}
+
+	for (; started < nr_threads; started++) {
+		if (git_thread_create(&threads[started], write_thread, &wt)) {
+			git_error_set(GIT_ERROR_THREAD, "unable to create thread");
+			error = -1;
+			break;
+		}
+	}
+
+	for (i = 0; !error && i < nr_entries; i++) {
+		entry = &entries[i];
+
+		git_mutex_lock(&wt.mutex);
+		while (!entry->ready)
+			git_cond_wait(&wt.cond, &wt.mutex);
+		git_mutex_unlock(&wt.mutex);
+
+		if ((error = entry->error) < 0) {
+			git_error_restore(entry->error_info);
+			entry->error_info = NULL;
+			break;
+		}
+
+		size = entry->buf.size;
+		error = write_entry(w, entry);
+
+		git_mutex_lock(&wt.mutex);
+		wt.in_flight -= size;
+		wt.written = i + 1;
+		git_cond_broadcast(&wt.cond);
+		git_mutex_unlock(&wt.mutex);
+	}
+
+	git_mutex_lock(&wt.mutex);
+	wt.stop = true;
+	git_cond_broadcast(&wt.cond);
+	git_mutex_unlock(&wt.mutex);
+
+	while (started)
+		git_thread_join(&threads[--started], NULL);
+
+	git_cond_free(&wt.cond);
+	git_mutex_free(&wt.mutex);
+	git__free(threads);
+	return error;
+}
+
+#endif
+
+static int write_entries(
+	git_packbuilder *pb,
+	struct pack_writer *w,
+	struct pack_write_entry *entries,
+	size_t nr_entries)
+{
+	size_t i;
+	int error;
+
+#ifdef GIT_THREADS
+	size_t nr_threads = pb->nr_threads;
+
+	if (!nr_threads)
+		nr_threads = git__online_cpus();
+
+	if (nr_threads > 1 && nr_entries > 1)
+		return write_entries_threaded(pb, w, entries, nr_entries,
+			min(nr_threads, nr_entries));
+#endif
+
+	for (i = 0; i < nr_entries; i++) {
+		if ((error = prepare_entry(pb, &pb->zstream, &entries[i])) < 0 ||
+		    (error = write_entry(w, &entries[i])) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
 static int write_pack(git_packbuilder *pb,
 	int (*write_cb)(void *buf, size_t size, void *cb_data),
 	void *cb_data)
 {
+	struct pack_writer writer = { 0 };
+	struct pack_write_entry *entries = NULL;
 	git_pobject **write_order;
 	git_pobject *po;
-	enum write_one_status status;
 	struct git_pack_header ph;
-	git_oid entry_oid;
-	size_t i = 0;
+	size_t i, nr_entries = 0;
 	int error;
 
 	if ((error = compute_write_order(&write_order, pb)) < 0)
@@ -650,43 +1032,50 @@ static int write_pack(git_packbuilder *pb,
 		goto done;
 	}
 
-	/* Write pack header */
-	ph.hdr_signature = htonl(PACK_SIGNATURE);
-	ph.hdr_version = htonl(PACK_VERSION);
-	ph.hdr_entries = htonl(pb->nr_objects);
+	writer.pb = pb;
+	writer.write_cb = write_cb;
+	writer.cb_data = cb_data;
 
-	if ((error = write_cb(&ph, sizeof(ph), cb_data)) < 0 ||
-		(error = git_hash_update(&pb->ctx, &ph, sizeof(ph))) < 0)
+	if ((writer.chunk = git__malloc(WRITE_CHUNK_SIZE + GIT_OID_MAX_SIZE)) == NULL ||
+	    (pb->nr_objects &&
+	     (entries = git__calloc(pb->nr_objects, sizeof(*entries))) == NULL)) {
+		error = -1;
 		goto done;
+	}
 
-	pb->nr_remaining = pb->nr_objects;
-	do {
-		pb->nr_written = 0;
-		for ( ; i < pb->nr_objects; ++i) {
-			po = write_order[i];
+	for (i = 0; i < pb->nr_objects; i++)
+		plan_one(entries, &nr_entries, write_order[i]);
 
-			if ((error = write_one(&status, pb, po, write_cb, cb_data)) < 0)
-				goto done;
-		}
+	/* Write pack header */
+	ph.hdr_signature = htonl(PACK_SIGNATURE);
+	ph.hdr_version = htonl(PACK_VERSION);
+	ph.hdr_entries = htonl(pb->nr_objects);
 
-		pb->nr_remaining -= pb->nr_written;
-	} while (pb->nr_remaining && i < pb->nr_objects);
+	pb->nr_written = 0;
 
-	if ((error = git_hash_final(entry_oid.id, &pb->ctx)) < 0)
+	if ((error = pack_writer_put(&writer, &ph, sizeof(ph))) < 0 ||
+	    (error = write_entries(pb, &writer, entries, nr_entries)) < 0)
 		goto done;
 
-	error = write_cb(entry_oid.id, git_oid_size(pb->oid_type), cb_data);
+	error = pack_writer_finish(&writer);
 
 done:
+	for (i = 0; i < nr_entries; i++) {
+		git_str_dispose(&entries[i].buf);
+		git_error_free(entries[i].error_info);
+	}
+
 	/* if callback cancelled writing, we must still free delta_data */
-	for ( ; i < pb->nr_objects; ++i) {
-		po = write_order[i];
+	for (i = 0; i < pb->nr_objects; i++) {
+		po = &pb->object_list[i];
 		if (po->delta_data) {
 			git__free(po->delta_data);
 			po->delta_data = NULL;
 		}
 	}
 
+	git__free(entries);
+	git__free(writer.chunk);
 	git__free(write_order);
 	return error;
 }
@@ -768,7 +1157,8 @@ static int try_delta(git_packbuilder *pb, struct unpacked *trg,
 
 	*ret = 0;
 
-	/* TODO: support reuse-delta */
+	if (!git_delta_islands_allow(trg_object, src_object))
+		return 0;
 
 	/* Let's not bust the allowed depth. */
 	if (src->depth >= max_depth)
@@ -1108,212 +1498,412 @@ on_error:
 
 #ifdef GIT_THREADS
 
-struct thread_params {
-	git_thread thread;
+/*
+ * The delta search is shared out by the size of the objects rather
+ * than by their number, since the time that an object takes grows with
+ * its size: a few large blobs can take longer than thousands of small
+ * files.  Each thread works through its own part of the sorted list
+ * from the front.  A thread that runs out of work takes the back half,
+ * by size, of the part that has the most left to do.
+ *
+ * No deltas are searched for across a split, so parts of no more than
+ * twice the window are only split when what is left of them is large
+ * enough to be worth it.
+ */
+#define DELTA_SPLIT_MIN_SIZE (16 * 1024 * 1024)
+
+struct delta_worker;
+
+struct delta_scheduler {
 	git_packbuilder *pb;
 
 	git_pobject **list;
+	uint64_t *cost; /* the total size of the objects before each one */
 
-	git_cond cond;
-	git_mutex mutex;
+	size_t window;
+	size_t depth;
+
+	struct delta_worker *workers;
+	size_t nr_workers;
+};
+
+struct delta_worker {
+	git_thread thread;
+	struct delta_scheduler *sched;
 
+	/* the part of the list being searched, under the progress lock */
+	git_pobject **list;
 	size_t list_size;
 	size_t remaining;
 
-	size_t window;
-	size_t depth;
-	size_t working;
-	size_t data_ready;
+	git_packbuilder_delta_stats stats;
+
+	int error;
+	git_error *error_info;
 };
 
-static void *threaded_find_deltas(void *arg)
+GIT_INLINE(size_t) worker_start(struct delta_worker *w)
 {
-	struct thread_params *me = arg;
+	return (w->list - w->sched->list) + w->list_size - w->remaining;
+}
 
-	while (me->remaining) {
-		if (find_deltas(me->pb, me->list, &me->remaining,
-				me->window, me->depth) < 0) {
-			; /* TODO */
-		}
+GIT_INLINE(size_t) worker_end(struct delta_worker *w)
+{
+	return (w->list - w->sched->list) + w->list_size;
+}
+
+GIT_INLINE(uint64_t) list_cost(
+	struct delta_scheduler *sched,
+	size_t start,
+	size_t end)
+{
+	return sched->cost[end] - sched->cost[start];
+}
+
+/*
+ * Find where to split `start` to `end` (which holds at least two
+ * objects) so that about `target` bytes come before the split.  The
+ * split is moved forward so that objects of the same path stay
+ * together, unless that leaves nothing after it.
+ */
+static size_t split_point(
+	struct delta_scheduler *sched,
+	size_t start,
+	size_t end,
+	uint64_t target)
+{
+	size_t lo = start + 1, hi = end - 1, mid, split;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+
+		if (list_cost(sched, start, mid) < target)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (split = lo; split < end; split++) {
+		if (!sched->list[split]->hash ||
+		    sched->list[split]->hash != sched->list[split - 1]->hash)
+			return split;
+	}
+
+	return lo;
+}
+
+GIT_INLINE(bool) worth_splitting(
+	struct delta_scheduler *sched,
+	size_t start,
+	size_t end)
+{
+	return end - start > 2 * sched->window ||
+		(end - start >= 2 &&
+		 list_cost(sched, start, end) >= DELTA_SPLIT_MIN_SIZE);
+}
 
-		GIT_ASSERT_WITH_RETVAL(git_packbuilder__progress_lock(me->pb) == 0, NULL);
-		me->working = 0;
-		git_cond_signal(&me->pb->progress_cond);
-		GIT_ASSERT_WITH_RETVAL(git_packbuilder__progress_unlock(me->pb) == 0, NULL);
+/*
+ * Give a thread that finished its part the back half of the busiest
+ * part.  Returns false when there is nothing left that is worth taking.
+ */
+static bool steal_work(struct delta_worker *me)
+{
+	struct delta_scheduler *sched = me->sched;
+	struct delta_worker *w, *victim = NULL;
+	uint64_t cost, victim_cost = 0;
+	size_t i, start, end, split;
+
+	if (git_packbuilder__progress_lock(sched->pb) < 0)
+		return false;
+
+	start = worker_end(me) - me->list_size;
+	me->stats.objects += me->list_size;
+	me->stats.bytes += list_cost(sched, start, start + me->list_size);
+	me->list_size = me->remaining = 0;
+
+	for (i = 0; i < sched->nr_workers; i++) {
+		w = &sched->workers[i];
+		start = worker_start(w);
+		end = worker_end(w);
+
+		if (!worth_splitting(sched, start, end))
+			continue;
 
-		if (git_mutex_lock(&me->mutex)) {
-			git_error_set(GIT_ERROR_THREAD, "unable to lock packfile condition mutex");
-			return NULL;
+		if ((cost = list_cost(sched, start, end)) > victim_cost) {
+			victim = w;
+			victim_cost = cost;
 		}
+	}
 
-		while (!me->data_ready)
-			git_cond_wait(&me->cond, &me->mutex);
+	if (victim) {
+		end = worker_end(victim);
+		split = split_point(sched, worker_start(victim), end, victim_cost / 2);
 
-		/*
-		 * We must not set ->data_ready before we wait on the
-		 * condition because the main thread may have set it to 1
-		 * before we get here. In order to be sure that new
-		 * work is available if we see 1 in ->data_ready, it
-		 * was initialized to 0 before this thread was spawned
-		 * and we reset it to 0 right away.
-		 */
-		me->data_ready = 0;
-		git_mutex_unlock(&me->mutex);
+		me->list = sched->list + split;
+		me->list_size = me->remaining = end - split;
+
+		victim->list_size -= me->list_size;
+		victim->remaining -= me->list_size;
+
+		me->stats.steals++;
 	}
-	/* leave ->working 1 so that this doesn't get more work assigned */
+
+	git_packbuilder__progress_unlock(sched->pb);
+	return victim != NULL;
+}
+
+static void *threaded_find_deltas(void *arg)
+{
+	struct delta_worker *me = arg;
+	struct delta_scheduler *sched = me->sched;
+	uint64_t start;
+	int error;
+
+	do {
+		start = git_time_monotonic();
+		error = find_deltas(sched->pb, me->list, &me->remaining,
+			sched->window, sched->depth);
+		me->stats.busy_time += git_time_monotonic() - start;
+	} while (!error && steal_work(me));
+
+	if (error < 0) {
+		me->error = error;
+		git_error_save(&me->error_info);
+	}
+
 	return NULL;
 }
 
 static int ll_find_deltas(git_packbuilder *pb, git_pobject **list,
 			  size_t list_size, size_t window, size_t depth)
 {
-	struct thread_params *p;
-	size_t i;
-	int ret, active_threads = 0;
+	struct delta_scheduler sched = { 0 };
+	struct delta_worker *w;
+	git_packbuilder_delta_stats *stats;
+	size_t i, start, end, started = 0;
+	int error = 0;
 
 	if (!pb->nr_threads)
 		pb->nr_threads = git__online_cpus();
 
-	if (pb->nr_threads <= 1) {
-		find_deltas(pb, list, &list_size, window, depth);
-		return 0;
+	if (pb->nr_threads <= 1)
+		return find_deltas(pb, list, &list_size, window, depth);
+
+	sched.pb = pb;
+	sched.list = list;
+	sched.window = window;
+	sched.depth = depth;
+	sched.nr_workers = pb->nr_threads;
+
+	sched.cost = git__mallocarray(list_size + 1, sizeof(uint64_t));
+	GIT_ERROR_CHECK_ALLOC(sched.cost);
+
+	sched.workers = git__calloc(sched.nr_workers, sizeof(struct delta_worker));
+	if (!sched.workers) {
+		git__free(sched.cost);
+		return -1;
 	}
 
-	p = git__mallocarray(pb->nr_threads, sizeof(*p));
-	GIT_ERROR_CHECK_ALLOC(p);
+	for (sched.cost[0] = 0, i = 0; i < list_size; i++)
+		sched.cost[i + 1] = sched.cost[i] + list[i]->size;
+
+	/*
+	 * Partition the work among the threads by size; a thread
+	 * that gets a part too small to find deltas in starts out
+	 * idle and takes work from the others.
+	 */
+	for (i = 0, start = 0; i < sched.nr_workers; i++) {
+		w = &sched.workers[i];
+		end = list_size;
 
-	/* Partition the work among the threads */
-	for (i = 0; i < pb->nr_threads; ++i) {
-		size_t sub_size = list_size / (pb->nr_threads - i);
+		if (i + 1 < sched.nr_workers && list_size - start >= 2) {
+			end = split_point(&sched, start, list_size,
+				list_cost(&sched, start, list_size) / (sched.nr_workers - i));
 
-		/* don't use too small segments or no deltas will be found */
-		if (sub_size < 2*window && i+1 < pb->nr_threads)
-			sub_size = 0;
+			if (end - start <= 2 * window &&
+			    list_cost(&sched, start, end) < DELTA_SPLIT_MIN_SIZE)
+				end = start;
+		}
 
-		p[i].pb = pb;
-		p[i].window = window;
-		p[i].depth = depth;
-		p[i].working = 1;
-		p[i].data_ready = 0;
+		w->sched = &sched;
+		w->list = list + start;
+		w->list_size = w->remaining = end - start;
 
-		/* try to split chunks on "path" boundaries */
-		while (sub_size && sub_size < list_size &&
-		       list[sub_size]->hash &&
-		       list[sub_size]->hash == list[sub_size-1]->hash)
-			sub_size++;
+		start = end;
+	}
 
-		p[i].list = list;
-		p[i].list_size = sub_size;
-		p[i].remaining = sub_size;
+	for (; started < sched.nr_workers; started++) {
+		w = &sched.workers[started];
 
-		list += sub_size;
-		list_size -= sub_size;
+		if (git_thread_create(&w->thread, threaded_find_deltas, w)) {
+			git_error_set(GIT_ERROR_THREAD, "unable to create thread");
+			error = -1;
+			break;
+		}
 	}
 
-	/* Start work threads */
-	for (i = 0; i < pb->nr_threads; ++i) {
-		if (!p[i].list_size)
-			continue;
+	git_array_clear(pb->delta_stats);
 
-		git_mutex_init(&p[i].mutex);
-		git_cond_init(&p[i].cond);
+	for (i = 0; i < started; i++) {
+		w = &sched.workers[i];
+		git_thread_join(&w->thread, NULL);
 
-		ret = git_thread_create(&p[i].thread,
-					threaded_find_deltas, &p[i]);
-		if (ret) {
-			git_error_set(GIT_ERROR_THREAD, "unable to create thread");
-			return -1;
+		if (w->error && !error) {
+			error = w->error;
+			git_error_restore(w->error_info);
+			w->error_info = NULL;
 		}
-		active_threads++;
+
+		git_error_free(w->error_info);
+
+		git_trace(GIT_TRACE_DEBUG,
+			"pack-objects: delta search thread %" PRIuZ ": %" PRIuZ " objects, %" PRIu64 " bytes, %" PRIuZ " steals, %" PRIu64 "ms",
+			i, w->stats.objects, w->stats.bytes, w->stats.steals,
+			w->stats.busy_time);
+
+		if ((stats = git_array_alloc(pb->delta_stats)) != NULL)
+			memcpy(stats, &w->stats, sizeof(*stats));
 	}
 
-	/*
-	 * Now let's wait for work completion.  Each time a thread is done
-	 * with its work, we steal half of the remaining work from the
-	 * thread with the largest number of unprocessed objects and give
-	 * it to that newly idle thread.  This ensure good load balancing
-	 * until the remaining object list segments are simply too short
-	 * to be worth splitting anymore.
-	 */
-	while (active_threads) {
-		struct thread_params *target = NULL;
-		struct thread_params *victim = NULL;
-		size_t sub_size = 0;
-
-		/* Start by locating a thread that has transitioned its
-		 * 'working' flag from 1 -> 0. This indicates that it is
-		 * ready to receive more work using our work-stealing
-		 * algorithm. */
-		GIT_ASSERT(git_packbuilder__progress_lock(pb) == 0);
-		for (;;) {
-			for (i = 0; !target && i < pb->nr_threads; i++)
-				if (!p[i].working)
-					target = &p[i];
-			if (target)
-				break;
-			git_cond_wait(&pb->progress_cond, &pb->progress_mutex);
+	git__free(sched.workers);
+	git__free(sched.cost);
+	return error;
+}
+
+#else
+#define ll_find_deltas(pb, l, ls, w, d) find_deltas(pb, l, &ls, w, d)
+#endif
+
+/*
+ * Find where our objects are stored, so that they can be copied rather
+ * than recompressed.  Deltas whose base we are also sending are kept
+ * as they are and left out of the delta search.
+ */
+static int find_reusable_objects(git_packbuilder *pb)
+{
+	git_packfile_raw_entry entry;
+	struct git_pack_entry e;
+	git_pobject *po, *base;
+	git_oid base_id;
+	size_t i;
+	int error;
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		po = pb->object_list + i;
+
+		if (po->in_pack)
+			continue;
+
+		if ((error = git_odb__find_pack_entry(&e, pb->odb, &po->id)) == GIT_ENOTFOUND) {
+			git_error_clear();
+			continue;
+		} else if (error < 0 ||
+		           (error = git_packfile_object_disk_size(&po->in_pack_size,
+				e.p, e.offset)) < 0) {
+			return error;
 		}
 
-		/* At this point we hold the progress lock and have located
-		 * a thread to receive more work. We still need to locate a
-		 * thread from which to steal work (the victim). */
-		for (i = 0; i < pb->nr_threads; i++)
-			if (p[i].remaining > 2*window &&
-			    (!victim || victim->remaining < p[i].remaining))
-				victim = &p[i];
-
-		if (victim) {
-			sub_size = victim->remaining / 2;
-			list = victim->list + victim->list_size - sub_size;
-			while (sub_size && list[0]->hash &&
-			       list[0]->hash == list[-1]->hash) {
-				list++;
-				sub_size--;
-			}
-			if (!sub_size) {
-				/*
-				 * It is possible for some "paths" to have
-				 * so many objects that no hash boundary
-				 * might be found.  Let's just steal the
-				 * exact half in that case.
-				 */
-				sub_size = victim->remaining / 2;
-				list -= sub_size;
-			}
-			target->list = list;
-			victim->list_size -= sub_size;
-			victim->remaining -= sub_size;
+		po->in_pack = e.p;
+		po->in_pack_offset = e.offset;
+	}
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		po = pb->object_list + i;
+
+		if (!po->in_pack || po->in_pack_type)
+			continue;
+
+		if ((error = git_packfile_raw_entry_read(&entry, po->in_pack,
+				po->in_pack_offset)) < 0)
+			return error;
+
+		/* A corrupt entry is not copied; the object is compressed anew */
+		if ((error = git_packfile_raw_entry_verify(po->in_pack,
+				po->in_pack_offset, po->in_pack_size, &entry)) == GIT_EMISMATCH) {
+			git_error_clear();
+			po->in_pack = NULL;
+			continue;
+		} else if (error < 0) {
+			return error;
 		}
-		target->list_size = sub_size;
-		target->remaining = sub_size;
-		target->working = 1;
-		GIT_ASSERT(git_packbuilder__progress_unlock(pb) == 0);
 
-		if (git_mutex_lock(&target->mutex)) {
-			git_error_set(GIT_ERROR_THREAD, "unable to lock packfile condition mutex");
-			git__free(p);
-			return -1;
+		po->in_pack_type = entry.type;
+		po->in_pack_data_offset = entry.data_offset;
+
+		if (!type_is_delta(entry.type)) {
+			po->size = entry.size;
+			po->size_valid = 1;
+			continue;
 		}
 
-		target->data_ready = 1;
-		git_cond_signal(&target->cond);
-		git_mutex_unlock(&target->mutex);
+		if (po->delta)
+			continue;
+
+		if ((error = git_packfile_id_at_offset(&base_id, po->in_pack,
+				entry.base_offset)) < 0)
+			return error;
+
+		/*
+		 * Only reuse deltas against bases in the same pack: a pack's
+		 * deltas cannot form a cycle, but deltas across packs could.
+		 */
+		if ((base = git_oidmap_get(pb->object_ix, &base_id)) == NULL ||
+		    base->in_pack != po->in_pack ||
+		    base->in_pack_offset != entry.base_offset ||
+		    !git_delta_islands_allow(po, base))
+			continue;
+
+		po->delta = base;
+		po->delta_size = entry.size;
+		po->reuse_delta = 1;
 
-		if (!sub_size) {
-			git_thread_join(&target->thread, NULL);
-			git_cond_free(&target->cond);
-			git_mutex_free(&target->mutex);
-			active_threads--;
+		/*
+		 * Like git, size a reused delta by its delta data: it is left
+		 * out of the delta search, which is all that needs the size.
+		 */
+		if (!po->size_valid) {
+			po->size = entry.size;
+			po->size_valid = 1;
 		}
 	}
 
-	git__free(p);
 	return 0;
 }
 
-#else
-#define ll_find_deltas(pb, l, ls, w, d) find_deltas(pb, l, &ls, w, d)
-#endif
+/*
+ * Objects enumerated from a bitmap are added without their size.  The
+ * header of an object that is stored whole has it; that of a delta only
+ * has the size of the delta data, so for deltas that are not reused the
+ * start of the delta is inflated to find the size of the object, as git
+ * does.
+ */
+static int resolve_object_sizes(git_packbuilder *pb)
+{
+	git_pobject *po;
+	git_object_t type;
+	size_t i;
+	int error;
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		po = pb->object_list + i;
+
+		if (po->size_valid)
+			continue;
+
+		if (po->in_pack)
+			error = git_packfile_resolve_header(&po->size, &type,
+				po->in_pack, po->in_pack_offset);
+		else
+			error = git_odb_read_header(&po->size, &type, pb->odb, &po->id);
+
+		if (error < 0)
+			return error;
+
+		po->size_valid = 1;
+	}
+
+	return 0;
+}
 
 int git_packbuilder__prepare(git_packbuilder *pb)
 {
@@ -1330,12 +1920,24 @@ int git_packbuilder__prepare(git_packbuilder *pb)
 	if (pb->progress_cb)
 			pb->progress_cb(GIT_PACKBUILDER_DELTAFICATION, 0, pb->nr_objects, pb->progress_cb_payload);
 
+	if (pb->use_delta_islands && !pb->islands &&
+	    git_delta_islands_load(&pb->islands, pb) < 0)
+		return -1;
+
+	if ((pb->reuse_objects && find_reusable_objects(pb) < 0) ||
+	    resolve_object_sizes(pb) < 0)
+		return -1;
+
 	delta_list = git__mallocarray(pb->nr_objects, sizeof(*delta_list));
 	GIT_ERROR_CHECK_ALLOC(delta_list);
 
 	for (i = 0; i < pb->nr_objects; ++i) {
 		git_pobject *po = pb->object_list + i;
 
+		/* We are sending the delta that it is stored as */
+		if (po->reuse_delta)
+			continue;
+
 		/* Make sure the item is within our size limits */
 		if (po->size < 50 || po->size > pb->big_file_threshold)
 			continue;
@@ -1346,8 +1948,8 @@ int git_packbuilder__prepare(git_packbuilder *pb)
 	if (n > 1) {
 		git__tsort((void **)delta_list, n, type_size_sort);
 		if (ll_find_deltas(pb, delta_list, n,
-				   GIT_PACK_WINDOW + 1,
-				   GIT_PACK_DEPTH) < 0) {
+				   pb->window + 1,
+				   pb->depth) < 0) {
 			git__free(delta_list);
 			return -1;
 		}
@@ -1368,6 +1970,43 @@ int git_packbuilder_foreach(git_packbuilder *pb, int (*cb)(void *buf, size_t siz
 	return write_pack(pb, cb, payload);
 }
 
+static int write_pack_fd(void *buf, size_t size, void *data)
+{
+	int fd = *(int *)data;
+
+	if (p_write(fd, buf, size) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to write pack");
+		return -1;
+	}
+
+	return 0;
+}
+
+int git_packbuilder_write_fd(git_packbuilder *pb, int fd)
+{
+	GIT_ASSERT_ARG(pb);
+	GIT_ASSERT_ARG(fd >= 0);
+
+	PREPARE_PACK;
+
+	return write_pack(pb, &write_pack_fd, &fd);
+}
+
+static int write_pack_stream(void *buf, size_t size, void *data)
+{
+	return git_stream__write_full(data, buf, size, 0);
+}
+
+int git_packbuilder_write_stream(git_packbuilder *pb, git_stream *stream)
+{
+	GIT_ASSERT_ARG(pb);
+	GIT_ASSERT_ARG(stream);
+
+	PREPARE_PACK;
+
+	return write_pack(pb, &write_pack_stream, stream);
+}
+
 int git_packbuilder__write_buf(git_str *buf, git_packbuilder *pb)
 {
 	PREPARE_PACK;
@@ -1386,6 +2025,14 @@ static int write_cb(void *buf, size_t len, void *payload)
 	return git_indexer_append(ctx->indexer, buf, len, ctx->stats);
 }
 
+static uint32_t bitmap_name_hash(const git_oid *id, void *payload)
+{
+	git_packbuilder *pb = payload;
+	git_pobject *po = git_oidmap_get(pb->object_ix, id);
+
+	return po ? po->hash : 0;
+}
+
 int git_packbuilder_write(
 	git_packbuilder *pb,
 	const char *path,
@@ -1394,7 +2041,7 @@ int git_packbuilder_write(
 	void *progress_cb_payload)
 {
 	int error = -1;
-	git_str object_path = GIT_STR_INIT;
+	git_str object_path = GIT_STR_INIT, pack_path = GIT_STR_INIT;
 	git_indexer_options opts = GIT_INDEXER_OPTIONS_INIT;
 	git_indexer *indexer = NULL;
 	git_indexer_progress stats;
@@ -1414,6 +2061,9 @@ int git_packbuilder_write(
 	opts.progress_cb = progress_cb;
 	opts.progress_cb_payload = progress_cb_payload;
 
+	/* Bitmaps are in pack order, so like git write the reverse index too */
+	opts.write_reverse_index = pb->write_bitmap;
+
 	/* TODO: SHA256 */
 
 #ifdef GIT_EXPERIMENTAL_SHA256
@@ -1447,9 +2097,18 @@ int git_packbuilder_write(
 	pb->pack_name = git__strdup(git_indexer_name(indexer));
 	GIT_ERROR_CHECK_ALLOC(pb->pack_name);
 
+	if (pb->write_bitmap) {
+		if ((error = git_str_printf(&pack_path, "%s/pack-%s.pack",
+				path, pb->pack_name)) < 0 ||
+		    (error = git_pack_bitmap_write(pack_path.ptr, pb->repo,
+				bitmap_name_hash, pb)) < 0)
+			goto cleanup;
+	}
+
 cleanup:
 	git_indexer_free(indexer);
 	git_str_dispose(&object_path);
+	git_str_dispose(&pack_path);
 	return error;
 }
 
@@ -1655,23 +2314,18 @@ cleanup:
  * git_revwalk, the commits are already uninteresting, but we need to
  * mark the trees and blobs.
  */
-static int mark_edges_uninteresting(git_packbuilder *pb, git_commit_list *commits)
+static int mark_edges_uninteresting(git_packbuilder *pb, git_revwalk *walk)
 {
 	int error;
 	git_commit_list *list;
-	git_commit *commit;
+	git_oid tree_id;
 
-	for (list = commits; list; list = list->next) {
+	for (list = walk->user_input; list; list = list->next) {
 		if (!list->item->uninteresting)
 			continue;
 
-		if ((error = git_commit_lookup(&commit, pb->repo, &list->item->oid)) < 0)
-			return error;
-
-		error = mark_tree_uninteresting(pb, git_commit_tree_id(commit));
-		git_commit_free(commit);
-
-		if (error < 0)
+		if ((error = git_commit_list_tree_id(&tree_id, walk, list->item)) < 0 ||
+		    (error = mark_tree_uninteresting(pb, &tree_id)) < 0)
 			return error;
 	}
 
@@ -1757,6 +2411,74 @@ cleanup:
 	return error;
 }
 
+/*
+ * Enumerate the objects of a walk using the bitmap index: the objects
+ * that are reachable from the wanted commits, minus those reachable
+ * from the hidden ones.  Returns GIT_ENOTFOUND when the bitmap cannot
+ * answer for this walk.
+ */
+static int insert_walk_bitmap(git_packbuilder *pb, git_revwalk *walk)
+{
+	git_array_t(git_oid) wants = GIT_ARRAY_INIT, haves = GIT_ARRAY_INIT;
+	git_bitmap want_objects = GIT_BITMAP_INIT, have_objects = GIT_BITMAP_INIT;
+	git_pack_bitmap *bitmap;
+	git_commit_list *list;
+	struct git_pack_file *pack;
+	git_object_t type;
+	git_oid *id, oid;
+	off64_t offset, disk_size;
+	uint32_t hash;
+	size_t pos;
+	int error;
+
+	/* these change which commits the walk would produce */
+	if (walk->first_parent || walk->hide_cb || walk->walking)
+		return GIT_ENOTFOUND;
+
+	if ((error = git_odb__get_pack_bitmap(&bitmap, pb->odb)) < 0)
+		return error;
+
+	for (list = walk->user_input; list; list = list->next) {
+		if (list->item->uninteresting)
+			id = git_array_alloc(haves);
+		else
+			id = git_array_alloc(wants);
+
+		GIT_ERROR_CHECK_ALLOC(id);
+		git_oid_cpy(id, &list->item->oid);
+	}
+
+	if ((error = git_pack_bitmap_reachable(&want_objects, bitmap,
+			pb->repo, wants.ptr, wants.size, 0)) < 0 ||
+	    (error = git_pack_bitmap_reachable(&have_objects, bitmap,
+			pb->repo, haves.ptr, haves.size, 0)) < 0)
+		goto done;
+
+	git_bitmap_and_not(&want_objects, &have_objects);
+
+	for (pos = 0; git_bitmap_next(&pos, &want_objects); pos++) {
+		if ((type = git_pack_bitmap_object_type(bitmap, pos)) == GIT_OBJECT_INVALID) {
+			git_error_set(GIT_ERROR_ODB, "bitmap has no type for object");
+			error = -1;
+			goto done;
+		}
+
+		if ((error = git_pack_bitmap_object(&oid, &hash, bitmap, pos)) < 0 ||
+		    (error = git_pack_bitmap_object_location(&pack, &offset,
+				&disk_size, bitmap, pos)) < 0 ||
+		    (error = packbuilder_insert(pb, &oid, hash, type,
+				pack, offset, disk_size)) < 0)
+			goto done;
+	}
+
+done:
+	git_bitmap_dispose(&want_objects);
+	git_bitmap_dispose(&have_objects);
+	git_array_clear(wants);
+	git_array_clear(haves);
+	return error;
+}
+
 int git_packbuilder_insert_walk(git_packbuilder *pb, git_revwalk *walk)
 {
 	int error;
@@ -1766,7 +2488,14 @@ int git_packbuilder_insert_walk(git_packbuilder *pb, git_revwalk *walk)
 	GIT_ASSERT_ARG(pb);
 	GIT_ASSERT_ARG(walk);
 
-	if ((error = mark_edges_uninteresting(pb, walk->user_input)) < 0)
+	if (pb->use_bitmaps) {
+		if ((error = insert_walk_bitmap(pb, walk)) != GIT_ENOTFOUND)
+			return error;
+
+		git_error_clear();
+	}
+
+	if ((error = mark_edges_uninteresting(pb, walk)) < 0)
 		return error;
 
 	/*
@@ -1807,6 +2536,8 @@ int git_packbuilder_set_callbacks(git_packbuilder *pb, git_packbuilder_progress
 
 void git_packbuilder_free(git_packbuilder *pb)
 {
+	size_t i;
+
 	if (pb == NULL)
 		return;
 
@@ -1814,7 +2545,6 @@ void git_packbuilder_free(git_packbuilder *pb)
 
 	git_mutex_free(&pb->cache_mutex);
 	git_mutex_free(&pb->progress_mutex);
-	git_cond_free(&pb->progress_cond);
 
 #endif
 
@@ -1824,11 +2554,17 @@ void git_packbuilder_free(git_packbuilder *pb)
 	if (pb->object_ix)
 		git_oidmap_free(pb->object_ix);
 
+	/* deltas are cached by the delta search until the pack is written */
+	for (i = 0; i < pb->nr_objects; i++)
+		git__free(pb->object_list[i].delta_data);
+
 	if (pb->object_list)
 		git__free(pb->object_list);
 
 	git_oidmap_free(pb->walk_objects);
 	git_pool_clear(&pb->object_pool);
+	git_array_clear(pb->delta_stats);
+	git_delta_islands_free(pb->islands);
 
 	git_hash_ctx_cleanup(&pb->ctx);
 	git_zstream_free(&pb->zstream);
@@ -10,6 +10,8 @@
 
 #include "common.h"
 
+#include "array.h"
+#include "ewah.h"
 #include "str.h"
 #include "hash.h"
 #include "oidmap.h"
@@ -22,9 +24,11 @@
 
 #define GIT_PACK_WINDOW 10 /* number of objects to possibly delta against */
 #define GIT_PACK_DEPTH 50 /* max delta depth */
+#define GIT_PACK_MAX_DEPTH 4095 /* as git allows */
 #define GIT_PACK_DELTA_CACHE_SIZE (256 * 1024 * 1024)
 #define GIT_PACK_DELTA_CACHE_LIMIT 1000
 #define GIT_PACK_BIG_FILE_THRESHOLD (512 * 1024 * 1024)
+#define GIT_PACK_WRITE_WINDOW (32 * 1024 * 1024) /* compressed ahead of writing */
 
 typedef struct git_pobject {
 	git_oid id;
@@ -35,6 +39,15 @@ typedef struct git_pobject {
 
 	unsigned int hash; /* name hint hash */
 
+	/* where the object is stored in an existing pack, if known */
+	struct git_pack_file *in_pack;
+	off64_t in_pack_offset;
+	off64_t in_pack_size; /* bytes taken up in the pack */
+	off64_t in_pack_data_offset; /* where its compressed data starts */
+	git_object_t in_pack_type; /* as stored, so possibly a delta */
+
+	const git_bitmap *islands; /* the delta islands it is on, if any */
+
 	struct git_pobject *delta; /* delta base object */
 	struct git_pobject *delta_child; /* deltified objects who bases me */
 	struct git_pobject *delta_sibling; /* other deltified objects
@@ -48,9 +61,19 @@ typedef struct git_pobject {
 	unsigned int written:1,
 	             recursing:1,
 	             tagged:1,
-	             filled:1;
+	             filled:1,
+	             reuse_delta:1, /* `delta` is the base of the stored delta */
+	             size_valid:1; /* `size` is known, see resolve_object_sizes */
 } git_pobject;
 
+/* How a thread spent its time searching for deltas */
+typedef struct {
+	size_t objects; /* the objects it searched a delta for */
+	uint64_t bytes; /* their total size */
+	size_t steals; /* the times it took work from another thread */
+	uint64_t busy_time; /* in milliseconds */
+} git_packbuilder_delta_stats;
+
 struct git_packbuilder {
 	git_repository *repo; /* associated repository */
 	git_odb *odb; /* associated object database */
@@ -62,8 +85,7 @@ struct git_packbuilder {
 
 	uint32_t nr_objects,
 		nr_deltified,
-		nr_written,
-		nr_remaining;
+		nr_written;
 
 	size_t nr_alloc;
 
@@ -74,15 +96,16 @@ struct git_packbuilder {
 	git_oidmap *walk_objects;
 	git_pool object_pool;
 
-#ifndef GIT_DEPRECATE_HARD
+	/*
+	 * Not conditional on GIT_DEPRECATE_HARD, so that the layout does
+	 * not depend on how the includer was built.
+	 */
 	git_oid pack_oid; /* hash of written pack */
-#endif
 	char *pack_name; /* name of written pack */
 
 	/* synchronization objects */
 	git_mutex cache_mutex;
 	git_mutex progress_mutex;
-	git_cond progress_cond;
 
 	/* configs */
 	size_t delta_cache_size;
@@ -90,9 +113,22 @@ struct git_packbuilder {
 	size_t cache_max_small_delta_size;
 	size_t big_file_threshold;
 	size_t window_memory_limit;
+	size_t write_window;
+	size_t window; /* number of objects to possibly delta against */
+	size_t depth; /* max delta depth */
 
 	unsigned int nr_threads; /* nr of threads to use */
 
+	/* one entry per thread of the last threaded delta search */
+	git_array_t(git_packbuilder_delta_stats) delta_stats;
+
+	bool use_bitmaps; /* enumerate objects using a bitmap index */
+	bool reuse_objects; /* copy objects and deltas from existing packs */
+	bool write_bitmap; /* write a bitmap index along with the pack */
+	bool use_delta_islands; /* keep deltas within the `pack.island`s */
+
+	struct git_delta_islands *islands;
+
 	git_packbuilder_progress progress_cb;
 	void *progress_cb_payload;
 
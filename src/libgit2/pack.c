@@ -8,8 +8,10 @@
 #include "pack.h"
 
 #include "delta.h"
+#include "filebuf.h"
 #include "futils.h"
 #include "mwindow.h"
+#include "runtime.h"
 #include "odb.h"
 #include "oid.h"
 #include "oidarray.h"
@@ -51,7 +53,56 @@ static int packfile_error(const char *message)
  * Delta base cache
  ********************/
 
-static git_pack_cache_entry *new_cache_object(git_rawobj *source)
+size_t git_pack__cache_memory_limit = GIT_PACK_CACHE_MEMORY_LIMIT;
+size_t git_pack__cache_object_limit = GIT_PACK_CACHE_SIZE_LIMIT;
+
+git_atomic_ssize git_pack__cache_hits = {0};
+git_atomic_ssize git_pack__cache_inflations = {0};
+git_atomic_ssize git_pack__cache_evictions = {0};
+
+/*
+ * The recency list is shared by all packfiles.  Lookups only take the
+ * lock for reading and mark the entry as referenced; the list is
+ * reordered when an entry needs to be evicted, at which point recently
+ * referenced entries get a second chance instead.
+ */
+static git_rwlock pack_cache_lock;
+static git_pack_cache_entry *pack_cache_lru_head;
+static git_pack_cache_entry *pack_cache_lru_tail;
+static size_t pack_cache_memory_used;
+static size_t pack_cache_count;
+
+static void pack_global_shutdown(void)
+{
+	git_rwlock_free(&pack_cache_lock);
+}
+
+int git_pack_global_init(void)
+{
+	if (git_rwlock_init(&pack_cache_lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to initialize pack cache lock");
+		return -1;
+	}
+
+	return git_runtime_shutdown_register(pack_global_shutdown);
+}
+
+size_t git_pack__cache_memory_used(void)
+{
+	size_t used = 0;
+
+	if (git_rwlock_rdlock(&pack_cache_lock) == 0) {
+		used = pack_cache_memory_used;
+		git_rwlock_rdunlock(&pack_cache_lock);
+	}
+
+	return used;
+}
+
+static git_pack_cache_entry *new_cache_object(
+	git_pack_cache *cache,
+	git_rawobj *source,
+	off64_t offset)
 {
 	git_pack_cache_entry *e = git__calloc(1, sizeof(git_pack_cache_entry));
 	if (!e)
@@ -59,6 +110,8 @@ static git_pack_cache_entry *new_cache_object(git_rawobj *source)
 
 	git_atomic32_inc(&e->refcount);
 	memcpy(&e->raw, source, sizeof(git_rawobj));
+	e->cache = cache;
+	e->offset = offset;
 
 	return e;
 }
@@ -73,68 +126,132 @@ static void free_cache_object(void *o)
 	}
 }
 
-static void cache_free(git_pack_cache *cache)
+/* Run with the cache lock held */
+static void lru_unlink(git_pack_cache_entry *entry)
 {
-	git_pack_cache_entry *entry;
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		pack_cache_lru_head = entry->next;
 
-	if (cache->entries) {
-		git_offmap_foreach_value(cache->entries, entry, {
-			free_cache_object(entry);
-		});
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		pack_cache_lru_tail = entry->prev;
 
-		git_offmap_free(cache->entries);
-		cache->entries = NULL;
-	}
+	entry->prev = entry->next = NULL;
 }
 
-static int cache_init(git_pack_cache *cache)
+/* Run with the cache lock held */
+static void lru_push(git_pack_cache_entry *entry)
 {
-	if (git_offmap_new(&cache->entries) < 0)
-		return -1;
+	entry->prev = NULL;
+	entry->next = pack_cache_lru_head;
 
-	cache->memory_limit = GIT_PACK_CACHE_MEMORY_LIMIT;
+	if (pack_cache_lru_head)
+		pack_cache_lru_head->prev = entry;
+	else
+		pack_cache_lru_tail = entry;
 
-	if (git_mutex_init(&cache->lock)) {
-		git_error_set(GIT_ERROR_OS, "failed to initialize pack cache mutex");
+	pack_cache_lru_head = entry;
+}
 
-		git__free(cache->entries);
-		cache->entries = NULL;
+/* Run with the cache lock held */
+static void cache_remove(git_pack_cache_entry *entry)
+{
+	lru_unlink(entry);
+	git_offmap_delete(entry->cache->entries, entry->offset);
 
-		return -1;
+	entry->cache->memory_used -= entry->raw.len;
+	pack_cache_memory_used -= entry->raw.len;
+	pack_cache_count--;
+
+	free_cache_object(entry);
+}
+
+static void cache_free(git_pack_cache *cache)
+{
+	git_pack_cache_entry *entry;
+
+	if (!cache->entries)
+		return;
+
+	if (git_rwlock_wrlock(&pack_cache_lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock pack cache");
+		return;
 	}
 
-	return 0;
+	git_offmap_foreach_value(cache->entries, entry, {
+		lru_unlink(entry);
+		pack_cache_memory_used -= entry->raw.len;
+		pack_cache_count--;
+		free_cache_object(entry);
+	});
+
+	git_rwlock_wrunlock(&pack_cache_lock);
+
+	git_offmap_free(cache->entries);
+	cache->entries = NULL;
+	cache->memory_used = 0;
+}
+
+static int cache_init(git_pack_cache *cache)
+{
+	memset(cache, 0, sizeof(git_pack_cache));
+
+	return git_offmap_new(&cache->entries);
 }
 
 static git_pack_cache_entry *cache_get(git_pack_cache *cache, off64_t offset)
 {
 	git_pack_cache_entry *entry;
 
-	if (git_mutex_lock(&cache->lock) < 0)
+	if (git_rwlock_rdlock(&pack_cache_lock) < 0)
 		return NULL;
 
 	if ((entry = git_offmap_get(cache->entries, offset)) != NULL) {
 		git_atomic32_inc(&entry->refcount);
-		entry->last_usage = cache->use_ctr++;
+		git_atomic32_set(&entry->referenced, 1);
 	}
-	git_mutex_unlock(&cache->lock);
+	git_rwlock_rdunlock(&pack_cache_lock);
+
+	if (entry)
+		git_atomic_ssize_add(&git_pack__cache_hits, 1);
 
 	return entry;
 }
 
-/* Run with the cache lock held */
-static void free_lowest_entry(git_pack_cache *cache)
+/*
+ * Run with the cache lock held.  Evict the least recently used entries
+ * that nobody is reading until `size` more bytes fit into the cache;
+ * returns false if that is not possible.
+ */
+static bool cache_make_room(size_t size)
 {
-	off64_t offset;
 	git_pack_cache_entry *entry;
-
-	git_offmap_foreach(cache->entries, offset, entry, {
-		if (entry && git_atomic32_get(&entry->refcount) == 0) {
-			cache->memory_used -= entry->raw.len;
-			git_offmap_delete(cache->entries, offset);
-			free_cache_object(entry);
+	size_t limit = git_pack__cache_memory_limit;
+	size_t scan = 0, max_scan = 2 * pack_cache_count;
+
+	if (size > limit)
+		return false;
+
+	while ((entry = pack_cache_lru_tail) != NULL &&
+	       pack_cache_memory_used + size > limit &&
+	       scan++ < max_scan) {
+		if (git_atomic32_get(&entry->refcount) == 0 &&
+		    git_atomic32_get(&entry->referenced) == 0) {
+			cache_remove(entry);
+			git_atomic_ssize_add(&git_pack__cache_evictions, 1);
+			continue;
 		}
-	});
+
+		/* in use or recently used; give it another round */
+		git_atomic32_set(&entry->referenced, 0);
+		lru_unlink(entry);
+		lru_push(entry);
+	}
+
+	return (pack_cache_memory_used + size <= limit);
 }
 
 static int cache_add(
@@ -144,35 +261,37 @@ static int cache_add(
 		off64_t offset)
 {
 	git_pack_cache_entry *entry;
-	int exists;
+	int exists, added = 0;
 
-	if (base->len > GIT_PACK_CACHE_SIZE_LIMIT)
+	if (base->len > git_pack__cache_object_limit)
 		return -1;
 
-	entry = new_cache_object(base);
-	if (entry) {
-		if (git_mutex_lock(&cache->lock) < 0) {
-			git_error_set(GIT_ERROR_OS, "failed to lock cache");
-			git__free(entry);
-			return -1;
-		}
-		/* Add it to the cache if nobody else has */
-		exists = git_offmap_exists(cache->entries, offset);
-		if (!exists) {
-			while (cache->memory_used + base->len > cache->memory_limit)
-				free_lowest_entry(cache);
-
-			git_offmap_set(cache->entries, offset, entry);
-			cache->memory_used += entry->raw.len;
+	/* the caller keeps ownership of the base when it is not added */
+	if ((entry = new_cache_object(cache, base, offset)) == NULL)
+		return -1;
 
-			*cached_out = entry;
-		}
-		git_mutex_unlock(&cache->lock);
-		/* Somebody beat us to adding it into the cache */
-		if (exists) {
-			git__free(entry);
-			return -1;
-		}
+	if (git_rwlock_wrlock(&pack_cache_lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock cache");
+		git__free(entry);
+		return -1;
+	}
+	/* Add it to the cache if nobody else has */
+	exists = git_offmap_exists(cache->entries, offset);
+	if (!exists && cache_make_room(base->len) &&
+	    git_offmap_set(cache->entries, offset, entry) == 0) {
+		lru_push(entry);
+		cache->memory_used += entry->raw.len;
+		pack_cache_memory_used += entry->raw.len;
+		pack_cache_count++;
+
+		*cached_out = entry;
+		added = 1;
+	}
+	git_rwlock_wrunlock(&pack_cache_lock);
+	/* Somebody beat us to adding it into the cache, or it's full */
+	if (!added) {
+		git__free(entry);
+		return -1;
 	}
 
 	return 0;
@@ -184,8 +303,22 @@ static int cache_add(
  *
  ***********************************************************/
 
+static void pack_revindex_free(struct git_pack_file *p)
+{
+	if (p->rev_map.data) {
+		git_futils_mmap_free(&p->rev_map);
+		p->rev_map.data = NULL;
+	}
+
+	git__free(p->rev_computed);
+	p->rev_computed = NULL;
+	p->revindex = NULL;
+}
+
 static void pack_index_free(struct git_pack_file *p)
 {
+	pack_revindex_free(p);
+
 	if (p->ids) {
 		git__free(p->ids);
 		p->ids = NULL;
@@ -336,6 +469,406 @@ cleanup:
 	return error;
 }
 
+/***********************************************************
+ *
+ * PACK REVERSE INDEX
+ *
+ ***********************************************************/
+
+#define PACK_REV_HEADER_SIZE 12
+
+GIT_INLINE(uint32_t) revindex_at(const struct git_pack_file *p, uint32_t pack_pos)
+{
+	return ntohl(*(const uint32_t *)(p->revindex + (size_t)pack_pos * 4));
+}
+
+static int revindex_error(const char *path, const char *message)
+{
+	git_error_set(GIT_ERROR_ODB, "invalid reverse index '%s': %s", path, message);
+	return -1;
+}
+
+/*
+ * Run with the packfile lock held and the index open.  Returns
+ * GIT_ENOTFOUND when there is no ".rev" file for this pack.
+ */
+static int pack_revindex_read_locked(struct git_pack_file *p, const char *path)
+{
+	const unsigned char *data, *pack_checksum;
+	size_t size, expected_size, i;
+	struct stat st;
+	git_file fd;
+	int error;
+
+	if ((fd = git_futils_open_ro(path)) < 0) {
+		git_error_clear();
+		return GIT_ENOTFOUND;
+	}
+
+	if (p_fstat(fd, &st) < 0) {
+		p_close(fd);
+		git_error_set(GIT_ERROR_OS, "unable to stat reverse index '%s'", path);
+		return -1;
+	}
+
+	expected_size = PACK_REV_HEADER_SIZE + (size_t)p->num_objects * 4 +
+		p->oid_size * 2;
+
+	if (!S_ISREG(st.st_mode) || !git__is_sizet(st.st_size) ||
+	    (size = (size_t)st.st_size) != expected_size) {
+		p_close(fd);
+		return revindex_error(path, "wrong file size");
+	}
+
+	error = git_futils_mmap_ro(&p->rev_map, fd, 0, size);
+	p_close(fd);
+
+	if (error < 0)
+		return error;
+
+	data = p->rev_map.data;
+
+	if (ntohl(*(const uint32_t *)(data + 0)) != PACK_REV_SIGNATURE ||
+	    ntohl(*(const uint32_t *)(data + 4)) != PACK_REV_VERSION) {
+		error = revindex_error(path, "unsupported signature or version");
+		goto on_error;
+	}
+
+	if (ntohl(*(const uint32_t *)(data + 8)) != (uint32_t)p->oid_type) {
+		error = revindex_error(path, "object format does not match the pack");
+		goto on_error;
+	}
+
+	/* A reverse index left behind for an older pack of the same name */
+	pack_checksum = (const unsigned char *)p->index_map.data +
+		p->index_map.len - (p->oid_size * 2);
+
+	if (memcmp(data + size - (p->oid_size * 2), pack_checksum, p->oid_size) != 0) {
+		git_futils_mmap_free(&p->rev_map);
+		p->rev_map.data = NULL;
+		return GIT_ENOTFOUND;
+	}
+
+	p->revindex = data + PACK_REV_HEADER_SIZE;
+
+	for (i = 0; i < p->num_objects; i++) {
+		if (revindex_at(p, (uint32_t)i) >= p->num_objects) {
+			error = revindex_error(path, "index position out of range");
+			goto on_error;
+		}
+	}
+
+	return 0;
+
+on_error:
+	git_futils_mmap_free(&p->rev_map);
+	p->rev_map.data = NULL;
+	p->revindex = NULL;
+	return error;
+}
+
+static int revindex_offset_cmp(const void *a, const void *b, void *payload)
+{
+	const off64_t *offsets = payload;
+	off64_t a_off = offsets[*(const uint32_t *)a];
+	off64_t b_off = offsets[*(const uint32_t *)b];
+
+	return (a_off > b_off) - (a_off < b_off);
+}
+
+/* Run with the packfile lock held and the index open */
+static int pack_revindex_compute_locked(struct git_pack_file *p)
+{
+	off64_t *offsets;
+	uint32_t i;
+	int error = 0;
+
+	offsets = git__calloc(p->num_objects ? p->num_objects : 1, sizeof(off64_t));
+	GIT_ERROR_CHECK_ALLOC(offsets);
+
+	p->rev_computed = git__calloc(p->num_objects ? p->num_objects : 1, sizeof(uint32_t));
+	if (!p->rev_computed) {
+		git__free(offsets);
+		return -1;
+	}
+
+	for (i = 0; i < p->num_objects; i++) {
+		if ((offsets[i] = nth_packed_object_offset_locked(p, i)) < 0) {
+			error = packfile_error("invalid large offset");
+			goto done;
+		}
+
+		p->rev_computed[i] = i;
+	}
+
+	git__qsort_r(p->rev_computed, p->num_objects, sizeof(uint32_t),
+		revindex_offset_cmp, offsets);
+
+	for (i = 0; i < p->num_objects; i++)
+		p->rev_computed[i] = htonl(p->rev_computed[i]);
+
+	p->revindex = (const unsigned char *)p->rev_computed;
+
+done:
+	if (error < 0) {
+		git__free(p->rev_computed);
+		p->rev_computed = NULL;
+	}
+
+	git__free(offsets);
+	return error;
+}
+
+/* Run with the packfile lock held */
+static int pack_revindex_load_locked(struct git_pack_file *p)
+{
+	git_str rev_name = GIT_STR_INIT;
+	int error;
+
+	if (p->revindex)
+		return 0;
+
+	if ((error = pack_index_open_locked(p)) < 0)
+		return error;
+
+	if (!p->index_map.data) {
+		git_error_set(GIT_ERROR_INTERNAL, "internal error: p->index_map.data == NULL");
+		return -1;
+	}
+
+	if ((error = git_str_put(&rev_name, p->pack_name,
+			strlen(p->pack_name) - strlen(".pack"))) < 0 ||
+	    (error = git_str_puts(&rev_name, ".rev")) < 0)
+		goto done;
+
+	if ((error = pack_revindex_read_locked(p, rev_name.ptr)) == GIT_ENOTFOUND)
+		error = pack_revindex_compute_locked(p);
+
+done:
+	git_str_dispose(&rev_name);
+	return error;
+}
+
+int git_packfile_revindex_load(struct git_pack_file *p)
+{
+	int error;
+
+	if (git_mutex_lock(&p->lock) < 0)
+		return packfile_error("failed to get lock for the reverse index");
+
+	error = pack_revindex_load_locked(p);
+
+	git_mutex_unlock(&p->lock);
+	return error;
+}
+
+int git_packfile_pack_pos_to_index(
+	uint32_t *out,
+	struct git_pack_file *p,
+	uint32_t pack_pos)
+{
+	int error;
+
+	if ((error = git_packfile_revindex_load(p)) < 0)
+		return error;
+
+	if (pack_pos >= p->num_objects) {
+		git_error_set(GIT_ERROR_ODB, "pack position %u out of range", pack_pos);
+		return -1;
+	}
+
+	*out = revindex_at(p, pack_pos);
+	return 0;
+}
+
+/* Run with the packfile lock held and the reverse index loaded */
+static off64_t pack_pos_to_offset_locked(struct git_pack_file *p, uint32_t pack_pos)
+{
+	if (pack_pos == p->num_objects)
+		return p->mwf.size - p->oid_size;
+
+	return nth_packed_object_offset_locked(p, revindex_at(p, pack_pos));
+}
+
+int git_packfile_pack_pos_to_offset(
+	off64_t *out,
+	struct git_pack_file *p,
+	uint32_t pack_pos)
+{
+	int error;
+
+	if (git_mutex_lock(&p->lock) < 0)
+		return packfile_error("failed to get lock for the reverse index");
+
+	if ((error = pack_revindex_load_locked(p)) < 0)
+		goto done;
+
+	if (pack_pos > p->num_objects) {
+		git_error_set(GIT_ERROR_ODB, "pack position %u out of range", pack_pos);
+		error = -1;
+	} else if ((*out = pack_pos_to_offset_locked(p, pack_pos)) < 0) {
+		error = packfile_error("invalid large offset");
+	}
+
+done:
+	git_mutex_unlock(&p->lock);
+	return error;
+}
+
+/* Run with the packfile lock held and the reverse index loaded */
+static int offset_to_pack_pos_locked(
+	uint32_t *out,
+	struct git_pack_file *p,
+	off64_t offset)
+{
+	uint32_t lo = 0, hi = p->num_objects, mid;
+	off64_t mid_offset;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+
+		if ((mid_offset = pack_pos_to_offset_locked(p, mid)) < 0)
+			return packfile_error("invalid large offset");
+
+		if (mid_offset == offset) {
+			*out = mid;
+			return 0;
+		} else if (mid_offset > offset) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	return git_odb__error_notfound("no object at this offset in the pack", NULL, 0);
+}
+
+int git_packfile_offset_to_pack_pos(
+	uint32_t *out,
+	struct git_pack_file *p,
+	off64_t offset)
+{
+	int error;
+
+	if (git_mutex_lock(&p->lock) < 0)
+		return packfile_error("failed to get lock for the reverse index");
+
+	if ((error = pack_revindex_load_locked(p)) == 0)
+		error = offset_to_pack_pos_locked(out, p, offset);
+
+	git_mutex_unlock(&p->lock);
+	return error;
+}
+
+int git_packfile_object_disk_size(
+	off64_t *out,
+	struct git_pack_file *p,
+	off64_t offset)
+{
+	uint32_t pack_pos;
+	off64_t next;
+	int error;
+
+	if (git_mutex_lock(&p->lock) < 0)
+		return packfile_error("failed to get lock for the reverse index");
+
+	if ((error = pack_revindex_load_locked(p)) < 0 ||
+	    (error = offset_to_pack_pos_locked(&pack_pos, p, offset)) < 0)
+		goto done;
+
+	if ((next = pack_pos_to_offset_locked(p, pack_pos + 1)) < offset) {
+		error = packfile_error("invalid object offset");
+		goto done;
+	}
+
+	*out = next - offset;
+
+done:
+	git_mutex_unlock(&p->lock);
+	return error;
+}
+
+int git_packfile_id_at_offset(
+	git_oid *out,
+	struct git_pack_file *p,
+	off64_t offset)
+{
+	const unsigned char *index;
+	uint32_t pack_pos, n;
+	int error;
+
+	if (git_mutex_lock(&p->lock) < 0)
+		return packfile_error("failed to get lock for the reverse index");
+
+	if ((error = pack_revindex_load_locked(p)) < 0 ||
+	    (error = offset_to_pack_pos_locked(&pack_pos, p, offset)) < 0)
+		goto done;
+
+	n = revindex_at(p, pack_pos);
+	index = (const unsigned char *)p->index_map.data + 4 * 256;
+
+	if (p->index_version == 1)
+		index += (p->oid_size + 4) * (size_t)n + 4;
+	else
+		index += 8 + p->oid_size * (size_t)n;
+
+	error = git_oid__fromraw(out, index, p->oid_type);
+
+done:
+	git_mutex_unlock(&p->lock);
+	return error;
+}
+
+int git_packfile_revindex_write(
+	const char *path,
+	const uint32_t *index_positions,
+	size_t num_objects,
+	const unsigned char *pack_checksum,
+	git_oid_t oid_type,
+	unsigned int mode,
+	bool do_fsync)
+{
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_hash_algorithm_t algorithm = git_oid_algorithm(oid_type);
+	unsigned char checksum[GIT_HASH_MAX_SIZE];
+	size_t checksum_size = git_hash_size(algorithm), i;
+	uint32_t header[3], word;
+	int flags = git_filebuf_hash_flags(algorithm), error;
+
+	GIT_ASSERT(checksum_size);
+
+	if (do_fsync)
+		flags |= GIT_FILEBUF_FSYNC;
+
+	if ((error = git_filebuf_open(&file, path, flags, mode)) < 0)
+		return error;
+
+	header[0] = htonl(PACK_REV_SIGNATURE);
+	header[1] = htonl(PACK_REV_VERSION);
+	header[2] = htonl((uint32_t)oid_type);
+
+	if ((error = git_filebuf_write(&file, header, sizeof(header))) < 0)
+		goto done;
+
+	for (i = 0; i < num_objects; i++) {
+		word = htonl(index_positions[i]);
+
+		if ((error = git_filebuf_write(&file, &word, sizeof(word))) < 0)
+			goto done;
+	}
+
+	if ((error = git_filebuf_write(&file, pack_checksum, checksum_size)) < 0 ||
+	    (error = git_filebuf_hash(checksum, &file)) < 0 ||
+	    (error = git_filebuf_write(&file, checksum, checksum_size)) < 0)
+		goto done;
+
+	error = git_filebuf_commit(&file);
+
+done:
+	git_filebuf_cleanup(&file);
+	return error;
+}
+
 static unsigned char *pack_window_open(
 		struct git_pack_file *p,
 		git_mwindow **w_cursor,
@@ -496,17 +1029,8 @@ int git_packfile_unpack_header(
 	return 0;
 }
 
-int git_packfile_resolve_header(
-		size_t *size_p,
-		git_object_t *type_p,
-		struct git_pack_file *p,
-		off64_t offset)
+static int packfile_open_for_read(struct git_pack_file *p)
 {
-	git_mwindow *w_curs = NULL;
-	off64_t curpos = offset;
-	size_t size;
-	git_object_t type;
-	off64_t base_offset;
 	int error;
 
 	error = git_mutex_lock(&p->lock);
@@ -521,56 +1045,104 @@ int git_packfile_resolve_header(
 		return error;
 	}
 
-	if (p->mwf.fd == -1 && (error = packfile_open_locked(p)) < 0) {
-		git_mutex_unlock(&p->mwf.lock);
-		git_mutex_unlock(&p->lock);
-		return error;
-	}
+	if (p->mwf.fd == -1)
+		error = packfile_open_locked(p);
+
 	git_mutex_unlock(&p->mwf.lock);
 	git_mutex_unlock(&p->lock);
+	return error;
+}
 
-	error = git_packfile_unpack_header(&size, &type, p, &w_curs, &curpos);
-	if (error < 0)
-		return error;
-
-	if (type == GIT_OBJECT_OFS_DELTA || type == GIT_OBJECT_REF_DELTA) {
-		size_t base_size;
-		git_packfile_stream stream;
-
-		error = get_delta_base(&base_offset, p, &w_curs, &curpos, type, offset);
-		git_mwindow_close(&w_curs);
-
-		if (error < 0)
-			return error;
-
-		if ((error = git_packfile_stream_open(&stream, p, curpos)) < 0)
-			return error;
-		error = git_delta_read_header_fromstream(&base_size, size_p, &stream);
-		git_packfile_stream_dispose(&stream);
-		if (error < 0)
-			return error;
-	} else {
-		*size_p = size;
-		base_offset = 0;
-	}
+/*
+ * Follow the chain of delta bases from the entry at `offset` to the
+ * object that is stored whole, reading only the entries' headers.
+ */
+static int packfile_resolve_type(
+		git_object_t *type_p,
+		struct git_pack_file *p,
+		git_mwindow **w_curs,
+		off64_t offset)
+{
+	off64_t curpos, base_offset = offset;
+	size_t size;
+	git_object_t type;
+	int error;
 
-	while (type == GIT_OBJECT_OFS_DELTA || type == GIT_OBJECT_REF_DELTA) {
+	while (true) {
 		curpos = base_offset;
-		error = git_packfile_unpack_header(&size, &type, p, &w_curs, &curpos);
+		error = git_packfile_unpack_header(&size, &type, p, w_curs, &curpos);
 		if (error < 0)
 			return error;
 		if (type != GIT_OBJECT_OFS_DELTA && type != GIT_OBJECT_REF_DELTA)
 			break;
 
-		error = get_delta_base(&base_offset, p, &w_curs, &curpos, type, base_offset);
-		git_mwindow_close(&w_curs);
+		error = get_delta_base(&base_offset, p, w_curs, &curpos, type, base_offset);
+		git_mwindow_close(w_curs);
 
 		if (error < 0)
 			return error;
 	}
 	*type_p = type;
 
-	return error;
+	return 0;
+}
+
+int git_packfile_resolve_type(
+		git_object_t *type_p,
+		struct git_pack_file *p,
+		off64_t offset)
+{
+	git_mwindow *w_curs = NULL;
+	int error;
+
+	if ((error = packfile_open_for_read(p)) < 0)
+		return error;
+
+	return packfile_resolve_type(type_p, p, &w_curs, offset);
+}
+
+int git_packfile_resolve_header(
+		size_t *size_p,
+		git_object_t *type_p,
+		struct git_pack_file *p,
+		off64_t offset)
+{
+	git_mwindow *w_curs = NULL;
+	off64_t curpos = offset;
+	size_t size, base_size;
+	git_object_t type;
+	off64_t base_offset;
+	git_packfile_stream stream;
+	int error;
+
+	if ((error = packfile_open_for_read(p)) < 0)
+		return error;
+
+	error = git_packfile_unpack_header(&size, &type, p, &w_curs, &curpos);
+	if (error < 0)
+		return error;
+
+	if (type != GIT_OBJECT_OFS_DELTA && type != GIT_OBJECT_REF_DELTA) {
+		*size_p = size;
+		*type_p = type;
+		return 0;
+	}
+
+	error = get_delta_base(&base_offset, p, &w_curs, &curpos, type, offset);
+	git_mwindow_close(&w_curs);
+
+	if (error < 0)
+		return error;
+
+	/* the size of the object is in the header of the delta data */
+	if ((error = git_packfile_stream_open(&stream, p, curpos)) < 0)
+		return error;
+	error = git_delta_read_header_fromstream(&base_size, size_p, &stream);
+	git_packfile_stream_dispose(&stream);
+	if (error < 0)
+		return error;
+
+	return packfile_resolve_type(type_p, p, &w_curs, base_offset);
 }
 
 #define SMALL_STACK_SIZE 64
@@ -732,6 +1304,9 @@ int git_packfile_unpack(
 			error = packfile_unpack_compressed(obj, p, &w_curs, &curpos, elem->size, elem->type);
 			git_mwindow_close(&w_curs);
 			base_type = elem->type;
+
+			if (stack_size > 1)
+				git_atomic_ssize_add(&git_pack__cache_inflations, 1);
 		}
 		if (error < 0)
 			goto cleanup;
@@ -831,6 +1406,35 @@ cleanup:
 	return error;
 }
 
+int git_packfile_cache_base(
+	struct git_pack_file *p,
+	off64_t offset,
+	const git_rawobj *obj)
+{
+	git_pack_cache_entry *cached = NULL;
+	git_rawobj copy;
+
+	if (obj->len > git_pack__cache_object_limit)
+		return 0;
+
+	copy.len = obj->len;
+	copy.type = obj->type;
+	copy.data = git__malloc(obj->len + 1);
+	GIT_ERROR_CHECK_ALLOC(copy.data);
+
+	memcpy(copy.data, obj->data, obj->len);
+	((char *)copy.data)[obj->len] = '\0';
+
+	/* the cache may be full, or have the object already */
+	if (cache_add(&cached, &p->bases, &copy, offset) < 0) {
+		git__free(copy.data);
+		return 0;
+	}
+
+	git_atomic32_dec(&cached->refcount);
+	return 0;
+}
+
 int git_packfile_stream_open(git_packfile_stream *obj, struct git_pack_file *p, off64_t curpos)
 {
 	memset(obj, 0, sizeof(git_packfile_stream));
@@ -1039,6 +1643,193 @@ int get_delta_base(
 	return 0;
 }
 
+int git_packfile_raw_entry_read(
+	git_packfile_raw_entry *out,
+	struct git_pack_file *p,
+	off64_t offset)
+{
+	git_mwindow *w_curs = NULL;
+	off64_t curpos = offset;
+	int error;
+
+	memset(out, 0, sizeof(*out));
+
+	if ((error = git_packfile_unpack_header(&out->size, &out->type,
+			p, &w_curs, &curpos)) < 0)
+		return error;
+
+	if (out->type == GIT_OBJECT_OFS_DELTA || out->type == GIT_OBJECT_REF_DELTA) {
+		error = get_delta_base(&out->base_offset, p, &w_curs, &curpos,
+			out->type, offset);
+		git_mwindow_close(&w_curs);
+
+		if (error == GIT_PASSTHROUGH)
+			error = packfile_error("delta base is not in the pack");
+		if (error < 0)
+			return error;
+	}
+
+	out->data_offset = curpos;
+	return 0;
+}
+
+int git_packfile_raw_copy(
+	struct git_pack_file *p,
+	off64_t offset,
+	off64_t len,
+	git_packfile_raw_copy_cb cb,
+	void *payload)
+{
+	git_mwindow *w_curs = NULL;
+	unsigned char *data;
+	unsigned int left;
+	size_t chunk;
+	int error = 0;
+
+	while (len > 0) {
+		if ((data = pack_window_open(p, &w_curs, offset, &left)) == NULL)
+			return packfile_error("packfile is truncated");
+
+		chunk = (size_t)min((off64_t)left, len);
+		error = cb(data, chunk, payload);
+		git_mwindow_close(&w_curs);
+
+		if (error < 0)
+			break;
+
+		offset += chunk;
+		len -= chunk;
+	}
+
+	return error;
+}
+
+static int packfile_entry_corrupt(void)
+{
+	git_error_set(GIT_ERROR_ODB, "packed object is corrupt");
+	return GIT_EMISMATCH;
+}
+
+static int packfile_entry_crc(
+	uint32_t *out,
+	struct git_pack_file *p,
+	off64_t offset,
+	off64_t len)
+{
+	git_mwindow *w_curs = NULL;
+	unsigned char *data;
+	unsigned int left, chunk;
+	uint32_t crc = crc32(0L, Z_NULL, 0);
+
+	while (len > 0) {
+		if ((data = pack_window_open(p, &w_curs, offset, &left)) == NULL)
+			return packfile_error("packfile is truncated");
+
+		chunk = (unsigned int)min((off64_t)left, len);
+		crc = crc32(crc, data, chunk);
+		git_mwindow_close(&w_curs);
+
+		offset += chunk;
+		len -= chunk;
+	}
+
+	*out = crc;
+	return 0;
+}
+
+/* Inflate the data from `position` to `end`, which must hold `size` bytes */
+static int packfile_entry_inflates(
+	struct git_pack_file *p,
+	off64_t position,
+	off64_t end,
+	size_t size)
+{
+	git_zstream zstream = GIT_ZSTREAM_INIT;
+	git_mwindow *w_curs = NULL;
+	char buf[GIT_BUFSIZE_FILEIO];
+	size_t total = 0;
+	int error;
+
+	if ((error = git_zstream_init(&zstream, GIT_ZSTREAM_INFLATE)) < 0)
+		return error;
+
+	while (!git_zstream_eos(&zstream) && position < end) {
+		size_t bytes = sizeof(buf);
+		unsigned int window_len, consumed;
+		unsigned char *in;
+
+		if ((in = pack_window_open(p, &w_curs, position, &window_len)) == NULL) {
+			error = packfile_error("packfile is truncated");
+			goto done;
+		}
+
+		if ((off64_t)window_len > end - position)
+			window_len = (unsigned int)(end - position);
+
+		error = git_zstream_set_input(&zstream, in, window_len);
+
+		if (!error && git_zstream_get_output_chunk(buf, &bytes, &zstream) < 0)
+			error = packfile_entry_corrupt();
+
+		git_mwindow_close(&w_curs);
+
+		if (error < 0)
+			goto done;
+
+		consumed = window_len - (unsigned int)zstream.in_len;
+
+		if (!bytes && !consumed)
+			break;
+
+		position += consumed;
+		total += bytes;
+	}
+
+	if (!git_zstream_eos(&zstream) || position != end || total != size)
+		error = packfile_entry_corrupt();
+
+done:
+	git_zstream_free(&zstream);
+	return error;
+}
+
+int git_packfile_raw_entry_verify(
+	struct git_pack_file *p,
+	off64_t offset,
+	off64_t len,
+	const git_packfile_raw_entry *entry)
+{
+	const unsigned char *index;
+	uint32_t pack_pos, expected, crc;
+	int error;
+
+	if (git_mutex_lock(&p->lock) < 0)
+		return packfile_error("failed to get lock for the reverse index");
+
+	if ((error = pack_revindex_load_locked(p)) < 0 ||
+	    (error = offset_to_pack_pos_locked(&pack_pos, p, offset)) < 0) {
+		git_mutex_unlock(&p->lock);
+		return error;
+	}
+
+	if (p->index_version == 1) {
+		git_mutex_unlock(&p->lock);
+		return packfile_entry_inflates(p, entry->data_offset,
+			offset + len, entry->size);
+	}
+
+	index = (const unsigned char *)p->index_map.data + 4 * 256 + 8 +
+		(size_t)p->num_objects * p->oid_size;
+	expected = ntohl(*((uint32_t *)(index + 4 * (size_t)revindex_at(p, pack_pos))));
+
+	git_mutex_unlock(&p->lock);
+
+	if ((error = packfile_entry_crc(&crc, p, offset, len)) < 0)
+		return error;
+
+	return (crc == expected) ? 0 : packfile_entry_corrupt();
+}
+
 /***********************************************************
  *
  * PACKFILE METHODS
@@ -1073,7 +1864,6 @@ void git_packfile_free(struct git_pack_file *p, bool unlink_packfile)
 
 	git__free(p->bad_object_ids);
 
-	git_mutex_free(&p->bases.lock);
 	git_mutex_free(&p->mwf.lock);
 	git_mutex_free(&p->lock);
 	git__free(p);
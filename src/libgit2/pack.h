@@ -60,14 +60,23 @@ struct git_pack_header {
 
 #define PACK_IDX_SIGNATURE 0xff744f63	/* "\377tOc" */
 
+#define PACK_REV_SIGNATURE 0x52494458	/* "RIDX" */
+#define PACK_REV_VERSION 1
+
 struct git_pack_idx_header {
 	uint32_t idx_signature;
 	uint32_t idx_version;
 };
 
+typedef struct git_pack_cache git_pack_cache;
+
 typedef struct git_pack_cache_entry {
-	size_t last_usage; /* enough? */
+	struct git_pack_cache_entry *prev; /* more recently used */
+	struct git_pack_cache_entry *next; /* less recently used */
+	git_pack_cache *cache;
+	off64_t offset;
 	git_atomic32 refcount;
+	git_atomic32 referenced;
 	git_rawobj raw;
 } git_pack_cache_entry;
 
@@ -80,16 +89,28 @@ struct pack_chain_elem {
 
 typedef git_array_t(struct pack_chain_elem) git_dependency_chain;
 
-#define GIT_PACK_CACHE_MEMORY_LIMIT 16 * 1024 * 1024
-#define GIT_PACK_CACHE_SIZE_LIMIT 1024 * 1024 /* don't bother caching anything over 1MB */
+#define GIT_PACK_CACHE_MEMORY_LIMIT (96 * 1024 * 1024)
+#define GIT_PACK_CACHE_SIZE_LIMIT (1024 * 1024) /* don't bother caching anything over 1MB */
 
-typedef struct {
-	size_t memory_used;
-	size_t memory_limit;
-	size_t use_ctr;
-	git_mutex lock;
+extern size_t git_pack__cache_memory_limit;
+extern size_t git_pack__cache_object_limit;
+
+extern git_atomic_ssize git_pack__cache_hits;
+extern git_atomic_ssize git_pack__cache_inflations;
+extern git_atomic_ssize git_pack__cache_evictions;
+
+/*
+ * Each packfile keeps the delta bases it has cached in its own map,
+ * but the memory budget and the recency list are shared by all the
+ * packfiles in the process, so that the cache follows the working set
+ * wherever it is.  When the cache is full, the least recently used
+ * bases that are not in use by a reader are evicted, regardless of the
+ * packfile that they belong to.
+ */
+struct git_pack_cache {
 	git_offmap *entries;
-} git_pack_cache;
+	size_t memory_used;
+};
 
 struct git_pack_file {
 	git_mwindow_file mwf;
@@ -113,6 +134,15 @@ struct git_pack_file {
 	git_oidmap *idx_cache;
 	unsigned char **ids;
 
+	/*
+	 * The reverse index: the index positions of the objects, in the
+	 * order of the objects in the pack, as 4-byte network order words.
+	 * Either read from the ".rev" file or computed from the index.
+	 */
+	const unsigned char *revindex;
+	git_map rev_map;
+	uint32_t *rev_computed;
+
 	git_pack_cache bases; /* delta base cache */
 
 	time_t last_freshen; /* last time the packfile was freshened */
@@ -153,6 +183,11 @@ typedef struct git_packfile_stream {
 	git_mwindow *mw;
 } git_packfile_stream;
 
+int git_pack_global_init(void);
+
+/* Total memory used by the delta base caches of all packfiles */
+size_t git_pack__cache_memory_used(void);
+
 int git_packfile__object_header(size_t *out, unsigned char *hdr, size_t size, git_object_t type);
 
 int git_packfile__name(char **out, const char *path);
@@ -170,8 +205,125 @@ int git_packfile_resolve_header(
 		struct git_pack_file *p,
 		off64_t offset);
 
+/*
+ * Find the type of the object at `offset`.  Unlike
+ * `git_packfile_resolve_header`, this does not inflate anything: only
+ * the headers of the entries on its chain of delta bases are read.
+ */
+int git_packfile_resolve_type(
+		git_object_t *type_p,
+		struct git_pack_file *p,
+		off64_t offset);
+
 int git_packfile_unpack(git_rawobj *obj, struct git_pack_file *p, off64_t *obj_offset);
 
+/*
+ * Put a copy of an object that was read from the pack at `offset` into
+ * the delta base cache, for the deltas against it that are read next.
+ * Objects that do not fit into the cache are left out.
+ */
+int git_packfile_cache_base(
+	struct git_pack_file *p,
+	off64_t offset,
+	const git_rawobj *obj);
+
+/*
+ * The reverse index maps between the position of an object in the pack
+ * (its "pack position", counting objects by their offset) and the object's
+ * position in the index.  It is loaded on first use, from the pack's ".rev"
+ * file when there is one that matches the pack.
+ */
+int git_packfile_revindex_load(struct git_pack_file *p);
+
+/* The index position of the object at the given pack position */
+int git_packfile_pack_pos_to_index(
+		uint32_t *out,
+		struct git_pack_file *p,
+		uint32_t pack_pos);
+
+/*
+ * The offset of the object at the given pack position; the pack position
+ * after the last object gives the offset of the pack's trailer.
+ */
+int git_packfile_pack_pos_to_offset(
+		off64_t *out,
+		struct git_pack_file *p,
+		uint32_t pack_pos);
+
+/* The pack position of the object at the given offset, or GIT_ENOTFOUND */
+int git_packfile_offset_to_pack_pos(
+		uint32_t *out,
+		struct git_pack_file *p,
+		off64_t offset);
+
+/*
+ * The number of bytes that the object at the given offset takes up in
+ * the pack, its header included, found from the offset of the next object.
+ */
+int git_packfile_object_disk_size(
+		off64_t *out,
+		struct git_pack_file *p,
+		off64_t offset);
+
+/* The id of the object at the given offset, found through the reverse index */
+int git_packfile_id_at_offset(
+		git_oid *out,
+		struct git_pack_file *p,
+		off64_t offset);
+
+/*
+ * An object's entry in a pack as it is stored: for deltas, `type` is
+ * the delta type and `size` the size of the delta data.
+ */
+typedef struct {
+	git_object_t type;
+	size_t size;
+	/* For deltas, where the base object starts in the same pack */
+	off64_t base_offset;
+	/* Where the entry's compressed data starts */
+	off64_t data_offset;
+} git_packfile_raw_entry;
+
+int git_packfile_raw_entry_read(
+		git_packfile_raw_entry *out,
+		struct git_pack_file *p,
+		off64_t offset);
+
+typedef int (*git_packfile_raw_copy_cb)(const void *buf, size_t len, void *payload);
+
+/*
+ * Hand `len` bytes of the pack, starting at `offset`, to the callback as
+ * they are stored, without inflating them.
+ */
+int git_packfile_raw_copy(
+		struct git_pack_file *p,
+		off64_t offset,
+		off64_t len,
+		git_packfile_raw_copy_cb cb,
+		void *payload);
+
+/*
+ * Check the `len` bytes of the entry at `offset`, as read into `entry`,
+ * before they are copied as they are: against the CRC32 in a version 2
+ * index, or by inflating the entry's data for a version 1 index, which
+ * has none.  Returns GIT_EMISMATCH if the entry is corrupt.
+ */
+int git_packfile_raw_entry_verify(
+		struct git_pack_file *p,
+		off64_t offset,
+		off64_t len,
+		const git_packfile_raw_entry *entry);
+
+/* Write the ".rev" file for the given index positions, sorted by offset. */
+int git_packfile_revindex_write(
+		const char *path,
+		const uint32_t *index_positions,
+		size_t num_objects,
+		const unsigned char *pack_checksum,
+		git_oid_t oid_type,
+		unsigned int mode,
+		bool do_fsync);
+
 int git_packfile_stream_open(git_packfile_stream *obj, struct git_pack_file *p, off64_t curpos);
 ssize_t git_packfile_stream_read(git_packfile_stream *obj, void *buffer, size_t len);
 void git_packfile_stream_dispose(git_packfile_stream *obj);
@@ -175,6 +175,9 @@ void git_repository_free(git_repository *repo)
 
 	git_repository__cleanup(repo);
 
+	if (repo->fsmonitor)
+		repo->fsmonitor->free(repo->fsmonitor);
+
 	git_cache_dispose(&repo->objects);
 
 	git_diff_driver_registry_free(repo->diff_drivers);
@@ -1714,6 +1717,23 @@ int git_repository_set_index(git_repository *repo, git_index *index)
 	return 0;
 }
 
+int git_repository_set_fsmonitor(git_repository *repo, git_fsmonitor *monitor)
+{
+	git_fsmonitor *old;
+
+	GIT_ASSERT_ARG(repo);
+
+	if (monitor)
+		GIT_ERROR_CHECK_VERSION(monitor, GIT_FSMONITOR_VERSION, "git_fsmonitor");
+
+	old = git_atomic_swap(repo->fsmonitor, monitor);
+
+	if (old)
+		old->free(old);
+
+	return 0;
+}
+
 int git_repository_grafts__weakptr(git_grafts **out, git_repository *repo)
 {
 	GIT_ASSERT_ARG(out && repo);
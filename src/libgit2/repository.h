@@ -15,6 +15,7 @@
 #include "git2/repository.h"
 #include "git2/object.h"
 #include "git2/config.h"
+#include "git2/sys/fsmonitor.h"
 
 #include "array.h"
 #include "cache.h"
@@ -54,6 +55,7 @@ typedef enum {
 	GIT_CONFIGMAP_PROTECTNTFS,      /* core.protectNTFS */
 	GIT_CONFIGMAP_FSYNCOBJECTFILES, /* core.fsyncObjectFiles */
 	GIT_CONFIGMAP_LONGPATHS,        /* core.longpaths */
+	GIT_CONFIGMAP_UNTRACKEDCACHE,   /* core.untrackedCache */
 	GIT_CONFIGMAP_CACHE_MAX
 } git_configmap_item;
 
@@ -120,7 +122,12 @@ typedef enum {
 	/* core.fsyncObjectFiles */
 	GIT_FSYNCOBJECTFILES_DEFAULT = GIT_CONFIGMAP_FALSE,
 	/* core.longpaths */
-	GIT_LONGPATHS_DEFAULT = GIT_CONFIGMAP_FALSE
+	GIT_LONGPATHS_DEFAULT = GIT_CONFIGMAP_FALSE,
+	/* core.untrackedCache: false, true, 'keep' */
+	GIT_UNTRACKEDCACHE_FALSE = GIT_CONFIGMAP_FALSE,
+	GIT_UNTRACKEDCACHE_TRUE = GIT_CONFIGMAP_TRUE,
+	GIT_UNTRACKEDCACHE_KEEP = 2,
+	GIT_UNTRACKEDCACHE_DEFAULT = GIT_UNTRACKEDCACHE_KEEP
 } git_configmap_value;
 
 /* internal repository init flags */
@@ -136,6 +143,7 @@ struct git_repository {
 	git_refdb *_refdb;
 	git_config *_config;
 	git_index *_index;
+	git_fsmonitor *fsmonitor;
 
 	git_cache objects;
 	git_attr_cache *attrcache;
@@ -12,6 +12,7 @@
 #include "pool.h"
 
 #include "git2/revparse.h"
+#include "git2/sys/revwalk.h"
 #include "merge.h"
 #include "vector.h"
 
@@ -38,13 +39,24 @@ git_commit_list_node *git_revwalk__commit_lookup(
 	return commit;
 }
 
-int git_revwalk__push_commit(git_revwalk *walk, const git_oid *oid, const git_revwalk__push_options *opts)
+static int peel_to_commit_id(
+	git_oid *out,
+	git_revwalk *walk,
+	const git_oid *oid,
+	const git_revwalk__push_options *opts)
 {
-	git_oid commit_id;
-	int error;
+	git_commit_graph_file *cgraph_file;
+	git_commit_graph_entry e;
 	git_object *obj, *oobj;
-	git_commit_list_node *commit;
-	git_commit_list *list;
+	int error;
+
+	/* Anything in the commit-graph is a commit, no need to read it */
+	if (git_commit_list_graph_entry(&cgraph_file, &e, walk, oid) == 0) {
+		git_oid_cpy(out, oid);
+		return 0;
+	}
+
+	git_error_clear();
 
 	if ((error = git_object_lookup(&oobj, walk->repo, oid, GIT_OBJECT_ANY)) < 0)
 		return error;
@@ -55,7 +67,7 @@ int git_revwalk__push_commit(git_revwalk *walk, const git_oid *oid, const git_re
 	if (error == GIT_ENOTFOUND || error == GIT_EINVALIDSPEC || error == GIT_EPEEL) {
 		/* If this comes from e.g. push_glob("tags"), ignore this */
 		if (opts->from_glob)
-			return 0;
+			return GIT_PASSTHROUGH;
 
 		git_error_set(GIT_ERROR_INVALID, "object is not a committish");
 		return error;
@@ -63,8 +75,22 @@ int git_revwalk__push_commit(git_revwalk *walk, const git_oid *oid, const git_re
 	if (error < 0)
 		return error;
 
-	git_oid_cpy(&commit_id, git_object_id(obj));
+	git_oid_cpy(out, git_object_id(obj));
 	git_object_free(obj);
+	return 0;
+}
+
+int git_revwalk__push_commit(git_revwalk *walk, const git_oid *oid, const git_revwalk__push_options *opts)
+{
+	git_oid commit_id;
+	int error;
+	git_commit_list_node *commit;
+	git_commit_list *list;
+
+	if ((error = peel_to_commit_id(&commit_id, walk, oid, opts)) == GIT_PASSTHROUGH)
+		return 0;
+	else if (error < 0)
+		return error;
 
 	commit = git_revwalk__commit_lookup(walk, &commit_id);
 	if (commit == NULL)
@@ -611,11 +637,182 @@ cleanup:
 	return error;
 }
 
+/*
+ * Incremental topological sorting.
+ *
+ * Instead of walking the whole history before returning the first commit,
+ * we use the commit-graph's generation numbers to know when a commit
+ * cannot gain any further children: all of its children have a larger
+ * generation number.  We count the in-degree of commits only down to the
+ * lowest generation number that we have been asked to emit so far, and a
+ * commit is ready to be emitted once all of its counted children have been
+ * emitted.  This is git's "--topo-order" walk.
+ */
+
+GIT_INLINE(uint64_t) topo_generation(git_commit_list_node *commit)
+{
+	/* commits which are not in the commit-graph sort above all others */
+	return commit->generation ? commit->generation : UINT64_MAX;
+}
+
+static int topo_generation_cmp(const void *a, const void *b)
+{
+	uint64_t generation_a = topo_generation((git_commit_list_node *)a);
+	uint64_t generation_b = topo_generation((git_commit_list_node *)b);
+
+	if (generation_a < generation_b)
+		return 1;
+	if (generation_a > generation_b)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Count the children of every commit with a generation number of at least
+ * `generation`. A commit's in-degree is one more than its number of
+ * children, zero means it hasn't been reached yet.
+ */
+static int topo_walk_indegree(git_revwalk *walk, uint64_t generation)
+{
+	git_commit_list_node *commit, *parent;
+	unsigned short i;
+	int error;
+
+	while ((commit = git_pqueue_get(&walk->topo_indegree, 0)) != NULL &&
+	       topo_generation(commit) >= generation) {
+		git_pqueue_pop(&walk->topo_indegree);
+
+		for (i = 0; i < commit->out_degree; i++) {
+			parent = commit->parents[i];
+
+			if (parent->in_degree) {
+				parent->in_degree++;
+				continue;
+			}
+
+			if ((error = git_commit_list_parse(walk, parent)) < 0)
+				return error;
+
+			parent->in_degree = 2;
+
+			if ((error = git_pqueue_insert(&walk->topo_indegree, parent)) < 0)
+				return error;
+		}
+	}
+
+	walk->topo_generation = generation;
+	return 0;
+}
+
+static int init_topo_walk(git_revwalk *walk, git_commit_list *list)
+{
+	git_commit_list *ll;
+	git_vector_cmp ready_cmp = NULL;
+	uint64_t generation = UINT64_MAX;
+	int error;
+
+	if (walk->sorting & GIT_SORT_TIME)
+		ready_cmp = git_commit_list_time_cmp;
+
+	git_pqueue_free(&walk->topo_indegree);
+	git_pqueue_free(&walk->topo_ready);
+
+	if ((error = git_pqueue_init(&walk->topo_indegree, 0, 8, topo_generation_cmp)) < 0 ||
+	    (error = git_pqueue_init(&walk->topo_ready, 0, 8, ready_cmp)) < 0)
+		return error;
+
+	for (ll = list; ll; ll = ll->next) {
+		ll->item->in_degree = 1;
+
+		if ((error = git_pqueue_insert(&walk->topo_indegree, ll->item)) < 0)
+			return error;
+
+		generation = min(generation, topo_generation(ll->item));
+	}
+
+	if ((error = topo_walk_indegree(walk, generation)) < 0)
+		return error;
+
+	/* The tips are those of our input that no other input reaches */
+	for (ll = list; ll; ll = ll->next) {
+		if (ll->item->in_degree == 1 &&
+		    (error = git_pqueue_insert(&walk->topo_ready, ll->item)) < 0)
+			return error;
+	}
+
+	/* As in sort_in_topological_order, emit the tips in input order */
+	if ((walk->sorting & GIT_SORT_TIME) == 0)
+		git_pqueue_reverse(&walk->topo_ready);
+
+	return 0;
+}
+
+static int revwalk_next_topo_incremental(git_commit_list_node **object_out, git_revwalk *walk)
+{
+	git_commit_list_node *next, *parent;
+	uint64_t generation;
+	unsigned short i;
+	int error;
+
+	if ((next = git_pqueue_pop(&walk->topo_ready)) == NULL) {
+		git_error_clear();
+		return GIT_ITEROVER;
+	}
+
+	for (i = 0; i < next->out_degree; i++) {
+		parent = next->parents[i];
+
+		/*
+		 * Before we can tell whether the parent is ready, all of
+		 * its children must have been counted, and those all have
+		 * a higher generation number than the parent itself.
+		 */
+		generation = topo_generation(parent);
+
+		if (generation < walk->topo_generation &&
+		    (error = topo_walk_indegree(walk, generation)) < 0)
+			return error;
+
+		if (--parent->in_degree == 1 &&
+		    (error = git_pqueue_insert(&walk->topo_ready, parent)) < 0)
+			return error;
+	}
+
+	*object_out = next;
+	return 0;
+}
+
+/*
+ * Whether we can sort topologically without walking the whole history
+ * first. Hidden commits need the full walk to find out what's reachable
+ * from them, and without generation numbers every commit may still gain
+ * children until the walk is over.  When simplifying to the first parent,
+ * sort_in_topological_order still orders by every parent within the
+ * walked commits, which we cannot know about up front.
+ */
+static bool topo_walk_is_incremental(git_revwalk *walk)
+{
+	git_commit_graph_file *cgraph_file;
+
+	if ((walk->sorting & GIT_SORT_TOPOLOGICAL) == 0 ||
+	    walk->did_hide || walk->hide_cb || walk->first_parent)
+		return false;
+
+	if (git_odb__get_commit_graph_file(&cgraph_file, walk->odb) < 0) {
+		git_error_clear();
+		return false;
+	}
+
+	return true;
+}
+
 static int prepare_walk(git_revwalk *walk)
 {
 	int error = 0;
 	git_commit_list *list, *commits = NULL, *commits_last = NULL;
 	git_commit_list_node *next;
+	bool incremental;
 
 	/* If there were no pushes, we know that the walk is already over */
 	if (!walk->did_push) {
@@ -654,10 +851,21 @@ static int prepare_walk(git_revwalk *walk)
 		}
 	}
 
-	if (walk->limited && (error = limit_list(&commits, walk, commits)) < 0)
+	incremental = topo_walk_is_incremental(walk);
+
+	if (walk->limited && !incremental &&
+	    (error = limit_list(&commits, walk, commits)) < 0)
 		return error;
 
-	if (walk->sorting & GIT_SORT_TOPOLOGICAL) {
+	if (incremental) {
+		error = init_topo_walk(walk, commits);
+		git_commit_list_free(&commits);
+
+		if (error < 0)
+			return error;
+
+		walk->get_next = &revwalk_next_topo_incremental;
+	} else if (walk->sorting & GIT_SORT_TOPOLOGICAL) {
 		error = sort_in_topological_order(&walk->iterator_topo, walk, commits);
 		git_commit_list_free(&commits);
 
@@ -719,6 +927,17 @@ int git_revwalk_new(git_revwalk **revwalk_out, git_repository *repo)
 	return 0;
 }
 
+int git_revwalk_get_perfdata(git_revwalk_perfdata *out, const git_revwalk *walk)
+{
+	GIT_ASSERT_ARG(out);
+	GIT_ASSERT_ARG(walk);
+	GIT_ERROR_CHECK_VERSION(out, GIT_REVWALK_PERFDATA_VERSION, "git_revwalk_perfdata");
+
+	out->parsed_from_graph = walk->parsed_from_graph;
+	out->parsed_from_odb = walk->parsed_from_odb;
+	return 0;
+}
+
 void git_revwalk_free(git_revwalk *walk)
 {
 	if (walk == NULL)
@@ -812,6 +1031,8 @@ int git_revwalk_reset(git_revwalk *walk)
 		});
 
 	git_pqueue_clear(&walk->iterator_time);
+	git_pqueue_free(&walk->topo_indegree);
+	git_pqueue_free(&walk->topo_ready);
 	git_commit_list_free(&walk->iterator_topo);
 	git_commit_list_free(&walk->iterator_rand);
 	git_commit_list_free(&walk->iterator_reverse);
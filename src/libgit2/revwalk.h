@@ -30,6 +30,11 @@ struct git_revwalk {
 	git_commit_list *iterator_reverse;
 	git_pqueue iterator_time;
 
+	/* incremental topological sorting (see init_topo_walk) */
+	git_pqueue topo_indegree;
+	git_pqueue topo_ready;
+	uint64_t topo_generation;
+
 	int (*get_next)(git_commit_list_node **, git_revwalk *);
 	int (*enqueue)(git_revwalk *, git_commit_list_node *);
 
@@ -46,6 +51,10 @@ struct git_revwalk {
 	/* hide callback */
 	git_revwalk_hide_cb hide_cb;
 	void *hide_cb_payload;
+
+	/* how many commits were parsed from the commit-graph and the odb */
+	size_t parsed_from_graph;
+	size_t parsed_from_odb;
 };
 
 git_commit_list_node *git_revwalk__commit_lookup(git_revwalk *walk, const git_oid *oid);
@@ -21,6 +21,7 @@
 #include "mwindow.h"
 #include "object.h"
 #include "odb.h"
+#include "pack.h"
 #include "rand.h"
 #include "refs.h"
 #include "runtime.h"
@@ -184,6 +185,36 @@ int git_libgit2_opts(int key, ...)
 		*(va_arg(ap, ssize_t *)) = git_cache__max_storage;
 		break;
 
+	case GIT_OPT_SET_CACHE_TYPE_MAX_SIZE:
+		{
+			git_object_t type = (git_object_t)va_arg(ap, int);
+			ssize_t size = va_arg(ap, ssize_t);
+			error = git_cache_set_max_type_storage(type, size);
+			break;
+		}
+
+	case GIT_OPT_GET_CACHE_STATISTICS:
+		*(va_arg(ap, size_t *)) = (size_t)git_atomic_ssize_get(&git_cache__hits);
+		*(va_arg(ap, size_t *)) = (size_t)git_atomic_ssize_get(&git_cache__misses);
+		*(va_arg(ap, size_t *)) = (size_t)git_atomic_ssize_get(&git_cache__evictions);
+		break;
+
+	case GIT_OPT_GET_PACK_CACHE_MAX_SIZE:
+		*(va_arg(ap, size_t *)) = git_pack__cache_memory_limit;
+		*(va_arg(ap, size_t *)) = git_pack__cache_object_limit;
+		break;
+
+	case GIT_OPT_SET_PACK_CACHE_MAX_SIZE:
+		git_pack__cache_memory_limit = va_arg(ap, size_t);
+		git_pack__cache_object_limit = va_arg(ap, size_t);
+		break;
+
+	case GIT_OPT_GET_PACK_CACHE_STATISTICS:
+		*(va_arg(ap, size_t *)) = (size_t)git_atomic_ssize_get(&git_pack__cache_hits);
+		*(va_arg(ap, size_t *)) = (size_t)git_atomic_ssize_get(&git_pack__cache_inflations);
+		*(va_arg(ap, size_t *)) = (size_t)git_atomic_ssize_get(&git_pack__cache_evictions);
+		break;
+
 	case GIT_OPT_GET_TEMPLATE_PATH:
 		{
 			git_buf *out = va_arg(ap, git_buf *);
@@ -0,0 +1,340 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "sparse-checkout.h"
+
+#include "config.h"
+#include "futils.h"
+#include "index.h"
+#include "repository.h"
+
+#define SPARSE_CHECKOUT_FILE "sparse-checkout"
+
+static int sparse_checkout_add(
+	git_sparse_checkout *sparse,
+	git_strmap *set,
+	const char *dir,
+	size_t len)
+{
+	char *key;
+
+	if ((key = git_pool_strndup(&sparse->pool, dir, len)) == NULL)
+		return -1;
+
+	if (len > sparse->max_len)
+		sparse->max_len = len;
+
+	return git_strmap_set(set, key, key);
+}
+
+/*
+ * Parse one line of the file into `dir`, returning 1 if it names a
+ * recursive directory, 2 if a parent directory, 0 if it is one of
+ * the patterns for the root or is empty and -1 if it is not a cone
+ * pattern at all.
+ */
+static int sparse_checkout_parse_line(git_str *dir, const char *line)
+{
+	size_t len;
+	bool negative;
+
+	git_str_clear(dir);
+
+	if (!*line || *line == '#' ||
+	    strcmp(line, "/*") == 0 || strcmp(line, "!/*/") == 0)
+		return 0;
+
+	if ((negative = (*line == '!')))
+		line++;
+
+	len = strlen(line);
+
+	if (len < 3 || line[0] != '/' || line[len - 1] != '/')
+		return -1;
+
+	if (negative) {
+		if (len < 5 || line[len - 2] != '*' || line[len - 3] != '/')
+			return -1;
+
+		len -= 2;
+	}
+
+	if (git_str_put(dir, line + 1, len - 2) < 0)
+		return -1;
+
+	git_str_unescape(dir);
+
+	return (dir->size == 0) ? -1 : negative ? 2 : 1;
+}
+
+/* Every ancestor of a directory in the cone is a parent directory */
+static int sparse_checkout_add_ancestors(
+	git_sparse_checkout *sparse,
+	git_strmap *set)
+{
+	const char *dir, *slash;
+	char *value;
+	git_vector dirs = GIT_VECTOR_INIT;
+	size_t i;
+	int error = 0;
+
+	git_strmap_foreach(set, dir, value, {
+		GIT_UNUSED(value);
+
+		if ((error = git_vector_insert(&dirs, (char *)dir)) < 0)
+			goto done;
+	});
+
+	git_vector_foreach(&dirs, i, dir) {
+		for (slash = strchr(dir, '/'); slash; slash = strchr(slash + 1, '/')) {
+			if ((error = sparse_checkout_add(sparse,
+					sparse->parents, dir, slash - dir)) < 0)
+				goto done;
+		}
+	}
+
+done:
+	git_vector_free(&dirs);
+	return error;
+}
+
+static int sparse_checkout_parse(
+	git_sparse_checkout *sparse,
+	const char *contents)
+{
+	git_str line = GIT_STR_INIT, dir = GIT_STR_INIT;
+	const char *scan = contents, *eol;
+	int kind, error = 0;
+
+	while (*scan) {
+		eol = strchr(scan, '\n');
+
+		git_str_clear(&line);
+		git_str_put(&line, scan, eol ? (size_t)(eol - scan) : strlen(scan));
+		git_str_rtrim(&line);
+
+		if (git_str_oom(&line)) {
+			error = -1;
+			goto done;
+		}
+
+		scan = eol ? eol + 1 : scan + strlen(scan);
+
+		if ((kind = sparse_checkout_parse_line(&dir, line.ptr)) < 0) {
+			if (git_str_oom(&dir)) {
+				error = -1;
+				goto done;
+			}
+
+			/* not a cone mode sparse checkout */
+			sparse->enabled = false;
+			goto done;
+		}
+
+		if (kind == 2) {
+			git_strmap_delete(sparse->recursive, dir.ptr);
+			error = sparse_checkout_add(sparse,
+				sparse->parents, dir.ptr, dir.size);
+		} else if (kind == 1 && !git_strmap_exists(sparse->parents, dir.ptr)) {
+			error = sparse_checkout_add(sparse,
+				sparse->recursive, dir.ptr, dir.size);
+		}
+
+		if (error < 0)
+			goto done;
+	}
+
+	if ((error = sparse_checkout_add_ancestors(sparse, sparse->recursive)) < 0 ||
+	    (error = sparse_checkout_add_ancestors(sparse, sparse->parents)) < 0)
+		goto done;
+
+	sparse->buf = git__malloc(sparse->max_len + 1);
+	GIT_ERROR_CHECK_ALLOC(sparse->buf);
+
+done:
+	git_str_dispose(&line);
+	git_str_dispose(&dir);
+	return error;
+}
+
+int git_sparse_checkout_load(
+	git_sparse_checkout *out,
+	git_repository *repo)
+{
+	git_config *cfg;
+	git_str path = GIT_STR_INIT, contents = GIT_STR_INIT;
+	int error;
+
+	GIT_ASSERT_ARG(out);
+	GIT_ASSERT_ARG(repo);
+
+	memset(out, 0, sizeof(git_sparse_checkout));
+
+	if ((error = git_repository_config__weakptr(&cfg, repo)) < 0)
+		return error;
+
+	if (!git_config__get_bool_force(cfg, "core.sparsecheckout", 0) ||
+	    !git_config__get_bool_force(cfg, "core.sparsecheckoutcone", 0))
+		return 0;
+
+	if ((error = git_repository__item_path(&path, repo, GIT_REPOSITORY_ITEM_INFO)) < 0 ||
+	    (error = git_str_joinpath(&path, path.ptr, SPARSE_CHECKOUT_FILE)) < 0)
+		goto done;
+
+	if ((error = git_futils_readbuffer(&contents, path.ptr)) < 0) {
+		/* without patterns, everything is checked out */
+		if (error == GIT_ENOTFOUND) {
+			git_error_clear();
+			error = 0;
+		}
+
+		goto done;
+	}
+
+	out->enabled = true;
+
+	if ((error = git_strmap_new(&out->recursive)) < 0 ||
+	    (error = git_strmap_new(&out->parents)) < 0 ||
+	    (error = git_pool_init(&out->pool, 1)) < 0 ||
+	    (error = sparse_checkout_parse(out, contents.ptr)) < 0)
+		goto done;
+
+done:
+	if (error < 0 || !out->enabled)
+		git_sparse_checkout_dispose(out);
+
+	git_str_dispose(&path);
+	git_str_dispose(&contents);
+	return error;
+}
+
+GIT_INLINE(bool) sparse_checkout_has(
+	git_sparse_checkout *sparse,
+	git_strmap *set,
+	const char *path,
+	size_t path_len)
+{
+	if (path_len > sparse->max_len)
+		return false;
+
+	memcpy(sparse->buf, path, path_len);
+	sparse->buf[path_len] = '\0';
+
+	return git_strmap_exists(set, sparse->buf);
+}
+
+bool git_sparse_checkout_includes_dir(
+	git_sparse_checkout *sparse,
+	const char *path,
+	size_t path_len)
+{
+	size_t i;
+
+	if (!sparse->enabled)
+		return true;
+
+	/* beneath a recursive directory, or a parent directory itself */
+	for (i = 1; i <= path_len; i++) {
+		if ((i == path_len || path[i] == '/') &&
+		    sparse_checkout_has(sparse, sparse->recursive, path, i))
+			return true;
+	}
+
+	return sparse_checkout_has(sparse, sparse->parents, path, path_len);
+}
+
+bool git_sparse_checkout_includes(
+	git_sparse_checkout *sparse,
+	const char *path)
+{
+	const char *slash;
+
+	if (!sparse->enabled || (slash = strrchr(path, '/')) == NULL)
+		return true;
+
+	return git_sparse_checkout_includes_dir(sparse, path, slash - path);
+}
+
+static int sparse_checkout_add_checked_out(
+	git_sparse_checkout *sparse,
+	const char *dir,
+	size_t len)
+{
+	char *buf;
+
+	/* the lookup buffer has to fit the new directory */
+	if (len > sparse->max_len) {
+		buf = git__realloc(sparse->buf, len + 1);
+		GIT_ERROR_CHECK_ALLOC(buf);
+		sparse->buf = buf;
+	}
+
+	return sparse_checkout_add(sparse, sparse->checked_out, dir, len);
+}
+
+int git_sparse_checkout_read_index(
+	git_sparse_checkout *sparse,
+	git_vector *entries)
+{
+	const git_index_entry *entry;
+	const char *slash;
+	size_t i, len;
+	int error;
+
+	if (!sparse->enabled)
+		return 0;
+
+	if (!sparse->checked_out &&
+	    (error = git_strmap_new(&sparse->checked_out)) < 0)
+		return error;
+
+	git_vector_foreach(entries, i, entry) {
+		if ((entry->flags_extended & GIT_INDEX_ENTRY_SKIP_WORKTREE) != 0 ||
+		    git_sparse_checkout_includes(sparse, entry->path))
+			continue;
+
+		/* keep every directory on the way to the file */
+		for (slash = strchr(entry->path, '/'); slash; slash = strchr(slash + 1, '/')) {
+			len = slash - entry->path;
+
+			if (sparse_checkout_has(sparse, sparse->checked_out, entry->path, len))
+				continue;
+
+			if ((error = sparse_checkout_add_checked_out(sparse,
+					entry->path, len)) < 0)
+				return error;
+		}
+	}
+
+	return 0;
+}
+
+bool git_sparse_checkout_prunes_dir(
+	git_sparse_checkout *sparse,
+	const char *path,
+	size_t path_len)
+{
+	if (!sparse->enabled || !sparse->checked_out)
+		return false;
+
+	return !git_sparse_checkout_includes_dir(sparse, path, path_len) &&
+		!sparse_checkout_has(sparse, sparse->checked_out, path, path_len);
+}
+
+void git_sparse_checkout_dispose(git_sparse_checkout *sparse)
+{
+	if (!sparse)
+		return;
+
+	git_strmap_free(sparse->recursive);
+	git_strmap_free(sparse->parents);
+	git_strmap_free(sparse->checked_out);
+	git_pool_clear(&sparse->pool);
+	git__free(sparse->buf);
+
+	memset(sparse, 0, sizeof(git_sparse_checkout));
+}
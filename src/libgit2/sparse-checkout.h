@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#ifndef INCLUDE_sparse_checkout_h__
+#define INCLUDE_sparse_checkout_h__
+
+#include "common.h"
+
+#include "pool.h"
+#include "strmap.h"
+#include "vector.h"
+#include "git2/repository.h"
+
+/*
+ * A sparse checkout in "cone mode" (`core.sparseCheckout` and
+ * `core.sparseCheckoutCone`) only has some directories of the working
+ * tree checked out, as listed in `$GIT_DIR/info/sparse-checkout`.
+ * Besides the two patterns for the root, that file has a line `/a/b/`
+ * for each "recursive" directory, which is checked out with everything
+ * beneath it, and for each "parent" directory, of which only the files
+ * are checked out, a line `/a/` followed by a negated pattern for its
+ * subdirectories.  The files at the root are always checked out.
+ *
+ * Paths outside of the cone have the skip-worktree bit set in the index,
+ * and are neither written by checkout nor walked by status, as long as
+ * they do not have files checked out (eg from before the cone was
+ * enabled) that the index still tracks without that bit.  Sparse
+ * checkouts whose patterns are not all cone patterns are not supported,
+ * and are treated like full checkouts.
+ */
+typedef struct {
+	bool enabled;
+
+	git_strmap *recursive;
+	git_strmap *parents;
+	git_pool pool;
+
+	/*
+	 * Directories outside of the cone that have index entries without
+	 * the skip-worktree bit beneath them; NULL until the index is read.
+	 */
+	git_strmap *checked_out;
+
+	/* for looking up directories that are not NUL-terminated */
+	char *buf;
+	size_t max_len;
+} git_sparse_checkout;
+
+/*
+ * Load the sparse checkout of the repository; it is left disabled if the
+ * repository does not use a cone mode sparse checkout.
+ */
+extern int git_sparse_checkout_load(
+	git_sparse_checkout *out,
+	git_repository *repo);
+
+/*
+ * Whether the directory `path` (of length `path_len`, without a trailing
+ * slash) is in the cone, ie whether it has anything checked out.
+ */
+extern bool git_sparse_checkout_includes_dir(
+	git_sparse_checkout *sparse,
+	const char *path,
+	size_t path_len);
+
+/* Whether the file `path` is in the cone */
+extern bool git_sparse_checkout_includes(
+	git_sparse_checkout *sparse,
+	const char *path);
+
+/*
+ * Read the entries of the index (a vector of `git_index_entry`), to
+ * know which directories outside of the cone still have files checked
+ * out that are tracked without the skip-worktree bit.
+ */
+extern int git_sparse_checkout_read_index(
+	git_sparse_checkout *sparse,
+	git_vector *entries);
+
+/*
+ * Whether the directory `path` (of length `path_len`, without a trailing
+ * slash) can be left out of a walk of the working directory: it is
+ * outside of the cone and everything that the index has beneath it is
+ * skip-worktree.  Nothing is left out until the index has been read.
+ */
+extern bool git_sparse_checkout_prunes_dir(
+	git_sparse_checkout *sparse,
+	const char *path,
+	size_t path_len);
+
+extern void git_sparse_checkout_dispose(git_sparse_checkout *sparse);
+
+#endif
@@ -570,6 +570,12 @@ int git_status_list_get_perfdata(
 	out->stat_calls = 0;
 	out->oid_calculations = 0;
 
+	if (out->version > 1)
+		out->preload_stat_calls = 0;
+
+	if (out->version > 2)
+		out->skipped_stat_calls = 0;
+
 	if (status->head2idx) {
 		out->stat_calls += status->head2idx->perf.stat_calls;
 		out->oid_calculations += status->head2idx->perf.oid_calculations;
@@ -577,6 +583,12 @@ int git_status_list_get_perfdata(
 	if (status->idx2wd) {
 		out->stat_calls += status->idx2wd->perf.stat_calls;
 		out->oid_calculations += status->idx2wd->perf.oid_calculations;
+
+		if (out->version > 1)
+			out->preload_stat_calls += status->idx2wd->perf.preload_stat_calls;
+
+		if (out->version > 2)
+			out->skipped_stat_calls += status->idx2wd->perf.skipped_stat_calls;
 	}
 
 	return 0;
@@ -0,0 +1,720 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "untracked-cache.h"
+
+#include "ewah.h"
+#include "index.h"
+#include "oid.h"
+#include "varint.h"
+
+#ifndef GIT_WIN32
+# include <sys/utsname.h>
+#endif
+
+/* git's `dir_struct` flags that describe what is cached */
+#define DIR_SHOW_OTHER_DIRECTORIES (1 << 1)
+#define DIR_SHOW_IGNORED_TOO       (1 << 5)
+
+/* every name that is not in the index, ignored or not */
+#define UNTRACKED_CACHE_FLAGS \
+	(DIR_SHOW_OTHER_DIRECTORIES | DIR_SHOW_IGNORED_TOO)
+
+#define UNTRACKED_CACHE_STAT_SIZE 36
+#define UNTRACKED_CACHE_MAX_DEPTH 4096
+
+static int dir_cmp(const void *a, const void *b)
+{
+	const git_untracked_cache_dir *x = a, *y = b;
+	return strcmp(x->name, y->name);
+}
+
+static void dir_clear_untracked(git_untracked_cache_dir *dir)
+{
+	char *name;
+	size_t i;
+
+	git_vector_foreach(&dir->untracked, i, name)
+		git__free(name);
+
+	git_vector_clear(&dir->untracked);
+}
+
+static void dir_free(git_untracked_cache_dir *dir)
+{
+	git_untracked_cache_dir *child;
+	size_t i;
+
+	if (!dir)
+		return;
+
+	git_vector_foreach(&dir->dirs, i, child)
+		dir_free(child);
+
+	dir_clear_untracked(dir);
+	git_vector_free(&dir->untracked);
+	git_vector_free(&dir->dirs);
+	git__free(dir);
+}
+
+static git_untracked_cache_dir *dir_alloc(const char *name, size_t name_len)
+{
+	git_untracked_cache_dir *dir;
+	size_t alloc_size;
+
+	if (GIT_ADD_SIZET_OVERFLOW(&alloc_size, sizeof(*dir), name_len) ||
+	    GIT_ADD_SIZET_OVERFLOW(&alloc_size, alloc_size, 1) ||
+	    (dir = git__calloc(1, alloc_size)) == NULL)
+		return NULL;
+
+	memcpy(dir->name, name, name_len);
+
+	if (git_vector_init(&dir->untracked, 0, git__strcmp_cb) < 0 ||
+	    git_vector_init(&dir->dirs, 0, dir_cmp) < 0) {
+		dir_free(dir);
+		return NULL;
+	}
+
+	return dir;
+}
+
+static void dir_invalidate(git_untracked_cache_dir *dir)
+{
+	dir->valid = 0;
+	dir->check_only = 0;
+	dir_clear_untracked(dir);
+}
+
+static git_untracked_cache_dir *dir_find(
+	git_untracked_cache_dir *dir, const char *name, size_t name_len)
+{
+	git_untracked_cache_dir *child;
+	size_t lo = 0, hi = dir->dirs.length, mid;
+	int cmp;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		child = git_vector_get(&dir->dirs, mid);
+
+		if ((cmp = strncmp(child->name, name, name_len)) == 0)
+			cmp = child->name[name_len] ? 1 : 0;
+
+		if (!cmp)
+			return child;
+		else if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return NULL;
+}
+
+/* Find the directory `path` ("" or "a/b/"), creating it if asked to */
+static git_untracked_cache_dir *dir_lookup(
+	git_untracked_cache *uc, const char *path, bool create)
+{
+	git_untracked_cache_dir *dir, *child;
+	const char *end;
+
+	if (!uc->root) {
+		if (!create || (uc->root = dir_alloc("", 0)) == NULL)
+			return NULL;
+	}
+
+	for (dir = uc->root; *path; dir = child) {
+		if ((end = strchr(path, '/')) == NULL)
+			end = path + strlen(path);
+
+		if ((child = dir_find(dir, path, end - path)) == NULL) {
+			if (!create ||
+			    (child = dir_alloc(path, end - path)) == NULL)
+				return NULL;
+
+			if (git_vector_insert_sorted(&dir->dirs, child, NULL) < 0) {
+				dir_free(child);
+				return NULL;
+			}
+		}
+
+		path = *end ? end + 1 : end;
+	}
+
+	return dir;
+}
+
+static void stat_from_struct(git_untracked_cache_stat *out, const struct stat *st)
+{
+	out->ctime.seconds = (int32_t)st->st_ctime;
+	out->mtime.seconds = (int32_t)st->st_mtime;
+#if defined(GIT_USE_NSEC)
+	out->ctime.nanoseconds = st->st_ctime_nsec;
+	out->mtime.nanoseconds = st->st_mtime_nsec;
+#else
+	out->ctime.nanoseconds = 0;
+	out->mtime.nanoseconds = 0;
+#endif
+	out->dev = (uint32_t)st->st_dev;
+	out->ino = (uint32_t)st->st_ino;
+	out->uid = (uint32_t)st->st_uid;
+	out->gid = (uint32_t)st->st_gid;
+	out->size = (uint32_t)st->st_size;
+}
+
+static bool stat_matches(
+	const git_untracked_cache_stat *cached,
+	const git_untracked_cache_stat *current,
+	bool trust_ctime)
+{
+	return git_index_time_eq(&cached->mtime, &current->mtime) &&
+	       (!trust_ctime || git_index_time_eq(&cached->ctime, &current->ctime)) &&
+	       cached->ino == current->ino &&
+	       cached->size == current->size;
+}
+
+static int stat_write(git_str *out, const git_untracked_cache_stat *st)
+{
+	uint32_t data[UNTRACKED_CACHE_STAT_SIZE / 4];
+
+	data[0] = htonl((uint32_t)st->ctime.seconds);
+	data[1] = htonl(st->ctime.nanoseconds);
+	data[2] = htonl((uint32_t)st->mtime.seconds);
+	data[3] = htonl(st->mtime.nanoseconds);
+	data[4] = htonl(st->dev);
+	data[5] = htonl(st->ino);
+	data[6] = htonl(st->uid);
+	data[7] = htonl(st->gid);
+	data[8] = htonl(st->size);
+
+	return git_str_put(out, (const char *)data, sizeof(data));
+}
+
+static void stat_read(git_untracked_cache_stat *st, const char *buffer)
+{
+	uint32_t data[UNTRACKED_CACHE_STAT_SIZE / 4];
+
+	memcpy(data, buffer, sizeof(data));
+
+	st->ctime.seconds = (int32_t)ntohl(data[0]);
+	st->ctime.nanoseconds = ntohl(data[1]);
+	st->mtime.seconds = (int32_t)ntohl(data[2]);
+	st->mtime.nanoseconds = ntohl(data[3]);
+	st->dev = ntohl(data[4]);
+	st->ino = ntohl(data[5]);
+	st->uid = ntohl(data[6]);
+	st->gid = ntohl(data[7]);
+	st->size = ntohl(data[8]);
+}
+
+/* git's "Location <worktree>, system <sysname>" */
+static int ident_for(git_str *out, const char *workdir)
+{
+	const char *sysname;
+	size_t len = strlen(workdir);
+#ifndef GIT_WIN32
+	struct utsname uts;
+
+	if (uname(&uts) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to get the system name");
+		return -1;
+	}
+
+	sysname = uts.sysname;
+#else
+	sysname = "Windows";
+#endif
+
+	while (len > 1 && workdir[len - 1] == '/')
+		len--;
+
+	git_str_puts(out, "Location ");
+	git_str_put(out, workdir, len);
+	git_str_printf(out, ", system %s", sysname);
+	git_str_putc(out, '\0');
+
+	return git_str_oom(out) ? -1 : 0;
+}
+
+int git_untracked_cache_new(
+	git_untracked_cache **out,
+	const char *workdir,
+	git_oid_t oid_type)
+{
+	git_untracked_cache *uc;
+
+	uc = git__calloc(1, sizeof(git_untracked_cache));
+	GIT_ERROR_CHECK_ALLOC(uc);
+
+	uc->oid_type = oid_type;
+	uc->dir_flags = UNTRACKED_CACHE_FLAGS;
+
+	git_oid_clear(&uc->info_exclude_id, oid_type);
+	git_oid_clear(&uc->excludes_file_id, oid_type);
+
+	if (ident_for(&uc->ident, workdir) < 0 ||
+	    (uc->exclude_per_dir = git__strdup(".gitignore")) == NULL) {
+		git_untracked_cache_free(uc);
+		return -1;
+	}
+
+	*out = uc;
+	return 0;
+}
+
+void git_untracked_cache_free(git_untracked_cache *uc)
+{
+	if (!uc)
+		return;
+
+	dir_free(uc->root);
+	git_str_dispose(&uc->ident);
+	git__free(uc->exclude_per_dir);
+	git__free(uc);
+}
+
+bool git_untracked_cache_is_ours(
+	const git_untracked_cache *uc,
+	const char *workdir)
+{
+	git_str ident = GIT_STR_INIT;
+	bool ours;
+
+	if (uc->dir_flags != UNTRACKED_CACHE_FLAGS || ident_for(&ident, workdir) < 0)
+		return false;
+
+	ours = (ident.size == uc->ident.size &&
+	        memcmp(ident.ptr, uc->ident.ptr, ident.size) == 0);
+
+	git_str_dispose(&ident);
+	return ours;
+}
+
+void git_untracked_cache_invalidate_path(
+	git_untracked_cache *uc,
+	const char *path)
+{
+	git_untracked_cache_dir *dir;
+	const char *end;
+
+	if (!uc)
+		return;
+
+	for (dir = uc->root; dir; path = end + 1) {
+		dir_invalidate(dir);
+
+		if ((end = strchr(path, '/')) == NULL)
+			break;
+
+		dir = dir_find(dir, path, end - path);
+	}
+}
+
+const git_vector *git_untracked_cache_lookup(
+	git_untracked_cache *uc,
+	const char *path,
+	const struct stat *st,
+	bool trust_ctime)
+{
+	git_untracked_cache_dir *dir;
+	git_untracked_cache_stat current;
+
+	if ((dir = dir_lookup(uc, path, false)) == NULL || !dir->valid)
+		return NULL;
+
+	stat_from_struct(&current, st);
+
+	return stat_matches(&dir->st, &current, trust_ctime) ?
+		&dir->untracked : NULL;
+}
+
+int git_untracked_cache_update(
+	git_untracked_cache *uc,
+	const char *path,
+	const struct stat *st,
+	const git_vector *untracked)
+{
+	git_untracked_cache_dir *dir;
+	const char *name;
+	char *copy;
+	size_t i;
+
+	if ((dir = dir_lookup(uc, path, true)) == NULL)
+		return -1;
+
+	dir_invalidate(dir);
+
+	/*
+	 * A directory that was changed in the second that it was read in
+	 * can change again without its mtime changing; don't trust it.
+	 */
+	if ((int64_t)st->st_mtime >= (int64_t)time(NULL))
+		return 1;
+
+	git_vector_foreach(untracked, i, name) {
+		if ((copy = git__strdup(name)) == NULL ||
+		    git_vector_insert(&dir->untracked, copy) < 0) {
+			git__free(copy);
+			dir_invalidate(dir);
+			return -1;
+		}
+	}
+
+	git_vector_sort(&dir->untracked);
+
+	stat_from_struct(&dir->st, st);
+	dir->valid = 1;
+
+	return 1;
+}
+
+struct read_data {
+	const char *ptr;
+	const char *end;
+	git_vector dirs; /* in the order they are stored in */
+};
+
+static int read_varint(size_t *out, struct read_data *rd)
+{
+	uintmax_t value;
+	size_t len;
+
+	if (rd->ptr >= rd->end)
+		return -1;
+
+	value = git_decode_varint((const unsigned char *)rd->ptr, &len);
+
+	if (!len || value > SIZE_MAX || len > (size_t)(rd->end - rd->ptr))
+		return -1;
+
+	rd->ptr += len;
+	*out = (size_t)value;
+	return 0;
+}
+
+static int read_string(const char **out, size_t *out_len, struct read_data *rd)
+{
+	const char *eos;
+
+	if ((eos = memchr(rd->ptr, '\0', rd->end - rd->ptr)) == NULL)
+		return -1;
+
+	*out = rd->ptr;
+	*out_len = eos - rd->ptr;
+	rd->ptr = eos + 1;
+	return 0;
+}
+
+static int read_dir(
+	git_untracked_cache_dir **out,
+	struct read_data *rd,
+	size_t depth)
+{
+	git_untracked_cache_dir *dir, *child;
+	size_t untracked_nr, dirs_nr, len, i;
+	const char *str;
+	char *name;
+
+	if (depth > UNTRACKED_CACHE_MAX_DEPTH ||
+	    read_varint(&untracked_nr, rd) < 0 ||
+	    read_varint(&dirs_nr, rd) < 0 ||
+	    read_string(&str, &len, rd) < 0 ||
+	    (dir = dir_alloc(str, len)) == NULL)
+		return -1;
+
+	if (git_vector_insert(&rd->dirs, dir) < 0)
+		goto on_error;
+
+	for (i = 0; i < untracked_nr; i++) {
+		if (read_string(&str, &len, rd) < 0 ||
+		    (name = git__strndup(str, len)) == NULL)
+			goto on_error;
+
+		if (git_vector_insert(&dir->untracked, name) < 0) {
+			git__free(name);
+			goto on_error;
+		}
+	}
+
+	for (i = 0; i < dirs_nr; i++) {
+		if (read_dir(&child, rd, depth + 1) < 0)
+			goto on_error;
+
+		if (git_vector_insert(&dir->dirs, child) < 0) {
+			dir_free(child);
+			goto on_error;
+		}
+	}
+
+	git_vector_sort(&dir->dirs);
+
+	*out = dir;
+	return 0;
+
+on_error:
+	dir_free(dir);
+	return -1;
+}
+
+static int read_bitmap(git_bitmap *out, struct read_data *rd)
+{
+	size_t len;
+
+	if (git_ewah_size(&len, (const unsigned char *)rd->ptr, rd->end - rd->ptr) < 0 ||
+	    git_ewah_xor(out, (const unsigned char *)rd->ptr, len) < 0)
+		return -1;
+
+	rd->ptr += len;
+	return 0;
+}
+
+static int read_cache(
+	git_untracked_cache *uc,
+	struct read_data *rd)
+{
+	git_bitmap valid = GIT_BITMAP_INIT, check_only = GIT_BITMAP_INIT,
+		id_valid = GIT_BITMAP_INIT;
+	git_untracked_cache_dir *dir;
+	size_t oid_size = git_oid_size(uc->oid_type), len, dirs_nr, pos;
+	const char *str;
+	uint32_t flags;
+	int error = -1;
+
+	if (read_varint(&len, rd) < 0 ||
+	    len > (size_t)(rd->end - rd->ptr) ||
+	    git_str_put(&uc->ident, rd->ptr, len) < 0)
+		return -1;
+
+	rd->ptr += len;
+
+	if ((size_t)(rd->end - rd->ptr) < UNTRACKED_CACHE_STAT_SIZE * 2 + 4 + oid_size * 2)
+		return -1;
+
+	stat_read(&uc->info_exclude_st, rd->ptr);
+	stat_read(&uc->excludes_file_st, rd->ptr + UNTRACKED_CACHE_STAT_SIZE);
+	rd->ptr += UNTRACKED_CACHE_STAT_SIZE * 2;
+
+	memcpy(&flags, rd->ptr, 4);
+	uc->dir_flags = ntohl(flags);
+	rd->ptr += 4;
+
+	git_oid__fromraw(&uc->info_exclude_id, (const unsigned char *)rd->ptr, uc->oid_type);
+	git_oid__fromraw(&uc->excludes_file_id, (const unsigned char *)rd->ptr + oid_size, uc->oid_type);
+	rd->ptr += oid_size * 2;
+
+	if (read_string(&str, &len, rd) < 0 ||
+	    (uc->exclude_per_dir = git__strndup(str, len)) == NULL)
+		return -1;
+
+	if (read_varint(&dirs_nr, rd) < 0)
+		return -1;
+
+	if (!dirs_nr)
+		return 0;
+
+	if (read_dir(&uc->root, rd, 0) < 0 || rd->dirs.length != dirs_nr)
+		goto done;
+
+	if (read_bitmap(&valid, rd) < 0 ||
+	    read_bitmap(&check_only, rd) < 0 ||
+	    read_bitmap(&id_valid, rd) < 0)
+		goto done;
+
+	for (pos = 0; git_bitmap_next(&pos, &check_only); pos++) {
+		if ((dir = git_vector_get(&rd->dirs, pos)) == NULL)
+			goto done;
+
+		dir->check_only = 1;
+	}
+
+	for (pos = 0; git_bitmap_next(&pos, &valid); pos++) {
+		if ((dir = git_vector_get(&rd->dirs, pos)) == NULL ||
+		    (size_t)(rd->end - rd->ptr) < UNTRACKED_CACHE_STAT_SIZE)
+			goto done;
+
+		stat_read(&dir->st, rd->ptr);
+		dir->valid = 1;
+		rd->ptr += UNTRACKED_CACHE_STAT_SIZE;
+	}
+
+	for (pos = 0; git_bitmap_next(&pos, &id_valid); pos++) {
+		if ((dir = git_vector_get(&rd->dirs, pos)) == NULL ||
+		    (size_t)(rd->end - rd->ptr) < oid_size)
+			goto done;
+
+		git_oid__fromraw(&dir->exclude_id, (const unsigned char *)rd->ptr, uc->oid_type);
+		rd->ptr += oid_size;
+	}
+
+	error = 0;
+
+done:
+	git_bitmap_dispose(&valid);
+	git_bitmap_dispose(&check_only);
+	git_bitmap_dispose(&id_valid);
+	return error;
+}
+
+int git_untracked_cache_read(
+	git_untracked_cache **out,
+	const char *buffer,
+	size_t buffer_size,
+	git_oid_t oid_type)
+{
+	git_untracked_cache *uc;
+	struct read_data rd = { 0 };
+	int error = -1;
+
+	*out = NULL;
+
+	uc = git__calloc(1, sizeof(git_untracked_cache));
+	GIT_ERROR_CHECK_ALLOC(uc);
+
+	uc->oid_type = oid_type;
+
+	if (git_vector_init(&rd.dirs, 16, NULL) < 0)
+		goto done;
+
+	/* the extension ends with a NUL, which keeps varints from running over */
+	if (!buffer_size || buffer[buffer_size - 1] != '\0')
+		goto done;
+
+	rd.ptr = buffer;
+	rd.end = buffer + buffer_size - 1;
+
+	if (read_cache(uc, &rd) < 0 || rd.ptr != rd.end)
+		goto done;
+
+	*out = uc;
+	error = 0;
+
+done:
+	if (error < 0) {
+		git_error_set(GIT_ERROR_INDEX, "invalid untracked cache extension");
+		git_untracked_cache_free(uc);
+	}
+
+	git_vector_free(&rd.dirs);
+	return error;
+}
+
+struct write_data {
+	size_t oid_size;
+	size_t index;
+	git_str dirs;
+	git_str stats;
+	git_str ids;
+	git_bitmap valid;
+	git_bitmap check_only;
+	git_bitmap id_valid;
+};
+
+static int put_varint(git_str *out, size_t value)
+{
+	unsigned char buf[16];
+	int len;
+
+	if ((len = git_encode_varint(buf, sizeof(buf), value)) < 0)
+		return -1;
+
+	return git_str_put(out, (const char *)buf, len);
+}
+
+/* Like git, size the bitmaps to their last set bit */
+static int write_bitmap(git_str *out, git_bitmap *bitmap)
+{
+	size_t pos = 0, bits = 0;
+
+	for (; git_bitmap_next(&pos, bitmap); pos++)
+		bits = pos + 1;
+
+	return git_ewah_write(out, bitmap, bits);
+}
+
+static int write_dir(struct write_data *wd, git_untracked_cache_dir *dir)
+{
+	git_untracked_cache_dir *child;
+	const char *name;
+	size_t pos = wd->index++, i;
+	int error;
+
+	if (dir->valid &&
+	    ((error = git_bitmap_set(&wd->valid, pos)) < 0 ||
+	     (error = stat_write(&wd->stats, &dir->st)) < 0))
+		return error;
+
+	if (dir->check_only &&
+	    (error = git_bitmap_set(&wd->check_only, pos)) < 0)
+		return error;
+
+	if (!git_oid_is_zero(&dir->exclude_id)) {
+		if ((error = git_bitmap_set(&wd->id_valid, pos)) < 0 ||
+		    (error = git_str_put(&wd->ids, (const char *)dir->exclude_id.id, wd->oid_size)) < 0)
+			return error;
+	}
+
+	if ((error = put_varint(&wd->dirs, dir->untracked.length)) < 0 ||
+	    (error = put_varint(&wd->dirs, dir->dirs.length)) < 0 ||
+	    (error = git_str_put(&wd->dirs, dir->name, strlen(dir->name) + 1)) < 0)
+		return error;
+
+	git_vector_foreach(&dir->untracked, i, name) {
+		if ((error = git_str_put(&wd->dirs, name, strlen(name) + 1)) < 0)
+			return error;
+	}
+
+	git_vector_foreach(&dir->dirs, i, child) {
+		if ((error = write_dir(wd, child)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+int git_untracked_cache_write(git_str *out, git_untracked_cache *uc)
+{
+	struct write_data wd = { 0 };
+	size_t oid_size = git_oid_size(uc->oid_type);
+	uint32_t flags = htonl(uc->dir_flags);
+	int error;
+
+	if ((error = put_varint(out, uc->ident.size)) < 0 ||
+	    (error = git_str_put(out, uc->ident.ptr, uc->ident.size)) < 0 ||
+	    (error = stat_write(out, &uc->info_exclude_st)) < 0 ||
+	    (error = stat_write(out, &uc->excludes_file_st)) < 0 ||
+	    (error = git_str_put(out, (const char *)&flags, 4)) < 0 ||
+	    (error = git_str_put(out, (const char *)uc->info_exclude_id.id, oid_size)) < 0 ||
+	    (error = git_str_put(out, (const char *)uc->excludes_file_id.id, oid_size)) < 0 ||
+	    (error = git_str_put(out, uc->exclude_per_dir, strlen(uc->exclude_per_dir) + 1)) < 0)
+		return error;
+
+	/* without directories, the count doubles as the closing NUL */
+	if (!uc->root)
+		return put_varint(out, 0);
+
+	wd.oid_size = oid_size;
+
+	if ((error = write_dir(&wd, uc->root)) < 0 ||
+	    (error = put_varint(out, wd.index)) < 0 ||
+	    (error = git_str_put(out, wd.dirs.ptr, wd.dirs.size)) < 0 ||
+	    (error = write_bitmap(out, &wd.valid)) < 0 ||
+	    (error = write_bitmap(out, &wd.check_only)) < 0 ||
+	    (error = write_bitmap(out, &wd.id_valid)) < 0 ||
+	    (error = git_str_put(out, wd.stats.ptr, wd.stats.size)) < 0 ||
+	    (error = git_str_put(out, wd.ids.ptr, wd.ids.size)) < 0)
+		goto done;
+
+	error = git_str_putc(out, '\0');
+
+done:
+	git_str_dispose(&wd.dirs);
+	git_str_dispose(&wd.stats);
+	git_str_dispose(&wd.ids);
+	git_bitmap_dispose(&wd.valid);
+	git_bitmap_dispose(&wd.check_only);
+	git_bitmap_dispose(&wd.id_valid);
+	return error;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#ifndef INCLUDE_untracked_cache_h__
+#define INCLUDE_untracked_cache_h__
+
+#include "common.h"
+
+#include "str.h"
+#include "vector.h"
+#include "git2/index.h"
+#include "git2/oid.h"
+
+/*
+ * The untracked cache (the "UNTR" index extension) remembers, for each
+ * directory of the working tree, the names in it that are not in the
+ * index, along with the directory's stat data.  While a directory's
+ * stat data is unchanged, no entries were added to or removed from it,
+ * so its listing is the names in the index plus the cached ones, and
+ * it does not have to be read again.
+ *
+ * The on-disk format is git's.  The entries that git caches depend on
+ * its ignore rules, while the ones cached here are every name that is
+ * not in the index, ignored or not; the two are told apart by the
+ * cache's flags, and git rebuilds a cache that was written with other
+ * flags than its own (and vice versa).
+ */
+
+/* The stat data of a directory or ignore file, as git stores it */
+typedef struct {
+	git_index_time ctime;
+	git_index_time mtime;
+	uint32_t dev;
+	uint32_t ino;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t size;
+} git_untracked_cache_stat;
+
+typedef struct git_untracked_cache_dir {
+	git_untracked_cache_stat st;
+	git_oid exclude_id; /* of the directory's ignore file, if known */
+
+	unsigned int valid:1, /* the untracked names and stat data are known */
+	             check_only:1;
+
+	git_vector untracked; /* names; git suffixes directories with '/' */
+	git_vector dirs; /* of git_untracked_cache_dir, sorted by name */
+
+	char name[GIT_FLEX_ARRAY];
+} git_untracked_cache_dir;
+
+typedef struct {
+	git_oid_t oid_type;
+
+	git_str ident; /* where the cache may be used */
+	uint32_t dir_flags;
+
+	git_untracked_cache_stat info_exclude_st;
+	git_untracked_cache_stat excludes_file_st;
+	git_oid info_exclude_id;
+	git_oid excludes_file_id;
+	char *exclude_per_dir;
+
+	git_untracked_cache_dir *root;
+} git_untracked_cache;
+
+/* Create an empty cache for the given working directory */
+int git_untracked_cache_new(
+	git_untracked_cache **out,
+	const char *workdir,
+	git_oid_t oid_type);
+
+int git_untracked_cache_read(
+	git_untracked_cache **out,
+	const char *buffer,
+	size_t buffer_size,
+	git_oid_t oid_type);
+
+int git_untracked_cache_write(git_str *out, git_untracked_cache *uc);
+
+void git_untracked_cache_free(git_untracked_cache *uc);
+
+/*
+ * Whether the cache was built by us for the given working directory,
+ * rather than by git (or for the working directory before it moved).
+ */
+bool git_untracked_cache_is_ours(
+	const git_untracked_cache *uc,
+	const char *workdir);
+
+/*
+ * Forget the listings of the directories that lead to `path`, after it
+ * was added to or removed from the index.
+ */
+void git_untracked_cache_invalidate_path(
+	git_untracked_cache *uc,
+	const char *path);
+
+/*
+ * Look up the names cached for the directory `path` (empty for the
+ * root, otherwise with a trailing slash).  Returns NULL unless they
+ * were recorded with the given stat data.
+ */
+const git_vector *git_untracked_cache_lookup(
+	git_untracked_cache *uc,
+	const char *path,
+	const struct stat *st,
+	bool trust_ctime);
+
+/*
+ * Record the names in the directory `path` that are not in the index,
+ * read after it had the given stat data.  Returns 1 if the cache was
+ * changed, 0 if it was not.
+ */
+int git_untracked_cache_update(
+	git_untracked_cache *uc,
+	const char *path,
+	const struct stat *st,
+	const git_vector *untracked);
+
+#endif
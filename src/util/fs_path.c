@@ -1343,6 +1343,17 @@ int git_fs_path_diriter_fullpath(
 	return 0;
 }
 
+unsigned int git_fs_path_diriter_type(git_fs_path_diriter *diriter)
+{
+	DWORD attrs = diriter->current.dwFileAttributes;
+
+	/* reparse points may be symlinks or junctions; let lstat decide */
+	if (attrs & FILE_ATTRIBUTE_REPARSE_POINT)
+		return 0;
+
+	return (attrs & FILE_ATTRIBUTE_DIRECTORY) ? S_IFDIR : S_IFREG;
+}
+
 int git_fs_path_diriter_stat(struct stat *out, git_fs_path_diriter *diriter)
 {
 	GIT_ASSERT_ARG(out);
@@ -1432,6 +1443,22 @@ int git_fs_path_diriter_next(git_fs_path_diriter *diriter)
 	filename = de->d_name;
 	filename_len = strlen(filename);
 
+#ifdef DT_UNKNOWN
+	switch (de->d_type) {
+	case DT_DIR:
+		diriter->type = S_IFDIR;
+		break;
+	case DT_REG:
+		diriter->type = S_IFREG;
+		break;
+	case DT_LNK:
+		diriter->type = S_IFLNK;
+		break;
+	default:
+		diriter->type = 0;
+	}
+#endif
+
 #ifdef GIT_USE_ICONV
 	if ((diriter->flags & GIT_FS_PATH_DIR_PRECOMPOSE_UNICODE) != 0 &&
 		(error = git_fs_path_iconv(&diriter->ic, &filename, &filename_len)) < 0)
@@ -1481,6 +1508,11 @@ int git_fs_path_diriter_fullpath(
 	return 0;
 }
 
+unsigned int git_fs_path_diriter_type(git_fs_path_diriter *diriter)
+{
+	return diriter->type;
+}
+
 int git_fs_path_diriter_stat(struct stat *out, git_fs_path_diriter *diriter)
 {
 	GIT_ASSERT_ARG(out);
@@ -508,6 +508,7 @@ struct git_fs_path_diriter
 	size_t parent_len;
 
 	unsigned int flags;
+	unsigned int type;
 
 	DIR *dir;
 
@@ -570,6 +571,16 @@ extern int git_fs_path_diriter_fullpath(
 	size_t *out_len,
 	git_fs_path_diriter *diriter);
 
+/**
+ * Returns the type of the current item in the iterator, as the
+ * directory told it: `S_IFDIR`, `S_IFREG` or `S_IFLNK`, or 0 when it
+ * is something else or is not known without an `lstat`.
+ *
+ * @param diriter The directory iterator
+ * @return the type of the current item or 0
+ */
+extern unsigned int git_fs_path_diriter_type(git_fs_path_diriter *diriter);
+
 /**
  * Performs an `lstat` on the current item in the iterator.
  *
@@ -158,6 +158,26 @@ GIT_INLINE(int) git_atomic32_get(git_atomic32 *a)
 #endif
 }
 
+/*
+ * Atomically sets the contents of *a to newval if they are oldval.
+ * @return the contents of *a before the operation.
+ */
+GIT_INLINE(int) git_atomic32_compare_and_swap(
+	git_atomic32 *a, int oldval, int newval)
+{
+#if defined(GIT_WIN32)
+	return (int)InterlockedCompareExchange(&a->val, (LONG)newval, (LONG)oldval);
+#elif defined(GIT_BUILTIN_ATOMIC)
+	int foundval = oldval;
+	__atomic_compare_exchange_n(&a->val, &foundval, newval, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return foundval;
+#elif defined(GIT_BUILTIN_SYNC)
+	return __sync_val_compare_and_swap(&a->val, oldval, newval);
+#else
+#	error "Unsupported architecture for atomic operations"
+#endif
+}
+
 GIT_INLINE(void *) git_atomic__compare_and_swap(
 	void * volatile *ptr, void *oldval, void *newval)
 {
@@ -320,6 +340,15 @@ GIT_INLINE(int) git_atomic32_get(git_atomic32 *a)
 	return (int)a->val;
 }
 
+GIT_INLINE(int) git_atomic32_compare_and_swap(
+	git_atomic32 *a, int oldval, int newval)
+{
+	int foundval = a->val;
+	if (foundval == oldval)
+		a->val = newval;
+	return foundval;
+}
+
 GIT_INLINE(void *) git_atomic__compare_and_swap(
 	void * volatile *ptr, void *oldval, void *newval)
 {
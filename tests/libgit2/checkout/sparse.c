@@ -0,0 +1,365 @@
+#include "clar_libgit2.h"
+
+#include "git2/checkout.h"
+#include "repository.h"
+#include "futils.h"
+#include "sparse-checkout.h"
+
+static git_repository *g_repo;
+
+static const char *cone =
+	"/*\n"
+	"!/*/\n"
+	"/ab/\n"
+	"!/ab/*/\n"
+	"/ab/de/\n";
+
+void test_checkout_sparse__initialize(void)
+{
+	git_index *index;
+	git_object *head;
+
+	g_repo = cl_git_sandbox_init("testrepo");
+
+	/* start from an index that matches HEAD */
+	cl_git_pass(git_revparse_single(&head, g_repo, "HEAD^{tree}"));
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_read_tree(index, (git_tree *)head));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+	git_object_free(head);
+
+	cl_repo_set_bool(g_repo, "core.sparseCheckout", true);
+	cl_repo_set_bool(g_repo, "core.sparseCheckoutCone", true);
+
+	cl_must_pass(p_mkdir("testrepo/.git/info", 0777));
+	cl_git_mkfile("testrepo/.git/info/sparse-checkout", cone);
+}
+
+void test_checkout_sparse__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+static int try_checkout_branch(const char *name, unsigned int strategy)
+{
+	git_checkout_options opts = GIT_CHECKOUT_OPTIONS_INIT;
+	git_str refname = GIT_STR_INIT;
+	git_object *obj;
+	int error;
+
+	opts.checkout_strategy = strategy;
+
+	cl_git_pass(git_str_printf(&refname, "refs/heads/%s", name));
+	cl_git_pass(git_revparse_single(&obj, g_repo, refname.ptr));
+
+	if ((error = git_checkout_tree(g_repo, obj, &opts)) == 0)
+		cl_git_pass(git_repository_set_head(g_repo, refname.ptr));
+
+	git_object_free(obj);
+	git_str_dispose(&refname);
+	return error;
+}
+
+static void checkout_branch(const char *name)
+{
+	cl_git_pass(try_checkout_branch(name, GIT_CHECKOUT_FORCE));
+}
+
+static bool skips_worktree(const char *path)
+{
+	git_index *index;
+	const git_index_entry *entry;
+
+	cl_git_pass(git_repository_index__weakptr(&index, g_repo));
+	cl_assert((entry = git_index_get_bypath(index, path, 0)) != NULL);
+
+	return (entry->flags_extended & GIT_INDEX_ENTRY_SKIP_WORKTREE) != 0;
+}
+
+void test_checkout_sparse__cone_patterns(void)
+{
+	git_sparse_checkout sparse;
+
+	cl_git_pass(git_sparse_checkout_load(&sparse, g_repo));
+	cl_assert(sparse.enabled);
+
+	cl_assert(git_sparse_checkout_includes(&sparse, "README"));
+	cl_assert(git_sparse_checkout_includes(&sparse, "ab/4.txt"));
+	cl_assert(git_sparse_checkout_includes(&sparse, "ab/de/2.txt"));
+	cl_assert(git_sparse_checkout_includes(&sparse, "ab/de/fgh/1.txt"));
+	cl_assert(!git_sparse_checkout_includes(&sparse, "ab/c/3.txt"));
+	cl_assert(!git_sparse_checkout_includes(&sparse, "a/b.txt"));
+	cl_assert(!git_sparse_checkout_includes(&sparse, "abc/file"));
+
+	cl_assert(git_sparse_checkout_includes_dir(&sparse, "ab", 2));
+	cl_assert(git_sparse_checkout_includes_dir(&sparse, "ab/de/fgh", 9));
+	cl_assert(!git_sparse_checkout_includes_dir(&sparse, "ab/c", 4));
+	cl_assert(!git_sparse_checkout_includes_dir(&sparse, "ab/dex", 6));
+
+	git_sparse_checkout_dispose(&sparse);
+}
+
+void test_checkout_sparse__only_the_cone_is_checked_out(void)
+{
+	checkout_branch("subtrees");
+
+	cl_assert(git_fs_path_isfile("testrepo/README"));
+	cl_assert(git_fs_path_isfile("testrepo/ab/4.txt"));
+	cl_assert(git_fs_path_isfile("testrepo/ab/de/2.txt"));
+	cl_assert(git_fs_path_isfile("testrepo/ab/de/fgh/1.txt"));
+	cl_assert(!git_fs_path_exists("testrepo/ab/c"));
+
+	cl_assert(!skips_worktree("ab/4.txt"));
+	cl_assert(!skips_worktree("ab/de/fgh/1.txt"));
+	cl_assert(skips_worktree("ab/c/3.txt"));
+}
+
+void test_checkout_sparse__status_does_not_walk_outside_of_the_cone(void)
+{
+	git_status_list *status;
+	git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+
+	opts.flags = GIT_STATUS_OPT_DEFAULTS;
+
+	checkout_branch("subtrees");
+
+	/* neither the missing files nor untracked ones are reported */
+	cl_must_pass(p_mkdir("testrepo/ab/c", 0777));
+	cl_git_mkfile("testrepo/ab/c/untracked", "untracked\n");
+
+	cl_git_pass(git_status_list_new(&status, g_repo, &opts));
+	cl_assert_equal_sz(0, git_status_list_entrycount(status));
+	git_status_list_free(status);
+
+	cl_git_mkfile("testrepo/ab/de/untracked", "untracked\n");
+
+	cl_git_pass(git_status_list_new(&status, g_repo, &opts));
+	cl_assert_equal_sz(1, git_status_list_entrycount(status));
+	cl_assert_equal_s("ab/de/untracked",
+		git_status_byindex(status, 0)->index_to_workdir->new_file.path);
+	git_status_list_free(status);
+}
+
+/* Check out everything, then narrow the worktree down to the cone */
+static void checkout_full_then_enable_cone(void)
+{
+	cl_repo_set_bool(g_repo, "core.sparseCheckout", false);
+	checkout_branch("subtrees");
+	cl_repo_set_bool(g_repo, "core.sparseCheckout", true);
+
+	cl_assert(git_fs_path_isfile("testrepo/ab/c/3.txt"));
+	cl_assert(!skips_worktree("ab/c/3.txt"));
+}
+
+void test_checkout_sparse__status_sees_files_checked_out_before_the_cone(void)
+{
+	git_status_list *status;
+	git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+	git_object *head;
+	git_diff *diff;
+
+	opts.flags = GIT_STATUS_OPT_DEFAULTS;
+
+	checkout_full_then_enable_cone();
+
+	/* the tracked files outside of the cone are not deleted */
+	cl_git_pass(git_status_list_new(&status, g_repo, &opts));
+	cl_assert_equal_sz(0, git_status_list_entrycount(status));
+	git_status_list_free(status);
+
+	cl_git_pass(git_revparse_single(&head, g_repo, "HEAD^{tree}"));
+	cl_git_pass(git_diff_tree_to_workdir(&diff, g_repo, (git_tree *)head, NULL));
+	cl_assert_equal_sz(0, git_diff_num_deltas(diff));
+	git_diff_free(diff);
+	git_object_free(head);
+
+	/* and changes to them are seen */
+	cl_git_rewritefile("testrepo/ab/c/3.txt", "modified\n");
+
+	cl_git_pass(git_status_list_new(&status, g_repo, &opts));
+	cl_assert_equal_sz(1, git_status_list_entrycount(status));
+	cl_assert_equal_s("ab/c/3.txt",
+		git_status_byindex(status, 0)->index_to_workdir->new_file.path);
+	cl_assert_equal_i(GIT_STATUS_WT_MODIFIED, git_status_byindex(status, 0)->status);
+	git_status_list_free(status);
+}
+
+void test_checkout_sparse__update_all_keeps_files_checked_out_before_the_cone(void)
+{
+	git_index *index;
+	const git_index_entry *entry;
+	git_oid modified;
+
+	checkout_full_then_enable_cone();
+
+	cl_git_rewritefile("testrepo/ab/c/3.txt", "modified\n");
+	cl_git_pass(git_odb_hash(&modified, "modified\n", 9, GIT_OBJECT_BLOB));
+
+	cl_git_pass(git_repository_index__weakptr(&index, g_repo));
+	cl_git_pass(git_index_update_all(index, NULL, NULL, NULL));
+
+	cl_assert((entry = git_index_get_bypath(index, "ab/c/3.txt", 0)) != NULL);
+	cl_assert_equal_oid(&modified, &entry->id);
+}
+
+void test_checkout_sparse__switching_updates_the_index(void)
+{
+	git_index *index;
+
+	checkout_branch("subtrees");
+	checkout_branch("master");
+
+	cl_git_pass(git_repository_index__weakptr(&index, g_repo));
+	cl_assert(git_index_get_bypath(index, "ab/c/3.txt", 0) == NULL);
+	cl_assert(!git_fs_path_exists("testrepo/ab"));
+
+	checkout_branch("subtrees");
+
+	cl_assert(skips_worktree("ab/c/3.txt"));
+	cl_assert(git_fs_path_isfile("testrepo/ab/4.txt"));
+	cl_assert(!git_fs_path_exists("testrepo/ab/c"));
+}
+
+void test_checkout_sparse__other_patterns_are_a_full_checkout(void)
+{
+	cl_git_rewritefile("testrepo/.git/info/sparse-checkout", "*.txt\n");
+
+	checkout_branch("subtrees");
+
+	cl_assert(git_fs_path_isfile("testrepo/ab/c/3.txt"));
+	cl_assert(!skips_worktree("ab/c/3.txt"));
+}
+
+void test_checkout_sparse__requires_cone_mode(void)
+{
+	cl_repo_set_bool(g_repo, "core.sparseCheckoutCone", false);
+
+	checkout_branch("subtrees");
+
+	cl_assert(git_fs_path_isfile("testrepo/ab/c/3.txt"));
+	cl_assert(!skips_worktree("ab/c/3.txt"));
+}
+
+static void assert_sized_like_blob(const char *path)
+{
+	git_index *index;
+	const git_index_entry *entry;
+	git_blob *blob;
+
+	cl_git_pass(git_repository_index__weakptr(&index, g_repo));
+	cl_assert((entry = git_index_get_bypath(index, path, 0)) != NULL);
+
+	cl_git_pass(git_blob_lookup(&blob, g_repo, &entry->id));
+	cl_assert_equal_i(git_blob_rawsize(blob), entry->file_size);
+	git_blob_free(blob);
+}
+
+void test_checkout_sparse__skipped_entries_have_their_size(void)
+{
+	checkout_branch("subtrees");
+
+	cl_assert(skips_worktree("ab/c/3.txt"));
+	assert_sized_like_blob("ab/c/3.txt");
+}
+
+void test_checkout_sparse__removes_clean_files_outside_of_the_cone(void)
+{
+	checkout_full_then_enable_cone();
+
+	cl_git_pass(try_checkout_branch("subtrees", GIT_CHECKOUT_SAFE));
+
+	cl_assert(!git_fs_path_exists("testrepo/ab/c"));
+	cl_assert(git_fs_path_isfile("testrepo/ab/de/fgh/1.txt"));
+
+	cl_assert(skips_worktree("ab/c/3.txt"));
+	cl_assert(!skips_worktree("ab/4.txt"));
+	assert_sized_like_blob("ab/c/3.txt");
+}
+
+void test_checkout_sparse__modified_files_outside_of_the_cone_conflict(void)
+{
+	checkout_full_then_enable_cone();
+
+	cl_git_rewritefile("testrepo/ab/c/3.txt", "modified\n");
+
+	cl_assert_equal_i(GIT_ECONFLICT,
+		try_checkout_branch("subtrees", GIT_CHECKOUT_SAFE));
+
+	cl_assert(git_fs_path_isfile("testrepo/ab/c/3.txt"));
+	cl_assert(!skips_worktree("ab/c/3.txt"));
+
+	/* unless they are forced away */
+	cl_git_pass(try_checkout_branch("subtrees", GIT_CHECKOUT_FORCE));
+
+	cl_assert(!git_fs_path_exists("testrepo/ab/c"));
+	cl_assert(skips_worktree("ab/c/3.txt"));
+}
+
+void test_checkout_sparse__conflicts_outside_of_the_cone_can_be_allowed(void)
+{
+	checkout_full_then_enable_cone();
+
+	cl_git_rewritefile("testrepo/ab/c/3.txt", "modified\n");
+
+	cl_git_pass(try_checkout_branch("subtrees",
+		GIT_CHECKOUT_SAFE | GIT_CHECKOUT_ALLOW_CONFLICTS));
+
+	/* the modified file is kept, and so is its index entry */
+	cl_assert(git_fs_path_isfile("testrepo/ab/c/3.txt"));
+	cl_assert(!skips_worktree("ab/c/3.txt"));
+}
+
+static void widen_cone_to_ab(void)
+{
+	checkout_branch("subtrees");
+	cl_assert(skips_worktree("ab/c/3.txt"));
+
+	cl_git_rewritefile("testrepo/.git/info/sparse-checkout",
+		"/*\n"
+		"!/*/\n"
+		"/ab/\n");
+}
+
+void test_checkout_sparse__widening_checks_out_skipped_files(void)
+{
+	git_checkout_options opts = GIT_CHECKOUT_OPTIONS_INIT;
+	git_status_list *status;
+	git_status_options status_opts = GIT_STATUS_OPTIONS_INIT;
+
+	widen_cone_to_ab();
+
+	opts.checkout_strategy = GIT_CHECKOUT_SAFE;
+	cl_git_pass(git_checkout_head(g_repo, &opts));
+
+	cl_assert(git_fs_path_isfile("testrepo/ab/c/3.txt"));
+	cl_assert(!skips_worktree("ab/c/3.txt"));
+
+	status_opts.flags = GIT_STATUS_OPT_DEFAULTS;
+	cl_git_pass(git_status_list_new(&status, g_repo, &status_opts));
+	cl_assert_equal_sz(0, git_status_list_entrycount(status));
+	git_status_list_free(status);
+}
+
+void test_checkout_sparse__widening_does_not_overwrite_modified_files(void)
+{
+	git_checkout_options opts = GIT_CHECKOUT_OPTIONS_INIT;
+
+	widen_cone_to_ab();
+
+	cl_must_pass(p_mkdir("testrepo/ab/c", 0777));
+	cl_git_mkfile("testrepo/ab/c/3.txt", "modified\n");
+
+	opts.checkout_strategy = GIT_CHECKOUT_SAFE;
+	cl_assert_equal_i(GIT_ECONFLICT, git_checkout_head(g_repo, &opts));
+
+	cl_assert(skips_worktree("ab/c/3.txt"));
+
+	/* unless it is forced away */
+	opts.checkout_strategy = GIT_CHECKOUT_FORCE;
+	cl_git_pass(git_checkout_head(g_repo, &opts));
+
+	cl_assert(!skips_worktree("ab/c/3.txt"));
+	assert_sized_like_blob("ab/c/3.txt");
+	cl_assert_equal_file("3.txt\n", 0, "testrepo/ab/c/3.txt");
+}
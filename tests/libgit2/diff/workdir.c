@@ -63,7 +63,9 @@ void test_diff_workdir__to_index(void)
 		git_diff_perfdata perf = GIT_DIFF_PERFDATA_INIT;
 		cl_git_pass(git_diff_get_perfdata(&perf, diff));
 		cl_assert_equal_sz(
-			13 /* in root */ + 3 /* in subdir */, perf.stat_calls);
+			11 /* in root */ + 3 /* in subdir */, perf.stat_calls);
+		cl_assert_equal_sz(
+			2 /* directories */, perf.skipped_stat_calls);
 		cl_assert_equal_sz(5, perf.oid_calculations);
 	}
 
@@ -125,6 +127,8 @@ void test_diff_workdir__to_index_with_assume_unchanged(void)
 	diff_expects exp;
 	const git_index_entry *iep;
 	git_index_entry ie;
+	git_diff_perfdata before = GIT_DIFF_PERFDATA_INIT,
+		after = GIT_DIFF_PERFDATA_INIT;
 
 	g_repo = cl_git_sandbox_init("status");
 
@@ -138,6 +142,7 @@ void test_diff_workdir__to_index_with_assume_unchanged(void)
 	cl_assert_equal_i(0, exp.file_status[GIT_DELTA_ADDED]);
 	cl_assert_equal_i(4, exp.file_status[GIT_DELTA_DELETED]);
 	cl_assert_equal_i(4, exp.file_status[GIT_DELTA_MODIFIED]);
+	cl_git_pass(git_diff_get_perfdata(&before, diff));
 	git_diff_free(diff);
 
 	/* mark a couple of entries with ASSUME_UNCHANGED */
@@ -167,8 +172,60 @@ void test_diff_workdir__to_index_with_assume_unchanged(void)
 	cl_assert_equal_i(0, exp.file_status[GIT_DELTA_ADDED]);
 	cl_assert_equal_i(3, exp.file_status[GIT_DELTA_DELETED]);
 	cl_assert_equal_i(3, exp.file_status[GIT_DELTA_MODIFIED]);
+
+	/* and that the one that exists is not even stat'ed */
+	cl_git_pass(git_diff_get_perfdata(&after, diff));
+	cl_assert_equal_sz(before.stat_calls - 1, after.stat_calls);
+	cl_assert_equal_sz(before.skipped_stat_calls + 1, after.skipped_stat_calls);
 	git_diff_free(diff);
+}
+
+void test_diff_workdir__to_index_with_skip_worktree(void)
+{
+	git_diff_options opts = GIT_DIFF_OPTIONS_INIT;
+	git_diff *diff = NULL;
+	git_index *idx = NULL;
+	diff_expects exp;
+	const git_index_entry *iep;
+	git_index_entry ie;
+	git_diff_perfdata before = GIT_DIFF_PERFDATA_INIT,
+		after = GIT_DIFF_PERFDATA_INIT;
+
+	g_repo = cl_git_sandbox_init("status");
+
+	cl_git_pass(git_diff_index_to_workdir(&diff, g_repo, NULL, &opts));
+	cl_git_pass(git_diff_get_perfdata(&before, diff));
+	git_diff_free(diff);
+
+	/* mark the modified files as outside of the sparse checkout */
+
+	cl_git_pass(git_repository_index(&idx, g_repo));
 
+	cl_assert((iep = git_index_get_bypath(idx, "modified_file", 0)) != NULL);
+	memcpy(&ie, iep, sizeof(ie));
+	ie.flags_extended |= GIT_INDEX_ENTRY_SKIP_WORKTREE;
+	cl_git_pass(git_index_add(idx, &ie));
+
+	cl_assert((iep = git_index_get_bypath(idx, "subdir/modified_file", 0)) != NULL);
+	memcpy(&ie, iep, sizeof(ie));
+	ie.flags_extended |= GIT_INDEX_ENTRY_SKIP_WORKTREE;
+	cl_git_pass(git_index_add(idx, &ie));
+
+	cl_git_pass(git_index_write(idx));
+	git_index_free(idx);
+
+	/* the files are neither reported nor stat'ed */
+
+	cl_git_pass(git_diff_index_to_workdir(&diff, g_repo, NULL, &opts));
+	memset(&exp, 0, sizeof(exp));
+	cl_git_pass(git_diff_foreach(
+		diff, diff_file_cb, diff_binary_cb, diff_hunk_cb, diff_line_cb, &exp));
+	cl_assert_equal_i(2, exp.file_status[GIT_DELTA_MODIFIED]);
+
+	cl_git_pass(git_diff_get_perfdata(&after, diff));
+	cl_assert_equal_sz(before.stat_calls - 2, after.stat_calls);
+	cl_assert_equal_sz(before.skipped_stat_calls + 2, after.skipped_stat_calls);
+	git_diff_free(diff);
 }
 
 void test_diff_workdir__to_tree(void)
@@ -1853,7 +1910,7 @@ void test_diff_workdir__can_update_index(void)
 	basic_diff_status(&diff, &opts);
 
 	cl_git_pass(git_diff_get_perfdata(&perf, diff));
-	cl_assert_equal_sz(13 + 3, perf.stat_calls);
+	cl_assert_equal_sz(11 + 3, perf.stat_calls);
 	cl_assert_equal_sz(5, perf.oid_calculations);
 
 	git_diff_free(diff);
@@ -1868,7 +1925,7 @@ void test_diff_workdir__can_update_index(void)
 	basic_diff_status(&diff, &opts);
 
 	cl_git_pass(git_diff_get_perfdata(&perf, diff));
-	cl_assert_equal_sz(13 + 3, perf.stat_calls);
+	cl_assert_equal_sz(11 + 3, perf.stat_calls);
 	cl_assert_equal_sz(5, perf.oid_calculations);
 
 	git_diff_free(diff);
@@ -1880,7 +1937,7 @@ void test_diff_workdir__can_update_index(void)
 	basic_diff_status(&diff, &opts);
 
 	cl_git_pass(git_diff_get_perfdata(&perf, diff));
-	cl_assert_equal_sz(13 + 3, perf.stat_calls);
+	cl_assert_equal_sz(11 + 3, perf.stat_calls);
 	cl_assert_equal_sz(0, perf.oid_calculations);
 
 	git_diff_free(diff);
@@ -2,6 +2,7 @@
 
 #include <git2.h>
 #include <git2/sys/commit_graph.h>
+#include <git2/sys/revwalk.h>
 
 #include "commit_graph.h"
 #include "futils.h"
@@ -116,6 +117,8 @@ void test_graph_commitgraph__writer(void)
 	cl_git_pass(git_commit_graph_writer_add_revwalk(w, walk));
 	git_revwalk_free(walk);
 
+	/* The fixture predates corrected commit dates. */
+	opts.generation_version = 1;
 	cl_git_pass(git_commit_graph_writer_dump(&cgraph, w, &opts));
 	cl_git_pass(git_str_joinpath(&path, git_repository_path(repo), "objects/info/commit-graph"));
 	cl_git_pass(git_futils_readbuffer(&expected_cgraph, git_str_cstr(&path)));
@@ -178,3 +181,385 @@ void test_graph_commitgraph__validate_corrupt(void)
 
 	cl_fixture_cleanup("testrepo.git");
 }
+
+static int bloom_maybe_changed(
+	git_commit_graph_file *file,
+	const char *commit_id,
+	const char *path)
+{
+	git_commit_graph_entry e;
+	git_commit_graph_bloom_key key;
+	git_oid id;
+	int result;
+
+	cl_git_pass(git_oid__fromstr(&id, commit_id, GIT_OID_SHA1));
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &id, GIT_OID_SHA1_HEXSIZE));
+	cl_git_pass(git_commit_graph_bloom_key_init(&key, file, path));
+
+	result = git_commit_graph_bloom_maybe_changed(file, &e, &key);
+
+	git_commit_graph_bloom_key_dispose(&key);
+	return result;
+}
+
+void test_graph_commitgraph__writer_changed_paths(void)
+{
+	git_repository *repo;
+	git_commit_graph_writer *w = NULL;
+	git_commit_graph_file *file;
+	git_revwalk *walk;
+	git_commit_graph_writer_options opts = GIT_COMMIT_GRAPH_WRITER_OPTIONS_INIT;
+	git_blame *blame;
+	git_str path = GIT_STR_INIT;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+	cl_git_pass(git_str_joinpath(&path, git_repository_path(repo), "objects/info"));
+
+#ifdef GIT_EXPERIMENTAL_SHA256
+	cl_git_pass(git_commit_graph_writer_new(&w, git_str_cstr(&path), GIT_OID_SHA1));
+#else
+	cl_git_pass(git_commit_graph_writer_new(&w, git_str_cstr(&path)));
+#endif
+
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "refs/*"));
+	cl_git_pass(git_commit_graph_writer_add_revwalk(w, walk));
+	git_revwalk_free(walk);
+
+	opts.changed_paths = 1;
+	cl_git_pass(git_commit_graph_writer_commit(w, &opts));
+	git_commit_graph_writer_free(w);
+
+	cl_git_pass(git_str_joinpath(&path, git_str_cstr(&path), "commit-graph"));
+	cl_git_pass(git_commit_graph_file_open(&file, git_str_cstr(&path), GIT_OID_SHA1));
+	cl_assert(file->bloom_filter_index != NULL);
+
+	/* a merge that changes a single file in its first parent */
+	cl_assert_equal_i(1, bloom_maybe_changed(file, "be3563ae3f795b2b4353bcce3a527ad0a4f7f644", "branch_file.txt"));
+	cl_assert_equal_i(0, bloom_maybe_changed(file, "be3563ae3f795b2b4353bcce3a527ad0a4f7f644", "README"));
+
+	/* a commit adding files in subdirectories */
+	cl_assert_equal_i(1, bloom_maybe_changed(file, "763d71aadf09a7951596c9746c024e7eece7c7af", "ab/de/fgh/1.txt"));
+	cl_assert_equal_i(1, bloom_maybe_changed(file, "763d71aadf09a7951596c9746c024e7eece7c7af", "ab/de"));
+	cl_assert_equal_i(0, bloom_maybe_changed(file, "763d71aadf09a7951596c9746c024e7eece7c7af", "ab/de/fgh/2.txt"));
+	cl_assert_equal_i(0, bloom_maybe_changed(file, "763d71aadf09a7951596c9746c024e7eece7c7af", "new.txt"));
+
+	git_commit_graph_file_free(file);
+
+	/* blame skips the unchanged commits but finds the same origins */
+	cl_git_pass(git_blame_file(&blame, repo, "branch_file.txt", NULL));
+	cl_assert_equal_i(2, git_blame_get_hunk_count(blame));
+	cl_assert_equal_s("c47800c7266a2be04c571c04d5a6614691ea99bd",
+		git_oid_tostr_s(&git_blame_get_hunk_byindex(blame, 0)->final_commit_id));
+	cl_assert_equal_s("a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+		git_oid_tostr_s(&git_blame_get_hunk_byindex(blame, 1)->final_commit_id));
+	git_blame_free(blame);
+
+	git_str_dispose(&path);
+	cl_git_sandbox_cleanup();
+}
+
+static void write_graph(
+	git_repository *repo,
+	const char *refs,
+	git_commit_graph_split_strategy_t split_strategy)
+{
+	git_commit_graph_writer *w = NULL;
+	git_commit_graph_writer_options opts = GIT_COMMIT_GRAPH_WRITER_OPTIONS_INIT;
+	git_revwalk *walk;
+	git_str path = GIT_STR_INIT;
+
+	cl_git_pass(git_str_joinpath(&path, git_repository_path(repo), "objects/info"));
+
+#ifdef GIT_EXPERIMENTAL_SHA256
+	cl_git_pass(git_commit_graph_writer_new(&w, git_str_cstr(&path), GIT_OID_SHA1));
+#else
+	cl_git_pass(git_commit_graph_writer_new(&w, git_str_cstr(&path)));
+#endif
+
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	if (strchr(refs, '*'))
+		cl_git_pass(git_revwalk_push_glob(walk, refs));
+	else
+		cl_git_pass(git_revwalk_push_ref(walk, refs));
+	cl_git_pass(git_commit_graph_writer_add_revwalk(w, walk));
+	git_revwalk_free(walk);
+
+	opts.split_strategy = split_strategy;
+	cl_git_pass(git_commit_graph_writer_commit(w, &opts));
+
+	git_commit_graph_writer_free(w);
+	git_str_dispose(&path);
+}
+
+static git_commit_graph *open_graph(git_repository *repo)
+{
+	git_commit_graph *cgraph;
+	git_str objects_dir = GIT_STR_INIT;
+
+	cl_git_pass(git_str_joinpath(&objects_dir, git_repository_path(repo), "objects"));
+
+#ifdef GIT_EXPERIMENTAL_SHA256
+	cl_git_pass(git_commit_graph_open(&cgraph, git_str_cstr(&objects_dir), GIT_OID_SHA1));
+#else
+	cl_git_pass(git_commit_graph_open(&cgraph, git_str_cstr(&objects_dir)));
+#endif
+
+	git_str_dispose(&objects_dir);
+	return cgraph;
+}
+
+/* Check that a commit-graph has the same contents as the fixture's. */
+static void assert_same_graph(git_commit_graph_file *file)
+{
+	git_commit_graph_file *expected;
+	git_commit_graph_entry e, expected_e, parent, expected_parent;
+	git_oid id;
+	size_t i, j, num_commits = 0;
+
+	cl_git_pass(git_commit_graph_file_open(&expected,
+		cl_fixture("testrepo.git/objects/info/commit-graph"), GIT_OID_SHA1));
+
+	for (i = 0; i < expected->num_commits; i++) {
+		cl_git_pass(git_oid__fromraw(&id, expected->oid_lookup + i * GIT_OID_SHA1_SIZE, GIT_OID_SHA1));
+		cl_git_pass(git_commit_graph_entry_find(&expected_e, expected, &id, GIT_OID_SHA1_HEXSIZE));
+		cl_git_pass(git_commit_graph_entry_find(&e, file, &id, GIT_OID_SHA1_HEXSIZE));
+
+		cl_assert_equal_oid(&expected_e.tree_oid, &e.tree_oid);
+		cl_assert_equal_i(expected_e.generation, e.generation);
+		cl_assert_equal_i(expected_e.commit_time, e.commit_time);
+		cl_assert_equal_i(expected_e.parent_count, e.parent_count);
+
+		for (j = 0; j < e.parent_count; j++) {
+			cl_git_pass(git_commit_graph_entry_parent(&expected_parent, expected, &expected_e, j));
+			cl_git_pass(git_commit_graph_entry_parent(&parent, file, &e, j));
+			cl_assert_equal_oid(&expected_parent.sha1, &parent.sha1);
+		}
+	}
+
+	for (; file; file = file->base)
+		num_commits += file->num_commits;
+	cl_assert_equal_sz(expected->num_commits, num_commits);
+
+	git_commit_graph_file_free(expected);
+}
+
+static size_t count_chain_files(git_repository *repo)
+{
+	git_str path = GIT_STR_INIT;
+	git_vector files = GIT_VECTOR_INIT;
+	size_t count;
+
+	cl_git_pass(git_str_joinpath(&path, git_repository_path(repo), "objects/info/commit-graphs"));
+	cl_git_pass(git_fs_path_dirload(&files, path.ptr, 0, 0));
+	count = files.length;
+
+	git_vector_free_deep(&files);
+	git_str_dispose(&path);
+	return count;
+}
+
+void test_graph_commitgraph__writer_split(void)
+{
+	git_repository *repo;
+	git_commit_graph *cgraph;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+	cl_must_pass(p_unlink("testrepo.git/objects/info/commit-graph"));
+
+	write_graph(repo, "refs/heads/br2", GIT_COMMIT_GRAPH_SPLIT_STRATEGY_NO_MERGE);
+	write_graph(repo, "refs/*", GIT_COMMIT_GRAPH_SPLIT_STRATEGY_NO_MERGE);
+
+	/* the second file only has the commits that were not in the first */
+	cgraph = open_graph(repo);
+	cl_assert(cgraph->file->base != NULL);
+	cl_assert_equal_i(1, cgraph->file->num_base_graphs);
+	cl_assert_equal_i(6, cgraph->file->base->num_commits);
+	cl_assert_equal_i(9, cgraph->file->num_commits);
+	assert_same_graph(cgraph->file);
+	git_commit_graph_free(cgraph);
+
+	write_graph(repo, "refs/*", GIT_COMMIT_GRAPH_SPLIT_STRATEGY_REPLACE);
+
+	cgraph = open_graph(repo);
+	cl_assert(cgraph->file->base == NULL);
+	cl_assert_equal_i(15, cgraph->file->num_commits);
+	assert_same_graph(cgraph->file);
+	git_commit_graph_free(cgraph);
+
+	/* the chain file and the remaining graph file */
+	cl_assert_equal_sz(2, count_chain_files(repo));
+
+	cl_git_sandbox_cleanup();
+}
+
+void test_graph_commitgraph__writer_split_merge(void)
+{
+	git_repository *repo;
+	git_commit_graph *cgraph;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+
+	/* a single file becomes the first file of the chain */
+	write_graph(repo, "refs/heads/br2", GIT_COMMIT_GRAPH_SPLIT_STRATEGY_SINGLE_FILE);
+	write_graph(repo, "refs/heads/master", GIT_COMMIT_GRAPH_SPLIT_STRATEGY_MERGE_BY_SIZE);
+
+	cl_assert(!git_fs_path_exists("testrepo.git/objects/info/commit-graph"));
+
+	cgraph = open_graph(repo);
+	cl_assert(cgraph->file->base != NULL);
+	cl_assert_equal_i(6, cgraph->file->base->num_commits);
+	cl_assert_equal_i(2, cgraph->file->num_commits);
+	git_commit_graph_free(cgraph);
+
+	/*
+	 * seven new commits are enough to merge both files, with the default
+	 * size multiple of 2 that a zero `size_multiple` stands for
+	 */
+	write_graph(repo, "refs/*", GIT_COMMIT_GRAPH_SPLIT_STRATEGY_MERGE_BY_SIZE);
+
+	cgraph = open_graph(repo);
+	cl_assert(cgraph->file->base == NULL);
+	cl_assert_equal_i(15, cgraph->file->num_commits);
+	assert_same_graph(cgraph->file);
+	git_commit_graph_free(cgraph);
+
+	cl_assert_equal_sz(2, count_chain_files(repo));
+
+	/* a single file supersedes the chain */
+	write_graph(repo, "refs/*", GIT_COMMIT_GRAPH_SPLIT_STRATEGY_SINGLE_FILE);
+	cl_assert(git_fs_path_exists("testrepo.git/objects/info/commit-graph"));
+	cl_assert(!git_fs_path_exists("testrepo.git/objects/info/commit-graphs"));
+
+	cl_git_sandbox_cleanup();
+}
+
+static void create_commit(
+	git_oid *out,
+	git_repository *repo,
+	git_time_t time,
+	const git_oid *parent_id)
+{
+	git_signature *sig;
+	git_commit *parent = NULL;
+	git_tree *tree;
+	git_oid tree_id;
+
+	cl_git_pass(git_signature_new(&sig, "Clock", "clock@example.com", time, 0));
+	cl_git_pass(git_oid__fromstr(&tree_id, "944c0f6e4dfa41595e6eb3ceecdb14f50fe18162", GIT_OID_SHA1));
+	cl_git_pass(git_tree_lookup(&tree, repo, &tree_id));
+
+	if (parent_id)
+		cl_git_pass(git_commit_lookup(&parent, repo, parent_id));
+
+	cl_git_pass(git_commit_create(out, repo, NULL, sig, sig, NULL, "skewed",
+		tree, parent ? 1 : 0, (const git_commit **)&parent));
+
+	git_commit_free(parent);
+	git_tree_free(tree);
+	git_signature_free(sig);
+}
+
+void test_graph_commitgraph__corrected_commit_dates(void)
+{
+	git_repository *repo;
+	git_commit_graph *cgraph;
+	git_commit_graph_entry e;
+	git_oid a, b, c, base;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+
+	/* a commit from far in the future, then commits with sane clocks */
+	create_commit(&a, repo, 4000000000, NULL);
+	create_commit(&b, repo, 1000000000, &a);
+	create_commit(&c, repo, 1000000100, &b);
+	cl_git_pass(git_reference_create(NULL, repo, "refs/heads/skewed", &c, 0, NULL));
+
+	write_graph(repo, "refs/*", GIT_COMMIT_GRAPH_SPLIT_STRATEGY_SINGLE_FILE);
+
+	cgraph = open_graph(repo);
+	cl_assert(cgraph->file->generation_data != NULL);
+	cl_assert(cgraph->file->generation_data_overflow != NULL);
+
+	cl_git_pass(git_commit_graph_entry_find(&e, cgraph->file, &a, GIT_OID_SHA1_HEXSIZE));
+	cl_assert_equal_i(1, e.generation);
+	cl_assert_equal_i(4000000000, e.corrected_commit_date);
+
+	/* the offset from the commit time does not fit in 31 bits */
+	cl_git_pass(git_commit_graph_entry_find(&e, cgraph->file, &b, GIT_OID_SHA1_HEXSIZE));
+	cl_assert_equal_i(2, e.generation);
+	cl_assert_equal_i(1000000000, e.commit_time);
+	cl_assert_equal_i(4000000001, e.corrected_commit_date);
+
+	cl_git_pass(git_commit_graph_entry_find(&e, cgraph->file, &c, GIT_OID_SHA1_HEXSIZE));
+	cl_assert_equal_i(4000000002, e.corrected_commit_date);
+
+	/* commits with sane clocks are not affected */
+	cl_git_pass(git_oid__fromstr(&base, "be3563ae3f795b2b4353bcce3a527ad0a4f7f644", GIT_OID_SHA1));
+	cl_git_pass(git_commit_graph_entry_find(&e, cgraph->file, &base, GIT_OID_SHA1_HEXSIZE));
+	cl_assert_equal_i(e.commit_time, e.corrected_commit_date);
+
+	git_commit_graph_free(cgraph);
+
+	/* walks use the corrected dates */
+	repo = cl_git_sandbox_reopen();
+	cl_assert_equal_i(1, git_graph_descendant_of(repo, &c, &a));
+	cl_assert_equal_i(0, git_graph_descendant_of(repo, &a, &c));
+	cl_assert_equal_i(0, git_graph_descendant_of(repo, &c, &base));
+	cl_git_pass(git_merge_base(&base, repo, &c, &a));
+	cl_assert_equal_oid(&a, &base);
+
+	cl_git_sandbox_cleanup();
+}
+
+static void walk_master(size_t expected_from_graph, size_t expected_from_odb)
+{
+	git_repository *repo = cl_git_sandbox_reopen();
+	git_revwalk_perfdata perf = GIT_REVWALK_PERFDATA_INIT;
+	git_revwalk *walk;
+	git_oid id;
+
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_ref(walk, "refs/heads/master"));
+
+	while (git_revwalk_next(&id, walk) == 0)
+		;
+
+	cl_git_pass(git_revwalk_get_perfdata(&perf, walk));
+	cl_assert_equal_sz(expected_from_graph, perf.parsed_from_graph);
+	cl_assert_equal_sz(expected_from_odb, perf.parsed_from_odb);
+
+	git_revwalk_free(walk);
+}
+
+void test_graph_commitgraph__revwalk_parses_from_graph(void)
+{
+	git_repository *repo;
+	git_revwalk_perfdata perf = GIT_REVWALK_PERFDATA_INIT;
+	git_revwalk *walk;
+	git_oid id;
+
+	cl_git_sandbox_init("testrepo.git");
+
+	walk_master(7, 0);
+
+	/* hidden commits are parsed from the graph, too */
+	repo = cl_git_sandbox_reopen();
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_ref(walk, "refs/heads/master"));
+	cl_git_pass(git_revwalk_hide_ref(walk, "refs/heads/br2"));
+
+	while (git_revwalk_next(&id, walk) == 0)
+		;
+
+	cl_git_pass(git_revwalk_get_perfdata(&perf, walk));
+	cl_assert_equal_sz(8, perf.parsed_from_graph);
+	cl_assert_equal_sz(0, perf.parsed_from_odb);
+	git_revwalk_free(walk);
+
+	/* without a commit-graph, every commit is read from the odb */
+	cl_git_pass(p_unlink(cl_git_sandbox_path(0, "testrepo.git", "objects", "info", "commit-graph", NULL)));
+	walk_master(0, 7);
+
+	cl_git_sandbox_cleanup();
+}
@@ -0,0 +1,181 @@
+#include "clar_libgit2.h"
+#include "futils.h"
+#include "index.h"
+
+static size_t orig_read_threads;
+
+/*
+ * A version 4 index that git wrote with index.threads=2, which has two
+ * blocks of four entries ("file_a" through "file_h") in its offset
+ * table.
+ */
+static const unsigned char git_index_data[] = {
+  0x44, 0x49, 0x52, 0x43, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x08,
+  0x6a, 0xd3, 0x07, 0x67, 0x0f, 0x72, 0x47, 0x14, 0x6a, 0xd3, 0x07, 0x67,
+  0x0f, 0x72, 0x47, 0x14, 0x00, 0x00, 0xfe, 0x00, 0x00, 0xce, 0xa2, 0xa1,
+  0x00, 0x00, 0x81, 0xa4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x02, 0x78, 0x98, 0x19, 0x22, 0x61, 0x3b, 0x2a, 0xfb,
+  0x60, 0x25, 0x04, 0x2f, 0xf6, 0xbd, 0x87, 0x8a, 0xc1, 0x99, 0x4e, 0x85,
+  0x00, 0x06, 0x00, 0x66, 0x69, 0x6c, 0x65, 0x5f, 0x61, 0x00, 0x6a, 0xd3,
+  0x07, 0x67, 0x0f, 0x72, 0x47, 0x14, 0x6a, 0xd3, 0x07, 0x67, 0x0f, 0x72,
+  0x47, 0x14, 0x00, 0x00, 0xfe, 0x00, 0x00, 0xce, 0xa2, 0xb1, 0x00, 0x00,
+  0x81, 0xa4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x02, 0x61, 0x78, 0x07, 0x98, 0x22, 0x8d, 0x17, 0xaf, 0x2d, 0x34,
+  0xfc, 0xe4, 0xcf, 0xbd, 0xf3, 0x55, 0x56, 0x83, 0x24, 0x72, 0x00, 0x06,
+  0x01, 0x62, 0x00, 0x6a, 0xd3, 0x07, 0x67, 0x0f, 0x72, 0x47, 0x14, 0x6a,
+  0xd3, 0x07, 0x67, 0x0f, 0x72, 0x47, 0x14, 0x00, 0x00, 0xfe, 0x00, 0x00,
+  0xce, 0xa3, 0x36, 0x00, 0x00, 0x81, 0xa4, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0xf2, 0xad, 0x6c, 0x76, 0xf0,
+  0x11, 0x5a, 0x6b, 0xa5, 0xb0, 0x04, 0x56, 0xa8, 0x49, 0x81, 0x0e, 0x7e,
+  0xc0, 0xaf, 0x20, 0x00, 0x06, 0x01, 0x63, 0x00, 0x6a, 0xd3, 0x07, 0x67,
+  0x0f, 0x72, 0x47, 0x14, 0x6a, 0xd3, 0x07, 0x67, 0x0f, 0x72, 0x47, 0x14,
+  0x00, 0x00, 0xfe, 0x00, 0x00, 0xce, 0xa3, 0x5c, 0x00, 0x00, 0x81, 0xa4,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+  0x4b, 0xcf, 0xe9, 0x8e, 0x64, 0x0c, 0x82, 0x84, 0x51, 0x13, 0x12, 0x66,
+  0x0f, 0xb8, 0x70, 0x9b, 0x0a, 0xfa, 0x88, 0x8e, 0x00, 0x06, 0x01, 0x64,
+  0x00, 0x6a, 0xd3, 0x07, 0x67, 0x0f, 0x72, 0x47, 0x14, 0x6a, 0xd3, 0x07,
+  0x67, 0x0f, 0x72, 0x47, 0x14, 0x00, 0x00, 0xfe, 0x00, 0x00, 0xce, 0xa3,
+  0x61, 0x00, 0x00, 0x81, 0xa4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x02, 0xd9, 0x05, 0xd9, 0xda, 0x82, 0xc9, 0x72,
+  0x64, 0xab, 0x6f, 0x49, 0x20, 0xe2, 0x02, 0x42, 0xe0, 0x88, 0x85, 0x0c,
+  0xe9, 0x00, 0x06, 0x06, 0x66, 0x69, 0x6c, 0x65, 0x5f, 0x65, 0x00, 0x6a,
+  0xd3, 0x07, 0x67, 0x0f, 0x72, 0x47, 0x14, 0x6a, 0xd3, 0x07, 0x67, 0x0f,
+  0x72, 0x47, 0x14, 0x00, 0x00, 0xfe, 0x00, 0x00, 0xce, 0xa3, 0x71, 0x00,
+  0x00, 0x81, 0xa4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x02, 0x6a, 0x69, 0xf9, 0x20, 0x20, 0xf5, 0xdf, 0x77, 0xaf,
+  0x6e, 0x88, 0x13, 0xff, 0x12, 0x32, 0x49, 0x33, 0x83, 0xb7, 0x08, 0x00,
+  0x06, 0x01, 0x66, 0x00, 0x6a, 0xd3, 0x07, 0x67, 0x0f, 0x72, 0x47, 0x14,
+  0x6a, 0xd3, 0x07, 0x67, 0x0f, 0x72, 0x47, 0x14, 0x00, 0x00, 0xfe, 0x00,
+  0x00, 0xce, 0xa3, 0x81, 0x00, 0x00, 0x81, 0xa4, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x01, 0x05, 0x8d, 0x84,
+  0x4a, 0x98, 0xd2, 0x93, 0xa3, 0xb0, 0x3a, 0x86, 0x15, 0xa3, 0x47, 0x00,
+  0xe4, 0xed, 0x2b, 0xe3, 0x00, 0x06, 0x01, 0x67, 0x00, 0x6a, 0xd3, 0x07,
+  0x67, 0x0f, 0x72, 0x47, 0x14, 0x6a, 0xd3, 0x07, 0x67, 0x0f, 0x72, 0x47,
+  0x14, 0x00, 0x00, 0xfe, 0x00, 0x00, 0xce, 0xa3, 0x91, 0x00, 0x00, 0x81,
+  0xa4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x02, 0x6e, 0x9f, 0x0d, 0xa1, 0x3f, 0x19, 0xb4, 0x44, 0xec, 0x3a, 0x9c,
+  0x3d, 0x6e, 0x79, 0x5a, 0xd3, 0x5c, 0x05, 0x54, 0xa2, 0x00, 0x06, 0x01,
+  0x68, 0x00, 0x49, 0x45, 0x4f, 0x54, 0x00, 0x00, 0x00, 0x14, 0x00, 0x00,
+  0x00, 0x01, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00,
+  0x01, 0x15, 0x00, 0x00, 0x00, 0x04, 0x45, 0x4f, 0x49, 0x45, 0x00, 0x00,
+  0x00, 0x18, 0x00, 0x00, 0x02, 0x1e, 0x5d, 0x54, 0xc6, 0xd0, 0xe2, 0x71,
+  0x94, 0xe9, 0x97, 0x8e, 0x94, 0x98, 0xc8, 0x64, 0x70, 0x7e, 0x33, 0xe6,
+  0x92, 0xe9, 0x0f, 0x60, 0xe6, 0x61, 0xee, 0xe0, 0x80, 0x52, 0x0f, 0xf3,
+  0x73, 0xb3, 0x4c, 0x70, 0x84, 0x41, 0xdf, 0xbe, 0x3f, 0xa3
+};
+
+void test_index_parallel__initialize(void)
+{
+	orig_read_threads = git_index__read_threads;
+}
+
+void test_index_parallel__cleanup(void)
+{
+	git_index__read_threads = orig_read_threads;
+	cl_fixture_cleanup("parallel_index");
+}
+
+static void assert_git_index(git_index *index)
+{
+	const git_index_entry *entry;
+	char path[7] = "file_a";
+	size_t i;
+
+	cl_assert_equal_sz(8, git_index_entrycount(index));
+
+	for (i = 0; i < 8; i++) {
+		path[5] = 'a' + (char)i;
+
+		cl_assert((entry = git_index_get_byindex(index, i)) != NULL);
+		cl_assert_equal_s(path, entry->path);
+		cl_assert(git_index_get_bypath(index, path, 0) == entry);
+	}
+
+	cl_assert((entry = git_index_get_bypath(index, "file_e", 0)) != NULL);
+	cl_assert_equal_oidstr("d905d9da82c97264ab6f4920e20242e088850ce9", &entry->id);
+}
+
+void test_index_parallel__read_git_offset_table(void)
+{
+	git_index *index;
+
+	cl_git_write2file("parallel_index", (const char *)git_index_data,
+		sizeof(git_index_data), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+	git_index__read_threads = 1;
+	cl_git_pass(git_index__open(&index, "parallel_index", GIT_OID_SHA1));
+	assert_git_index(index);
+	git_index_free(index);
+
+	git_index__read_threads = 2;
+	cl_git_pass(git_index__open(&index, "parallel_index", GIT_OID_SHA1));
+	assert_git_index(index);
+	git_index_free(index);
+}
+
+static void write_and_read(unsigned int version)
+{
+	git_index *index, *read;
+	git_index_entry entry = {{0}};
+	const git_index_entry *expected, *actual;
+	git_str contents = GIT_STR_INIT, path = GIT_STR_INIT;
+	unsigned char raw[GIT_OID_SHA1_SIZE] = {0};
+	size_t i, count = 25000, threads;
+
+	cl_git_pass(git_index__open(&index, "parallel_index", GIT_OID_SHA1));
+	cl_git_pass(git_index_set_version(index, version));
+
+	entry.mode = GIT_FILEMODE_BLOB;
+
+	for (i = 0; i < count; i++) {
+		git_str_clear(&path);
+		cl_git_pass(git_str_printf(&path, "dir%02d/file%05d", (int)(i % 37), (int)i));
+
+		memcpy(raw, &i, sizeof(i));
+		cl_git_pass(git_oid__fromraw(&entry.id, raw, GIT_OID_SHA1));
+		entry.path = path.ptr;
+		entry.file_size = (uint32_t)i;
+
+		cl_git_pass(git_index_add(index, &entry));
+	}
+
+	cl_git_pass(git_index_write(index));
+
+	/* three blocks, listed in the first extension; the end is marked last */
+	cl_git_pass(git_futils_readbuffer(&contents, "parallel_index"));
+	cl_assert(memcmp(contents.ptr + contents.size - 20 - 32, "EOIE", 4) == 0);
+	cl_assert(git__memmem(contents.ptr, contents.size, "IEOT\0\0\0\x1c\0\0\0\x01", 12) != NULL);
+
+	for (threads = 1; threads <= 4; threads++) {
+		git_index__read_threads = threads;
+		cl_git_pass(git_index__open(&read, "parallel_index", GIT_OID_SHA1));
+
+		cl_assert_equal_sz(count, git_index_entrycount(read));
+
+		for (i = 0; i < count; i++) {
+			expected = git_index_get_byindex(index, i);
+			actual = git_index_get_byindex(read, i);
+
+			cl_assert_equal_s(expected->path, actual->path);
+			cl_assert_equal_oid(&expected->id, &actual->id);
+			cl_assert_equal_i(expected->file_size, actual->file_size);
+			cl_assert(git_index_get_bypath(read, expected->path, 0) == actual);
+		}
+
+		git_index_free(read);
+	}
+
+	git_str_dispose(&contents);
+	git_str_dispose(&path);
+	git_index_free(index);
+}
+
+void test_index_parallel__write_offset_table(void)
+{
+	write_and_read(2);
+}
+
+void test_index_parallel__write_offset_table_with_path_compression(void)
+{
+	write_and_read(4);
+}
@@ -1,5 +1,6 @@
 #include "clar_libgit2.h"
 #include "index.h"
+#include "futils.h"
 
 static git_repository *g_repo;
 
@@ -13,9 +14,210 @@ void test_index_splitindex__cleanup(void)
 	cl_git_sandbox_cleanup();
 }
 
-void test_index_splitindex__fail_on_open(void)
+static void add_file(git_index *index, const char *path, const char *content)
 {
-	git_index *idx;
-	cl_git_fail_with(-1, git_repository_index(&idx, g_repo));
-	cl_assert_equal_s(git_error_last()->message, "unsupported mandatory extension: 'link'");
+	git_str fullpath = GIT_STR_INIT;
+
+	cl_git_pass(git_str_joinpath(&fullpath, "splitindex", path));
+	cl_git_mkfile(fullpath.ptr, content);
+	cl_git_pass(git_index_add_bypath(index, path));
+
+	git_str_dispose(&fullpath);
+}
+
+static void shared_index_path(git_str *out, git_index *index)
+{
+	char hex[GIT_OID_SHA1_HEXSIZE + 1];
+
+	cl_assert(index->split);
+	git_hash_fmt(hex, index->split->base_checksum, GIT_OID_SHA1_SIZE);
+
+	git_str_clear(out);
+	cl_git_pass(git_str_printf(out, "splitindex/.git/sharedindex.%s", hex));
+}
+
+static git_index *reopen_index(void)
+{
+	git_index *index;
+
+	g_repo = cl_git_sandbox_reopen();
+	cl_git_pass(git_repository_index(&index, g_repo));
+
+	return index;
+}
+
+static size_t count_shared_indexes(void)
+{
+	git_vector files = GIT_VECTOR_INIT;
+	git_str path = GIT_STR_INIT;
+	char *file;
+	size_t i, count = 0;
+
+	cl_git_pass(git_str_puts(&path, "splitindex/.git"));
+	cl_git_pass(git_fs_path_dirload(&files, path.ptr, 0, 0));
+
+	git_vector_foreach(&files, i, file) {
+		if (strstr(file, "/sharedindex.") != NULL)
+			count++;
+
+		git__free(file);
+	}
+
+	git_vector_free(&files);
+	git_str_dispose(&path);
+	return count;
+}
+
+void test_index_splitindex__open(void)
+{
+	git_index *index;
+	git_str path = GIT_STR_INIT;
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_assert_equal_i(0, git_index_entrycount(index));
+
+	shared_index_path(&path, index);
+	cl_assert_equal_s("splitindex/.git/sharedindex.39d890139ee5356c7ef572216cebcd27aa41f9df", path.ptr);
+
+	git_str_dispose(&path);
+	git_index_free(index);
+}
+
+void test_index_splitindex__write_and_read(void)
+{
+	git_index *index;
+	const git_index_entry *entry;
+	git_str first = GIT_STR_INIT, second = GIT_STR_INIT;
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	add_file(index, "a.txt", "a\n");
+	add_file(index, "b.txt", "b\n");
+	add_file(index, "c.txt", "c\n");
+	cl_git_pass(git_index_write(index));
+
+	/* the entries are all new, so they go to a new shared index */
+	shared_index_path(&first, index);
+	cl_assert(git_fs_path_exists(first.ptr));
+	git_index_free(index);
+
+	cl_repo_set_int(g_repo, "splitIndex.maxPercentChange", 100);
+
+	index = reopen_index();
+	cl_assert_equal_i(3, git_index_entrycount(index));
+
+	/* replace, delete and add entries */
+	add_file(index, "a.txt", "changed\n");
+	cl_git_pass(git_index_remove_bypath(index, "b.txt"));
+	add_file(index, "d.txt", "d\n");
+	cl_git_pass(git_index_write(index));
+
+	shared_index_path(&second, index);
+	cl_assert_equal_s(first.ptr, second.ptr);
+	git_index_free(index);
+
+	index = reopen_index();
+	cl_assert_equal_i(3, git_index_entrycount(index));
+
+	cl_assert((entry = git_index_get_bypath(index, "a.txt", 0)) != NULL);
+	cl_assert_equal_i(8, entry->file_size);
+	cl_assert_equal_oidstr("5ea2ed416fbd4a4cbe227b75fe255dd7fa6bd4d6", &entry->id);
+	cl_assert(git_index_get_bypath(index, "b.txt", 0) == NULL);
+	cl_assert(git_index_get_bypath(index, "c.txt", 0) != NULL);
+	cl_assert(git_index_get_bypath(index, "d.txt", 0) != NULL);
+
+	/* writing it again keeps what it shares */
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	index = reopen_index();
+	cl_assert_equal_i(3, git_index_entrycount(index));
+	cl_assert_equal_i(8, git_index_get_bypath(index, "a.txt", 0)->file_size);
+	cl_assert(git_index_get_bypath(index, "b.txt", 0) == NULL);
+
+	git_str_dispose(&first);
+	git_str_dispose(&second);
+	git_index_free(index);
+}
+
+void test_index_splitindex__too_many_changes_write_new_shared_index(void)
+{
+	git_index *index;
+	git_str first = GIT_STR_INIT, second = GIT_STR_INIT;
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	add_file(index, "a.txt", "a\n");
+	add_file(index, "b.txt", "b\n");
+	add_file(index, "c.txt", "c\n");
+	add_file(index, "d.txt", "d\n");
+	add_file(index, "e.txt", "e\n");
+	cl_git_pass(git_index_write(index));
+	shared_index_path(&first, index);
+
+	/* one change in five is within the default of 20 percent */
+	add_file(index, "a.txt", "changed\n");
+	cl_git_pass(git_index_write(index));
+	shared_index_path(&second, index);
+	cl_assert_equal_s(first.ptr, second.ptr);
+
+	/* but two are not */
+	add_file(index, "b.txt", "changed\n");
+	cl_git_pass(git_index_write(index));
+	shared_index_path(&second, index);
+	cl_assert(strcmp(first.ptr, second.ptr) != 0);
+	git_index_free(index);
+
+	index = reopen_index();
+	cl_assert_equal_i(5, git_index_entrycount(index));
+	cl_assert_equal_i(8, git_index_get_bypath(index, "a.txt", 0)->file_size);
+	cl_assert_equal_i(8, git_index_get_bypath(index, "b.txt", 0)->file_size);
+
+	git_str_dispose(&first);
+	git_str_dispose(&second);
+	git_index_free(index);
+}
+
+void test_index_splitindex__expire_shared_indexes(void)
+{
+	git_index *index;
+
+	cl_repo_set_int(g_repo, "splitIndex.maxPercentChange", 0);
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	add_file(index, "a.txt", "a\n");
+	cl_git_pass(git_index_write(index));
+
+	/* the shared index from the fixture is not old enough to expire */
+	cl_assert_equal_i(2, count_shared_indexes());
+
+	cl_repo_set_string(g_repo, "splitIndex.sharedIndexExpire", "now");
+	add_file(index, "b.txt", "b\n");
+	cl_git_pass(git_index_write(index));
+	cl_assert_equal_i(1, count_shared_indexes());
+
+	git_index_free(index);
+}
+
+void test_index_splitindex__unsplit(void)
+{
+	git_index *index;
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	add_file(index, "a.txt", "a\n");
+	cl_git_pass(git_index_write(index));
+	cl_assert(index->split != NULL);
+
+	cl_repo_set_bool(g_repo, "core.splitIndex", false);
+	git_index_free(index);
+
+	index = reopen_index();
+	cl_git_pass(git_index_write(index));
+	cl_assert(index->split == NULL);
+	git_index_free(index);
+
+	cl_repo_set_bool(g_repo, "core.splitIndex", true);
+
+	index = reopen_index();
+	cl_assert_equal_i(1, git_index_entrycount(index));
+	cl_assert(index->split == NULL);
+	git_index_free(index);
 }
@@ -0,0 +1,257 @@
+#include "clar_libgit2.h"
+#include "futils.h"
+
+#include "index.h"
+#include "untracked-cache.h"
+
+static git_repository *g_repo;
+
+void test_index_untracked_cache__initialize(void)
+{
+	git_index *index;
+	git_config *cfg;
+
+	g_repo = cl_git_sandbox_init("empty_standard_repo");
+
+	cl_git_pass(git_repository_config(&cfg, g_repo));
+	cl_git_pass(git_config_set_bool(cfg, "core.untrackedcache", true));
+	cl_git_pass(git_config_set_bool(cfg, "core.trustctime", false));
+	git_config_free(cfg);
+
+	cl_must_pass(p_mkdir("empty_standard_repo/dir", 0777));
+	cl_git_mkfile("empty_standard_repo/tracked", "tracked\n");
+	cl_git_mkfile("empty_standard_repo/dir/tracked", "tracked\n");
+	cl_git_mkfile("empty_standard_repo/untracked", "untracked\n");
+	cl_git_mkfile("empty_standard_repo/dir/untracked", "untracked\n");
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_add_bypath(index, "tracked"));
+	cl_git_pass(git_index_add_bypath(index, "dir/tracked"));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+}
+
+void test_index_untracked_cache__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+/*
+ * Give the directories a timestamp well in the past, so that they can
+ * be cached, and so that changes to them can be hidden.
+ */
+static void age_directories(void)
+{
+	struct p_timeval times[2];
+
+	times[0].tv_sec = 1234567890;
+	times[0].tv_usec = 0;
+	times[1].tv_sec = 1234567890;
+	times[1].tv_usec = 0;
+
+	cl_must_pass(p_utimes("empty_standard_repo", times));
+	cl_must_pass(p_utimes("empty_standard_repo/dir", times));
+}
+
+/* Run a status that updates the index, returning the untracked paths */
+static void untracked_paths(git_str *out)
+{
+	git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+	git_status_list *status;
+	const git_status_entry *entry;
+	size_t i;
+
+	opts.flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED |
+	             GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS |
+	             GIT_STATUS_OPT_UPDATE_INDEX;
+
+	git_str_clear(out);
+	cl_git_pass(git_status_list_new(&status, g_repo, &opts));
+
+	for (i = 0; i < git_status_list_entrycount(status); i++) {
+		entry = git_status_byindex(status, i);
+
+		if (entry->status == GIT_STATUS_WT_NEW)
+			cl_git_pass(git_str_printf(out, "%s;",
+				entry->index_to_workdir->new_file.path));
+	}
+
+	git_status_list_free(status);
+}
+
+void test_index_untracked_cache__written_by_status(void)
+{
+	git_index *index;
+	git_untracked_cache_dir *root;
+	git_str paths = GIT_STR_INIT;
+
+	age_directories();
+	untracked_paths(&paths);
+	cl_assert_equal_s("dir/untracked;untracked;", paths.ptr);
+
+	/* read the cache back from disk */
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_read(index, true));
+
+	cl_assert(index->untracked);
+	cl_assert(git_untracked_cache_is_ours(index->untracked,
+		git_repository_workdir(g_repo)));
+
+	cl_assert((root = index->untracked->root) != NULL);
+	cl_assert(root->valid);
+	cl_assert_equal_sz(2, root->untracked.length);
+	cl_assert_equal_s(".git", git_vector_get(&root->untracked, 0));
+	cl_assert_equal_s("untracked", git_vector_get(&root->untracked, 1));
+	cl_assert_equal_sz(1, root->dirs.length);
+
+	untracked_paths(&paths);
+	cl_assert_equal_s("dir/untracked;untracked;", paths.ptr);
+
+	git_str_dispose(&paths);
+	git_index_free(index);
+}
+
+void test_index_untracked_cache__unchanged_directories_are_not_read(void)
+{
+	git_config *cfg;
+	git_str paths = GIT_STR_INIT;
+
+	age_directories();
+	untracked_paths(&paths);
+	cl_assert_equal_s("dir/untracked;untracked;", paths.ptr);
+
+	/*
+	 * Rename a file and hide it from the directory's stat data: the
+	 * cached listing is used, so the new name is not seen.
+	 */
+	cl_must_pass(p_rename("empty_standard_repo/dir/untracked",
+		"empty_standard_repo/dir/ghost"));
+	age_directories();
+
+	untracked_paths(&paths);
+	cl_assert_equal_s("untracked;", paths.ptr);
+
+	cl_git_pass(git_repository_config(&cfg, g_repo));
+	cl_git_pass(git_config_set_bool(cfg, "core.untrackedcache", false));
+	git_config_free(cfg);
+
+	untracked_paths(&paths);
+	cl_assert_equal_s("dir/ghost;untracked;", paths.ptr);
+
+	git_str_dispose(&paths);
+}
+
+void test_index_untracked_cache__changed_directories_are_read(void)
+{
+	git_str paths = GIT_STR_INIT;
+
+	age_directories();
+	untracked_paths(&paths);
+
+	cl_git_mkfile("empty_standard_repo/dir/new", "new\n");
+
+	untracked_paths(&paths);
+	cl_assert_equal_s("dir/new;dir/untracked;untracked;", paths.ptr);
+
+	git_str_dispose(&paths);
+}
+
+void test_index_untracked_cache__index_changes_invalidate(void)
+{
+	git_index *index;
+	git_str paths = GIT_STR_INIT;
+
+	age_directories();
+	untracked_paths(&paths);
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_remove_bypath(index, "dir/tracked"));
+	cl_git_pass(git_index_add_bypath(index, "dir/untracked"));
+	cl_git_pass(git_index_write(index));
+
+	untracked_paths(&paths);
+	cl_assert_equal_s("dir/tracked;untracked;", paths.ptr);
+
+	git_str_dispose(&paths);
+	git_index_free(index);
+}
+
+/* An extension written by git 2.39 */
+static const unsigned char git_extension[] = {
+	0x21, 0x4c, 0x6f, 0x63, 0x61, 0x74, 0x69, 0x6f, 0x6e, 0x20, 0x2f, 0x74,
+	0x6d, 0x70, 0x2f, 0x75, 0x6e, 0x74, 0x72, 0x2c, 0x20, 0x73, 0x79, 0x73,
+	0x74, 0x65, 0x6d, 0x20, 0x4c, 0x69, 0x6e, 0x75, 0x78, 0x00, 0x6a, 0xd3,
+	0x02, 0x3c, 0x2c, 0x02, 0xda, 0x58, 0x6a, 0xd3, 0x02, 0x3c, 0x2c, 0x02,
+	0xda, 0x58, 0x00, 0x00, 0xfe, 0x00, 0x00, 0xce, 0xa0, 0x8c, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xf0, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x06, 0xcc, 0x30, 0xca, 0x8b, 0x9b, 0x10, 0xbb, 0x92, 0xf8, 0xe5,
+	0xc9, 0x6e, 0xe9, 0x43, 0x48, 0xc6, 0xc4, 0xac, 0x93, 0xe6, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x2e, 0x67, 0x69, 0x74, 0x69, 0x67,
+	0x6e, 0x6f, 0x72, 0x65, 0x00, 0x03, 0x03, 0x01, 0x00, 0x2e, 0x67, 0x69,
+	0x74, 0x69, 0x67, 0x6e, 0x6f, 0x72, 0x65, 0x00, 0x7a, 0x2e, 0x6f, 0x00,
+	0x75, 0x00, 0x01, 0x01, 0x61, 0x00, 0x62, 0x2f, 0x00, 0x01, 0x00, 0x62,
+	0x00, 0x76, 0x00, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x02, 0x00,
+	0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x00,
+	0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x02, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00,
+	0x00, 0x00, 0x00, 0x6a, 0xd3, 0x02, 0x3c, 0x2c, 0x51, 0xe9, 0xc2, 0x6a,
+	0xd3, 0x02, 0x3c, 0x2c, 0x51, 0xe9, 0xc2, 0x00, 0x00, 0xfe, 0x00, 0x00,
+	0xce, 0xa0, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x10, 0x00, 0x6a, 0xd3, 0x02, 0x3c, 0x2c, 0x3c, 0xac, 0x61, 0x6a,
+	0xd3, 0x02, 0x3c, 0x2c, 0x3c, 0xac, 0x61, 0x00, 0x00, 0xfe, 0x00, 0x00,
+	0xce, 0xa0, 0xa4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x10, 0x00, 0x6a, 0xd3, 0x02, 0x3c, 0x2c, 0x51, 0xe9, 0xc2, 0x6a,
+	0xd3, 0x02, 0x3c, 0x2c, 0x51, 0xe9, 0xc2, 0x00, 0x00, 0xfe, 0x00, 0x00,
+	0xce, 0xa0, 0xb4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x10, 0x00, 0xf9, 0x7a, 0x7f, 0xa6, 0xb5, 0xdc, 0x2b, 0x14, 0x24,
+	0xca, 0x13, 0xc4, 0xe1, 0x80, 0x61, 0xfd, 0x44, 0x0e, 0x47, 0x75, 0x00,
+};
+
+void test_index_untracked_cache__read_and_write_git_format(void)
+{
+	git_untracked_cache *uc;
+	git_untracked_cache_dir *root, *a;
+	git_str out = GIT_STR_INIT;
+
+	cl_git_pass(git_untracked_cache_read(&uc, (const char *)git_extension,
+		sizeof(git_extension), GIT_OID_SHA1));
+
+	cl_assert_equal_s("Location /tmp/untr, system Linux", uc->ident.ptr);
+	cl_assert_equal_s(".gitignore", uc->exclude_per_dir);
+	cl_assert(!git_untracked_cache_is_ours(uc, "/tmp/untr/"));
+
+	cl_assert((root = uc->root) != NULL);
+	cl_assert(root->valid);
+	cl_assert_equal_sz(3, root->untracked.length);
+	cl_assert_equal_s("u", git_vector_get(&root->untracked, 2));
+
+	cl_assert_equal_sz(1, root->dirs.length);
+	a = git_vector_get(&root->dirs, 0);
+	cl_assert_equal_s("a", a->name);
+	cl_assert_equal_sz(1, a->untracked.length);
+	cl_assert_equal_s("b/", git_vector_get(&a->untracked, 0));
+
+	cl_git_pass(git_untracked_cache_write(&out, uc));
+	cl_assert_equal_sz(sizeof(git_extension), out.size);
+	cl_assert(memcmp(git_extension, out.ptr, out.size) == 0);
+
+	git_str_dispose(&out);
+	git_untracked_cache_free(uc);
+}
+
+void test_index_untracked_cache__read_invalid(void)
+{
+	git_untracked_cache *uc;
+
+	cl_git_fail(git_untracked_cache_read(&uc, (const char *)git_extension,
+		sizeof(git_extension) - 1, GIT_OID_SHA1));
+	cl_git_fail(git_untracked_cache_read(&uc, (const char *)git_extension,
+		64, GIT_OID_SHA1));
+}
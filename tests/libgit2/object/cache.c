@@ -1,4 +1,5 @@
 #include "clar_libgit2.h"
+#include "cache.h"
 #include "repository.h"
 
 static git_repository *g_repo;
@@ -274,3 +275,152 @@ void test_object_cache__fast_thread_rush(void)
 		g_repo = NULL;
 	}
 }
+
+void test_object_cache__statistics(void)
+{
+	size_t hits, misses, evictions;
+	size_t new_hits, new_misses, new_evictions;
+	git_oid oid;
+	git_object *obj;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATISTICS, &hits, &misses, &evictions));
+
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_oid__fromstr(&oid, g_data[4].sha, GIT_OID_SHA1));
+
+	cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJECT_ANY));
+	git_object_free(obj);
+
+	cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJECT_ANY));
+	git_object_free(obj);
+
+	/* statistics are folded into the global counters lazily */
+	git_repository_free(g_repo);
+	g_repo = NULL;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATISTICS, &new_hits, &new_misses, &new_evictions));
+	cl_assert_equal_sz(hits + 1, new_hits);
+	cl_assert(new_misses > misses);
+	cl_assert_equal_sz(evictions, new_evictions);
+}
+
+void test_object_cache__statistics_past_the_batch_size(void)
+{
+	git_cache cache;
+	git_oid oid;
+	size_t hits, misses, evictions, new_misses, i;
+
+	cl_git_pass(git_cache_init(&cache));
+	cl_git_pass(git_oid__fromstr(&oid, g_data[4].sha, GIT_OID_SHA1));
+
+	/* concurrent lookups may have taken the count past the batch size */
+	for (i = 0; i < GIT_CACHE_SHARDS; i++)
+		git_atomic32_set(&cache.shards[i].pending_misses, 1000);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATISTICS, &hits, &misses, &evictions));
+
+	cl_assert(git_cache_get_any(&cache, &oid) == NULL);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATISTICS, &hits, &new_misses, &evictions));
+	cl_assert_equal_sz(misses + 1001, new_misses);
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++)
+		git_atomic32_set(&cache.shards[i].pending_misses, 0);
+
+	git_cache_dispose(&cache);
+}
+
+struct scan_data {
+	git_odb *odb;
+	git_oid hot;
+	size_t seen;
+};
+
+static int scan_object(const git_oid *oid, void *payload)
+{
+	struct scan_data *data = payload;
+	git_odb_object *odb_obj;
+	git_object *obj;
+
+	cl_git_pass(git_odb_read(&odb_obj, data->odb, oid));
+	git_odb_object_free(odb_obj);
+
+	/* keep touching the hot object while scanning everything else */
+	if ((++data->seen % 4) == 0) {
+		cl_git_pass(git_object_lookup(&obj, g_repo, &data->hot, GIT_OBJECT_ANY));
+		git_object_free(obj);
+	}
+
+	return 0;
+}
+
+void test_object_cache__scan_resistance(void)
+{
+	ssize_t old_max_storage = git_cache__max_storage;
+	struct scan_data data = { 0 };
+	size_t hits, misses, evictions, new_evictions;
+	git_object *obj;
+
+	git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, (int)GIT_OBJECT_BLOB, (size_t)32767);
+	git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, (ssize_t)2048);
+
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_repository_odb(&data.odb, g_repo));
+	cl_git_pass(git_oid__fromstr(&data.hot, g_data[4].sha, GIT_OID_SHA1));
+
+	cl_git_pass(git_object_lookup(&obj, g_repo, &data.hot, GIT_OBJECT_ANY));
+	git_object_free(obj);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATISTICS, &hits, &misses, &evictions));
+	cl_git_pass(git_odb_foreach(data.odb, scan_object, &data));
+
+	cl_assert((obj = git_cache_get_parsed(&g_repo->objects, &data.hot)) != NULL);
+	git_object_free(obj);
+
+	git_odb_free(data.odb);
+	git_repository_free(g_repo);
+	g_repo = NULL;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATISTICS, &hits, &misses, &new_evictions));
+	cl_assert(new_evictions > evictions);
+	git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, old_max_storage);
+}
+
+void test_object_cache__type_budget(void)
+{
+	size_t i;
+	git_oid oid;
+	git_object *obj;
+
+	git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, (int)GIT_OBJECT_BLOB, (size_t)32767);
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CACHE_TYPE_MAX_SIZE, (int)GIT_OBJECT_BLOB, (ssize_t)16));
+	cl_git_fail(git_libgit2_opts(GIT_OPT_SET_CACHE_TYPE_MAX_SIZE, (int)GIT_OBJECT_BLOB, (ssize_t)-1));
+
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("testrepo.git")));
+
+	for (i = 0; g_data[i].sha != NULL; ++i) {
+		if (g_data[i].type != GIT_OBJECT_BLOB)
+			continue;
+
+		cl_git_pass(git_oid__fromstr(&oid, g_data[i].sha, GIT_OID_SHA1));
+		cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJECT_ANY));
+		git_object_free(obj);
+	}
+
+	/* at most one batch of blobs over the budget can be cached */
+	cl_assert(git_cache_size(&g_repo->objects) < 10);
+
+	/* the trees were not subject to the blob budget */
+	for (i = 0; g_data[i].sha != NULL; ++i) {
+		if (g_data[i].type != GIT_OBJECT_TREE)
+			continue;
+
+		cl_git_pass(git_oid__fromstr(&oid, g_data[i].sha, GIT_OID_SHA1));
+		cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJECT_ANY));
+		git_object_free(obj);
+	}
+
+	cl_assert(git_cache_size(&g_repo->objects) >= 4);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CACHE_TYPE_MAX_SIZE, (int)GIT_OBJECT_BLOB, (ssize_t)0));
+}
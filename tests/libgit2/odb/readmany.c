@@ -0,0 +1,100 @@
+#include "clar_libgit2.h"
+#include "array.h"
+#include "odb.h"
+
+static git_odb *_odb;
+static git_array_t(git_oid) _ids = GIT_ARRAY_INIT;
+
+static int collect_id(const git_oid *id, void *payload)
+{
+	git_oid *out;
+
+	GIT_UNUSED(payload);
+
+	out = git_array_alloc(_ids);
+	GIT_ERROR_CHECK_ALLOC(out);
+
+	git_oid_cpy(out, id);
+	return 0;
+}
+
+void test_odb_readmany__initialize(void)
+{
+	git_oid id;
+	size_t i, count;
+
+	/* testrepo.git has both loose and packed objects */
+	cl_git_pass(git_odb__open(&_odb, cl_fixture("testrepo.git/objects"), NULL));
+	cl_git_pass(git_odb_foreach(_odb, collect_id, NULL));
+
+	/* repeat them, so that there are enough to share out */
+	count = git_array_size(_ids);
+
+	for (i = 0; i < count * 7; i++) {
+		git_oid_cpy(&id, git_array_get(_ids, i));
+		cl_git_pass(collect_id(&id, NULL));
+	}
+}
+
+void test_odb_readmany__cleanup(void)
+{
+	git_array_clear(_ids);
+	git_odb_free(_odb);
+	_odb = NULL;
+}
+
+static void read_and_compare(unsigned int threads)
+{
+	git_odb_read_many_options opts = GIT_ODB_READ_MANY_OPTIONS_INIT;
+	git_odb_object **objects, *expected;
+	size_t i, count = git_array_size(_ids);
+
+	opts.threads = threads;
+
+	objects = git__calloc(count, sizeof(*objects));
+	cl_assert(objects);
+
+	cl_git_pass(git_odb_read_many(objects, _odb, _ids.ptr, count, &opts));
+
+	for (i = 0; i < count; i++) {
+		cl_assert(objects[i] != NULL);
+		cl_git_pass(git_odb_read(&expected, _odb, &_ids.ptr[i]));
+
+		cl_assert_equal_oid(&_ids.ptr[i], git_odb_object_id(objects[i]));
+		cl_assert_equal_i(git_odb_object_type(expected), git_odb_object_type(objects[i]));
+		cl_assert_equal_sz(git_odb_object_size(expected), git_odb_object_size(objects[i]));
+		cl_assert(memcmp(git_odb_object_data(expected),
+			git_odb_object_data(objects[i]), git_odb_object_size(expected)) == 0);
+
+		git_odb_object_free(expected);
+		git_odb_object_free(objects[i]);
+	}
+
+	git__free(objects);
+}
+
+void test_odb_readmany__matches_single_reads(void)
+{
+	read_and_compare(1);
+}
+
+void test_odb_readmany__threaded(void)
+{
+	read_and_compare(4);
+}
+
+void test_odb_readmany__missing_object(void)
+{
+	git_odb_object *objects[3] = { NULL };
+	git_oid ids[3];
+
+	git_oid_cpy(&ids[0], git_array_get(_ids, 0));
+	cl_git_pass(git_oid__fromstr(&ids[1], "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef", GIT_OID_SHA1));
+	git_oid_cpy(&ids[2], git_array_get(_ids, 1));
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_odb_read_many(objects, _odb, ids, 3, NULL));
+
+	cl_assert(objects[0] == NULL);
+	cl_assert(objects[1] == NULL);
+	cl_assert(objects[2] == NULL);
+}
@@ -0,0 +1,453 @@
+#include "clar_libgit2.h"
+#include "ewah.h"
+#include "futils.h"
+#include "midx.h"
+#include "mwindow.h"
+#include "odb.h"
+#include "pack.h"
+#include "pack-bitmap.h"
+#include "pack-objects.h"
+#include "repository.h"
+
+static git_repository *_repo;
+static git_str _pack_path = GIT_STR_INIT;
+
+void test_pack_bitmap__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+}
+
+void test_pack_bitmap__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+	_repo = NULL;
+	git_str_dispose(&_pack_path);
+}
+
+void test_pack_bitmap__ewah_roundtrip(void)
+{
+	git_bitmap bitmap = GIT_BITMAP_INIT, read = GIT_BITMAP_INIT;
+	git_str buf = GIT_STR_INIT;
+	size_t i, size, pos, expected = 0;
+
+	/* a run of zeroes, a run of ones, then scattered bits */
+	for (i = 200; i < 450; i++) {
+		cl_git_pass(git_bitmap_set(&bitmap, i));
+		expected++;
+	}
+
+	for (i = 1000; i < 2000; i += 7) {
+		cl_git_pass(git_bitmap_set(&bitmap, i));
+		expected++;
+	}
+
+	cl_git_pass(git_ewah_write(&buf, &bitmap, 2048));
+	cl_git_pass(git_ewah_size(&size, (const unsigned char *)buf.ptr, buf.size));
+	cl_assert_equal_sz(buf.size, size);
+
+	cl_git_pass(git_ewah_xor(&read, (const unsigned char *)buf.ptr, buf.size));
+	cl_assert_equal_sz(expected, git_bitmap_popcount(&read));
+
+	for (pos = 0, i = 0; git_bitmap_next(&pos, &read); pos++, i++)
+		cl_assert(git_bitmap_get(&bitmap, pos));
+
+	cl_assert_equal_sz(expected, i);
+
+	/* XOR-ing the same bitmap again clears it */
+	cl_git_pass(git_ewah_xor(&read, (const unsigned char *)buf.ptr, buf.size));
+	cl_assert_equal_sz(0, git_bitmap_popcount(&read));
+
+	cl_git_fail(git_ewah_xor(&read, (const unsigned char *)buf.ptr, buf.size - 5));
+
+	git_bitmap_dispose(&bitmap);
+	git_bitmap_dispose(&read);
+	git_str_dispose(&buf);
+}
+
+static void write_bitmapped_pack(void)
+{
+	git_packbuilder *pb;
+	git_revwalk *walk;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "refs/heads/*"));
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	cl_git_pass(git_packbuilder_set_write_bitmap(pb, 1));
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+	cl_git_pass(git_packbuilder_write(pb, NULL, 0, NULL, NULL));
+
+	git_str_clear(&_pack_path);
+	cl_git_pass(git_str_printf(&_pack_path, "%s/objects/pack/pack-%s",
+		git_repository_path(_repo), git_packbuilder_name(pb)));
+
+	git_packbuilder_free(pb);
+	git_revwalk_free(walk);
+
+	/* pick up the new pack and its bitmap */
+	_repo = cl_git_sandbox_reopen();
+}
+
+static void build_pack(git_packbuilder **out, bool use_bitmaps)
+{
+	git_revwalk *walk;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_ref(walk, "refs/heads/master"));
+	cl_git_pass(git_revwalk_hide_ref(walk, "refs/heads/br2"));
+
+	cl_git_pass(git_packbuilder_new(out, _repo));
+	(*out)->use_bitmaps = use_bitmaps;
+	cl_git_pass(git_packbuilder_insert_walk(*out, walk));
+
+	git_revwalk_free(walk);
+}
+
+void test_pack_bitmap__write_and_read(void)
+{
+	git_pack_bitmap *bitmap;
+	git_odb *odb;
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, _repo));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_odb__get_pack_bitmap(&bitmap, odb));
+
+	write_bitmapped_pack();
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, _repo));
+	cl_git_pass(git_odb__get_pack_bitmap(&bitmap, odb));
+	cl_assert(git_pack_bitmap_object_count(bitmap) > 0);
+}
+
+void test_pack_bitmap__enumeration_matches_walk(void)
+{
+	git_packbuilder *walked, *bitmapped;
+	size_t i;
+
+	write_bitmapped_pack();
+
+	build_pack(&walked, false);
+	build_pack(&bitmapped, true);
+
+	cl_assert(git_packbuilder_object_count(walked) > 0);
+	cl_assert_equal_sz(git_packbuilder_object_count(walked),
+		git_packbuilder_object_count(bitmapped));
+
+	for (i = 0; i < walked->nr_objects; i++) {
+		git_pobject *po = git_oidmap_get(bitmapped->object_ix,
+			&walked->object_list[i].id);
+
+		cl_assert(po != NULL);
+		cl_assert_equal_i(walked->object_list[i].type, po->type);
+	}
+
+	git_packbuilder_free(walked);
+	git_packbuilder_free(bitmapped);
+}
+
+static void assert_sizes_resolved(git_packbuilder *pb)
+{
+	git_object_t type;
+	size_t i, size;
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		git_pobject *po = pb->object_list + i;
+
+		cl_assert(po->size_valid);
+
+		/* a reused delta is sized by its delta data, as in git */
+		if (po->reuse_delta) {
+			cl_assert_equal_sz(po->delta_size, po->size);
+			continue;
+		}
+
+		cl_git_pass(git_odb_read_header(&size, &type, pb->odb, &po->id));
+		cl_assert_equal_sz(size, po->size);
+		cl_assert_equal_i(type, po->type);
+	}
+}
+
+void test_pack_bitmap__enumeration_defers_sizes(void)
+{
+	git_packbuilder *pb;
+	size_t i;
+
+	write_bitmapped_pack();
+
+	build_pack(&pb, true);
+
+	/* objects come with their type, but nothing is read yet */
+	for (i = 0; i < pb->nr_objects; i++)
+		cl_assert(!pb->object_list[i].size_valid);
+
+	cl_git_pass(git_packbuilder__prepare(pb));
+	assert_sizes_resolved(pb);
+	cl_git_pass(git_packbuilder_write(pb, NULL, 0, NULL, NULL));
+
+	git_packbuilder_free(pb);
+
+	/* without reusing, nothing is copied from the bitmapped pack */
+	build_pack(&pb, true);
+	pb->reuse_objects = false;
+
+	cl_git_pass(git_packbuilder__prepare(pb));
+	assert_sizes_resolved(pb);
+	cl_git_pass(git_packbuilder_write(pb, NULL, 0, NULL, NULL));
+
+	git_packbuilder_free(pb);
+}
+
+void test_pack_bitmap__ahead_behind(void)
+{
+	git_oid master, br2, subtrees;
+	size_t ahead, behind;
+
+	cl_git_pass(git_reference_name_to_id(&master, _repo, "refs/heads/master"));
+	cl_git_pass(git_reference_name_to_id(&br2, _repo, "refs/heads/br2"));
+	cl_git_pass(git_reference_name_to_id(&subtrees, _repo, "refs/heads/subtrees"));
+
+	write_bitmapped_pack();
+
+	cl_git_pass(git_graph_ahead_behind(&ahead, &behind, _repo, &master, &br2));
+	cl_assert_equal_sz(2, ahead);
+	cl_assert_equal_sz(1, behind);
+
+	cl_git_pass(git_graph_ahead_behind(&ahead, &behind, _repo, &subtrees, &master));
+	cl_assert_equal_sz(1, ahead);
+	cl_assert_equal_sz(4, behind);
+}
+
+typedef git_array_t(uint32_t) pack_order_array;
+
+static void read_pack_order(pack_order_array *out, off64_t *disk_size)
+{
+	struct git_pack_file *p;
+	git_str idx_path = GIT_STR_INIT;
+	off64_t offset, next, size;
+	uint32_t pos, *index_pos;
+
+	cl_git_pass(git_str_printf(&idx_path, "%s.idx", _pack_path.ptr));
+	cl_git_pass(git_mwindow_get_pack(&p, idx_path.ptr, 0));
+	cl_git_pass(git_packfile_revindex_load(p));
+
+	*disk_size = 0;
+
+	for (pos = 0; pos < p->num_objects; pos++) {
+		cl_assert((index_pos = git_array_alloc(*out)) != NULL);
+		cl_git_pass(git_packfile_pack_pos_to_index(index_pos, p, pos));
+
+		cl_git_pass(git_packfile_pack_pos_to_offset(&offset, p, pos));
+		cl_git_pass(git_packfile_pack_pos_to_offset(&next, p, pos + 1));
+		cl_assert(offset < next);
+
+		cl_git_pass(git_packfile_object_disk_size(&size, p, offset));
+		cl_assert_equal_i(next - offset, size);
+		*disk_size += size;
+	}
+
+	cl_assert_equal_i(GIT_ENOTFOUND, git_packfile_offset_to_pack_pos(&pos, p, 1));
+
+	git_mwindow_put_pack(p);
+	git_str_dispose(&idx_path);
+}
+
+void test_pack_bitmap__reverse_index(void)
+{
+	pack_order_array from_file = GIT_ARRAY_INIT, computed = GIT_ARRAY_INIT;
+	git_str rev_path = GIT_STR_INIT;
+	off64_t file_size, computed_size;
+	struct stat st;
+
+	write_bitmapped_pack();
+
+	cl_git_pass(git_str_printf(&rev_path, "%s.rev", _pack_path.ptr));
+	cl_assert(git_fs_path_exists(rev_path.ptr));
+
+	read_pack_order(&from_file, &file_size);
+
+	/* without the ".rev" file the same order is computed from the index */
+	cl_git_pass(p_unlink(rev_path.ptr));
+	read_pack_order(&computed, &computed_size);
+
+	cl_assert(from_file.size > 0);
+	cl_assert_equal_sz(from_file.size, computed.size);
+	cl_assert(memcmp(from_file.ptr, computed.ptr,
+		from_file.size * sizeof(uint32_t)) == 0);
+
+	/* every byte between the header and the trailer belongs to an object */
+	git_str_clear(&rev_path);
+	cl_git_pass(git_str_printf(&rev_path, "%s.pack", _pack_path.ptr));
+	cl_git_pass(p_stat(rev_path.ptr, &st));
+	cl_assert_equal_i(st.st_size - 12 - GIT_OID_SHA1_SIZE, file_size);
+	cl_assert_equal_i(file_size, computed_size);
+
+	git_array_clear(from_file);
+	git_array_clear(computed);
+	git_str_dispose(&rev_path);
+}
+
+void test_pack_bitmap__enumeration_records_location(void)
+{
+	git_packbuilder *pb;
+	git_pobject *po;
+	off64_t size;
+	size_t i;
+
+	write_bitmapped_pack();
+	build_pack(&pb, true);
+
+	cl_assert(pb->nr_objects > 0);
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		po = &pb->object_list[i];
+
+		cl_assert(po->in_pack != NULL);
+		cl_git_pass(git_packfile_object_disk_size(&size, po->in_pack,
+			po->in_pack_offset));
+		cl_assert_equal_i(size, po->in_pack_size);
+	}
+
+	git_packbuilder_free(pb);
+}
+
+static void write_pack(git_str *idx_name, const char *push, const char *hide)
+{
+	git_packbuilder *pb;
+	git_revwalk *walk;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+
+	if (strchr(push, '*'))
+		cl_git_pass(git_revwalk_push_glob(walk, push));
+	else
+		cl_git_pass(git_revwalk_push_ref(walk, push));
+
+	if (hide)
+		cl_git_pass(git_revwalk_hide_ref(walk, hide));
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+	cl_git_pass(git_packbuilder_write(pb, NULL, 0, NULL, NULL));
+
+	cl_git_pass(git_str_printf(idx_name, "pack-%s.idx", git_packbuilder_name(pb)));
+
+	git_packbuilder_free(pb);
+	git_revwalk_free(walk);
+}
+
+/* Write two packs that only together hold every commit, and a midx bitmap */
+static void write_midx_bitmap(git_str *bitmap_path)
+{
+	git_midx_writer *w;
+	git_midx_file *midx;
+	git_str pack_dir = GIT_STR_INIT, first = GIT_STR_INIT, second = GIT_STR_INIT;
+
+	write_pack(&first, "refs/heads/br2", NULL);
+	write_pack(&second, "refs/heads/*", "refs/heads/br2");
+
+	cl_git_pass(git_str_joinpath(&pack_dir, git_repository_path(_repo), "objects/pack"));
+
+#ifdef GIT_EXPERIMENTAL_SHA256
+	cl_git_pass(git_midx_writer_new(&w, pack_dir.ptr, GIT_OID_SHA1));
+#else
+	cl_git_pass(git_midx_writer_new(&w, pack_dir.ptr));
+#endif
+	cl_git_pass(git_midx_writer_set_write_bitmap(w, _repo));
+	cl_git_pass(git_midx_writer_add(w, first.ptr));
+	cl_git_pass(git_midx_writer_add(w, second.ptr));
+	cl_git_pass(git_midx_writer_commit(w));
+	git_midx_writer_free(w);
+
+	/* the bitmap is named after the multi-pack-index */
+	cl_git_pass(git_str_joinpath(&_pack_path, pack_dir.ptr, "multi-pack-index"));
+	cl_git_pass(git_midx_open(&midx, _pack_path.ptr, GIT_OID_SHA1));
+	cl_git_pass(git_str_printf(bitmap_path, "%s-", _pack_path.ptr));
+	cl_git_pass(git_str_encode_hexstr(bitmap_path,
+		(const char *)midx->checksum, GIT_OID_SHA1_SIZE));
+	cl_git_pass(git_str_puts(bitmap_path, ".bitmap"));
+	git_midx_free(midx);
+
+	git_str_dispose(&pack_dir);
+	git_str_dispose(&first);
+	git_str_dispose(&second);
+
+	_repo = cl_git_sandbox_reopen();
+}
+
+void test_pack_bitmap__midx_write_and_read(void)
+{
+	git_pack_bitmap *bitmap;
+	git_midx_file *midx;
+	git_odb *odb;
+	git_str bitmap_path = GIT_STR_INIT;
+
+	/* the midx bitmap is preferred over that of a single pack */
+	write_bitmapped_pack();
+	cl_git_mkfile("testrepo.git/objects/pack/multi-pack-index-0000.bitmap", "stale");
+	write_midx_bitmap(&bitmap_path);
+
+	cl_assert(git_fs_path_isfile(bitmap_path.ptr));
+	cl_assert(!git_fs_path_exists("testrepo.git/objects/pack/multi-pack-index-0000.bitmap"));
+
+	cl_git_pass(git_midx_open(&midx, _pack_path.ptr, GIT_OID_SHA1));
+	cl_assert(midx->revindex != NULL);
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, _repo));
+	cl_git_pass(git_odb__get_pack_bitmap(&bitmap, odb));
+	cl_assert_equal_sz(midx->num_objects, git_pack_bitmap_object_count(bitmap));
+
+	git_midx_free(midx);
+	git_str_dispose(&bitmap_path);
+}
+
+void test_pack_bitmap__midx_enumeration_matches_walk(void)
+{
+	git_packbuilder *walked, *bitmapped;
+	git_pobject *po;
+	git_str bitmap_path = GIT_STR_INIT;
+	off64_t size;
+	size_t i;
+
+	write_midx_bitmap(&bitmap_path);
+
+	build_pack(&walked, false);
+	build_pack(&bitmapped, true);
+
+	cl_assert(git_packbuilder_object_count(walked) > 0);
+	cl_assert_equal_sz(git_packbuilder_object_count(walked),
+		git_packbuilder_object_count(bitmapped));
+
+	for (i = 0; i < walked->nr_objects; i++) {
+		po = git_oidmap_get(bitmapped->object_ix, &walked->object_list[i].id);
+
+		cl_assert(po != NULL);
+		cl_assert_equal_i(walked->object_list[i].type, po->type);
+
+		/* objects are found in whichever pack the midx picked */
+		cl_assert(po->in_pack != NULL);
+		cl_git_pass(git_packfile_object_disk_size(&size, po->in_pack,
+			po->in_pack_offset));
+		cl_assert_equal_i(size, po->in_pack_size);
+	}
+
+	git_packbuilder_free(walked);
+	git_packbuilder_free(bitmapped);
+	git_str_dispose(&bitmap_path);
+}
+
+void test_pack_bitmap__midx_ahead_behind(void)
+{
+	git_oid master, br2;
+	git_str bitmap_path = GIT_STR_INIT;
+	size_t ahead, behind;
+
+	cl_git_pass(git_reference_name_to_id(&master, _repo, "refs/heads/master"));
+	cl_git_pass(git_reference_name_to_id(&br2, _repo, "refs/heads/br2"));
+
+	write_midx_bitmap(&bitmap_path);
+
+	cl_git_pass(git_graph_ahead_behind(&ahead, &behind, _repo, &master, &br2));
+	cl_assert_equal_sz(2, ahead);
+	cl_assert_equal_sz(1, behind);
+
+	git_str_dispose(&bitmap_path);
+}
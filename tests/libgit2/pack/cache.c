@@ -0,0 +1,116 @@
+#include "clar_libgit2.h"
+#include "pack.h"
+
+static size_t old_max_storage, old_max_object;
+
+void test_pack_cache__initialize(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHE_MAX_SIZE, &old_max_storage, &old_max_object));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 0));
+}
+
+void test_pack_cache__cleanup(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_CACHE_MAX_SIZE, old_max_storage, old_max_object));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 1));
+}
+
+static int read_object(const git_oid *id, void *payload)
+{
+	git_odb *odb = payload;
+	git_odb_object *obj;
+
+	cl_git_pass(git_odb_read(&obj, odb, id));
+	git_odb_object_free(obj);
+
+	return 0;
+}
+
+static void read_all_objects(size_t *hits, size_t *inflations, size_t *evictions)
+{
+	size_t start_hits, start_inflations, start_evictions;
+	git_odb *odb;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHE_STATISTICS,
+		&start_hits, &start_inflations, &start_evictions));
+
+	cl_git_pass(git_odb_open(&odb, cl_fixture("testrepo.git/objects")));
+	cl_git_pass(git_odb_foreach(odb, read_object, odb));
+	git_odb_free(odb);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHE_STATISTICS,
+		hits, inflations, evictions));
+
+	*hits -= start_hits;
+	*inflations -= start_inflations;
+	*evictions -= start_evictions;
+}
+
+void test_pack_cache__options(void)
+{
+	size_t max_storage, max_object;
+
+	cl_assert_equal_sz(GIT_PACK_CACHE_MEMORY_LIMIT, old_max_storage);
+	cl_assert_equal_sz(GIT_PACK_CACHE_SIZE_LIMIT, old_max_object);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_CACHE_MAX_SIZE, (size_t)4096, (size_t)1024));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHE_MAX_SIZE, &max_storage, &max_object));
+
+	cl_assert_equal_sz(4096, max_storage);
+	cl_assert_equal_sz(1024, max_object);
+}
+
+void test_pack_cache__reuses_bases(void)
+{
+	size_t hits, inflations, evictions;
+
+	read_all_objects(&hits, &inflations, &evictions);
+
+	cl_assert(hits > 0);
+	cl_assert(inflations > 0);
+	cl_assert_equal_sz(0, evictions);
+}
+
+void test_pack_cache__disabled(void)
+{
+	size_t hits, inflations, evictions;
+	size_t cached_inflations;
+
+	read_all_objects(&hits, &cached_inflations, &evictions);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_CACHE_MAX_SIZE, (size_t)0, (size_t)0));
+	read_all_objects(&hits, &inflations, &evictions);
+
+	cl_assert_equal_sz(0, hits);
+	cl_assert_equal_sz(0, evictions);
+	cl_assert(inflations > cached_inflations);
+}
+
+void test_pack_cache__evicts_least_recently_used(void)
+{
+	size_t hits, inflations, evictions;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_CACHE_MAX_SIZE, (size_t)2048, (size_t)1024));
+	read_all_objects(&hits, &inflations, &evictions);
+
+	cl_assert(evictions > 0);
+}
+
+void test_pack_cache__budget_is_shared_by_all_packs(void)
+{
+	git_odb *odb;
+	size_t used;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_CACHE_MAX_SIZE, (size_t)8192, (size_t)1024));
+
+	cl_git_pass(git_odb_open(&odb, cl_fixture("testrepo.git/objects")));
+	cl_git_pass(git_odb_foreach(odb, read_object, odb));
+
+	used = git_pack__cache_memory_used();
+	cl_assert(used > 0);
+	cl_assert(used <= 8192);
+
+	/* the cached bases are released along with their packfiles */
+	git_odb_free(odb);
+	cl_assert_equal_sz(0, git_pack__cache_memory_used());
+}
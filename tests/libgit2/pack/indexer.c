@@ -25,6 +25,26 @@ static const unsigned char out_of_order_pack[] = {
 };
 static const unsigned int out_of_order_pack_len = 112;
 
+/*
+ * The out of order packfile, with its first delta in it twice.
+ */
+static const unsigned char duplicate_delta_pack[] = {
+  0x50, 0x41, 0x43, 0x4b, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x04,
+  0x32, 0x78, 0x9c, 0x63, 0x67, 0x00, 0x00, 0x00, 0x10, 0x00, 0x08, 0x76,
+  0xe6, 0x8f, 0xe8, 0x12, 0x9b, 0x54, 0x6b, 0x10, 0x1a, 0xee, 0x95, 0x10,
+  0xc5, 0x32, 0x8e, 0x7f, 0x21, 0xca, 0x1d, 0x18, 0x78, 0x9c, 0x63, 0x62,
+  0x66, 0x4e, 0xcb, 0xcf, 0x07, 0x00, 0x02, 0xac, 0x01, 0x4d, 0x75, 0x01,
+  0xd7, 0x71, 0x36, 0x66, 0xf4, 0xde, 0x82, 0x27, 0x76, 0xc7, 0x62, 0x2c,
+  0x10, 0xf1, 0xb0, 0x7d, 0xe2, 0x80, 0xdc, 0x78, 0x9c, 0x63, 0x62, 0x62,
+  0x62, 0xb7, 0x03, 0x00, 0x00, 0x69, 0x00, 0x4c, 0x76, 0xe6, 0x8f, 0xe8,
+  0x12, 0x9b, 0x54, 0x6b, 0x10, 0x1a, 0xee, 0x95, 0x10, 0xc5, 0x32, 0x8e,
+  0x7f, 0x21, 0xca, 0x1d, 0x18, 0x78, 0x9c, 0x63, 0x62, 0x66, 0x4e, 0xcb,
+  0xcf, 0x07, 0x00, 0x02, 0xac, 0x01, 0x4d, 0x31, 0x40, 0x70, 0xb7, 0x49,
+  0xa8, 0xa5, 0x81, 0x0f, 0x7c, 0xc7, 0x6f, 0xdf, 0xff, 0x35, 0xc9, 0x38,
+  0x08, 0x91, 0xbd
+};
+static const unsigned int duplicate_delta_pack_len = 147;
+
 /*
  * Packfile with two objects. The second is a delta against an object
  * which is not in the packfile
@@ -322,6 +342,244 @@ void test_pack_indexer__out_of_order_with_connectivity_checks(void)
 	git_indexer_free(idx);
 }
 
+void test_pack_indexer__out_of_order_threaded(void)
+{
+	git_indexer_options opts = GIT_INDEXER_OPTIONS_INIT;
+	git_indexer *idx = 0;
+	git_indexer_progress stats = { 0 };
+
+	opts.verify = 1;
+	opts.threads = 4;
+
+#ifdef GIT_EXPERIMENTAL_SHA256
+	cl_git_pass(git_indexer_new(&idx, ".", GIT_OID_SHA1, &opts));
+#else
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, &opts));
+#endif
+
+	cl_git_pass(git_indexer_append(
+		idx, out_of_order_pack, out_of_order_pack_len, &stats));
+	cl_git_pass(git_indexer_commit(idx, &stats));
+
+	cl_assert_equal_i(stats.total_objects, 3);
+	cl_assert_equal_i(stats.received_objects, 3);
+	cl_assert_equal_i(stats.indexed_objects, 3);
+	cl_assert_equal_i(stats.indexed_deltas, 2);
+
+	git_indexer_free(idx);
+}
+
+void test_pack_indexer__duplicate_delta_threaded(void)
+{
+	git_indexer_options opts = GIT_INDEXER_OPTIONS_INIT;
+	git_indexer *idx = 0;
+	git_indexer_progress stats = { 0 };
+	unsigned int threads[] = { 1, 4 };
+	size_t i;
+
+	cl_git_pass(git_futils_mkdir("duplicate", 0777, 0));
+
+	/* the duplicate is skipped and left unresolved, on any number of threads */
+	for (i = 0; i < ARRAY_SIZE(threads); i++) {
+		opts.threads = threads[i];
+
+#ifdef GIT_EXPERIMENTAL_SHA256
+		cl_git_pass(git_indexer_new(&idx, "duplicate", GIT_OID_SHA1, &opts));
+#else
+		cl_git_pass(git_indexer_new(&idx, "duplicate", 0, NULL, &opts));
+#endif
+
+		cl_git_pass(git_indexer_append(
+			idx, duplicate_delta_pack, duplicate_delta_pack_len, &stats));
+		cl_git_fail(git_indexer_commit(idx, &stats));
+
+		cl_assert_equal_i(stats.total_objects, 4);
+		cl_assert_equal_i(stats.indexed_objects, 3);
+
+		git_indexer_free(idx);
+	}
+
+	cl_git_pass(git_futils_rmdir_r("duplicate", NULL, GIT_RMDIR_REMOVE_FILES));
+}
+
+void test_pack_indexer__fix_thin_threaded(void)
+{
+	git_indexer *idx = NULL;
+	git_indexer_progress stats = { 0 };
+	git_repository *repo;
+	git_odb *odb;
+	git_oid id;
+	git_indexer_options opts = GIT_INDEXER_OPTIONS_INIT;
+
+	cl_git_pass(git_repository_init(&repo, "thin.git", true));
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_git_pass(git_odb_write(&id, odb, base_obj, base_obj_len, GIT_OBJECT_BLOB));
+
+	opts.threads = 2;
+
+#ifdef GIT_EXPERIMENTAL_SHA256
+	opts.odb = odb;
+	cl_git_pass(git_indexer_new(&idx, ".", GIT_OID_SHA1, &opts));
+#else
+	cl_git_pass(git_indexer_new(&idx, ".", 0, odb, &opts));
+#endif
+
+	cl_git_pass(git_indexer_append(idx, thin_pack, thin_pack_len, &stats));
+	cl_git_pass(git_indexer_commit(idx, &stats));
+
+	cl_assert_equal_i(stats.total_objects, 2);
+	cl_assert_equal_i(stats.indexed_objects, 2);
+	cl_assert_equal_i(stats.local_objects, 1);
+	cl_assert_equal_s("fefdb2d740a3a6b6c03a0c7d6ce431c6d5810e13", git_indexer_name(idx));
+
+	git_indexer_free(idx);
+	git_odb_free(odb);
+	git_repository_free(repo);
+}
+
+static void index_pack_with_options(
+	git_str *idx_out,
+	git_indexer_progress *stats,
+	const char *dir,
+	const char *packfile,
+	git_indexer_options *opts,
+	size_t chunk_size)
+{
+	git_indexer *idx;
+	git_str pack = GIT_STR_INIT, path = GIT_STR_INIT;
+	size_t offset, len;
+
+	cl_git_pass(git_futils_mkdir(dir, 0777, 0));
+	cl_git_pass(git_futils_readbuffer(&pack, packfile));
+
+#ifdef GIT_EXPERIMENTAL_SHA256
+	cl_git_pass(git_indexer_new(&idx, dir, GIT_OID_SHA1, opts));
+#else
+	cl_git_pass(git_indexer_new(&idx, dir, 0, NULL, opts));
+#endif
+
+	for (offset = 0; offset < pack.size; offset += len) {
+		len = min(chunk_size, pack.size - offset);
+		cl_git_pass(git_indexer_append(idx, pack.ptr + offset, len, stats));
+	}
+
+	cl_git_pass(git_indexer_commit(idx, stats));
+
+	cl_git_pass(git_str_printf(&path, "%s/pack-%s.idx", dir, git_indexer_name(idx)));
+	cl_git_pass(git_futils_readbuffer(idx_out, path.ptr));
+
+	git_indexer_free(idx);
+	git_str_dispose(&path);
+	git_str_dispose(&pack);
+}
+
+void test_pack_indexer__threaded_matches_single_threaded(void)
+{
+	const char *packfile = cl_fixture("testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.pack");
+	git_indexer_progress single_stats = { 0 }, threaded_stats = { 0 };
+	git_str single = GIT_STR_INIT, threaded = GIT_STR_INIT;
+
+	git_indexer_options opts = GIT_INDEXER_OPTIONS_INIT;
+
+	opts.threads = 1;
+	index_pack_with_options(&single, &single_stats, "single", packfile, &opts, SIZE_MAX);
+
+	opts.threads = 8;
+	index_pack_with_options(&threaded, &threaded_stats, "threaded", packfile, &opts, SIZE_MAX);
+
+	cl_assert(single_stats.indexed_deltas > 0);
+	cl_assert_equal_i(single_stats.total_objects, threaded_stats.total_objects);
+	cl_assert_equal_i(single_stats.indexed_objects, threaded_stats.indexed_objects);
+	cl_assert_equal_i(single_stats.indexed_deltas, threaded_stats.indexed_deltas);
+	cl_assert_equal_i(single_stats.total_deltas, threaded_stats.total_deltas);
+
+	cl_assert_equal_i(single.size, threaded.size);
+	cl_assert(memcmp(single.ptr, threaded.ptr, single.size) == 0);
+
+	git_str_dispose(&single);
+	git_str_dispose(&threaded);
+}
+
+static int count_progress(const git_indexer_progress *stats, void *payload)
+{
+	size_t *calls = payload;
+
+	GIT_UNUSED(stats);
+
+	(*calls)++;
+	return 0;
+}
+
+void test_pack_indexer__pipelined_matches_sequential(void)
+{
+	const char *packfile = cl_fixture("testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.pack");
+	git_indexer_options opts = GIT_INDEXER_OPTIONS_INIT;
+	git_indexer_progress sequential_stats = { 0 }, pipelined_stats = { 0 };
+	git_str sequential = GIT_STR_INIT, pipelined = GIT_STR_INIT;
+	size_t calls = 0;
+
+	index_pack_with_options(&sequential, &sequential_stats, "sequential", packfile, &opts, 97);
+
+	opts.pipeline = 1;
+	opts.progress_cb = count_progress;
+	opts.progress_cb_payload = &calls;
+	index_pack_with_options(&pipelined, &pipelined_stats, "pipelined", packfile, &opts, 97);
+
+	cl_assert(calls > 0);
+	cl_assert_equal_i(sequential_stats.total_objects, pipelined_stats.total_objects);
+	cl_assert_equal_i(sequential_stats.received_objects, pipelined_stats.received_objects);
+	cl_assert_equal_i(sequential_stats.indexed_objects, pipelined_stats.indexed_objects);
+	cl_assert_equal_i(sequential_stats.indexed_deltas, pipelined_stats.indexed_deltas);
+
+	cl_assert_equal_i(sequential.size, pipelined.size);
+	cl_assert(memcmp(sequential.ptr, pipelined.ptr, sequential.size) == 0);
+
+	git_str_dispose(&sequential);
+	git_str_dispose(&pipelined);
+}
+
+void test_pack_indexer__pipelined_reports_errors(void)
+{
+	git_indexer_options opts = GIT_INDEXER_OPTIONS_INIT;
+	git_indexer *idx = 0;
+	git_indexer_progress stats = { 0 };
+
+	opts.pipeline = 1;
+
+#ifdef GIT_EXPERIMENTAL_SHA256
+	cl_git_pass(git_indexer_new(&idx, ".", GIT_OID_SHA1, &opts));
+#else
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, &opts));
+#endif
+
+	/* errors surface from a later append or from the commit */
+	if (git_indexer_append(idx, leaky_pack, leaky_pack_len, &stats) == 0)
+		cl_git_fail(git_indexer_commit(idx, &stats));
+
+	cl_assert(git_error_last() != NULL);
+	cl_assert_equal_i(git_error_last()->klass, GIT_ERROR_INDEXER);
+
+	git_indexer_free(idx);
+}
+
+void test_pack_indexer__pipelined_free_without_commit(void)
+{
+	git_indexer_options opts = GIT_INDEXER_OPTIONS_INIT;
+	git_indexer *idx = 0;
+	git_indexer_progress stats = { 0 };
+
+	opts.pipeline = 1;
+
+#ifdef GIT_EXPERIMENTAL_SHA256
+	cl_git_pass(git_indexer_new(&idx, ".", GIT_OID_SHA1, &opts));
+#else
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, &opts));
+#endif
+
+	cl_git_pass(git_indexer_append(idx, out_of_order_pack, 40, &stats));
+	git_indexer_free(idx);
+}
+
 static int find_tmp_file_recurs(void *opaque, git_str *path)
 {
 	int error = 0;
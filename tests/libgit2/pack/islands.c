@@ -0,0 +1,196 @@
+#include "clar_libgit2.h"
+#include "ewah.h"
+#include "pack-objects.h"
+#include "repository.h"
+
+static git_repository *_repo;
+static git_oid _base, _fork_a, _fork_b;
+static git_oid _shared_blob, _blob_a, _blob_b;
+
+#define LINE_COUNT 400
+
+static void create_blob(git_oid *out, const char *who)
+{
+	git_str content = GIT_STR_INIT;
+	size_t line;
+
+	for (line = 0; line < LINE_COUNT; line++)
+		cl_git_pass(git_str_printf(&content, "line %" PRIuZ " of a file %s\n",
+			line, (line % 50 == 0) ? who : "everyone has"));
+
+	cl_git_pass(git_blob_create_from_buffer(out, _repo, content.ptr, content.size));
+	git_str_dispose(&content);
+}
+
+static void create_commit(
+	git_oid *out,
+	const char *path,
+	const git_oid *blob,
+	const git_oid *parent_id)
+{
+	git_treebuilder *tb;
+	git_signature *sig;
+	git_commit *parent = NULL;
+	git_tree *tree;
+	git_oid tree_id;
+
+	cl_git_pass(git_treebuilder_new(&tb, _repo, NULL));
+	cl_git_pass(git_treebuilder_insert(NULL, tb, path, blob, GIT_FILEMODE_BLOB));
+	cl_git_pass(git_treebuilder_write(&tree_id, tb));
+	cl_git_pass(git_tree_lookup(&tree, _repo, &tree_id));
+
+	if (parent_id)
+		cl_git_pass(git_commit_lookup(&parent, _repo, parent_id));
+
+	cl_git_pass(git_signature_new(&sig, "Islands", "islands@example.com", 1700000000, 0));
+	cl_git_pass(git_commit_create(out, _repo, NULL, sig, sig, NULL, path,
+		tree, parent ? 1 : 0, (const git_commit **)&parent));
+
+	git_signature_free(sig);
+	git_commit_free(parent);
+	git_tree_free(tree);
+	git_treebuilder_free(tb);
+}
+
+/*
+ * Two forks that share a base commit, each adding a file that is much
+ * like the shared one and the other fork's.
+ */
+void test_pack_islands__initialize(void)
+{
+	git_config *config;
+
+	cl_git_pass(git_repository_init(&_repo, "islands.git", true));
+
+	create_blob(&_shared_blob, "everyone has");
+	create_blob(&_blob_a, "fork a has");
+	create_blob(&_blob_b, "fork b has");
+
+	create_commit(&_base, "shared.txt", &_shared_blob, NULL);
+	create_commit(&_fork_a, "a.txt", &_blob_a, &_base);
+	create_commit(&_fork_b, "b.txt", &_blob_b, &_base);
+
+	cl_git_pass(git_reference_create(NULL, _repo, "refs/forks/a/heads/main", &_fork_a, 0, NULL));
+	cl_git_pass(git_reference_create(NULL, _repo, "refs/forks/b/heads/main", &_fork_b, 0, NULL));
+	cl_git_pass(git_reference_create(NULL, _repo, "refs/forks/b/tags/v1", &_fork_b, 0, NULL));
+
+	cl_git_pass(git_repository_config(&config, _repo));
+	cl_git_pass(git_config_set_string(config, "pack.island", "refs/forks/([a-z]+)/"));
+	git_config_free(config);
+}
+
+void test_pack_islands__cleanup(void)
+{
+	git_repository_free(_repo);
+	_repo = NULL;
+
+	cl_fixture_cleanup("islands.git");
+}
+
+static git_packbuilder *build_pack(bool islands, bool with_base)
+{
+	git_packbuilder *pb;
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	cl_git_pass(git_packbuilder_set_delta_islands(pb, islands));
+
+	cl_git_pass(git_packbuilder_insert_commit(pb, &_fork_a));
+	cl_git_pass(git_packbuilder_insert_commit(pb, &_fork_b));
+
+	if (with_base)
+		cl_git_pass(git_packbuilder_insert_commit(pb, &_base));
+
+	cl_git_pass(git_packbuilder__prepare(pb));
+	return pb;
+}
+
+static git_pobject *pack_object(git_packbuilder *pb, const git_oid *id)
+{
+	git_pobject *po = git_oidmap_get(pb->object_ix, id);
+
+	cl_assert(po != NULL);
+	return po;
+}
+
+void test_pack_islands__objects_are_on_the_islands_of_their_refs(void)
+{
+	git_packbuilder *pb = build_pack(true, true);
+
+	cl_assert(pb->islands != NULL);
+
+	cl_assert_equal_sz(2, git_bitmap_popcount(pack_object(pb, &_base)->islands));
+	cl_assert_equal_sz(2, git_bitmap_popcount(pack_object(pb, &_shared_blob)->islands));
+	cl_assert_equal_sz(1, git_bitmap_popcount(pack_object(pb, &_fork_a)->islands));
+	cl_assert_equal_sz(1, git_bitmap_popcount(pack_object(pb, &_blob_b)->islands));
+
+	cl_assert(!git_bitmap_is_subset(pack_object(pb, &_blob_a)->islands,
+		pack_object(pb, &_blob_b)->islands));
+	cl_assert(git_bitmap_is_subset(pack_object(pb, &_blob_a)->islands,
+		pack_object(pb, &_shared_blob)->islands));
+
+	git_packbuilder_free(pb);
+}
+
+void test_pack_islands__no_deltas_across_islands(void)
+{
+	git_packbuilder *pb;
+
+	/* the two files are close enough to be stored as deltas ... */
+	pb = build_pack(false, false);
+	cl_assert(pack_object(pb, &_blob_a)->delta || pack_object(pb, &_blob_b)->delta);
+	git_packbuilder_free(pb);
+
+	/* ... but not when the forks are kept apart */
+	pb = build_pack(true, false);
+	cl_assert(pack_object(pb, &_blob_a)->delta == NULL);
+	cl_assert(pack_object(pb, &_blob_b)->delta == NULL);
+	git_packbuilder_free(pb);
+}
+
+void test_pack_islands__deltas_against_shared_objects(void)
+{
+	git_packbuilder *pb = build_pack(true, true);
+	git_pobject *shared = pack_object(pb, &_shared_blob);
+	git_pobject *a = pack_object(pb, &_blob_a);
+	git_pobject *b = pack_object(pb, &_blob_b);
+
+	/* the forks may use what they share, but not the other way around */
+	cl_assert(shared->delta == NULL);
+	cl_assert(a->delta == NULL || a->delta == shared);
+	cl_assert(b->delta == NULL || b->delta == shared);
+	cl_assert(a->delta || b->delta);
+
+	git_packbuilder_free(pb);
+}
+
+void test_pack_islands__stored_deltas_across_islands_are_not_reused(void)
+{
+	git_packbuilder *pb;
+	git_odb *odb;
+	size_t i;
+
+	/* store the objects with deltas that cross the islands */
+	pb = build_pack(false, true);
+	cl_assert(pack_object(pb, &_shared_blob)->delta ||
+		pack_object(pb, &_blob_a)->delta == pack_object(pb, &_blob_b) ||
+		pack_object(pb, &_blob_b)->delta == pack_object(pb, &_blob_a));
+	cl_git_pass(git_packbuilder_write(pb, NULL, 0, NULL, NULL));
+	git_packbuilder_free(pb);
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, _repo));
+	cl_git_pass(git_odb_refresh(odb));
+
+	pb = build_pack(true, true);
+	cl_assert(pack_object(pb, &_shared_blob)->delta == NULL);
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		git_pobject *po = &pb->object_list[i];
+
+		cl_assert(po->in_pack != NULL);
+
+		if (po->delta)
+			cl_assert(git_bitmap_is_subset(po->islands, po->delta->islands));
+	}
+
+	git_packbuilder_free(pb);
+}
@@ -114,3 +114,66 @@ void test_pack_midx__odb_create(void)
 
 	cl_git_pass(git_futils_rmdir_r("./clone.git", NULL, GIT_RMDIR_REMOVE_FILES));
 }
+
+void test_pack_midx__reverse_index(void)
+{
+	git_repository *repo;
+	git_midx_writer *w = NULL;
+	git_midx_file *idx;
+	git_midx_entry e, found, prev = {0};
+	git_buf midx = GIT_BUF_INIT;
+	git_str path = GIT_STR_INIT, midx_path = GIT_STR_INIT;
+	uint32_t pos, index_pos;
+
+	cl_git_pass(git_repository_open(&repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_str_joinpath(&path, git_repository_path(repo), "objects/pack"));
+
+	/* the fixture was written by git without a reverse index */
+	cl_git_pass(git_str_joinpath(&midx_path, path.ptr, "multi-pack-index"));
+	cl_git_pass(git_midx_open(&idx, midx_path.ptr, GIT_OID_SHA1));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_midx_entry_at_pack_pos(&e, NULL, idx, 0));
+	git_midx_free(idx);
+
+#ifdef GIT_EXPERIMENTAL_SHA256
+	cl_git_pass(git_midx_writer_new(&w, git_str_cstr(&path), GIT_OID_SHA1));
+#else
+	cl_git_pass(git_midx_writer_new(&w, git_str_cstr(&path)));
+#endif
+	cl_git_pass(git_midx_writer_set_write_reverse_index(w, 1));
+	cl_git_pass(git_midx_writer_add(w, "pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5.idx"));
+	cl_git_pass(git_midx_writer_add(w, "pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a.idx"));
+	cl_git_pass(git_midx_writer_add(w, "pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx"));
+	cl_git_pass(git_midx_writer_dump(&midx, w));
+
+	idx = git__calloc(1, sizeof(git_midx_file));
+	cl_assert(idx);
+	idx->oid_type = GIT_OID_SHA1;
+	cl_git_pass(git_midx_parse(idx, (const unsigned char *)midx.ptr, midx.size));
+	cl_assert(idx->revindex != NULL);
+
+	/* objects come out sorted by pack, then by offset */
+	for (pos = 0; pos < idx->num_objects; pos++) {
+		cl_git_pass(git_midx_entry_at_pack_pos(&e, &index_pos, idx, pos));
+		cl_git_pass(git_midx_entry_find(&found, idx, &e.sha1, GIT_OID_SHA1_HEXSIZE));
+		cl_assert_equal_i(0, git_oid_raw_cmp(e.sha1.id,
+			idx->oid_lookup + index_pos * GIT_OID_SHA1_SIZE, GIT_OID_SHA1_SIZE));
+		cl_assert_equal_sz(found.pack_index, e.pack_index);
+		cl_assert_equal_i(found.offset, e.offset);
+
+		if (pos > 0)
+			cl_assert(prev.pack_index < e.pack_index ||
+				(prev.pack_index == e.pack_index && prev.offset < e.offset));
+
+		memcpy(&prev, &e, sizeof(e));
+	}
+
+	cl_git_fail(git_midx_entry_at_pack_pos(&e, NULL, idx, pos));
+
+	git_vector_free(&idx->packfile_names);
+	git__free(idx);
+	git_buf_dispose(&midx);
+	git_str_dispose(&midx_path);
+	git_str_dispose(&path);
+	git_midx_writer_free(w);
+	git_repository_free(repo);
+}
@@ -1,6 +1,8 @@
 #include "clar_libgit2.h"
 #include "futils.h"
+#include "mwindow.h"
 #include "pack.h"
+#include "pack-objects.h"
 #include "hash.h"
 #include "iterator.h"
 #include "vector.h"
@@ -301,3 +303,290 @@ void test_pack_packbuilder__keep_file_check(void)
 	cl_git_pass(git_libgit2_opts(GIT_OPT_DISABLE_PACK_KEEP_FILE_CHECKS, true));
 	assert(git_disable_pack_keep_file_checks);
 }
+
+static int insert_object_cb(const git_oid *id, void *payload)
+{
+	return git_packbuilder_insert((git_packbuilder *)payload, id, NULL);
+}
+
+static size_t write_all_objects(bool reuse_objects)
+{
+	git_odb *odb;
+	struct git_pack_file *p;
+	struct git_pack_entry e;
+	git_str path = GIT_STR_INIT;
+	size_t i, reused = 0;
+
+	git_packbuilder_free(_packbuilder);
+	cl_git_pass(git_packbuilder_new(&_packbuilder, _repo));
+	_packbuilder->reuse_objects = reuse_objects;
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, _repo));
+	cl_git_pass(git_odb_foreach(odb, insert_object_cb, _packbuilder));
+
+	git_indexer_free(_indexer);
+#ifdef GIT_EXPERIMENTAL_SHA256
+	cl_git_pass(git_indexer_new(&_indexer, ".", GIT_OID_SHA1, NULL));
+#else
+	cl_git_pass(git_indexer_new(&_indexer, ".", 0, NULL, NULL));
+#endif
+
+	cl_git_pass(git_packbuilder_foreach(_packbuilder, feed_indexer, &_stats));
+	cl_git_pass(git_indexer_commit(_indexer, &_stats));
+	cl_assert_equal_i(_packbuilder->nr_objects, _stats.indexed_objects);
+
+	/* the indexer hashed every object, so they all came through intact */
+	cl_git_pass(git_str_printf(&path, "pack-%s.idx", git_indexer_name(_indexer)));
+	cl_git_pass(git_mwindow_get_pack(&p, path.ptr, 0));
+
+	for (i = 0; i < _packbuilder->nr_objects; i++) {
+		cl_git_pass(git_pack_entry_find(&e, p,
+			&_packbuilder->object_list[i].id, GIT_OID_SHA1_HEXSIZE));
+
+		if (_packbuilder->object_list[i].reuse_delta)
+			reused++;
+	}
+
+	git_mwindow_put_pack(p);
+	git_str_dispose(&path);
+	return reused;
+}
+
+void test_pack_packbuilder__reuses_stored_deltas(void)
+{
+	size_t reused, total;
+
+	reused = write_all_objects(true);
+	total = _packbuilder->nr_objects;
+	cl_assert(reused > 0);
+
+	cl_assert_equal_sz(0, write_all_objects(false));
+	cl_assert_equal_sz(total, _packbuilder->nr_objects);
+}
+
+/* As in pack-objects.c */
+#define WRITE_CHUNK_SIZE (128 * 1024)
+#define LARGE_BLOB_SIZE (3 * WRITE_CHUNK_SIZE + 1000)
+
+struct written_pack {
+	git_str data;
+	size_t chunks;
+	size_t unaligned; /* chunks other than the last that were not aligned */
+	size_t last_size;
+};
+
+static int collect_pack_cb(void *buf, size_t len, void *payload)
+{
+	struct written_pack *pack = payload;
+
+	if (pack->chunks && pack->last_size % WRITE_CHUNK_SIZE)
+		pack->unaligned++;
+
+	pack->chunks++;
+	pack->last_size = len;
+	return git_str_put(&pack->data, buf, len);
+}
+
+/* A blob that does not compress, so the pack spans several chunks */
+static void create_large_blob(git_oid *out)
+{
+	unsigned char *data;
+	uint32_t x = 0x9e3779b9;
+	size_t i;
+
+	data = git__malloc(LARGE_BLOB_SIZE);
+	cl_assert(data != NULL);
+
+	for (i = 0; i < LARGE_BLOB_SIZE; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		data[i] = (unsigned char)x;
+	}
+
+	cl_git_pass(git_blob_create_from_buffer(out, _repo, data, LARGE_BLOB_SIZE));
+	git__free(data);
+}
+
+static void index_pack(const git_str *pack, size_t expected_objects)
+{
+	git_indexer_free(_indexer);
+#ifdef GIT_EXPERIMENTAL_SHA256
+	cl_git_pass(git_indexer_new(&_indexer, ".", GIT_OID_SHA1, NULL));
+#else
+	cl_git_pass(git_indexer_new(&_indexer, ".", 0, NULL, NULL));
+#endif
+
+	memset(&_stats, 0, sizeof(_stats));
+	cl_git_pass(git_indexer_append(_indexer, pack->ptr, pack->size, &_stats));
+	cl_git_pass(git_indexer_commit(_indexer, &_stats));
+	cl_assert_equal_sz(expected_objects, _stats.indexed_objects);
+}
+
+static void write_large_pack(
+	struct written_pack *out,
+	const git_oid *large_id,
+	unsigned int threads,
+	size_t window)
+{
+	git_packbuilder *pb;
+	git_revwalk *walk;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_ref(walk, "HEAD"));
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+	cl_git_pass(git_packbuilder_insert(pb, large_id, "large"));
+
+	/* search for deltas on a single thread, so both packs find the same */
+	git_packbuilder_set_threads(pb, 1);
+	cl_git_pass(git_packbuilder__prepare(pb));
+
+	git_packbuilder_set_threads(pb, threads);
+	cl_git_pass(git_packbuilder_set_write_window(pb, window));
+	cl_git_pass(git_packbuilder_foreach(pb, collect_pack_cb, out));
+	cl_assert_equal_sz(git_packbuilder_object_count(pb), git_packbuilder_written(pb));
+
+	index_pack(&out->data, git_packbuilder_object_count(pb));
+
+	git_packbuilder_free(pb);
+	git_revwalk_free(walk);
+}
+
+void test_pack_packbuilder__threaded_write_matches_single_threaded(void)
+{
+	struct written_pack single = { GIT_STR_INIT }, threaded = { GIT_STR_INIT };
+	git_oid large_id;
+
+	create_large_blob(&large_id);
+
+	write_large_pack(&single, &large_id, 1, GIT_PACK_WRITE_WINDOW);
+
+	/* a window smaller than any object still lets the pack through */
+	write_large_pack(&threaded, &large_id, 4, 1);
+
+	cl_assert(single.data.size > LARGE_BLOB_SIZE);
+	cl_assert(single.chunks > 1);
+	cl_assert_equal_sz(0, single.unaligned);
+	cl_assert_equal_sz(0, threaded.unaligned);
+
+	cl_assert_equal_sz(single.data.size, threaded.data.size);
+	cl_assert(memcmp(single.data.ptr, threaded.data.ptr, single.data.size) == 0);
+
+	git_str_dispose(&single.data);
+	git_str_dispose(&threaded.data);
+}
+
+void test_pack_packbuilder__write_fd(void)
+{
+	git_str pack = GIT_STR_INIT;
+	int fd;
+
+	seed_packbuilder();
+
+	fd = p_open("streamed.pack", O_CREAT | O_WRONLY | O_TRUNC, 0666);
+	cl_assert(fd >= 0);
+	cl_git_pass(git_packbuilder_write_fd(_packbuilder, fd));
+	cl_git_pass(p_close(fd));
+
+	cl_git_pass(git_futils_readbuffer(&pack, "streamed.pack"));
+	index_pack(&pack, git_packbuilder_object_count(_packbuilder));
+
+	git_str_dispose(&pack);
+}
+
+static void insert_revisions(
+	git_packbuilder *pb,
+	const char *name,
+	size_t revisions,
+	size_t lines)
+{
+	git_str content = GIT_STR_INIT;
+	git_oid id;
+	size_t rev, line;
+
+	for (rev = 0; rev < revisions; rev++) {
+		git_str_clear(&content);
+
+		for (line = 0; line < lines; line++)
+			cl_git_pass(git_str_printf(&content, "%s line %" PRIuZ " revision %" PRIuZ "\n",
+				name, line, (line % 7 == rev % 7) ? rev : 0));
+
+		cl_git_pass(git_blob_create_from_buffer(&id, _repo, content.ptr, content.size));
+		cl_git_pass(git_packbuilder_insert(pb, &id, name));
+	}
+
+	git_str_dispose(&content);
+}
+
+void test_pack_packbuilder__threaded_delta_search(void)
+{
+	git_str pack = GIT_STR_INIT;
+	size_t i, deltas = 0;
+
+	git_packbuilder_set_threads(_packbuilder, 4);
+
+	/* a few large files among many small ones */
+	insert_revisions(_packbuilder, "small", 60, 20);
+	insert_revisions(_packbuilder, "large", 4, 20000);
+
+	cl_git_pass(git_packbuilder__prepare(_packbuilder));
+
+	for (i = 0; i < _packbuilder->nr_objects; i++)
+		deltas += (_packbuilder->object_list[i].delta != NULL);
+
+	cl_assert(deltas > 0);
+
+#ifdef GIT_THREADS
+	{
+		git_packbuilder_delta_stats *stats;
+		size_t searched = 0;
+
+		cl_assert_equal_sz(4, git_array_size(_packbuilder->delta_stats));
+
+		git_array_foreach(_packbuilder->delta_stats, i, stats)
+			searched += stats->objects;
+
+		cl_assert_equal_sz(64, searched);
+	}
+#endif
+
+	cl_git_pass(git_packbuilder__write_buf(&pack, _packbuilder));
+	index_pack(&pack, 64);
+
+	git_str_dispose(&pack);
+}
+
+/* Flip the CRC32 of every entry in the pack's version 2 index */
+static void corrupt_index_crcs(const char *path)
+{
+	git_str idx = GIT_STR_INIT;
+	unsigned char *data;
+	size_t i, nr, crcs;
+
+	cl_git_pass(git_futils_readbuffer(&idx, path));
+	data = (unsigned char *)idx.ptr;
+	cl_assert(idx.size > 8 + 256 * 4 && data[7] == 2);
+
+	nr = ntohl(*(uint32_t *)(data + 8 + 255 * 4));
+	crcs = 8 + 256 * 4 + nr * GIT_OID_SHA1_SIZE;
+	cl_assert(crcs + nr * 4 <= idx.size);
+
+	for (i = 0; i < nr * 4; i++)
+		data[crcs + i] ^= 0xff;
+
+	cl_git_pass(p_chmod(path, 0666));
+	cl_git_pass(git_futils_writebuffer(&idx, path, O_WRONLY | O_TRUNC, 0666));
+	git_str_dispose(&idx);
+}
+
+void test_pack_packbuilder__corrupt_entries_are_not_reused(void)
+{
+	corrupt_index_crcs("objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx");
+	corrupt_index_crcs("objects/pack/pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5.idx");
+	corrupt_index_crcs("objects/pack/pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a.idx");
+
+	/* every object is compressed anew, and still comes through intact */
+	cl_assert_equal_sz(0, write_all_objects(true));
+}
@@ -0,0 +1,176 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+#include "array.h"
+
+/* This test requires a repository with a reasonably long history;
+ * like the merge test, we use the libgit2 repository itself.
+ */
+#define SRC_REPO (cl_fixture("../.."))
+
+/* Walk this many commits, diffing each one against its first parent */
+#define COMMIT_COUNT 500
+
+static void mixed_workload(ssize_t max_storage)
+{
+	git_repository *repo;
+	git_revwalk *walk;
+	git_oid id;
+	git_commit *commit, *parent;
+	git_tree *tree, *parent_tree;
+	git_diff *diff;
+	perf_timer t = PERF_TIMER_INIT;
+	size_t hits, misses, evictions;
+	size_t new_hits, new_misses, new_evictions;
+	size_t count = 0;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, max_storage));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATISTICS, &hits, &misses, &evictions));
+
+	perf__timer__start(&t);
+
+	cl_git_pass(git_repository_open(&repo, SRC_REPO));
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_head(walk));
+
+	while (count++ < COMMIT_COUNT && git_revwalk_next(&id, walk) == 0) {
+		cl_git_pass(git_commit_lookup(&commit, repo, &id));
+		cl_git_pass(git_commit_tree(&tree, commit));
+
+		if (git_commit_parentcount(commit) > 0) {
+			cl_git_pass(git_commit_parent(&parent, commit, 0));
+			cl_git_pass(git_commit_tree(&parent_tree, parent));
+			cl_git_pass(git_diff_tree_to_tree(&diff, repo, parent_tree, tree, NULL));
+
+			git_diff_free(diff);
+			git_tree_free(parent_tree);
+			git_commit_free(parent);
+		}
+
+		git_tree_free(tree);
+		git_commit_free(commit);
+	}
+
+	git_revwalk_free(walk);
+
+	perf__timer__stop(&t);
+
+	/* the cache publishes the last of its statistics when it is freed */
+	git_repository_free(repo);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATISTICS, &new_hits, &new_misses, &new_evictions));
+
+	new_hits -= hits;
+	new_misses -= misses;
+	new_evictions -= evictions;
+
+	perf__timer__report(&t, "cache %" PRIuZ "kb: %" PRIuZ " hits, %" PRIuZ " misses (%.1f%% hit rate), %" PRIuZ " evictions",
+		(size_t)(max_storage / 1024), new_hits, new_misses,
+		(new_hits + new_misses) ? (100.0 * new_hits) / (new_hits + new_misses) : 0.0,
+		new_evictions);
+}
+
+void test_perf_cache__revwalk_and_diff(void)
+{
+	ssize_t sizes[] = { 64 * 1024, 512 * 1024, 4 * 1024 * 1024, 256 * 1024 * 1024 };
+	ssize_t old_storage, old_max_storage;
+	size_t i;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY, &old_storage, &old_max_storage));
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++)
+		mixed_workload(sizes[i]);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, old_max_storage));
+}
+
+#define LOOKUP_ROUNDS 2000
+
+struct lookup_data {
+	git_repository *repo;
+	git_oid *ids;
+	size_t ids_len;
+	size_t offset;
+};
+
+static void *lookup_objects(void *payload)
+{
+	struct lookup_data *data = payload;
+	git_object *obj;
+	size_t i, round;
+
+	for (round = 0; round < LOOKUP_ROUNDS; round++) {
+		for (i = 0; i < data->ids_len; i++) {
+			const git_oid *id = &data->ids[(i + data->offset) % data->ids_len];
+
+			cl_git_pass(git_object_lookup(&obj, data->repo, id, GIT_OBJECT_ANY));
+			git_object_free(obj);
+		}
+	}
+
+	return NULL;
+}
+
+void test_perf_cache__thread_scaling(void)
+{
+	size_t thread_counts[] = { 1, 2, 4, 8, 16, 32 };
+	git_repository *repo;
+	git_revwalk *walk;
+	git_array_t(git_oid) ids = GIT_ARRAY_INIT;
+	git_oid id, *entry;
+	size_t i, t;
+
+	cl_git_pass(git_repository_open(&repo, SRC_REPO));
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_head(walk));
+
+	while (git_array_size(ids) < 256 && git_revwalk_next(&id, walk) == 0) {
+		cl_assert((entry = git_array_alloc(ids)) != NULL);
+		git_oid_cpy(entry, &id);
+	}
+
+	git_revwalk_free(walk);
+
+	for (t = 0; t < ARRAY_SIZE(thread_counts); t++) {
+		struct lookup_data *data;
+		perf_timer timer = PERF_TIMER_INIT;
+#ifdef GIT_THREADS
+		git_thread *threads;
+
+		threads = git__calloc(thread_counts[t], sizeof(git_thread));
+		cl_assert(threads);
+#endif
+		data = git__calloc(thread_counts[t], sizeof(struct lookup_data));
+		cl_assert(data);
+
+		perf__timer__start(&timer);
+
+		for (i = 0; i < thread_counts[t]; i++) {
+			data[i].repo = repo;
+			data[i].ids = ids.ptr;
+			data[i].ids_len = git_array_size(ids);
+			data[i].offset = i * 7;
+
+#ifdef GIT_THREADS
+			cl_git_pass(git_thread_create(&threads[i], lookup_objects, &data[i]));
+#else
+			lookup_objects(&data[i]);
+#endif
+		}
+
+#ifdef GIT_THREADS
+		for (i = 0; i < thread_counts[t]; i++)
+			cl_git_pass(git_thread_join(&threads[i], NULL));
+
+		git__free(threads);
+#endif
+
+		perf__timer__stop(&timer);
+		perf__timer__report(&timer, "%" PRIuZ " threads, %" PRIuZ " lookups each",
+			thread_counts[t], (size_t)LOOKUP_ROUNDS * git_array_size(ids));
+
+		git__free(data);
+	}
+
+	git_array_clear(ids);
+	git_repository_free(repo);
+}
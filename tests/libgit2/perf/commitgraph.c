@@ -0,0 +1,274 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+#include "commit_graph.h"
+#include "odb.h"
+#include "futils.h"
+
+#include <git2/sys/commit_graph.h>
+
+/*
+ * Build a linear history where every commit changes one of many files,
+ * and the file we look at changes rarely, then follow the history of
+ * that single file with and without the commit-graph's changed-path
+ * Bloom filters.  Raise COMMIT_COUNT (to 500000, say) for numbers that
+ * look like a large repository.
+ */
+#define COMMIT_COUNT 5000
+#define DIR_COUNT 32
+#define FILES_PER_DIR 32
+#define TARGET_INTERVAL 97
+#define TARGET_PATH "dir0/file0.txt"
+
+static git_repository *repo;
+static git_oid head;
+
+void test_perf_commitgraph__initialize(void)
+{
+	git_signature *sig;
+	git_tree_update update;
+	git_tree *tree = NULL, *new_tree;
+	git_commit *parent = NULL;
+	git_treebuilder *tb;
+	git_str path = GIT_STR_INIT, content = GIT_STR_INIT;
+	git_oid blob_id, tree_id;
+	size_t i, file;
+
+	cl_git_pass(git_repository_init(&repo, "commitgraph.git", true));
+	cl_git_pass(git_signature_new(&sig, "Perf", "perf@example.com", 1700000000, 0));
+
+	cl_git_pass(git_treebuilder_new(&tb, repo, NULL));
+	cl_git_pass(git_treebuilder_write(&tree_id, tb));
+	cl_git_pass(git_tree_lookup(&tree, repo, &tree_id));
+	git_treebuilder_free(tb);
+
+	for (i = 0; i < COMMIT_COUNT; i++) {
+		file = (i % TARGET_INTERVAL == 0) ? 0 :
+			1 + (i % (DIR_COUNT * FILES_PER_DIR - 1));
+
+		git_str_clear(&path);
+		git_str_clear(&content);
+		cl_git_pass(git_str_printf(&path, "dir%" PRIuZ "/file%" PRIuZ ".txt",
+			file / FILES_PER_DIR, file % FILES_PER_DIR));
+		cl_git_pass(git_str_printf(&content, "revision %" PRIuZ "\n", i));
+
+		cl_git_pass(git_blob_create_from_buffer(&blob_id, repo, content.ptr, content.size));
+
+		update.action = GIT_TREE_UPDATE_UPSERT;
+		update.filemode = GIT_FILEMODE_BLOB;
+		update.path = path.ptr;
+		git_oid_cpy(&update.id, &blob_id);
+
+		cl_git_pass(git_tree_create_updated(&tree_id, repo, tree, 1, &update));
+		cl_git_pass(git_tree_lookup(&new_tree, repo, &tree_id));
+		cl_git_pass(git_commit_create(&head, repo, NULL, sig, sig, NULL,
+			content.ptr, new_tree, parent ? 1 : 0,
+			(const git_commit **)&parent));
+
+		git_tree_free(tree);
+		git_commit_free(parent);
+		tree = new_tree;
+		cl_git_pass(git_commit_lookup(&parent, repo, &head));
+	}
+
+	cl_git_pass(git_reference_create(NULL, repo, "refs/heads/master", &head, true, NULL));
+
+	git_str_dispose(&path);
+	git_str_dispose(&content);
+	git_tree_free(tree);
+	git_commit_free(parent);
+	git_signature_free(sig);
+}
+
+void test_perf_commitgraph__cleanup(void)
+{
+	git_repository_free(repo);
+	cl_fixture_cleanup("commitgraph.git");
+}
+
+static void write_commit_graph(int changed_paths)
+{
+	git_commit_graph_writer_options opts = GIT_COMMIT_GRAPH_WRITER_OPTIONS_INIT;
+	git_commit_graph_writer *w;
+	git_revwalk *walk;
+	git_odb *odb;
+	perf_timer t = PERF_TIMER_INIT;
+
+	opts.changed_paths = changed_paths;
+
+	perf__timer__start(&t);
+
+#ifdef GIT_EXPERIMENTAL_SHA256
+	cl_git_pass(git_commit_graph_writer_new(&w, "commitgraph.git/objects/info", GIT_OID_SHA1));
+#else
+	cl_git_pass(git_commit_graph_writer_new(&w, "commitgraph.git/objects/info"));
+#endif
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push(walk, &head));
+	cl_git_pass(git_commit_graph_writer_add_revwalk(w, walk));
+	cl_git_pass(git_commit_graph_writer_commit(w, &opts));
+
+	perf__timer__stop(&t);
+	perf__timer__report(&t, "write commit-graph%s",
+		changed_paths ? " with changed-path filters" : "");
+
+	git_revwalk_free(walk);
+	git_commit_graph_writer_free(w);
+
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_git_pass(git_odb_refresh(odb));
+	git_odb_free(odb);
+}
+
+static bool path_changed(git_commit *commit)
+{
+	git_commit *parent = NULL;
+	git_tree *tree, *parent_tree = NULL;
+	git_tree_entry *entry = NULL, *parent_entry = NULL;
+	bool changed;
+
+	cl_git_pass(git_commit_tree(&tree, commit));
+	git_tree_entry_bypath(&entry, tree, TARGET_PATH);
+
+	if (git_commit_parentcount(commit) > 0) {
+		cl_git_pass(git_commit_parent(&parent, commit, 0));
+		cl_git_pass(git_commit_tree(&parent_tree, parent));
+		git_tree_entry_bypath(&parent_entry, parent_tree, TARGET_PATH);
+	}
+
+	if (!entry || !parent_entry)
+		changed = (entry != parent_entry);
+	else
+		changed = !git_oid_equal(git_tree_entry_id(entry), git_tree_entry_id(parent_entry));
+
+	git_tree_entry_free(entry);
+	git_tree_entry_free(parent_entry);
+	git_tree_free(tree);
+	git_tree_free(parent_tree);
+	git_commit_free(parent);
+	return changed;
+}
+
+/* The equivalent of `git log --format=%H -- <path>`. */
+static void single_file_log(bool use_filters)
+{
+	git_commit_graph_file *file = NULL;
+	git_commit_graph_bloom_key key = { 0 };
+	git_commit_graph_entry entry;
+	git_revwalk *walk;
+	git_commit *commit;
+	git_odb *odb;
+	git_oid id;
+	size_t found = 0, skipped = 0;
+	perf_timer t = PERF_TIMER_INIT;
+
+	perf__timer__start(&t);
+
+	if (use_filters) {
+		cl_git_pass(git_repository_odb(&odb, repo));
+		cl_git_pass(git_odb__get_commit_graph_file(&file, odb));
+		cl_git_pass(git_commit_graph_bloom_key_init(&key, file, TARGET_PATH));
+		git_odb_free(odb);
+	}
+
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push(walk, &head));
+
+	while (git_revwalk_next(&id, walk) == 0) {
+		if (use_filters &&
+		    git_commit_graph_entry_find(&entry, file, &id, GIT_OID_SHA1_HEXSIZE) == 0 &&
+		    git_commit_graph_bloom_maybe_changed(file, &entry, &key) == 0) {
+			skipped++;
+			continue;
+		}
+
+		cl_git_pass(git_commit_lookup(&commit, repo, &id));
+		found += path_changed(commit);
+		git_commit_free(commit);
+	}
+
+	perf__timer__stop(&t);
+
+	cl_assert_equal_sz((COMMIT_COUNT + TARGET_INTERVAL - 1) / TARGET_INTERVAL, found);
+
+	perf__timer__report(&t, "%s: %" PRIuZ " commits found, %" PRIuZ " skipped by filters",
+		use_filters ? "filters" : "tree lookups", found, skipped);
+
+	git_commit_graph_bloom_key_dispose(&key);
+	git_revwalk_free(walk);
+}
+
+void test_perf_commitgraph__single_file_log(void)
+{
+	write_commit_graph(0);
+	single_file_log(false);
+
+	write_commit_graph(1);
+	single_file_log(true);
+}
+
+static void blame_target(const char *label)
+{
+	git_blame *blame;
+	perf_timer t = PERF_TIMER_INIT;
+
+	perf__timer__start(&t);
+	cl_git_pass(git_blame_file(&blame, repo, TARGET_PATH, NULL));
+	perf__timer__stop(&t);
+
+	cl_assert_equal_i(1, git_blame_get_hunk_count(blame));
+	perf__timer__report(&t, "blame: %s", label);
+
+	git_blame_free(blame);
+}
+
+void test_perf_commitgraph__blame_single_file(void)
+{
+	write_commit_graph(0);
+	blame_target("commit-graph without filters");
+
+	write_commit_graph(1);
+	blame_target("commit-graph with changed-path filters");
+}
+
+#define FIRST_COMMITS 50
+
+/* The equivalent of `git log --topo-order -50`. */
+static void topo_order_first_commits(const char *label)
+{
+	git_revwalk *walk;
+	git_oid id;
+	size_t i;
+	perf_timer first = PERF_TIMER_INIT, all = PERF_TIMER_INIT;
+
+	perf__timer__start(&first);
+	perf__timer__start(&all);
+
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_sorting(walk, GIT_SORT_TOPOLOGICAL));
+	cl_git_pass(git_revwalk_push(walk, &head));
+
+	for (i = 0; i < FIRST_COMMITS; i++)
+		cl_git_pass(git_revwalk_next(&id, walk));
+
+	perf__timer__stop(&first);
+
+	while (git_revwalk_next(&id, walk) == 0)
+		i++;
+
+	perf__timer__stop(&all);
+
+	cl_assert_equal_sz(COMMIT_COUNT, i);
+
+	perf__timer__report(&first, "topo-order, first %d commits: %s", FIRST_COMMITS, label);
+	perf__timer__report(&all, "topo-order, all commits: %s", label);
+
+	git_revwalk_free(walk);
+}
+
+void test_perf_commitgraph__topo_order_first_commits(void)
+{
+	topo_order_first_commits("without commit-graph");
+
+	write_commit_graph(0);
+	topo_order_first_commits("with commit-graph");
+}
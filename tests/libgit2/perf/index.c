@@ -0,0 +1,71 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+#include "index.h"
+
+/*
+ * Write a large index, laid out like a deep working directory, then
+ * time loading it one entry after another and on several threads.
+ */
+#define ENTRY_COUNT 500000
+
+static size_t orig_read_threads;
+
+void test_perf_index__initialize(void)
+{
+	git_index *index;
+	git_index_entry entry = {{0}};
+	git_str path = GIT_STR_INIT;
+	unsigned char raw[GIT_OID_SHA1_SIZE] = {0};
+	size_t i;
+
+	orig_read_threads = git_index__read_threads;
+
+	cl_git_pass(git_index__open(&index, "perf_index", GIT_OID_SHA1));
+	entry.mode = GIT_FILEMODE_BLOB;
+
+	for (i = 0; i < ENTRY_COUNT; i++) {
+		git_str_clear(&path);
+		cl_git_pass(git_str_printf(&path, "src/module%03d/component%02d/file%06d.c",
+			(int)(i / 2000), (int)(i / 100 % 20), (int)i));
+
+		memcpy(raw, &i, sizeof(i));
+		cl_git_pass(git_oid__fromraw(&entry.id, raw, GIT_OID_SHA1));
+		entry.path = path.ptr;
+
+		cl_git_pass(git_index_add(index, &entry));
+	}
+
+	cl_git_pass(git_index_write(index));
+
+	git_str_dispose(&path);
+	git_index_free(index);
+}
+
+void test_perf_index__cleanup(void)
+{
+	git_index__read_threads = orig_read_threads;
+	cl_fixture_cleanup("perf_index");
+}
+
+static void read_index(size_t threads)
+{
+	git_index *index;
+	perf_timer t = PERF_TIMER_INIT;
+
+	git_index__read_threads = threads;
+
+	perf__timer__start(&t);
+	cl_git_pass(git_index__open(&index, "perf_index", GIT_OID_SHA1));
+	perf__timer__stop(&t);
+
+	cl_assert_equal_sz(ENTRY_COUNT, git_index_entrycount(index));
+	perf__timer__report(&t, "read %d entries with %" PRIuZ " thread(s)", ENTRY_COUNT, threads);
+
+	git_index_free(index);
+}
+
+void test_perf_index__read(void)
+{
+	read_index(1);
+	read_index(git__online_cpus() > 1 ? git__online_cpus() : 4);
+}
@@ -0,0 +1,148 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+#include "futils.h"
+
+/*
+ * Build a synthetic pack of many slowly evolving blobs, which gives long
+ * delta chains, and time how long it takes to index it with a varying
+ * number of delta resolution threads, and how long appending it stalls
+ * the caller with and without the pipeline.
+ */
+#define FILE_COUNT 256
+#define REVISION_COUNT 32
+#define LINE_COUNT 512
+
+static git_repository *repo;
+static git_buf pack = GIT_BUF_INIT;
+
+void test_perf_indexer__initialize(void)
+{
+	git_packbuilder *pb;
+	git_str content = GIT_STR_INIT;
+	git_oid id;
+	size_t file, rev, line;
+
+	cl_git_pass(git_repository_init(&repo, "indexer.git", true));
+	cl_git_pass(git_packbuilder_new(&pb, repo));
+	git_packbuilder_set_threads(pb, 0);
+
+	for (file = 0; file < FILE_COUNT; file++) {
+		for (rev = 0; rev < REVISION_COUNT; rev++) {
+			git_str_clear(&content);
+
+			for (line = 0; line < LINE_COUNT; line++) {
+				/* every revision touches a different handful of lines */
+				size_t edit = (line % 61 == rev % 61) ? rev : 0;
+				cl_git_pass(git_str_printf(&content,
+					"file %" PRIuZ " line %" PRIuZ " revision %" PRIuZ "\n",
+					file, line, edit));
+			}
+
+			cl_git_pass(git_blob_create_from_buffer(&id, repo, content.ptr, content.size));
+			cl_git_pass(git_packbuilder_insert(pb, &id, NULL));
+		}
+	}
+
+	cl_git_pass(git_packbuilder_write_buf(&pack, pb));
+
+	git_str_dispose(&content);
+	git_packbuilder_free(pb);
+}
+
+void test_perf_indexer__cleanup(void)
+{
+	git_buf_dispose(&pack);
+	git_repository_free(repo);
+	cl_fixture_cleanup("indexer.git");
+}
+
+static void index_pack(unsigned int threads)
+{
+	git_indexer_options opts = GIT_INDEXER_OPTIONS_INIT;
+	git_indexer_progress stats = { 0 };
+	git_indexer *idx;
+	perf_timer t = PERF_TIMER_INIT;
+
+	opts.threads = threads;
+
+	cl_git_pass(git_futils_mkdir("indexed", 0777, 0));
+
+	perf__timer__start(&t);
+
+#ifdef GIT_EXPERIMENTAL_SHA256
+	cl_git_pass(git_indexer_new(&idx, "indexed", GIT_OID_SHA1, &opts));
+#else
+	cl_git_pass(git_indexer_new(&idx, "indexed", 0, NULL, &opts));
+#endif
+
+	cl_git_pass(git_indexer_append(idx, pack.ptr, pack.size, &stats));
+	cl_git_pass(git_indexer_commit(idx, &stats));
+
+	perf__timer__stop(&t);
+
+	cl_assert_equal_i(FILE_COUNT * REVISION_COUNT, stats.indexed_objects);
+
+	perf__timer__report(&t, "%u threads: %u objects, %u deltas",
+		threads, stats.indexed_objects, stats.indexed_deltas);
+
+	git_indexer_free(idx);
+	cl_git_pass(git_futils_rmdir_r("indexed", NULL, GIT_RMDIR_REMOVE_FILES));
+}
+
+void test_perf_indexer__delta_resolution_threads(void)
+{
+	unsigned int thread_counts[] = { 1, 2, 4, 8 };
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(thread_counts); i++)
+		index_pack(thread_counts[i]);
+}
+
+#define APPEND_CHUNK_SIZE (64 * 1024)
+
+static void append_pack(unsigned char pipeline)
+{
+	git_indexer_options opts = GIT_INDEXER_OPTIONS_INIT;
+	git_indexer_progress stats = { 0 };
+	git_indexer *idx;
+	perf_timer append = PERF_TIMER_INIT, total = PERF_TIMER_INIT;
+	size_t offset, len;
+
+	opts.pipeline = pipeline;
+
+	cl_git_pass(git_futils_mkdir("indexed", 0777, 0));
+
+	perf__timer__start(&total);
+
+#ifdef GIT_EXPERIMENTAL_SHA256
+	cl_git_pass(git_indexer_new(&idx, "indexed", GIT_OID_SHA1, &opts));
+#else
+	cl_git_pass(git_indexer_new(&idx, "indexed", 0, NULL, &opts));
+#endif
+
+	for (offset = 0; offset < pack.size; offset += len) {
+		len = min(APPEND_CHUNK_SIZE, pack.size - offset);
+
+		perf__timer__start(&append);
+		cl_git_pass(git_indexer_append(idx, pack.ptr + offset, len, &stats));
+		perf__timer__stop(&append);
+	}
+
+	cl_git_pass(git_indexer_commit(idx, &stats));
+
+	perf__timer__stop(&total);
+
+	cl_assert_equal_i(FILE_COUNT * REVISION_COUNT, stats.indexed_objects);
+
+	perf__timer__report(&append, "%s: time spent in append", pipeline ? "pipelined" : "sequential");
+	perf__timer__report(&total, "%s: total", pipeline ? "pipelined" : "sequential");
+
+	git_indexer_free(idx);
+	cl_git_pass(git_futils_rmdir_r("indexed", NULL, GIT_RMDIR_REMOVE_FILES));
+}
+
+void test_perf_indexer__pipelined_append(void)
+{
+	append_pack(0);
+	append_pack(1);
+}
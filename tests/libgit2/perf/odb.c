@@ -0,0 +1,110 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+#include "array.h"
+#include "odb.h"
+
+/*
+ * Store many slowly evolving blobs in a pack, so that most of them are
+ * deltas, then time reading all of them in a scattered order, one by
+ * one and in batches.
+ */
+#define FILE_COUNT 128
+#define REVISION_COUNT 32
+#define LINE_COUNT 512
+
+static git_array_t(git_oid) ids = GIT_ARRAY_INIT;
+
+void test_perf_odb__initialize(void)
+{
+	git_repository *repo;
+	git_packbuilder *pb;
+	git_str content = GIT_STR_INIT;
+	git_oid *id, tmp;
+	size_t file, rev, line, i, j;
+
+	cl_git_pass(git_repository_init(&repo, "odb.git", true));
+	cl_git_pass(git_packbuilder_new(&pb, repo));
+	git_packbuilder_set_threads(pb, 0);
+
+	for (file = 0; file < FILE_COUNT; file++) {
+		for (rev = 0; rev < REVISION_COUNT; rev++) {
+			git_str_clear(&content);
+
+			for (line = 0; line < LINE_COUNT; line++) {
+				size_t edit = (line % 61 == rev % 61) ? rev : 0;
+				cl_git_pass(git_str_printf(&content,
+					"file %" PRIuZ " line %" PRIuZ " revision %" PRIuZ "\n",
+					file, line, edit));
+			}
+
+			cl_assert((id = git_array_alloc(ids)) != NULL);
+			cl_git_pass(git_blob_create_from_buffer(id, repo, content.ptr, content.size));
+			cl_git_pass(git_packbuilder_insert(pb, id, NULL));
+		}
+	}
+
+	cl_git_pass(git_packbuilder_write(pb, NULL, 0, NULL, NULL));
+
+	/* scatter the ids, as a caller collecting them would */
+	for (i = git_array_size(ids) - 1; i > 0; i--) {
+		j = rand() % (i + 1);
+		git_oid_cpy(&tmp, &ids.ptr[i]);
+		git_oid_cpy(&ids.ptr[i], &ids.ptr[j]);
+		git_oid_cpy(&ids.ptr[j], &tmp);
+	}
+
+	git_str_dispose(&content);
+	git_packbuilder_free(pb);
+	git_repository_free(repo);
+}
+
+void test_perf_odb__cleanup(void)
+{
+	git_array_clear(ids);
+	cl_fixture_cleanup("odb.git");
+}
+
+static void read_objects(unsigned int threads)
+{
+	git_odb_read_many_options opts = GIT_ODB_READ_MANY_OPTIONS_INIT;
+	git_odb *odb;
+	git_odb_object **objects;
+	perf_timer t = PERF_TIMER_INIT;
+	size_t i, count = git_array_size(ids);
+
+	objects = git__calloc(count, sizeof(*objects));
+	cl_assert(objects);
+
+	/* a new odb starts with empty caches */
+	cl_git_pass(git_odb__open(&odb, "odb.git/objects", NULL));
+
+	perf__timer__start(&t);
+
+	if (threads) {
+		opts.threads = threads;
+		cl_git_pass(git_odb_read_many(objects, odb, ids.ptr, count, &opts));
+	} else {
+		for (i = 0; i < count; i++)
+			cl_git_pass(git_odb_read(&objects[i], odb, &ids.ptr[i]));
+	}
+
+	perf__timer__stop(&t);
+
+	if (threads)
+		perf__timer__report(&t, "read %" PRIuZ " objects in a batch with %u thread(s)", count, threads);
+	else
+		perf__timer__report(&t, "read %" PRIuZ " objects one by one", count);
+
+	for (i = 0; i < count; i++)
+		git_odb_object_free(objects[i]);
+
+	git__free(objects);
+	git_odb_free(odb);
+}
+
+void test_perf_odb__read_many(void)
+{
+	read_objects(0);
+	read_objects(1);
+	read_objects(git__online_cpus() > 1 ? git__online_cpus() : 4);
+}
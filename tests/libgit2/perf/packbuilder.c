@@ -0,0 +1,211 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+#include "array.h"
+#include "futils.h"
+#include "repository.h"
+#include "pack-objects.h"
+
+/*
+ * Store many slowly evolving blobs in a pack, the way a server's
+ * repository would have them, then time building a pack of all of them
+ * (as for a clone) with and without reusing the stored objects and
+ * deltas.
+ */
+#define FILE_COUNT 256
+#define REVISION_COUNT 32
+#define LINE_COUNT 512
+
+static git_repository *repo;
+static git_array_t(git_oid) ids = GIT_ARRAY_INIT;
+
+void test_perf_packbuilder__initialize(void)
+{
+	git_packbuilder *pb;
+	git_odb *odb;
+	git_str content = GIT_STR_INIT;
+	git_oid *id;
+	size_t file, rev, line;
+
+	cl_git_pass(git_repository_init(&repo, "packbuilder.git", true));
+	cl_git_pass(git_packbuilder_new(&pb, repo));
+	git_packbuilder_set_threads(pb, 0);
+
+	for (file = 0; file < FILE_COUNT; file++) {
+		for (rev = 0; rev < REVISION_COUNT; rev++) {
+			git_str_clear(&content);
+
+			for (line = 0; line < LINE_COUNT; line++) {
+				size_t edit = (line % 61 == rev % 61) ? rev : 0;
+				cl_git_pass(git_str_printf(&content,
+					"file %" PRIuZ " line %" PRIuZ " revision %" PRIuZ "\n",
+					file, line, edit));
+			}
+
+			cl_assert((id = git_array_alloc(ids)) != NULL);
+			cl_git_pass(git_blob_create_from_buffer(id, repo, content.ptr, content.size));
+			cl_git_pass(git_packbuilder_insert(pb, id, NULL));
+		}
+	}
+
+	cl_git_pass(git_packbuilder_write(pb, NULL, 0, NULL, NULL));
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, repo));
+	cl_git_pass(git_odb_refresh(odb));
+
+	git_str_dispose(&content);
+	git_packbuilder_free(pb);
+}
+
+void test_perf_packbuilder__cleanup(void)
+{
+	git_array_clear(ids);
+	git_repository_free(repo);
+	cl_fixture_cleanup("packbuilder.git");
+}
+
+static void build_pack(bool reuse_objects)
+{
+	git_packbuilder *pb;
+	git_buf pack = GIT_BUF_INIT;
+	perf_timer t = PERF_TIMER_INIT;
+	git_oid *id;
+	size_t i;
+
+	perf__timer__start(&t);
+
+	cl_git_pass(git_packbuilder_new(&pb, repo));
+	pb->reuse_objects = reuse_objects;
+
+	git_array_foreach(ids, i, id)
+		cl_git_pass(git_packbuilder_insert(pb, id, NULL));
+
+	cl_git_pass(git_packbuilder_write_buf(&pack, pb));
+
+	perf__timer__stop(&t);
+	perf__timer__report(&t, "%s: %" PRIuZ " bytes",
+		reuse_objects ? "reusing stored objects" : "recomputing deltas",
+		pack.size);
+
+	git_buf_dispose(&pack);
+	git_packbuilder_free(pb);
+}
+
+void test_perf_packbuilder__full_pack(void)
+{
+	build_pack(false);
+	build_pack(true);
+}
+
+/*
+ * Time only writing the pack, with the deltas already found and nothing
+ * reused, so that every object is compressed on the way out.
+ */
+static void write_pack(unsigned int threads)
+{
+	git_packbuilder *pb;
+	perf_timer t = PERF_TIMER_INIT;
+	git_oid *id;
+	size_t i;
+	int fd;
+
+	cl_git_pass(git_packbuilder_new(&pb, repo));
+	pb->reuse_objects = false;
+
+	git_array_foreach(ids, i, id)
+		cl_git_pass(git_packbuilder_insert(pb, id, NULL));
+
+	cl_git_pass(git_packbuilder__prepare(pb));
+	git_packbuilder_set_threads(pb, threads);
+
+	cl_assert((fd = p_open("packbuilder.pack", O_CREAT | O_WRONLY | O_TRUNC, 0666)) >= 0);
+
+	perf__timer__start(&t);
+	cl_git_pass(git_packbuilder_write_fd(pb, fd));
+	perf__timer__stop(&t);
+
+	cl_git_pass(p_close(fd));
+	perf__timer__report(&t, "write pack with %u thread(s)", threads);
+
+	git_packbuilder_free(pb);
+	cl_git_pass(p_unlink("packbuilder.pack"));
+}
+
+void test_perf_packbuilder__write(void)
+{
+	write_pack(1);
+	write_pack(git__online_cpus());
+}
+
+#define LARGE_FILE_COUNT 4
+#define LARGE_REVISION_COUNT 8
+#define LARGE_LINE_COUNT 131072
+
+/*
+ * Add a few very large files to the many small ones, so that a split
+ * of the delta search by the number of objects would give one thread
+ * nearly all of the work, and time the search on every core.
+ */
+static void search_skewed_deltas(unsigned int threads)
+{
+	git_packbuilder *pb;
+	git_packbuilder_delta_stats *stats;
+	perf_timer t = PERF_TIMER_INIT;
+	git_oid *id;
+	uint64_t start, elapsed, busy = 0;
+	size_t i;
+
+	cl_git_pass(git_packbuilder_new(&pb, repo));
+	pb->reuse_objects = false;
+	git_packbuilder_set_threads(pb, threads);
+
+	git_array_foreach(ids, i, id)
+		cl_git_pass(git_packbuilder_insert(pb, id, NULL));
+
+	start = git_time_monotonic();
+	perf__timer__start(&t);
+	cl_git_pass(git_packbuilder__prepare(pb));
+	perf__timer__stop(&t);
+	elapsed = git_time_monotonic() - start;
+
+	perf__timer__report(&t, "delta search with %u thread(s)", threads);
+
+	git_array_foreach(pb->delta_stats, i, stats) {
+		printf("            thread %" PRIuZ ": %" PRIuZ " objects, %" PRIu64 " bytes, %" PRIuZ " steals, %" PRIu64 "ms\n",
+			i, stats->objects, stats->bytes, stats->steals, stats->busy_time);
+		busy += stats->busy_time;
+	}
+
+	if (git_array_size(pb->delta_stats) && elapsed)
+		printf("            core utilization: %.0f%%\n",
+			100.0 * busy / (elapsed * git_array_size(pb->delta_stats)));
+
+	git_packbuilder_free(pb);
+}
+
+void test_perf_packbuilder__skewed_delta_search(void)
+{
+	git_str content = GIT_STR_INIT;
+	git_oid *id;
+	size_t file, rev, line;
+
+	for (file = 0; file < LARGE_FILE_COUNT; file++) {
+		for (rev = 0; rev < LARGE_REVISION_COUNT; rev++) {
+			git_str_clear(&content);
+
+			for (line = 0; line < LARGE_LINE_COUNT; line++) {
+				size_t edit = (line % 997 == rev) ? rev : 0;
+				cl_git_pass(git_str_printf(&content,
+					"large %" PRIuZ " line %" PRIuZ " revision %" PRIuZ "\n",
+					file, line, edit));
+			}
+
+			cl_assert((id = git_array_alloc(ids)) != NULL);
+			cl_git_pass(git_blob_create_from_buffer(id, repo, content.ptr, content.size));
+		}
+	}
+
+	git_str_dispose(&content);
+
+	search_skewed_deltas(1);
+	search_skewed_deltas(git__online_cpus() > 1 ? git__online_cpus() : 4);
+}
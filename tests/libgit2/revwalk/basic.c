@@ -1,4 +1,6 @@
 #include "clar_libgit2.h"
+#include "array.h"
+#include "revwalk.h"
 
 /*
 	*   a4a7dce [0] Merge branch 'master' into br2
@@ -642,3 +644,95 @@ void test_revwalk_basic__newer_hidden_commit_hides_old_commits(void)
 
 	cl_git_fail_with(GIT_ITEROVER, git_revwalk_next(&oid, _walk));
 }
+
+static int hide_nothing_cb(const git_oid *commit_id, void *payload)
+{
+	GIT_UNUSED(commit_id);
+	GIT_UNUSED(payload);
+	return 0;
+}
+
+static size_t topo_walk(git_oid **out, unsigned int sorting, bool full)
+{
+	git_array_t(git_oid) ids = GIT_ARRAY_INIT;
+	git_oid id, *entry;
+
+	cl_git_pass(git_revwalk_sorting(_walk, sorting));
+	cl_git_pass(git_revwalk_push_glob(_walk, "*"));
+
+	/* a hide callback forces the walk through the whole history first */
+	if (full)
+		cl_git_pass(git_revwalk_add_hide_cb(_walk, hide_nothing_cb, NULL));
+
+	while (git_revwalk_next(&id, _walk) == 0) {
+		entry = git_array_alloc(ids);
+		cl_assert(entry);
+		git_oid_cpy(entry, &id);
+	}
+
+	cl_git_pass(git_revwalk_add_hide_cb(_walk, NULL, NULL));
+
+	*out = ids.ptr;
+	return ids.size;
+}
+
+void test_revwalk_basic__incremental_topological_matches_full_walk(void)
+{
+	unsigned int sortings[] = {
+		GIT_SORT_TOPOLOGICAL,
+		GIT_SORT_TOPOLOGICAL | GIT_SORT_TIME,
+		GIT_SORT_TOPOLOGICAL | GIT_SORT_REVERSE
+	};
+	const char *fixtures[] = { "testrepo.git", "merge-recursive" };
+	git_oid *incremental, *full;
+	size_t incremental_len, full_len, f, i, j;
+
+	for (f = 0; f < ARRAY_SIZE(fixtures); f++) {
+		revwalk_basic_setup_walk(fixtures[f]);
+
+		for (i = 0; i < ARRAY_SIZE(sortings); i++) {
+			incremental_len = topo_walk(&incremental, sortings[i], false);
+			full_len = topo_walk(&full, sortings[i], true);
+
+			cl_assert(full_len > 0);
+			cl_assert_equal_sz(full_len, incremental_len);
+
+			for (j = 0; j < full_len; j++)
+				cl_assert_equal_oid(&full[j], &incremental[j]);
+
+			git__free(incremental);
+			git__free(full);
+		}
+
+		git_revwalk_free(_walk);
+		_walk = NULL;
+		cl_git_sandbox_cleanup();
+		_fixture = NULL;
+		_repo = NULL;
+	}
+}
+
+void test_revwalk_basic__topological_walk_is_incremental(void)
+{
+	git_commit_list_node *node;
+	git_oid oid, root;
+	size_t walked = 0;
+
+	revwalk_basic_setup_walk("testrepo.git");
+
+	cl_git_pass(git_revwalk_sorting(_walk, GIT_SORT_TOPOLOGICAL));
+	cl_git_pass(git_revwalk_push_ref(_walk, "refs/heads/master"));
+
+	/* the history below the tip isn't needed for the first commit */
+	cl_git_pass(git_revwalk_next(&oid, _walk));
+	cl_assert_equal_s("a65fedf39aefe402d3bb6e24df4d4f5fe4547750", git_oid_tostr_s(&oid));
+	cl_git_pass(git_oid__fromstr(&root, "8496071c1b46c854b31185ea97743be6a8774479", GIT_OID_SHA1));
+	node = git_oidmap_get(_walk->commits, &root);
+	cl_assert(node == NULL || !node->parsed);
+
+	do {
+		walked++;
+	} while (git_revwalk_next(&oid, _walk) == 0);
+
+	cl_assert_equal_sz(7, walked);
+}
@@ -0,0 +1,297 @@
+#include "clar_libgit2.h"
+#include "futils.h"
+#include "index.h"
+#include "git2/sys/diff.h"
+#include "git2/sys/fsmonitor.h"
+
+static git_repository *g_repo;
+
+/* A monitor that reports whatever changes it is told to */
+typedef struct {
+	git_fsmonitor parent;
+	git_vector changed;
+	bool forgetful;
+	unsigned int queries;
+	char token[16];
+} test_monitor;
+
+static int test_monitor_query(
+	const char **out_token,
+	git_fsmonitor *fsmonitor,
+	const char *token,
+	git_fsmonitor_changed_cb changed_cb,
+	void *payload)
+{
+	test_monitor *monitor = (test_monitor *)fsmonitor;
+	const char *path;
+	size_t i;
+	int error = 0;
+
+	p_snprintf(monitor->token, sizeof(monitor->token), "%u", ++monitor->queries);
+	*out_token = monitor->token;
+
+	if (!token || monitor->forgetful)
+		return GIT_PASSTHROUGH;
+
+	git_vector_foreach(&monitor->changed, i, path) {
+		if ((error = changed_cb(path, payload)) != 0)
+			break;
+	}
+
+	git_vector_clear(&monitor->changed);
+	return error;
+}
+
+static void test_monitor_free(git_fsmonitor *fsmonitor)
+{
+	test_monitor *monitor = (test_monitor *)fsmonitor;
+
+	git_vector_free(&monitor->changed);
+	git__free(monitor);
+}
+
+static test_monitor *test_monitor_new(void)
+{
+	test_monitor *monitor = git__calloc(1, sizeof(test_monitor));
+
+	cl_assert(monitor);
+	cl_git_pass(git_fsmonitor_init(&monitor->parent, GIT_FSMONITOR_VERSION));
+	cl_git_pass(git_vector_init(&monitor->changed, 0, NULL));
+	monitor->parent.query = test_monitor_query;
+	monitor->parent.free = test_monitor_free;
+
+	return monitor;
+}
+
+void test_status_fsmonitor__initialize(void)
+{
+	git_index *index;
+
+	g_repo = cl_git_sandbox_init("empty_standard_repo");
+
+	cl_must_pass(p_mkdir("empty_standard_repo/dir", 0777));
+	cl_git_mkfile("empty_standard_repo/one", "one\n");
+	cl_git_mkfile("empty_standard_repo/two", "two\n");
+	cl_git_mkfile("empty_standard_repo/dir/three", "three\n");
+	cl_git_mkfile("empty_standard_repo/untracked", "untracked\n");
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_add_bypath(index, "one"));
+	cl_git_pass(git_index_add_bypath(index, "two"));
+	cl_git_pass(git_index_add_bypath(index, "dir/three"));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+}
+
+void test_status_fsmonitor__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+/* Run a status, returning the modified paths and the number of stats */
+static size_t status_stats(git_str *modified)
+{
+	git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+	git_diff_perfdata perf = GIT_DIFF_PERFDATA_INIT;
+	git_status_list *status;
+	const git_status_entry *entry;
+	size_t i;
+
+	opts.flags = GIT_STATUS_OPT_DEFAULTS | GIT_STATUS_OPT_UPDATE_INDEX;
+
+	git_str_clear(modified);
+	cl_git_pass(git_status_list_new(&status, g_repo, &opts));
+
+	for (i = 0; i < git_status_list_entrycount(status); i++) {
+		entry = git_status_byindex(status, i);
+
+		if (entry->status & GIT_STATUS_WT_MODIFIED)
+			cl_git_pass(git_str_printf(modified, "%s;",
+				entry->index_to_workdir->new_file.path));
+	}
+
+	cl_git_pass(git_status_list_get_perfdata(&perf, status));
+	git_status_list_free(status);
+
+	return perf.stat_calls;
+}
+
+void test_status_fsmonitor__unchanged_files_are_not_stated(void)
+{
+	test_monitor *monitor = test_monitor_new();
+	git_str modified = GIT_STR_INIT;
+	size_t all_stats;
+
+	cl_git_pass(git_repository_set_fsmonitor(g_repo, &monitor->parent));
+
+	/* nothing is known at first, so everything is looked at */
+	all_stats = status_stats(&modified);
+	cl_assert_equal_s("", modified.ptr);
+
+	cl_assert_equal_sz(all_stats - 3, status_stats(&modified));
+	cl_assert_equal_s("", modified.ptr);
+
+	/* a change that the monitor did not see goes unnoticed... */
+	cl_git_rewritefile("empty_standard_repo/one", "changed\n");
+	cl_assert_equal_sz(all_stats - 3, status_stats(&modified));
+	cl_assert_equal_s("", modified.ptr);
+
+	/* ...until it reports it */
+	cl_git_pass(git_vector_insert(&monitor->changed, "one"));
+	cl_assert_equal_sz(all_stats - 2, status_stats(&modified));
+	cl_assert_equal_s("one;", modified.ptr);
+
+	/* and a modified file is looked at until it is updated in the index */
+	cl_assert_equal_sz(all_stats - 2, status_stats(&modified));
+	cl_assert_equal_s("one;", modified.ptr);
+
+	/* directories cover everything beneath them */
+	cl_git_rewritefile("empty_standard_repo/dir/three", "changed\n");
+	cl_git_pass(git_vector_insert(&monitor->changed, "dir/"));
+	cl_assert_equal_sz(all_stats - 1, status_stats(&modified));
+	cl_assert_equal_s("dir/three;one;", modified.ptr);
+
+	git_str_dispose(&modified);
+}
+
+void test_status_fsmonitor__monitor_that_cannot_tell(void)
+{
+	test_monitor *monitor = test_monitor_new();
+	git_str modified = GIT_STR_INIT;
+	size_t all_stats;
+
+	cl_git_pass(git_repository_set_fsmonitor(g_repo, &monitor->parent));
+
+	all_stats = status_stats(&modified);
+	cl_assert_equal_sz(all_stats - 3, status_stats(&modified));
+
+	monitor->forgetful = true;
+	cl_git_rewritefile("empty_standard_repo/two", "changed\n");
+
+	cl_assert_equal_sz(all_stats, status_stats(&modified));
+	cl_assert_equal_s("two;", modified.ptr);
+
+	git_str_dispose(&modified);
+}
+
+void test_status_fsmonitor__state_is_kept_in_the_index(void)
+{
+	test_monitor *monitor = test_monitor_new();
+	git_str modified = GIT_STR_INIT;
+	git_index *index;
+	const git_index_entry *entry;
+	size_t all_stats;
+
+	cl_git_pass(git_repository_set_fsmonitor(g_repo, &monitor->parent));
+	all_stats = status_stats(&modified);
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_read(index, true));
+
+	cl_assert_equal_s("1", index->fsmonitor_token);
+	cl_assert((entry = git_index_get_bypath(index, "one", 0)) != NULL);
+	cl_assert(entry->flags_extended & GIT_INDEX_ENTRY__FSMONITOR_VALID);
+
+	/* updating an entry means it has to be looked at again */
+	cl_git_pass(git_index_add_bypath(index, "one"));
+	cl_assert((entry = git_index_get_bypath(index, "one", 0)) != NULL);
+	cl_assert(!(entry->flags_extended & GIT_INDEX_ENTRY__FSMONITOR_VALID));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	/* a new monitor that carries on from the stored token */
+	g_repo = cl_git_sandbox_reopen();
+
+	monitor = test_monitor_new();
+	monitor->queries = 1;
+	cl_git_pass(git_repository_set_fsmonitor(g_repo, &monitor->parent));
+
+	cl_assert_equal_sz(all_stats - 2, status_stats(&modified));
+	cl_assert_equal_sz(all_stats - 3, status_stats(&modified));
+
+	git_str_dispose(&modified);
+}
+
+void test_status_fsmonitor__inotify(void)
+{
+#ifdef GIT_FSMONITOR_INOTIFY
+	git_fsmonitor *monitor;
+	git_str modified = GIT_STR_INIT;
+	git_index *index;
+	size_t all_stats;
+
+	cl_git_pass(git_fsmonitor_inotify_new(&monitor, g_repo));
+	cl_git_pass(git_repository_set_fsmonitor(g_repo, monitor));
+
+	all_stats = status_stats(&modified);
+	cl_assert_equal_sz(all_stats - 3, status_stats(&modified));
+
+	cl_git_rewritefile("empty_standard_repo/dir/three", "changed\n");
+	cl_assert_equal_sz(all_stats - 2, status_stats(&modified));
+	cl_assert_equal_s("dir/three;", modified.ptr);
+
+	/* files in new directories are seen, too */
+	cl_must_pass(p_mkdir("empty_standard_repo/dir/sub", 0777));
+	cl_git_mkfile("empty_standard_repo/dir/sub/four", "four\n");
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_add_bypath(index, "dir/sub/four"));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	status_stats(&modified);
+	cl_assert_equal_s("dir/three;", modified.ptr);
+
+	cl_git_rewritefile("empty_standard_repo/dir/sub/four", "changed\n");
+	status_stats(&modified);
+	cl_assert_equal_s("dir/sub/four;dir/three;", modified.ptr);
+
+	git_str_dispose(&modified);
+#else
+	cl_skip();
+#endif
+}
+
+#ifdef GIT_FSMONITOR_INOTIFY
+static int count_changed(const char *path, void *payload)
+{
+	GIT_UNUSED(path);
+	(*(size_t *)payload)++;
+	return 0;
+}
+#endif
+
+void test_status_fsmonitor__inotify_forgets_old_tokens(void)
+{
+#ifdef GIT_FSMONITOR_INOTIFY
+	git_fsmonitor *monitor;
+	git_str first = GIT_STR_INIT, second = GIT_STR_INIT;
+	const char *token;
+	size_t changed = 0;
+
+	cl_git_pass(git_fsmonitor_inotify_new(&monitor, g_repo));
+
+	cl_assert_equal_i(GIT_PASSTHROUGH,
+		monitor->query(&token, monitor, NULL, count_changed, &changed));
+	cl_git_pass(git_str_puts(&first, token));
+
+	cl_git_rewritefile("empty_standard_repo/dir/three", "changed\n");
+	cl_git_pass(monitor->query(&token, monitor, first.ptr, count_changed, &changed));
+	cl_git_pass(git_str_puts(&second, token));
+	cl_assert_equal_sz(1, changed);
+
+	/* the previous token is still answered... */
+	changed = 0;
+	cl_git_pass(monitor->query(&token, monitor, second.ptr, count_changed, &changed));
+	cl_assert_equal_sz(0, changed);
+
+	/* ...but the changes for older ones have been dropped */
+	cl_assert_equal_i(GIT_PASSTHROUGH,
+		monitor->query(&token, monitor, first.ptr, count_changed, &changed));
+
+	git_str_dispose(&first);
+	git_str_dispose(&second);
+	monitor->free(monitor);
+#else
+	cl_skip();
+#endif
+}
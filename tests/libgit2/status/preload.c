@@ -0,0 +1,153 @@
+#include "clar_libgit2.h"
+#include "futils.h"
+#include "index.h"
+#include "git2/sys/diff.h"
+
+static git_repository *g_repo;
+
+void test_status_preload__initialize(void)
+{
+	git_index *index;
+	char path[64];
+	int i;
+
+	g_repo = cl_git_sandbox_init("empty_standard_repo");
+
+	cl_must_pass(p_mkdir("empty_standard_repo/dir", 0777));
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+
+	for (i = 0; i < 10; i++) {
+		p_snprintf(path, sizeof(path), "empty_standard_repo/file%d", i);
+		cl_git_mkfile(path, "content\n");
+		cl_git_pass(git_index_add_bypath(index, path + strlen("empty_standard_repo/")));
+
+		p_snprintf(path, sizeof(path), "empty_standard_repo/dir/file%d", i);
+		cl_git_mkfile(path, "content\n");
+		cl_git_pass(git_index_add_bypath(index, path + strlen("empty_standard_repo/")));
+	}
+
+	cl_git_mkfile("empty_standard_repo/untracked", "untracked\n");
+
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	git_index__preload_threads = 4;
+}
+
+void test_status_preload__cleanup(void)
+{
+	git_index__preload_threads = 0;
+	cl_git_sandbox_cleanup();
+}
+
+/* Run a status, returning the modified paths and the performance data */
+static void status_perf(git_str *modified, git_diff_perfdata *perf, const char *pathspec)
+{
+	git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+	git_status_list *status;
+	const git_status_entry *entry;
+	char *paths[] = { (char *)pathspec };
+	size_t i;
+
+	opts.flags = GIT_STATUS_OPT_DEFAULTS;
+
+	if (pathspec) {
+		opts.pathspec.strings = paths;
+		opts.pathspec.count = 1;
+	}
+
+	git_str_clear(modified);
+	cl_git_pass(git_status_list_new(&status, g_repo, &opts));
+
+	for (i = 0; i < git_status_list_entrycount(status); i++) {
+		entry = git_status_byindex(status, i);
+
+		if (entry->status & GIT_STATUS_WT_MODIFIED)
+			cl_git_pass(git_str_printf(modified, "%s;",
+				entry->index_to_workdir->new_file.path));
+	}
+
+	cl_git_pass(git_status_list_get_perfdata(perf, status));
+	git_status_list_free(status);
+}
+
+void test_status_preload__unchanged_files_are_stated_ahead(void)
+{
+	git_diff_perfdata perf = GIT_DIFF_PERFDATA_INIT;
+	git_str modified = GIT_STR_INIT;
+
+	status_perf(&modified, &perf, NULL);
+
+	cl_assert_equal_s("", modified.ptr);
+	cl_assert_equal_sz(20, perf.preload_stat_calls);
+
+	/* only the untracked file is stat'ed by the diff */
+	cl_assert_equal_sz(1, perf.stat_calls);
+	cl_assert_equal_sz(20 + 2, perf.skipped_stat_calls);
+
+	git_str_dispose(&modified);
+}
+
+void test_status_preload__changed_files_are_found(void)
+{
+	git_diff_perfdata perf = GIT_DIFF_PERFDATA_INIT;
+	git_str modified = GIT_STR_INIT;
+
+	cl_git_rewritefile("empty_standard_repo/file3", "changed content\n");
+	cl_git_rewritefile("empty_standard_repo/dir/file7", "changed content\n");
+
+	status_perf(&modified, &perf, NULL);
+
+	cl_assert_equal_s("dir/file7;file3;", modified.ptr);
+	cl_assert_equal_sz(20, perf.preload_stat_calls);
+	cl_assert_equal_sz(1 + 2, perf.stat_calls);
+
+	git_str_dispose(&modified);
+}
+
+void test_status_preload__only_the_pathspec_is_preloaded(void)
+{
+	git_diff_perfdata perf = GIT_DIFF_PERFDATA_INIT;
+	git_str modified = GIT_STR_INIT;
+
+	cl_git_rewritefile("empty_standard_repo/dir/file7", "changed content\n");
+
+	status_perf(&modified, &perf, "dir/*");
+
+	cl_assert_equal_s("dir/file7;", modified.ptr);
+	cl_assert_equal_sz(10, perf.preload_stat_calls);
+
+	git_str_dispose(&modified);
+}
+
+void test_status_preload__can_be_disabled(void)
+{
+	git_diff_perfdata perf = GIT_DIFF_PERFDATA_INIT;
+	git_str modified = GIT_STR_INIT;
+
+	cl_repo_set_bool(g_repo, "core.preloadIndex", false);
+
+	status_perf(&modified, &perf, NULL);
+
+	cl_assert_equal_s("", modified.ptr);
+	cl_assert_equal_sz(0, perf.preload_stat_calls);
+	cl_assert_equal_sz(21, perf.stat_calls);
+
+	git_str_dispose(&modified);
+}
+
+void test_status_preload__small_indexes_are_not_preloaded(void)
+{
+	git_diff_perfdata perf = GIT_DIFF_PERFDATA_INIT;
+	git_str modified = GIT_STR_INIT;
+
+	git_index__preload_threads = 0;
+
+	status_perf(&modified, &perf, NULL);
+
+	cl_assert_equal_sz(0, perf.preload_stat_calls);
+	cl_assert_equal_sz(21, perf.stat_calls);
+
+	git_str_dispose(&modified);
+}
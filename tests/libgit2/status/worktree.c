@@ -1051,7 +1051,7 @@ void test_status_worktree__update_stat_cache_0(void)
 	cl_git_pass(git_status_list_new(&status, repo, &opts));
 	check_status0(status);
 	cl_git_pass(git_status_list_get_perfdata(&perf, status));
-	cl_assert_equal_sz(13 + 3, perf.stat_calls);
+	cl_assert_equal_sz(11 + 3, perf.stat_calls);
 	cl_assert_equal_sz(5, perf.oid_calculations);
 
 	git_status_list_free(status);
@@ -1065,7 +1065,7 @@ void test_status_worktree__update_stat_cache_0(void)
 	cl_git_pass(git_status_list_new(&status, repo, &opts));
 	check_status0(status);
 	cl_git_pass(git_status_list_get_perfdata(&perf, status));
-	cl_assert_equal_sz(13 + 3, perf.stat_calls);
+	cl_assert_equal_sz(11 + 3, perf.stat_calls);
 	cl_assert_equal_sz(5, perf.oid_calculations);
 
 	git_status_list_free(status);
@@ -1077,7 +1077,7 @@ void test_status_worktree__update_stat_cache_0(void)
 	cl_git_pass(git_status_list_new(&status, repo, &opts));
 	check_status0(status);
 	cl_git_pass(git_status_list_get_perfdata(&perf, status));
-	cl_assert_equal_sz(13 + 3, perf.stat_calls);
+	cl_assert_equal_sz(11 + 3, perf.stat_calls);
 	cl_assert_equal_sz(0, perf.oid_calculations);
 
 	git_status_list_free(status);